@@ -0,0 +1,55 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "vec3.h"
+#include "utils.h"
+
+#include <cmath>
+
+using namespace std;
+
+// Axis aligned bounding box, empty until something is added
+class aabb {
+    public:
+        point3 lo;
+        point3 hi;
+
+        aabb() : lo(infinity, infinity, infinity), hi(-infinity, -infinity, -infinity) {};
+        aabb(const point3& a, const point3& b)
+            : lo(fmin(a.e[0], b.e[0]), fmin(a.e[1], b.e[1]), fmin(a.e[2], b.e[2])),
+              hi(fmax(a.e[0], b.e[0]), fmax(a.e[1], b.e[1]), fmax(a.e[2], b.e[2])) {};
+        aabb(const aabb& a, const aabb& b) : aabb(a) { expand(b); }
+
+        bool empty() const { return lo.e[0] > hi.e[0]; }
+
+        void expand(const point3& p){
+            for(int a = 0; a < 3; a++){
+                lo.e[a] = fmin(lo.e[a], p.e[a]);
+                hi.e[a] = fmax(hi.e[a], p.e[a]);
+            }
+        }
+
+        void expand(const aabb& b){
+            for(int a = 0; a < 3; a++){
+                lo.e[a] = fmin(lo.e[a], b.lo.e[a]);
+                hi.e[a] = fmax(hi.e[a], b.hi.e[a]);
+            }
+        }
+
+        point3 centroid() const { return 0.5 * (lo + hi); }
+
+        double extent(int axis) const { return hi.e[axis] - lo.e[axis]; }
+
+        int longest_axis() const {
+            if(extent(0) > extent(1))return extent(0) > extent(2) ? 0 : 2;
+            return extent(1) > extent(2) ? 1 : 2;
+        }
+
+        double surface_area() const {
+            if(empty())return 0;
+            double x = extent(0), y = extent(1), z = extent(2);
+            return 2 * (x * y + y * z + z * x);
+        }
+};
+
+#endif
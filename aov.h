@@ -0,0 +1,218 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "vec3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Arbitrary output variables, written next to the beauty color in the same pass
+enum aov_flags {
+    aov_albedo       = 1 << 0,
+    aov_normal       = 1 << 1,
+    aov_depth        = 1 << 2,
+    aov_object_id    = 1 << 3,
+    aov_material_id  = 1 << 4,
+    aov_sample_count = 1 << 5,
+    aov_time         = 1 << 6,
+    aov_all          = (1 << 7) - 1
+};
+
+// First hit data of one camera sample
+class aov_sample {
+    public:
+        color albedo = color(0,0,0);
+        vec3 normal = vec3(0,0,0);
+        double depth = 0;
+        int object_id = -1;
+        int material_id = -1;
+};
+
+// Per pixel AOV layers, indexed like grid (j * width + i).
+// albedo, normal and depth are averaged over samples, ids come from the first sample
+// and are -1 (0xffffffff in the EXR) where the ray hit nothing
+class aov_buffer {
+    public:
+        int width = 0;
+        int height = 0;
+        int flags = 0;
+
+        vector<color> albedo;
+        vector<vec3> normal;
+        vector<double> depth;
+        vector<int> object_id;
+        vector<int> material_id;
+        vector<int> sample_count;
+        vector<double> time_ms;
+
+        bool enabled(int f) const { return (flags & f) != 0; }
+
+        void resize(int w, int h, int f){
+            width = w;
+            height = h;
+            flags = f;
+            albedo.assign(enabled(aov_albedo) ? w * h : 0, color(0,0,0));
+            normal.assign(enabled(aov_normal) ? w * h : 0, vec3(0,0,0));
+            depth.assign(enabled(aov_depth) ? w * h : 0, 0.0);
+            object_id.assign(enabled(aov_object_id) ? w * h : 0, -1);
+            material_id.assign(enabled(aov_material_id) ? w * h : 0, -1);
+            sample_count.assign(w * h, 0);
+            time_ms.assign(enabled(aov_time) ? w * h : 0, 0.0);
+        }
+
+        void add(int i, int j, const aov_sample& s){
+            int p = j * width + i;
+            if(sample_count[p] == 0){
+                if(enabled(aov_object_id))object_id[p] = s.object_id;
+                if(enabled(aov_material_id))material_id[p] = s.material_id;
+            }
+            if(enabled(aov_albedo))albedo[p] += s.albedo;
+            if(enabled(aov_normal))normal[p] += s.normal;
+            if(enabled(aov_depth))depth[p] += s.depth;
+            sample_count[p]++;
+        }
+
+        void add_time(int i, int j, double ms){
+            time_ms[j * width + i] += ms;
+        }
+
+        // Turns the sums into averages, normals are renormalized
+        void resolve(){
+            for(int p = 0; p < width * height; p++){
+                int n = sample_count[p] > 0 ? sample_count[p] : 1;
+                if(enabled(aov_albedo))albedo[p] /= n;
+                if(enabled(aov_depth))depth[p] /= n;
+                if(enabled(aov_normal) && normal[p].length_squared() > 0)
+                    normal[p] = unit_vector(normal[p]);
+            }
+        }
+
+        // Multi layer OpenEXR (uncompressed scanlines) with the beauty as R, G, B and one
+        // layer per enabled AOV. beauty is linear color indexed like the AOV layers
+        bool write_exr(const string& path, const vector<color>& beauty) const;
+};
+
+bool aov_buffer::write_exr(const string& path, const vector<color>& beauty) const {
+    // EXR pixel types
+    const int32_t exr_uint = 0;
+    const int32_t exr_float = 2;
+
+    struct channel {
+        string name;
+        int32_t type;
+        // Value of pixel p, as raw 4 bytes
+        function<uint32_t(int)> value;
+    };
+
+    auto f32 = [](double v){
+        float f = v;
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+        return bits;
+    };
+
+    vector<channel> channels;
+    for(int c = 0; c < 3; c++){
+        channels.push_back({string(1, "RGB"[c]), exr_float, [&, c](int p){ return f32(beauty[p].e[c]); }});
+        if(enabled(aov_albedo))
+            channels.push_back({string("albedo.") + "RGB"[c], exr_float, [&, c](int p){ return f32(albedo[p].e[c]); }});
+        if(enabled(aov_normal))
+            channels.push_back({string("normal.") + "XYZ"[c], exr_float, [&, c](int p){ return f32(normal[p].e[c]); }});
+    }
+    if(enabled(aov_depth))
+        channels.push_back({"depth.Z", exr_float, [&](int p){ return f32(depth[p]); }});
+    if(enabled(aov_object_id))
+        channels.push_back({"object_id.id", exr_uint, [&](int p){ return (uint32_t)object_id[p]; }});
+    if(enabled(aov_material_id))
+        channels.push_back({"material_id.id", exr_uint, [&](int p){ return (uint32_t)material_id[p]; }});
+    if(enabled(aov_sample_count))
+        channels.push_back({"sample_count.count", exr_uint, [&](int p){ return (uint32_t)sample_count[p]; }});
+    if(enabled(aov_time))
+        channels.push_back({"time.ms", exr_float, [&](int p){ return f32(time_ms[p]); }});
+
+    // Channels are stored in alphabetical order
+    sort(channels.begin(), channels.end(), [](const channel& a, const channel& b){ return a.name < b.name; });
+
+    std::ofstream out (path, std::ios::binary);
+    if(!out)return false;
+
+    auto put = [&](const void* data, size_t n){ out.write((const char*)data, n); };
+    auto put_i32 = [&](int32_t v){ put(&v, 4); };
+    auto put_attr = [&](const string& name, const string& type, int32_t size){
+        put(name.c_str(), name.size() + 1);
+        put(type.c_str(), type.size() + 1);
+        put_i32(size);
+    };
+
+    const uint8_t magic[4] = {0x76, 0x2f, 0x31, 0x01};
+    put(magic, 4);
+    put_i32(2);
+
+    int32_t chlist_size = 1;
+    for(auto& c : channels)chlist_size += c.name.size() + 1 + 16;
+    put_attr("channels", "chlist", chlist_size);
+    for(auto& c : channels){
+        put(c.name.c_str(), c.name.size() + 1);
+        put_i32(c.type);
+        const uint8_t linear_reserved[4] = {0, 0, 0, 0};
+        put(linear_reserved, 4);
+        put_i32(1);
+        put_i32(1);
+    }
+    out.put(0);
+
+    put_attr("compression", "compression", 1);
+    out.put(0);
+
+    for(const char* window : {"dataWindow", "displayWindow"}){
+        put_attr(window, "box2i", 16);
+        put_i32(0);
+        put_i32(0);
+        put_i32(width - 1);
+        put_i32(height - 1);
+    }
+
+    put_attr("lineOrder", "lineOrder", 1);
+    out.put(0);
+
+    float one = 1.0f, zero = 0.0f;
+    put_attr("pixelAspectRatio", "float", 4);
+    put(&one, 4);
+    put_attr("screenWindowCenter", "v2f", 8);
+    put(&zero, 4);
+    put(&zero, 4);
+    put_attr("screenWindowWidth", "float", 4);
+    put(&one, 4);
+    out.put(0);
+
+    // Offset table, one scanline per block
+    const int32_t line_bytes = width * 4 * channels.size();
+    uint64_t offset = (uint64_t)out.tellp() + 8 * (uint64_t)height;
+    for(int y = 0; y < height; y++){
+        put(&offset, 8);
+        offset += 8 + line_bytes;
+    }
+
+    // EXR rows go top down, grid rows go bottom up
+    vector<uint32_t> line (width);
+    for(int y = 0; y < height; y++){
+        int j = height - 1 - y;
+        put_i32(y);
+        put_i32(line_bytes);
+        for(auto& c : channels){
+            for(int i = 0; i < width; i++)line[i] = c.value(j * width + i);
+            put(line.data(), 4 * width);
+        }
+    }
+
+    return bool(out);
+}
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+// Bump allocator. Allocations are carved out of large chunks in order, so objects built
+// together sit next to each other in memory. There is no per object free: reset() drops
+// everything at once and keeps the chunks for the next frame, release() gives them back.
+// Objects with destructors must be destroyed (or their shared_ptrs dropped) before that.
+class arena {
+    public:
+        arena(size_t chunk_bytes = 1 << 20) : chunk_bytes(chunk_bytes) {};
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        // Takes over o's chunks, so per worker arenas can live in a vector
+        arena(arena&& o) : chunk_bytes(o.chunk_bytes), chunks(std::move(o.chunks)), current(o.current),
+                           cursor(o.cursor), limit(o.limit), used(o.used) {
+            o.chunks.clear();
+            o.release();
+        }
+
+        ~arena(){ release(); }
+
+        void* allocate(size_t bytes, size_t align = alignof(max_align_t)){
+            uintptr_t p = (cursor + align - 1) & ~(uintptr_t)(align - 1);
+            if(p + bytes > limit){
+                next_chunk(bytes + align);
+                p = (cursor + align - 1) & ~(uintptr_t)(align - 1);
+            }
+            cursor = p + bytes;
+            used += bytes;
+            return (void*)p;
+        }
+
+        template <typename T, typename... Args>
+        T* create(Args&&... args){
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        // Uninitialised array of n T
+        template <typename T>
+        T* allocate_array(size_t n){
+            return (T*)allocate(n * sizeof(T), alignof(T));
+        }
+
+        // O(1) apart from rewinding the chunk list, memory is kept for reuse
+        void reset(){
+            current = 0;
+            used = 0;
+            if(chunks.empty()){
+                cursor = limit = 0;
+                return;
+            }
+            cursor = (uintptr_t)chunks[0].data;
+            limit = cursor + chunks[0].size;
+        }
+
+        void release(){
+            for(auto& c : chunks)free(c.data);
+            chunks.clear();
+            current = 0;
+            cursor = limit = 0;
+            used = 0;
+        }
+
+        size_t bytes_used() const { return used; }
+
+        size_t bytes_reserved() const {
+            size_t n = 0;
+            for(auto& c : chunks)n += c.size;
+            return n;
+        }
+
+    private:
+        class chunk {
+            public:
+                char* data;
+                size_t size;
+        };
+
+        size_t chunk_bytes;
+        vector<chunk> chunks;
+        size_t current = 0;
+        uintptr_t cursor = 0;
+        uintptr_t limit = 0;
+        size_t used = 0;
+
+        // Moves to the next kept chunk that fits, or allocates one
+        void next_chunk(size_t min_bytes){
+            if(!chunks.empty())current++;
+            while(current < chunks.size() && chunks[current].size < min_bytes)current++;
+            if(current >= chunks.size()){
+                size_t size = max(chunk_bytes, min_bytes);
+                char* data = (char*)aligned_alloc(64, (size + 63) & ~(size_t)63);
+                if(!data)throw bad_alloc();
+                chunks.push_back(chunk{data, size});
+                current = chunks.size() - 1;
+            }
+            cursor = (uintptr_t)chunks[current].data;
+            limit = cursor + chunks[current].size;
+        }
+};
+
+// Standard allocator over an arena, deallocate is a no op. Lets containers and
+// allocate_shared place their storage (and shared_ptr control blocks) in the arena
+template <typename T>
+class arena_allocator {
+    public:
+        using value_type = T;
+
+        arena* a;
+
+        arena_allocator(arena& a) : a(&a) {};
+
+        template <typename U>
+        arena_allocator(const arena_allocator<U>& o) : a(o.a) {};
+
+        T* allocate(size_t n){ return (T*)a->allocate(n * sizeof(T), alignof(T)); }
+        void deallocate(T*, size_t) {}
+
+        template <typename U>
+        bool operator==(const arena_allocator<U>& o) const { return a == o.a; }
+        template <typename U>
+        bool operator!=(const arena_allocator<U>& o) const { return a != o.a; }
+};
+
+// make_shared with the object and its reference counts placed in the arena
+template <typename T, typename... Args>
+shared_ptr<T> make_arena_shared(arena& a, Args&&... args){
+    return allocate_shared<T>(arena_allocator<T>(a), std::forward<Args>(args)...);
+}
+
+// Fixed size slots on top of an arena with a free list, for scratch objects that come and
+// go inside a frame (path states, queue entries). reset() empties it with the arena
+template <typename T>
+class pool {
+    public:
+        pool(arena& a) : a(a) {};
+
+        template <typename... Args>
+        T* create(Args&&... args){
+            void* slot;
+            if(free_list){
+                slot = free_list;
+                free_list = free_list->next;
+            }
+            else slot = a.allocate(sizeof(slot_type), alignof(slot_type));
+            live++;
+            return new (slot) T(std::forward<Args>(args)...);
+        }
+
+        void destroy(T* p){
+            p->~T();
+            slot_type* s = (slot_type*)p;
+            s->next = free_list;
+            free_list = s;
+            live--;
+        }
+
+        // Forgets every slot, call before resetting the arena. Destructors are not run
+        void reset(){
+            free_list = nullptr;
+            live = 0;
+        }
+
+        size_t size() const { return live; }
+
+    private:
+        union slot_type {
+            slot_type* next;
+            alignas(T) char storage[sizeof(T)];
+        };
+
+        arena& a;
+        slot_type* free_list = nullptr;
+        size_t live = 0;
+};
+
+#endif
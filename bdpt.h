@@ -0,0 +1,334 @@
+#ifndef BDPT_H
+#define BDPT_H
+
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "material.h"
+#include "film.h"
+#include "lights.h"
+#include "environment.h"
+#include "stats.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Bidirectional path tracing (Veach 1997), in the formulation of pbrt: a camera subpath and a
+// light subpath per pixel sample, joined at every pair of their vertices, and each of the
+// strategies weighted by the balance heuristic over the densities all of them would have
+// sampled the same path with. Joining a light subpath to the camera lands in some other
+// pixel and is splatted there through the tile's list, which keeps the image independent of
+// the schedule like everything else on the film.
+//
+// The estimate is the one camera::ray_color makes, including its habits: every scattering
+// vertex weighs a path by dot(in, out) of the two directions there, the camera ray by its
+// length, and lights glow the same in every direction. A connection gives a vertex the same
+// factor as a scattered ray would, eval times dot(arrival, connection), which is symmetric,
+// so light subpaths carry the same throughput as camera subpaths in the other direction.
+//
+// Light subpaths start on the spheres of the lights list. The environment is only found by
+// camera subpaths that leave the scene, and counts in full there.
+
+enum class vertex_kind { camera, light, surface };
+
+class path_vertex {
+    public:
+        vertex_kind kind;
+        hit_record rec;         // position, normal facing the arriving ray, material
+        vec3 arrival;           // direction of the ray that reached it, as traced
+        color beta;             // throughput of the subpath up to here
+        bool delta = false;     // scattered by a delta lobe, nothing can join it
+        bool surface = true;    // has a normal, points in media do not
+        double pdf_fwd = 0;     // area density of its own subpath reaching it
+        double pdf_rev = 0;     // the same for the other subpath coming from the far end
+
+        const point3& p() const { return rec.p; }
+};
+
+// The camera's film, for joining light subpaths to it. Camera rays go through lower_left +
+// u horizontal + v vertical, with u and v half a pixel past the first and last pixel centers
+class pinhole {
+    public:
+        point3 origin;
+        vec3 forward;           // unit, towards the film plane
+        double focal = 1;       // distance of the film plane
+        point3 lower_left;
+        vec3 horizontal;
+        vec3 vertical;
+        int width = 1;
+        int height = 1;
+
+        double film_area() const {
+            return horizontal.length() * vertical.length() * width * height / double((width - 1) * (height - 1));
+        }
+
+        // Pixel the point x is seen in and the camera ray towards it, as get_ray makes it
+        bool project(const point3& x, int& i, int& j, vec3& dir) const {
+            vec3 q = x - origin;
+            double s = dot(q, forward);
+            if(s <= 0)return false;
+            dir = q * (focal / s);
+            vec3 film = origin + dir - lower_left;
+            double u = dot(film, horizontal) / horizontal.length_squared();
+            double v = dot(film, vertical) / vertical.length_squared();
+            i = int(floor(u * (width - 1) + 0.5));
+            j = int(floor(v * (height - 1) + 0.5));
+            return i >= 0 && i < width && j >= 0 && j < height;
+        }
+
+        // Per steradian along the unit direction d of a camera ray through a uniform film point
+        double pdf(const vec3& d) const {
+            int i, j;
+            vec3 dir;
+            if(!project(origin + d, i, j, dir))return 0;
+            double c = dot(d, forward);
+            return focal * focal / (film_area() * c * c * c);
+        }
+};
+
+// One thread's subpaths, reused from sample to sample
+class bdpt_paths {
+    public:
+        vector<path_vertex> camera;
+        vector<path_vertex> light;
+};
+
+class bdpt_integrator {
+    public:
+        pinhole lens;
+        sphere_lights emitters;
+        int max_depth;
+        color radiance = color(10,10,10);
+        const environment_map* environment = nullptr;
+
+        bdpt_integrator(const pinhole& lens, const hittable& lights, int max_depth, const environment_map* environment)
+            : lens(lens), emitters(lights), max_depth(max_depth), environment(environment) {};
+
+        // Camera subpath from the camera ray r, with scatter() drawing from the active stream.
+        // Returns the environment seen where the subpath leaves the scene
+        color camera_walk(const ray& r, const hittable& world, const hittable& lights, vector<path_vertex>& path) const {
+            path.clear();
+            path_vertex camera;
+            camera.kind = vertex_kind::camera;
+            camera.rec.p = r.origin();
+            camera.beta = color(1,1,1);
+            camera.surface = false;
+            path.push_back(camera);
+            return walk(r, lens.pdf(unit_vector(r.direction())), color(1,1,1), max_depth + 1, true, world, lights, path);
+        }
+
+        // Light subpath from a point on the lights, drawing from random_double()
+        void light_walk(const hittable& world, const hittable& lights, vector<path_vertex>& path) const {
+            path.clear();
+            if(emitters.empty())return;
+
+            path_vertex light;
+            light.kind = vertex_kind::light;
+            double u = random_double(), u1 = random_double(), u2 = random_double();
+            emitters.sample(u, u1, u2, light.rec.p, light.rec.normal);
+            light.beta = radiance * emitters.area;
+            light.pdf_fwd = 1 / emitters.area;
+            path.push_back(light);
+
+            // Cosine weighted emission, pi / area after dividing by both densities
+            vec3 d = to_frame(light.rec.normal, cosine_direction(random_double(), random_double()));
+            double pdf = dot(d, light.rec.normal) / pi;
+            walk(ray(light.rec.p, d), pdf, light.beta * pi, max_depth, false, world, lights, path);
+        }
+
+        // Every strategy with at most max_depth segments. The camera's share is returned, joins
+        // to the camera are added to acc
+        color connect_all(vector<path_vertex>& camera, vector<path_vertex>& light, tile_accumulator& acc,
+                          const hittable& world, const hittable& lights) const {
+            color sum (0,0,0);
+            for(int t = 1; t <= (int)camera.size(); t++)
+                for(int s = 0; s <= (int)light.size(); s++){
+                    if(s + t - 1 > max_depth || s + t < 2 || (s == 1 && t == 1))continue;
+                    if(t == 1)splat_to_camera(camera, light, s, acc, world, lights);
+                    else sum += connect(camera, light, s, t, world, lights);
+                }
+            return sum;
+        }
+
+    private:
+        // Traces vertices onto path up to max_vertices. pdf is the density per steradian the
+        // direction of r was drawn with, beta the throughput r carries
+        color walk(ray r, double pdf, color beta, int max_vertices, bool from_camera, const hittable& world, const hittable& lights,
+                   vector<path_vertex>& path) const {
+            while((int)path.size() < max_vertices){
+                hit_record rec, lrec;
+                STAT_INC(rays_traced);
+                bool hit = world.hit(r, interval(0.00000001, infinity), rec);
+
+                // Lights are opaque, and only camera subpaths get anything from reaching one
+                if(lights.hit(r, interval(0.00000001, hit ? rec.t : infinity), lrec)){
+                    if(!from_camera)return color(0,0,0);
+                    path_vertex v;
+                    v.kind = vertex_kind::light;
+                    v.rec = move(lrec);
+                    v.arrival = r.direction();
+                    v.beta = beta;
+                    v.pdf_fwd = to_area(pdf, path.back().p(), v);
+                    path.push_back(v);
+                    return color(0,0,0);
+                }
+
+                if(!hit)return from_camera && environment ? beta * environment->eval(r.direction()) : color(0,0,0);
+
+                path_vertex v;
+                v.kind = vertex_kind::surface;
+                v.rec = rec;
+                v.arrival = r.direction();
+                v.beta = beta;
+                v.surface = rec.mat->on_surface();
+                v.pdf_fwd = to_area(pdf, path.back().p(), v);
+                path.push_back(v);
+                if((int)path.size() == max_vertices)break;
+
+                bsdf_sample bs;
+                if(!rec.mat->sample(r, rec, bs))break;
+                path_vertex& here = path.back();
+                path_vertex& before = path[path.size() - 2];
+                here.delta = bs.pdf == 0;
+                before.pdf_rev = here.delta ? 0 : to_area(bs.pdf_rev, here.p(), before);
+
+                beta = beta * bs.attenuation * dot(r.direction(), bs.dir);
+                pdf = bs.pdf;
+                r = ray(rec.p, bs.dir);
+            }
+            return color(0,0,0);
+        }
+
+        // Per steradian at from to per unit area at v, without a cosine at points in media
+        double to_area(double pdf, const point3& from, const path_vertex& v) const {
+            vec3 d = v.p() - from;
+            double dist2 = d.length_squared();
+            if(dist2 == 0)return 0;
+            if(v.surface)pdf *= fabs(dot(v.rec.normal, d)) / sqrt(dist2);
+            return pdf / dist2;
+        }
+
+        // Area density of v choosing next, having been reached from prev
+        double pdf_of(const path_vertex& v, const path_vertex* prev, const path_vertex& next) const {
+            vec3 d = unit_vector(next.p() - v.p());
+            double pdf;
+            if(v.kind == vertex_kind::light)pdf = fmax(0.0, dot(v.rec.normal, d)) / pi;
+            else if(v.kind == vertex_kind::camera)pdf = lens.pdf(d);
+            else pdf = v.rec.mat->scattering_pdf(ray(prev->p(), v.p() - prev->p()), v.rec, d);
+            return to_area(pdf, v.p(), next);
+        }
+
+        // Balance heuristic weight of the strategy with s light and t camera vertices, from
+        // the ratios of the reverse to the forward densities along the joined path
+        double mis_weight(vector<path_vertex>& camera, vector<path_vertex>& light, int s, int t) const {
+            if(s + t == 2)return 1;
+
+            path_vertex* pt = &camera[t - 1];
+            path_vertex* qs = s > 0 ? &light[s - 1] : nullptr;
+            path_vertex* pt_minus = t > 1 ? &camera[t - 2] : nullptr;
+            path_vertex* qs_minus = s > 1 ? &light[s - 2] : nullptr;
+
+            // The densities at the join depend on the strategy, set them for this one and put
+            // the subpaths' own back after
+            path_vertex* changed[4] = {pt, qs, pt_minus, qs_minus};
+            double saved_pdf[4] = {};
+            bool saved_delta[4] = {};
+            for(int k = 0; k < 4; k++)
+                if(changed[k]){
+                    saved_pdf[k] = changed[k]->pdf_rev;
+                    saved_delta[k] = changed[k]->delta;
+                }
+
+            pt->delta = false;
+            if(qs)qs->delta = false;
+            pt->pdf_rev = s > 0 ? pdf_of(*qs, qs_minus, *pt) : 1 / emitters.area;
+            if(pt_minus)pt_minus->pdf_rev = s > 0 ? pdf_of(*pt, qs, *pt_minus) : pdf_of(*pt, nullptr, *pt_minus);
+            if(qs)qs->pdf_rev = pdf_of(*pt, pt_minus, *qs);
+            if(qs_minus)qs_minus->pdf_rev = pdf_of(*qs, pt, *qs_minus);
+
+            auto remap = [](double f){ return f != 0 ? f : 1; };
+            double sum = 0, ratio = 1;
+            for(int i = t - 1; i > 0; i--){
+                ratio *= remap(camera[i].pdf_rev) / remap(camera[i].pdf_fwd);
+                if(!camera[i].delta && !camera[i - 1].delta)sum += ratio;
+            }
+            ratio = 1;
+            for(int i = s - 1; i >= 0; i--){
+                ratio *= remap(light[i].pdf_rev) / remap(light[i].pdf_fwd);
+                if(!light[i].delta && !(i > 0 && light[i - 1].delta))sum += ratio;
+            }
+
+            for(int k = 0; k < 4; k++)
+                if(changed[k]){
+                    changed[k]->pdf_rev = saved_pdf[k];
+                    changed[k]->delta = saved_delta[k];
+                }
+            return 1 / (1 + sum);
+        }
+
+        // Fraction of light getting from a to b, lights block it like other surfaces
+        double visibility(const point3& a, const point3& b, const hittable& world, const hittable& lights) const {
+            vec3 d = b - a;
+            double dist = d.length();
+            ray shadow (a, d / dist);
+            interval between (0.00000001, dist * (1 - 1e-6));
+            hit_record unused;
+            STAT_INC(rays_traced);
+            if(lights.hit(shadow, between, unused))return 0;
+            return world.transmittance(shadow, between);
+        }
+
+        // What v passes on towards the unit direction c, as a scattered ray would get it
+        color factor(const path_vertex& v, const vec3& c) const {
+            return v.rec.mat->eval(ray(v.p() - v.arrival, v.arrival), v.rec, c) * dot(v.arrival, c);
+        }
+
+        color connect(vector<path_vertex>& camera, vector<path_vertex>& light, int s, int t, const hittable& world, const hittable& lights) const {
+            const path_vertex& pt = camera[t - 1];
+            color L;
+            if(s == 0){
+                if(pt.kind != vertex_kind::light)return color(0,0,0);
+                L = pt.beta * radiance;
+            }
+            else {
+                const path_vertex& qs = light[s - 1];
+                if(pt.kind != vertex_kind::surface || pt.delta || qs.delta)return color(0,0,0);
+
+                vec3 d = qs.p() - pt.p();
+                double dist2 = d.length_squared();
+                vec3 c = d / sqrt(dist2);
+                color f = factor(pt, c);
+                color g = s == 1 ? color(1,1,1) * fmax(0.0, dot(qs.rec.normal, -1 * c)) : factor(qs, -1 * c);
+                L = pt.beta * f * g * qs.beta / dist2;
+                if(L.e[0] == 0 && L.e[1] == 0 && L.e[2] == 0)return L;
+                L = L * visibility(pt.p(), qs.p(), world, lights);
+            }
+            if(L.e[0] == 0 && L.e[1] == 0 && L.e[2] == 0)return L;
+            return L * mis_weight(camera, light, s, t);
+        }
+
+        // Light subpath vertex s - 1 seen straight from the camera, added to its pixel
+        void splat_to_camera(vector<path_vertex>& camera, vector<path_vertex>& light, int s, tile_accumulator& acc,
+                             const hittable& world, const hittable& lights) const {
+            const path_vertex& qs = light[s - 1];
+            if(qs.delta || qs.kind != vertex_kind::surface)return;
+
+            int i, j;
+            vec3 dir;
+            if(!lens.project(qs.p(), i, j, dir))return;
+
+            vec3 d = lens.origin - qs.p();
+            double dist2 = d.length_squared();
+            vec3 c = d / sqrt(dist2);
+            // The camera ray's length is one of the factors of a camera subpath
+            color L = qs.beta * factor(qs, c) * (dir.length() * lens.pdf(-1 * c) / dist2);
+            if(L.e[0] == 0 && L.e[1] == 0 && L.e[2] == 0)return;
+            L = L * visibility(qs.p(), lens.origin, world, lights);
+            if(L.e[0] == 0 && L.e[1] == 0 && L.e[2] == 0)return;
+            acc.splat(i, j, L * mis_weight(camera, light, s, 1));
+        }
+};
+
+#endif
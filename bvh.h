@@ -0,0 +1,716 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "aabb.h"
+#include "arena.h"
+#include "stats.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// 4 wide BVH with quantised child boxes, one 64 byte node per cache line.
+//
+// A node stores the corner of its own box in floats and one power of two step per axis.
+// Each child box is 8 bits per bound on that grid, rounded outwards, so it is never
+// smaller than the real box. Children are either another node or a leaf of up to
+// bvh_max_leaf primitives, the 4 slab tests of a node run in one SSE pass.
+
+const int bvh_max_leaf = 4;
+const uint32_t bvh_leaf_flag = 1u << 31;
+const uint32_t bvh_empty_child = 0xffffffffu;
+
+class alignas(64) bvh4_node {
+    public:
+        float origin[3];
+        int8_t exponent[3];
+        uint8_t child_count;
+        uint8_t qlo[3][4];      // [axis][child]
+        uint8_t qhi[3][4];
+        // Node index, or bvh_leaf_flag | (count - 1) << 28 | first primitive
+        uint32_t child[4];
+};
+
+static_assert(sizeof(bvh4_node) == 64, "bvh4_node must fill one cache line");
+
+// sah: binned surface area heuristic, the faster tree to trace.
+// morton: linear BVH, splits at the highest differing bit of sorted Morton codes. Several
+// times quicker to build, for previews and scenes that change every frame
+enum class bvh_builder { sah, morton };
+
+class bvh_build_options {
+    public:
+        bvh_builder builder = bvh_builder::sah;
+        int threads = 0;            // 0 = every hardware thread
+        bool report = false;        // print the phase timings after the build
+};
+
+// Phase timings of the last build in ms
+class bvh_build_timing {
+    public:
+        double refs = 0;            // bounding boxes of the objects
+        double sort = 0;            // Morton codes and radix sort, morton only
+        double top = 0;             // upper levels, ranges over 64K refs, with parallel binning
+        double subtrees = 0;        // independent subtrees, one job per thread at a time
+        double stitch = 0;          // joining the subtrees into one node array
+        double total = 0;
+        int jobs = 0;
+
+        void print(ostream& out) const {
+            out << "BVH build: " << total << " ms (refs " << refs << ", sort " << sort << ", top " << top
+                << ", subtrees " << subtrees << " in " << jobs << " jobs, stitch " << stitch << ")\n";
+        }
+};
+
+class bvh4 {
+    public:
+        // Primitives in leaf order, the hittables stay owned by the caller
+        vector<hittable*> prims;
+        aabb bounds;
+
+        // Sizes of the last build, for comparing with a binary BVH over the same splits
+        int binary_nodes = 0;
+        bvh_build_timing timing;
+
+        bvh4() {};
+        bvh4(const bvh4&) = delete;
+        bvh4& operator=(const bvh4&) = delete;
+
+        // The tree of other in this one's own memory, for per node replicas (numa.h). The
+        // primitives are the same objects
+        void copy_from(const bvh4& other){
+            owned.assign(other.nodes, other.nodes + other.count);
+            nodes = owned.data();
+            count = other.count;
+            prims = other.prims;
+            bounds = other.bounds;
+            binary_nodes = other.binary_nodes;
+        }
+
+        int node_count() const { return count; }
+        size_t node_bytes() const { return count * sizeof(bvh4_node); }
+        const void* node_memory() const { return nodes; }
+
+        // Nodes are copied into the arena when one is given. The tree only depends on the
+        // objects and the builder, never on the thread count
+        void build(const vector<shared_ptr<hittable>>& objects, arena* a = nullptr, const bvh_build_options& options = bvh_build_options()){
+            using clock = std::chrono::high_resolution_clock;
+            auto ms = [](clock::time_point from){ return std::chrono::duration<double, std::milli>(clock::now() - from).count(); };
+            auto start = clock::now();
+            timing = bvh_build_timing();
+            threads = options.threads;
+            builder = options.builder;
+
+            size_t n = objects.size();
+            refs.resize(n);
+            parallel_chunks(n, [&](size_t b, size_t e){
+                for(size_t i = b; i < e; i++){
+                    aabb box = objects[i]->bounding_box();
+                    for(int k = 0; k < 3; k++){
+                        refs[i].lo[k] = nextafterf(float(box.lo.e[k]), -INFINITY);
+                        refs[i].hi[k] = nextafterf(float(box.hi.e[k]), INFINITY);
+                    }
+                    refs[i].lo[3] = refs[i].hi[3] = 0;
+                    refs[i].index = i;
+                }
+            });
+            timing.refs = ms(start);
+
+            owned.clear();
+            prims.clear();
+            binary_nodes = 0;
+            bounds = aabb();
+            if(n > 0){
+                box4 root = range_bounds(0, n, true);
+                for(int k = 0; k < 3; k++){
+                    bounds.lo.e[k] = root.box_lo[k];
+                    bounds.hi.e[k] = root.box_hi[k];
+                }
+
+                if(builder == bvh_builder::morton){
+                    auto sort_start = clock::now();
+                    sort_by_morton(root);
+                    timing.sort = ms(sort_start);
+                }
+
+                // Upper levels until the ranges are small enough to hand out as jobs. Ranges
+                // below parallel_range would be binned on one thread here, so they are jobs
+                auto top_start = clock::now();
+                job_size = max<size_t>(parallel_range, n / (8 * worker_count(1 << 20, threads)));
+                build_context top;
+                top.nodes.emplace_back();
+                vector<subtree_job> jobs;
+                build_node(top, 0, n, root, 0, &jobs);
+                timing.top = ms(top_start);
+
+                auto sub_start = clock::now();
+                vector<build_context> done (jobs.size());
+                parallel_for(jobs.size(), [&](int j){
+                    done[j].nodes.emplace_back();
+                    build_node(done[j], jobs[j].begin, jobs[j].end, jobs[j].box, 0, nullptr);
+                }, threads);
+                timing.subtrees = ms(sub_start);
+                timing.jobs = jobs.size();
+
+                auto stitch_start = clock::now();
+                stitch(top, jobs, done, objects);
+                timing.stitch = ms(stitch_start);
+            }
+            refs.clear();
+            refs.shrink_to_fit();
+            codes.clear();
+            codes.shrink_to_fit();
+
+            count = owned.size();
+            if(a && count > 0){
+                nodes = a->allocate_array<bvh4_node>(count);
+                memcpy(nodes, owned.data(), node_bytes());
+                owned.clear();
+                owned.shrink_to_fit();
+            }
+            else nodes = owned.data();
+
+            timing.total = ms(start);
+            if(options.report)timing.print(cout);
+        }
+
+        // Calls leaf_hit(prim, t_max) for primitives in front to back order of their boxes.
+        // leaf_hit returns true and lowers t_max when it found a closer hit
+        template <typename F>
+        bool traverse(const point3& orig, const vec3& dir, double t_min, double& t_max, const F& leaf_hit) const {
+            if(count == 0)return false;
+            const slab_ray s (orig, dir, t_min);
+
+            uint32_t stack[64];
+            int top = 0;
+            stack[top++] = 0;
+            bool hit_anything = false;
+
+            while(top > 0){
+                const bvh4_node& n = nodes[stack[--top]];
+                STAT_INC(bvh_nodes);
+
+                __m128 near_t, far_t;
+                int mask = s.boxes(n, t_max, near_t, far_t);
+                if(!mask)continue;
+
+                alignas(16) float near[4];
+                _mm_store_ps(near, near_t);
+
+                // Children that were hit, nearest first
+                int order[4], hits = 0;
+                for(int c = 0; c < 4; c++){
+                    if(!(mask & (1 << c)))continue;
+                    int k = hits++;
+                    while(k > 0 && near[order[k - 1]] > near[c]){
+                        order[k] = order[k - 1];
+                        k--;
+                    }
+                    order[k] = c;
+                }
+
+                // Leaves right away, inner nodes pushed far to near so the nearest pops first
+                for(int k = 0; k < hits; k++){
+                    uint32_t child = n.child[order[k]];
+                    if(!(child & bvh_leaf_flag))continue;
+                    if(near[order[k]] > t_max)continue;
+                    uint32_t first = child & 0x0fffffffu;
+                    uint32_t leaf_count = ((child >> 28) & 7) + 1;
+                    for(uint32_t p = first; p < first + leaf_count; p++)
+                        if(leaf_hit(prims[p], t_max))hit_anything = true;
+                }
+                for(int k = hits - 1; k >= 0; k--){
+                    uint32_t child = n.child[order[k]];
+                    if(child & bvh_leaf_flag)continue;
+                    if(near[order[k]] > t_max)continue;
+                    stack[top++] = child;
+                }
+            }
+            return hit_anything;
+        }
+
+        // Whether occludes(prim) is true for a primitive whose box the ray crosses within
+        // [t_min, t_max]. Stops at the first one and visits children in stored order, a
+        // shadow ray needs any blocker rather than the closest
+        template <typename F>
+        bool any_hit(const point3& orig, const vec3& dir, double t_min, double t_max, const F& occludes) const {
+            if(count == 0)return false;
+            const slab_ray s (orig, dir, t_min);
+
+            uint32_t stack[64];
+            int top = 0;
+            stack[top++] = 0;
+
+            while(top > 0){
+                const bvh4_node& n = nodes[stack[--top]];
+                STAT_INC(bvh_nodes);
+
+                __m128 near_t, far_t;
+                int mask = s.boxes(n, t_max, near_t, far_t);
+                for(int c = 0; c < 4; c++){
+                    if(!(mask & (1 << c)))continue;
+                    uint32_t child = n.child[c];
+                    if(!(child & bvh_leaf_flag)){
+                        stack[top++] = child;
+                        continue;
+                    }
+                    uint32_t first = child & 0x0fffffffu;
+                    uint32_t leaf_count = ((child >> 28) & 7) + 1;
+                    for(uint32_t p = first; p < first + leaf_count; p++)
+                        if(occludes(prims[p]))return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        // A ray set up for slab tests against the quantised boxes of a node
+        class slab_ray {
+            public:
+                __m128 inv_x, inv_y, inv_z;
+                __m128 o_x, o_y, o_z;
+                __m128 t_lo;
+
+                slab_ray(const point3& orig, const vec3& dir, double t_min){
+                    // Zero direction components become tiny ones so the slabs stay finite
+                    float inv[3], o[3];
+                    for(int a = 0; a < 3; a++){
+                        double d = dir.e[a];
+                        if(fabs(d) < 1e-30)d = d < 0 ? -1e-30 : 1e-30;
+                        inv[a] = float(1.0 / d);
+                        o[a] = float(orig.e[a]);
+                    }
+                    inv_x = _mm_set1_ps(inv[0]), inv_y = _mm_set1_ps(inv[1]), inv_z = _mm_set1_ps(inv[2]);
+                    o_x = _mm_set1_ps(o[0]), o_y = _mm_set1_ps(o[1]), o_z = _mm_set1_ps(o[2]);
+                    t_lo = _mm_set1_ps(float(t_min));
+                }
+
+                // Box corners relative to the ray origin, then the usual slab test on 4 boxes.
+                // Mask of the children hit before t_max
+                int boxes(const bvh4_node& n, double t_max, __m128& near_t, __m128& far_t) const {
+                    near_t = t_lo;
+                    far_t = _mm_set1_ps(float(t_max));
+                    near_far(n, 0, o_x, inv_x, near_t, far_t);
+                    near_far(n, 1, o_y, inv_y, near_t, far_t);
+                    near_far(n, 2, o_z, inv_z, near_t, far_t);
+                    return _mm_movemask_ps(_mm_cmple_ps(near_t, far_t)) & ((1 << n.child_count) - 1);
+                }
+        };
+
+        // Float box of one object, rounded outwards. Lane 3 is unused so a ref loads as two __m128
+        class alignas(16) build_ref {
+            public:
+                float lo[4];
+                float hi[4];
+                uint32_t index;
+        };
+
+        // Bounds of a range and of its centroids
+        class box4 {
+            public:
+                float box_lo[4], box_hi[4];
+                float center_lo[4], center_hi[4];
+        };
+
+        class build_context {
+            public:
+                vector<bvh4_node> nodes;
+                vector<uint32_t> prims;     // object indices in leaf order
+                int binary_nodes = 0;
+        };
+
+        // A range left for the parallel phase, its root goes into child slot of node parent
+        class subtree_job {
+            public:
+                size_t begin, end;
+                box4 box;
+                uint32_t parent;
+                int slot;
+        };
+
+        static const int bins = 16;
+        // Smallest range that is bounded and binned in chunks on all workers
+        static constexpr size_t parallel_range = 1 << 16;
+
+        vector<bvh4_node> owned;
+        bvh4_node* nodes = nullptr;
+        int count = 0;
+
+        vector<build_ref> refs;
+        vector<uint32_t> codes;     // Morton code per ref, sorted along with refs
+        size_t job_size = 0;
+        int threads = 0;
+        bvh_builder builder = bvh_builder::sah;
+
+        static void near_far(const bvh4_node& n, int axis, __m128 o, __m128 inv, __m128& near_t, __m128& far_t){
+            const __m128 step = _mm_set1_ps(ldexpf(1.0f, n.exponent[axis]));
+            const __m128 base = _mm_sub_ps(_mm_set1_ps(n.origin[axis]), o);
+            uint32_t lo_bits, hi_bits;
+            memcpy(&lo_bits, n.qlo[axis], 4);
+            memcpy(&hi_bits, n.qhi[axis], 4);
+            const __m128 lo = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(lo_bits))), step));
+            const __m128 hi = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(hi_bits))), step));
+            const __m128 t0 = _mm_mul_ps(lo, inv);
+            const __m128 t1 = _mm_mul_ps(hi, inv);
+            near_t = _mm_max_ps(near_t, _mm_min_ps(t0, t1));
+            far_t = _mm_min_ps(far_t, _mm_max_ps(t0, t1));
+        }
+
+        // Runs fn(begin, end) over [0, n) in chunks on all workers
+        template <typename F>
+        void parallel_chunks(size_t n, const F& fn, size_t offset = 0) const {
+            const size_t chunk = 1 << 14;
+            int chunks = (n + chunk - 1) / chunk;
+            parallel_for(chunks, [&](int c){
+                fn(offset + c * chunk, offset + min(n, (c + 1) * chunk));
+            }, threads);
+        }
+
+        // parallel is only set outside the subtree jobs, which already run one per thread
+        box4 range_bounds(size_t begin, size_t end, bool parallel = false) const {
+            auto serial = [&](size_t b, size_t e){
+                __m128 blo = _mm_set1_ps(INFINITY), bhi = _mm_set1_ps(-INFINITY);
+                __m128 clo = blo, chi = bhi;
+                for(size_t i = b; i < e; i++){
+                    __m128 lo = _mm_load_ps(refs[i].lo), hi = _mm_load_ps(refs[i].hi);
+                    __m128 c = _mm_mul_ps(_mm_add_ps(lo, hi), _mm_set1_ps(0.5f));
+                    blo = _mm_min_ps(blo, lo);
+                    bhi = _mm_max_ps(bhi, hi);
+                    clo = _mm_min_ps(clo, c);
+                    chi = _mm_max_ps(chi, c);
+                }
+                box4 r;
+                _mm_storeu_ps(r.box_lo, blo);
+                _mm_storeu_ps(r.box_hi, bhi);
+                _mm_storeu_ps(r.center_lo, clo);
+                _mm_storeu_ps(r.center_hi, chi);
+                return r;
+            };
+            if(!parallel || end - begin < parallel_range)return serial(begin, end);
+
+            // Big ranges near the root: chunks in parallel, merged in chunk order
+            const size_t chunk = 1 << 14;
+            vector<box4> parts ((end - begin + chunk - 1) / chunk);
+            parallel_for(parts.size(), [&](int c){
+                parts[c] = serial(begin + c * chunk, min(end, begin + (c + 1) * chunk));
+            }, threads);
+            box4 r = parts[0];
+            for(size_t c = 1; c < parts.size(); c++){
+                for(int k = 0; k < 4; k++){
+                    r.box_lo[k] = fmin(r.box_lo[k], parts[c].box_lo[k]);
+                    r.box_hi[k] = fmax(r.box_hi[k], parts[c].box_hi[k]);
+                    r.center_lo[k] = fmin(r.center_lo[k], parts[c].center_lo[k]);
+                    r.center_hi[k] = fmax(r.center_hi[k], parts[c].center_hi[k]);
+                }
+            }
+            return r;
+        }
+
+        static float half_area(__m128 lo, __m128 hi){
+            alignas(16) float d[4];
+            _mm_store_ps(d, _mm_max_ps(_mm_sub_ps(hi, lo), _mm_setzero_ps()));
+            return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+        }
+
+        // Per axis boxes and counts of the centroid bins
+        class bin_set {
+            public:
+                __m128 lo[3][bins], hi[3][bins];
+                int count[3][bins];
+
+                bin_set(){
+                    for(int a = 0; a < 3; a++)
+                        for(int b = 0; b < bins; b++){
+                            lo[a][b] = _mm_set1_ps(INFINITY);
+                            hi[a][b] = _mm_set1_ps(-INFINITY);
+                            count[a][b] = 0;
+                        }
+                }
+
+                void merge(const bin_set& o){
+                    for(int a = 0; a < 3; a++)
+                        for(int b = 0; b < bins; b++){
+                            lo[a][b] = _mm_min_ps(lo[a][b], o.lo[a][b]);
+                            hi[a][b] = _mm_max_ps(hi[a][b], o.hi[a][b]);
+                            count[a][b] += o.count[a][b];
+                        }
+                }
+        };
+
+        void bin_range(size_t begin, size_t end, __m128 origin, __m128 scale, bin_set& out) const {
+            const __m128i last = _mm_set1_epi32(bins - 1);
+            for(size_t i = begin; i < end; i++){
+                __m128 lo = _mm_load_ps(refs[i].lo), hi = _mm_load_ps(refs[i].hi);
+                __m128 c = _mm_mul_ps(_mm_add_ps(lo, hi), _mm_set1_ps(0.5f));
+                alignas(16) int b[4];
+                __m128i k = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(c, origin), scale));
+                _mm_store_si128((__m128i*)b, _mm_max_epi32(_mm_min_epi32(k, last), _mm_setzero_si128()));
+                for(int a = 0; a < 3; a++){
+                    out.lo[a][b[a]] = _mm_min_ps(out.lo[a][b[a]], lo);
+                    out.hi[a][b[a]] = _mm_max_ps(out.hi[a][b[a]], hi);
+                    out.count[a][b[a]]++;
+                }
+            }
+        }
+
+        // Binned SAH split of [begin, end), refs are partitioned in place
+        size_t split_sah(size_t begin, size_t end, const box4& box, bool parallel){
+            __m128 origin = _mm_loadu_ps(box.center_lo);
+            __m128 extent = _mm_sub_ps(_mm_loadu_ps(box.center_hi), origin);
+            alignas(16) float ext[4], sc[4];
+            _mm_store_ps(ext, extent);
+            for(int a = 0; a < 4; a++)sc[a] = ext[a] > 0 ? bins * 0.9999f / ext[a] : 0;
+            __m128 scale = _mm_load_ps(sc);
+
+            bin_set set;
+            if(!parallel || end - begin < parallel_range)bin_range(begin, end, origin, scale, set);
+            else {
+                // Top levels bin in parallel, merged in chunk order
+                const size_t chunk = 1 << 14;
+                vector<bin_set> parts ((end - begin + chunk - 1) / chunk);
+                parallel_for(parts.size(), [&](int c){
+                    bin_range(begin + c * chunk, min(end, begin + (c + 1) * chunk), origin, scale, parts[c]);
+                }, threads);
+                for(auto& p : parts)set.merge(p);
+            }
+
+            float best = INFINITY;
+            int best_axis = -1, best_bin = 0;
+            for(int a = 0; a < 3; a++){
+                if(ext[a] <= 0)continue;
+                float right_area[bins];
+                int right_count[bins];
+                __m128 lo = _mm_set1_ps(INFINITY), hi = _mm_set1_ps(-INFINITY);
+                int c = 0;
+                for(int b = bins - 1; b > 0; b--){
+                    lo = _mm_min_ps(lo, set.lo[a][b]);
+                    hi = _mm_max_ps(hi, set.hi[a][b]);
+                    c += set.count[a][b];
+                    right_area[b] = half_area(lo, hi);
+                    right_count[b] = c;
+                }
+                lo = _mm_set1_ps(INFINITY);
+                hi = _mm_set1_ps(-INFINITY);
+                c = 0;
+                for(int b = 0; b < bins - 1; b++){
+                    lo = _mm_min_ps(lo, set.lo[a][b]);
+                    hi = _mm_max_ps(hi, set.hi[a][b]);
+                    c += set.count[a][b];
+                    if(c == 0 || right_count[b + 1] == 0)continue;
+                    float cost = half_area(lo, hi) * c + right_area[b + 1] * right_count[b + 1];
+                    if(cost < best){
+                        best = cost;
+                        best_axis = a;
+                        best_bin = b + 1;
+                    }
+                }
+            }
+            if(best_axis < 0)return (begin + end) / 2;
+
+            // Same bin formula as the binning so every ref lands on its side
+            float o = box.center_lo[best_axis], s = sc[best_axis];
+            auto left = [&](const build_ref& r){
+                float c = 0.5f * (r.lo[best_axis] + r.hi[best_axis]);
+                return min(bins - 1, max(0, int((c - o) * s))) < best_bin;
+            };
+            size_t mid = std::partition(refs.begin() + begin, refs.begin() + end, left) - refs.begin();
+            if(mid == begin || mid == end)mid = (begin + end) / 2;
+            return mid;
+        }
+
+        // Splits sorted codes where the highest differing bit flips
+        size_t split_morton(size_t begin, size_t end) const {
+            uint32_t first = codes[begin], last = codes[end - 1];
+            if(first == last)return (begin + end) / 2;
+            int bit = 31 - __builtin_clz(first ^ last);
+            uint32_t mask = ~0u << bit;
+            uint32_t target = (first & mask) | (1u << bit);
+            return std::lower_bound(codes.begin() + begin, codes.begin() + end, target) - codes.begin();
+        }
+
+        size_t split_range(build_context& ctx, size_t begin, size_t end, const box4& box, bool parallel){
+            ctx.binary_nodes++;
+            if(builder == bvh_builder::morton)return split_morton(begin, end);
+            return split_sah(begin, end, box, parallel);
+        }
+
+        // 10 bits per axis of the centroid in the root's centroid box, then a radix sort
+        void sort_by_morton(const box4& root){
+            size_t n = refs.size();
+            codes.resize(n);
+            float origin[3], scale[3];
+            for(int a = 0; a < 3; a++){
+                origin[a] = root.center_lo[a];
+                float extent = root.center_hi[a] - root.center_lo[a];
+                scale[a] = extent > 0 ? 1023.0f / extent : 0;
+            }
+            auto spread = [](uint32_t v){
+                v = (v | (v << 16)) & 0x030000ff;
+                v = (v | (v << 8)) & 0x0300f00f;
+                v = (v | (v << 4)) & 0x030c30c3;
+                v = (v | (v << 2)) & 0x09249249;
+                return v;
+            };
+            parallel_chunks(n, [&](size_t b, size_t e){
+                for(size_t i = b; i < e; i++){
+                    uint32_t q[3];
+                    for(int a = 0; a < 3; a++){
+                        float c = 0.5f * (refs[i].lo[a] + refs[i].hi[a]);
+                        q[a] = min(1023u, uint32_t(fmax(0.0f, (c - origin[a]) * scale[a])));
+                    }
+                    codes[i] = spread(q[0]) << 2 | spread(q[1]) << 1 | spread(q[2]);
+                }
+            });
+
+            // LSD radix sort, 3 passes of 10 bits, stable so equal codes keep object order.
+            // Every chunk counts its digits in parallel, the offsets are laid out digit major
+            // and chunk minor, then every chunk scatters from its own offsets in parallel
+            const size_t chunk = 1 << 14;
+            int chunks = (n + chunk - 1) / chunk;
+            vector<build_ref> tmp_refs (n);
+            vector<uint32_t> tmp_codes (n);
+            vector<size_t> offsets (chunks * 1024);
+            for(int shift = 0; shift < 30; shift += 10){
+                parallel_for(chunks, [&](int c){
+                    size_t* count = &offsets[c * 1024];
+                    fill(count, count + 1024, 0);
+                    for(size_t i = c * chunk; i < min(n, (c + 1) * chunk); i++)count[(codes[i] >> shift) & 1023]++;
+                }, threads);
+                size_t sum = 0;
+                for(int k = 0; k < 1024; k++){
+                    for(int c = 0; c < chunks; c++){
+                        size_t count = offsets[c * 1024 + k];
+                        offsets[c * 1024 + k] = sum;
+                        sum += count;
+                    }
+                }
+                parallel_for(chunks, [&](int c){
+                    size_t* next = &offsets[c * 1024];
+                    for(size_t i = c * chunk; i < min(n, (c + 1) * chunk); i++){
+                        size_t d = next[(codes[i] >> shift) & 1023]++;
+                        tmp_codes[d] = codes[i];
+                        tmp_refs[d] = refs[i];
+                    }
+                }, threads);
+                codes.swap(tmp_codes);
+                refs.swap(tmp_refs);
+            }
+        }
+
+        // Writes node index of ctx for [begin, end) with bounds box. With jobs set, large
+        // children are left as jobs instead of being built
+        void build_node(build_context& ctx, size_t begin, size_t end, const box4& box, uint32_t index, vector<subtree_job>* jobs){
+            bool parallel = jobs != nullptr;
+            // Up to 4 groups from two levels of binary splits
+            size_t cuts[5] = {begin, end, end, end, end};
+            int groups = 1;
+            if(end - begin > bvh_max_leaf){
+                size_t mid = split_range(ctx, begin, end, box, parallel);
+                groups = 0;
+                for(auto range : {make_pair(begin, mid), make_pair(mid, end)}){
+                    if(range.second - range.first > bvh_max_leaf){
+                        box4 half = range_bounds(range.first, range.second, parallel);
+                        size_t m = split_range(ctx, range.first, range.second, half, parallel);
+                        cuts[groups++] = range.first;
+                        cuts[groups++] = m;
+                    }
+                    else cuts[groups++] = range.first;
+                }
+                cuts[groups] = end;
+            }
+
+            // Quantisation grid of this node: the smallest power of two step that spans the box
+            {
+                bvh4_node& n = ctx.nodes[index];
+                memset(&n, 0, sizeof(n));
+                n.child_count = groups;
+                for(int a = 0; a < 3; a++){
+                    n.origin[a] = box.box_lo[a];
+                    double extent = fmax(double(box.box_hi[a]) - n.origin[a], 1e-30);
+                    int e = int(ceil(log2(extent / 255.0)));
+                    while(ldexp(255.0, e) < extent)e++;
+                    n.exponent[a] = (int8_t)max(-127, min(127, e));
+                }
+                for(int c = 0; c < 4; c++)n.child[c] = bvh_empty_child;
+            }
+
+            for(int g = 0; g < groups; g++){
+                size_t b = cuts[g], e = cuts[g + 1];
+                box4 child_box = range_bounds(b, e, parallel);
+
+                bvh4_node& n = ctx.nodes[index];
+                for(int a = 0; a < 3; a++){
+                    double step = ldexp(1.0, n.exponent[a]);
+                    double lo = floor((child_box.box_lo[a] - double(n.origin[a])) / step);
+                    double hi = ceil((child_box.box_hi[a] - double(n.origin[a])) / step);
+                    n.qlo[a][g] = uint8_t(fmin(fmax(lo, 0.0), 255.0));
+                    n.qhi[a][g] = uint8_t(fmin(fmax(hi, 0.0), 255.0));
+                }
+
+                if(e - b <= bvh_max_leaf){
+                    uint32_t first = ctx.prims.size();
+                    for(size_t i = b; i < e; i++)ctx.prims.push_back(refs[i].index);
+                    n.child[g] = bvh_leaf_flag | uint32_t(e - b - 1) << 28 | first;
+                    ctx.binary_nodes++;
+                }
+                else if(jobs && e - b <= job_size){
+                    jobs->push_back(subtree_job{b, e, child_box, index, g});
+                }
+                else {
+                    uint32_t child_index = ctx.nodes.size();
+                    ctx.nodes.emplace_back();
+                    ctx.nodes[index].child[g] = child_index;
+                    build_node(ctx, b, e, child_box, child_index, jobs);
+                }
+            }
+        }
+
+        // Appends the job trees after the top levels in job order and rebases their indices
+        void stitch(build_context& top, const vector<subtree_job>& jobs, vector<build_context>& done,
+                    const vector<shared_ptr<hittable>>& objects){
+            size_t total_nodes = top.nodes.size(), total_prims = top.prims.size();
+            vector<size_t> node_offset (jobs.size()), prim_offset (jobs.size());
+            for(size_t j = 0; j < jobs.size(); j++){
+                node_offset[j] = total_nodes;
+                prim_offset[j] = total_prims;
+                total_nodes += done[j].nodes.size();
+                total_prims += done[j].prims.size();
+            }
+
+            owned.resize(total_nodes);
+            prims.resize(total_prims);
+            copy(top.nodes.begin(), top.nodes.end(), owned.begin());
+            for(size_t p = 0; p < top.prims.size(); p++)prims[p] = objects[top.prims[p]].get();
+            binary_nodes = top.binary_nodes;
+            for(size_t j = 0; j < jobs.size(); j++){
+                owned[jobs[j].parent].child[jobs[j].slot] = node_offset[j];
+                binary_nodes += done[j].binary_nodes;
+            }
+
+            parallel_for(jobs.size(), [&](int j){
+                const build_context& d = done[j];
+                for(size_t k = 0; k < d.nodes.size(); k++){
+                    bvh4_node n = d.nodes[k];
+                    for(int c = 0; c < n.child_count; c++){
+                        if(n.child[c] & bvh_leaf_flag)n.child[c] += prim_offset[j];
+                        else n.child[c] += node_offset[j];
+                    }
+                    owned[node_offset[j] + k] = n;
+                }
+                for(size_t p = 0; p < d.prims.size(); p++)prims[prim_offset[j] + p] = objects[d.prims[p]].get();
+            }, threads);
+        }
+};
+
+#endif
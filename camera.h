@@ -1,4 +1,4 @@
-//#ifndef CAMERA_H
+#ifndef CAMERA_H
 #define CAMERA_H
 
 #include "vec3.h"
@@ -6,6 +6,20 @@
 #include "hittable.h"
 #include "hittable_list.h"
 #include "color.h"
+#include "sampler.h"
+#include "denoiser.h"
+#include "aov.h"
+#include "stats.h"
+#include "environment.h"
+#include "film.h"
+#include "parallel.h"
+#include "wavefront.h"
+#include "guiding.h"
+#include "photon.h"
+#include "bdpt.h"
+#include "restir.h"
+#include "static_scene.h"
+#include "numa.h"
 
 #include <fstream>
 #include <iostream>
@@ -16,65 +30,342 @@ class camera {
         int screen_width = 1200;
         double aspect_ratio = 16.0 / 9.0;
         int max_depth = 10;
+        int iterations = 15;
         int iterations_done = 0;
 
-        void render(const hittable &world, const hittable &lights){
+        // View, the default looks down -z from the origin
+        point3 lookfrom = point3(0,0,0);
+        point3 lookat = point3(0,0,-1);
+        vec3 vup = vec3(0,1,0);
+
+        // Tiles are handed to threads (0 = every hardware thread). The image only depends on
+        // seed, never on the thread count or schedule
+        int tile_size = 32;
+        int threads = 0;
+        uint64_t seed = 0;
+
+        // Trace tiles on one pinned worker per cpu, each NUMA node taking a contiguous band of
+        // tiles, with the film rows of that band and a copy of the world's BVH on the node
+        // (numa.h). Without numa_replicate the one BVH is interleaved over the nodes instead.
+        // numa_domains regroups the cpus into that many domains, 0 keeps the machine's nodes.
+        // Overrides threads for the tile loop
+        bool numa = false;
+        int numa_domains = 0;
+        bool numa_replicate = true;
+
+        // Threads of each pass when set, asked again before every pass so a scheduler can
+        // resize a running render (daemon.h). Overrides threads
+        function<int()> pass_threads;
+
+        // Trace each tile breadth first, one bounce of every path at a time (see wavefront.h).
+        // Use a bigger tile_size with it. On the 3M sphere cloud of test_wavefront it is within
+        // about 10% of pixel order either way. Sorting the rays between bounces was tried and
+        // was 5-15% slower than not sorting, so the paths keep pixel order
+        bool wavefront = false;
+        // With wavefront, the hits of each bounce on batched materials (dielectric) are
+        // shaded together by the 8 wide kernel (material::scatter_batch) instead of one
+        // scalar scatter per hit. The scatter is a small part of a bounce, test_glass shows
+        // no reliable gain on its glass field, so it is off by default
+        bool batch_scatter = false;
+
+        // Pixel and bsdf sample source, a sobol_sampler is used if none is set
+        shared_ptr<sampler> pixel_sampler;
+
+        // Filter the accumulated image with first hit albedo, normal and depth as guides
+        bool denoise = false;
+        denoiser denoise_filter;
+
+        // aov_flags of the extra layers to capture, they are written with the beauty to aov_path
+        int aov_layers = 0;
+        string aov_path = "out.exr";
+        aov_buffer aovs;
+
+        // Sky seen by rays that miss everything, sampled directly at diffuse hits. Black if unset
+        shared_ptr<environment_map> environment;
+
+        // Written when built with -DRT_STATS: cycles per pixel and a counter summary
+        string heatmap_path = "cost.ppm";
+
+        // Gamma corrected 8 bit P3, or linear floats when the name ends in .pfm
+        string output_path = "out.ppm";
+        // Per pass timings on cout
+        bool verbose = true;
+
+        // Trace with fast_ray_color (fast_hit and fast_scatter). No environment, media or AOVs
+        bool fast_kernels = false;
+
+        // Learn where light arrives from during the first guide_training passes and sample
+        // diffuse bounces from a mix of that and the bsdf (guiding.h). The guide is kept after
+        // render() and used by sample(). Not applied to wavefront or fast_kernels tracing
+        bool guiding = false;
+        int guide_training = 4;
+        path_guide guide;
+
+        // Caustics from photons (photon.h): every pass traces caustic_photons from the sphere
+        // lights and gathers them at the first diffuse hit of each path, within a radius that
+        // starts at caustic_radius and shrinks by caustic_alpha. Recursive integrator only
+        bool caustics = false;
+        int caustic_photons = 200000;
+        double caustic_radius = 0.05;
+        double caustic_alpha = 0.7;
+
+        // Bidirectional path tracing (bdpt.h) in place of ray_color, for lights that camera paths
+        // rarely reach. Light subpaths start on sphere lights. Not with wavefront or fast_kernels
+        bool bidirectional = false;
+
+        // Direct light at the first hit from reservoir resampling over the sphere lights, reused
+        // between neighbouring pixels and from the pass before (restir.h). The cost per pixel
+        // stays flat as lights are added, given a BVH over them. Recursive integrator only
+        bool resample_lights = false;
+        restir_lights light_resampler;
+
+        // render() for a static_scene (static_scene.h), with the bounce count and the
+        // static_feature flags fixed at compile time. max_depth and the integrator options
+        // above do not apply, only the beauty image is written
+        template <int MaxDepth, int Features = static_lights, typename Scene>
+        bool render_static(const Scene& scene){
             initialize();
 
-            // Rendering
-            std::ofstream out_file{"out.ppm"};
-            out_file << "P3\n" << screen_width << ' ' << screen_height << "\n255\n";
+            vector<tile> tiles = make_tiles(screen_width, screen_height, tile_size);
+            film image;
+            image.resize(screen_width, screen_height, tiles.size());
+            vector<tile_accumulator> accumulators (worker_count(tiles.size(), threads));
 
-            vector<vector<color>> grid (screen_height, vector<color> (screen_width));
+            auto start = std::chrono::high_resolution_clock::now();
+            for(int k = 0; k < iterations; k++){
+                parallel_for_workers(tiles.size(), [&](int t, int worker){
+                    tile_accumulator& acc = accumulators[worker];
+                    image.begin(acc, tiles[t]);
+                    for(int j = tiles[t].y1 - 1; j >= tiles[t].y0; j--)
+                        for(int i = tiles[t].x0; i < tiles[t].x1; i++){
+                            uint32_t pixel = j * screen_width + i;
+                            seed_pixel(pixel, k);
+                            sample_stream stream(pixel_sampler.get(), pixel, k);
+                            active_stream = &stream;
+                            ray r = get_ray(i, j, stream);
+                            acc.add(i, j, static_trace<MaxDepth, Features>(scene, r));
+                            active_stream = nullptr;
+                        }
+                    image.commit(acc);
+                }, threads);
+            }
+
+            if(verbose){
+                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+                std::cout << "Execution time: " << duration.count() << " ms" << std::endl;
+            }
+            return write_output(image);
+        }
+
+        // For renderers that schedule samples themselves (preview.h): setup() once per view
+        // change, then any number of sample() calls from any thread
+        void setup(){ initialize(); }
+        int height() const { return screen_height; }
+
+        color sample(int i, int j, int pass, const hittable& world, const hittable& lights){
+            uint32_t pixel = j * screen_width + i;
+            seed_pixel(pixel, pass);
+            sample_stream stream(pixel_sampler.get(), pixel, pass);
+            active_stream = &stream;
+            ray r = get_ray(i, j, stream);
+            color c = ray_color(r, max_depth, world, lights);
+            active_stream = nullptr;
+            return c;
+        }
+
+        // Renders into output_path, false when the image could not be written
+        bool render(const hittable &world, const hittable &lights){
+            initialize();
+
+            vector<tile> tiles = make_tiles(screen_width, screen_height, tile_size);
+            film image;
+            image.resize(screen_width, screen_height, tiles.size());
+            numa_topology topology;
+            vector<shared_ptr<hittable_list>> replicas;
+            if(numa)place_numa(world, tiles, image, topology, replicas);
+
+            // One scratch accumulator per worker, reused for every tile it renders. A worker
+            // first touches its own, so with numa they sit on the worker's node
+            vector<tile_accumulator> accumulators (numa ? topology.cpu_count() : worker_count(tiles.size(), threads));
+            vector<wavefront_scratch> scratch (accumulators.size());
+            vector<bdpt_paths> subpaths (bidirectional ? accumulators.size() : 0);
+            bdpt_integrator bdpt (film_lens(), lights, max_depth, environment.get());
+            aabb scene_bounds = world.bounding_box();
+            bool resampling = resample_lights && !bidirectional && !fast_kernels && !wavefront;
+            if(resampling)light_resampler.resize(screen_width, screen_height);
+
+            // Guide records of each tile, folded in tile order after every training pass
+            vector<vector<guide_record>> guide_records;
+            if(guiding){
+                guide.reset(scene_bounds);
+                guide_records.resize(tiles.size());
+            }
+
+            // The denoiser needs its guides even when they are not written out
+            int aov_capture = aov_layers | (denoise ? aov_albedo | aov_normal | aov_depth : 0);
+            aovs.resize(screen_width, screen_height, aov_capture);
+
+#ifdef RT_STATS
+            reset_stats();
+            vector<uint64_t> pixel_cycles (screen_width * screen_height, 0);
+#endif
 
             auto start = std::chrono::high_resolution_clock::now();
             auto step1 = start;
 
-            int iterations = 15;
             /*vec4 origin4 (origin, 0.0f);
             vec4 vertical4 (vertical.x(), vertical.y(), vertical.z(), 0);
             vec4 horizontal4 (horizontal.x(), horizontal.y(), horizontal.z(), 0);
             vec4 lower_left4 (lower_left.x(), lower_left.y(), lower_left.z(), 0);*/
 
             for(int k = 0; k < iterations; k++){
-                cout << "iteration " << k << "/" << iterations << "\n";
-                for(int j = screen_height - 1; j >= 0; j--){
-                    for(int i = 0; i < screen_width; i++) {
-                        auto u = double(i) / (screen_width  - 1) + random_double(0.000001,0.002) - 0.001;
-                        auto v = double(j) / (screen_height - 1) + random_double(0.000001,0.002) - 0.001;
-                    
-                        ray r(origin, lower_left + u * horizontal + v * vertical - origin);
-                        //ray4 r4(origin4, simd_add(simd_add(lower_left4, simd_mul(horizontal4, u)), simd_minus(simd_mul(vertical4, v), origin4)));
-
-                        color pixel_color = ray_color(r, max_depth, world, lights);
-                        //color pixel_color = fast_ray_color(r, max_depth, world, lights);
-                        //color pixel_color = simd_ray_color(r4, max_depth, world, lights);
-                        
-                        if(k == 0)
-                            grid[j][i] = pixel_color;
-                        else
-                            grid[j][i] = grid[j][i] + pixel_color;
-                        
+                if(verbose)cout << "iteration " << k << "/" << iterations << "\n";
+                bool training = guiding && k < guide_training;
+
+                int pass_count = threads;
+                if(pass_threads && !numa){
+                    pass_count = max(1, pass_threads());
+                    size_t workers = worker_count(tiles.size(), pass_count);
+                    if(workers > accumulators.size()){
+                        accumulators.resize(workers);
+                        scratch.resize(workers);
+                        if(bidirectional)subpaths.resize(workers);
                     }
                 }
 
+                if(caustics){
+                    photons.trace(world, lights, color(10,10,10), caustic_photons, seed * 0x2545f4914f6cdd1dull + k, max_depth, threads);
+                    photons.build(sqrt(photon_radius2(caustic_radius, caustic_alpha, k)));
+                }
+
+                if(resampling)
+                    light_resampler.prepare(tiles, k, seed, world, lights, [&](int i, int j, ray& r, hit_record& rec){
+                        return primary_hit(i, j, k, r, rec, world, lights);
+                    }, threads);
+
+                // Tiles are disjoint, so the per pixel AOV and cost buffers need no locking either
+                auto render_tile = [&](int t, int worker, const hittable& scene){
+                    tile_accumulator& acc = accumulators[worker];
+                    image.begin(acc, tiles[t]);
+                    if(training){
+                        guide_records[t].clear();
+                        active_guide_records = &guide_records[t];
+                    }
+
+                    if(wavefront){
+                        trace_wavefront(tiles[t], k, acc, scratch[worker], scene, lights, aov_capture);
+                        active_guide_records = nullptr;
+                        image.commit(acc);
+                        return;
+                    }
+
+                    for(int j = tiles[t].y1 - 1; j >= tiles[t].y0; j--){
+                        for(int i = tiles[t].x0; i < tiles[t].x1; i++) {
+                            uint32_t pixel = j * screen_width + i;
+                            seed_pixel(pixel, k);
+                            sample_stream stream(pixel_sampler.get(), pixel, k);
+                            active_stream = &stream;
+
+                            ray r = get_ray(i, j, stream);
+                            //ray4 r4(origin4, simd_add(simd_add(lower_left4, simd_mul(horizontal4, u)), simd_minus(simd_mul(vertical4, v), origin4)));
+
+                            aov_sample first_hit;
+                            auto pixel_start = aovs.enabled(aov_time) ? std::chrono::high_resolution_clock::now() : start;
+#ifdef RT_STATS
+                            uint64_t pixel_cycles_start = STAT_CYCLES();
+#endif
+                            STAT_INC(camera_rays);
+
+                            color pixel_color;
+                            if(bidirectional)pixel_color = bdpt_color(bdpt, r, pixel, k, acc, subpaths[worker], scene, lights, aov_capture ? &first_hit : nullptr);
+                            else if(fast_kernels)pixel_color = fast_ray_color(r, max_depth, scene, lights);
+                            else if(resampling && light_resampler.sampled(pixel))
+                                pixel_color = light_resampler.direct_light(pixel) + ray_color(r, max_depth, scene, lights, aov_capture ? &first_hit : nullptr, 0,
+                                                                                              caustic_path::before_diffuse, direct_light::resampled_here);
+                            else pixel_color = ray_color(r, max_depth, scene, lights, aov_capture ? &first_hit : nullptr);
+
+#ifdef RT_STATS
+                            pixel_cycles[pixel] += STAT_CYCLES() - pixel_cycles_start;
+#endif
+
+                            if(aov_capture)
+                                aovs.add(i, j, first_hit);
+                            if(aovs.enabled(aov_time))
+                                aovs.add_time(i, j, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pixel_start).count());
+                            //color pixel_color = simd_ray_color(r4, max_depth, world, lights);
+                            active_stream = nullptr;
+
+                            acc.add(i, j, pixel_color);
+                        }
+                    }
+
+                    active_guide_records = nullptr;
+                    image.commit(acc);
+                };
+
+                if(numa)
+                    numa_parallel_for(topology, tiles.size(), [&](int t, int worker, int node){
+                        render_tile(t, worker, replicas.empty() ? world : *replicas[node]);
+                    });
+                else
+                    parallel_for_workers(tiles.size(), [&](int t, int worker){ render_tile(t, worker, world); }, pass_count);
+
+                image.merge_splats();
+                if(training)guide.update(guide_records);
+
                 auto step2 = std::chrono::high_resolution_clock::now();
                 auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(step2 - step1);
-                std::cout << "time: " << diff.count() << " ms" << std::endl;
+                if(verbose)std::cout << "time: " << diff.count() << " ms" << std::endl;
                 swap(step2, step1);
             }
 
 
             auto end = std::chrono::high_resolution_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-            std::cout << "Execution time: " << duration.count() << " ms" << std::endl;
-            cout << "------------------ Next Stage -------------------\n\n\n";
+            if(verbose){
+                std::cout << "Execution time: " << duration.count() << " ms" << std::endl;
+                cout << "------------------ Next Stage -------------------\n\n\n";
+            }
 
-            for(int j = screen_height - 1; j >= 0; j--){
-                for(int i = 0; i < screen_width; i++) {
-                    write_color(out_file, grid[j][i] / iterations);
-                }
+            // sample() does not gather, so it must not skip the paths photons stand in for
+            photons.clear();
+            aovs.resolve();
+
+            if(denoise){
+                auto denoise_start = std::chrono::high_resolution_clock::now();
+
+                vector<color> beauty (screen_width * screen_height);
+                for(int j = 0; j < screen_height; j++)
+                    for(int i = 0; i < screen_width; i++)
+                        beauty[j * screen_width + i] = image.at(i, j) / iterations;
+
+                vector<color> filtered = denoise_filter.run(beauty, aovs);
+                for(int j = 0; j < screen_height; j++)
+                    for(int i = 0; i < screen_width; i++)
+                        image.at(i, j) = filtered[j * screen_width + i] * iterations;
+
+                auto denoise_end = std::chrono::high_resolution_clock::now();
+                auto denoise_time = std::chrono::duration_cast<std::chrono::milliseconds>(denoise_end - denoise_start);
+                if(verbose)std::cout << "Denoise time: " << denoise_time.count() << " ms" << std::endl;
+            }
+
+            bool written = write_output(image);
+
+#ifdef RT_STATS
+            write_heatmap(heatmap_path, pixel_cycles, screen_width, screen_height);
+            collect_stats().report(cout);
+#endif
+
+            if(aov_layers){
+                vector<color> beauty (screen_width * screen_height);
+                for(int j = 0; j < screen_height; j++)
+                    for(int i = 0; i < screen_width; i++)
+                        beauty[j * screen_width + i] = image.at(i, j) / iterations;
+
+                if(!aovs.write_exr(aov_path, beauty))
+                    cerr << "Could not write " << aov_path << "\n";
             }
+            return written;
         }
 
     private:
@@ -82,22 +373,43 @@ class camera {
         double viewport_height;
         double viewport_width;
         double focal_length;
+        // Angle covered by one pixel, the ray cone spread of camera rays
+        double pixel_spread;
 
         point3 origin;
         vec3 horizontal;
         vec3 vertical;
         vec3 lower_left ;
 
+        // Caustic photons of the running pass, empty outside render()
+        photon_map photons;
+
+        // Where a path is relative to the caustic gather, see photon.h. Light reached from the
+        // gather vertex through delta bounces only is the photons' part
+        enum class caustic_path { before_diffuse, gathered, delta_after_gather, past };
+
+        // Whether light reached by the bounce off the hit is counted by ray_color or was
+        // estimated there by the light resampler, which does so at the first hit only
+        enum class direct_light { traced, resampled_here, resampled_before };
+
         void initialize(){
             screen_height = static_cast<int>(screen_width / aspect_ratio);
             viewport_height = 2.0;
             viewport_width = aspect_ratio * viewport_height;
             focal_length = 1.0;
+            pixel_spread = viewport_height / screen_height / focal_length;
+
+            vec3 w = unit_vector(lookfrom - lookat);
+            vec3 u = unit_vector(cross(vup, w));
+            vec3 v = cross(w, u);
+
+            origin = lookfrom;
+            horizontal = viewport_width * u;
+            vertical = viewport_height * v;
+            lower_left = origin - horizontal/2 - vertical/2 - focal_length * w;
 
-            origin = point3(0,0,0);
-            horizontal = vec3(viewport_width, 0, 0);
-            vertical = vec3(0, viewport_height, 0);
-            lower_left = origin - horizontal/2 - vertical/2 - vec3(0,0,focal_length);
+            if(!pixel_sampler)
+                pixel_sampler = make_shared<sobol_sampler>(uint32_t(seed));
         }
 
         /*color simd_ray_color(const ray4& r4, int depth, const hittable& world, const hittable& lights){
@@ -140,31 +452,407 @@ class camera {
             return res;
         }*/
 
-        color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights){
-            if(depth == 0)return color(0,0,0);
+        // Restarts random_double and the direction caches from the pixel, pass and seed
+        // Jitter over the whole pixel footprint
+        ray get_ray(int i, int j, sample_stream& stream) const {
+            auto u = (i + stream.next() - 0.5) / (screen_width  - 1);
+            auto v = (j + stream.next() - 0.5) / (screen_height - 1);
+
+            ray r(origin, lower_left + u * horizontal + v * vertical - origin);
+            r.spread = pixel_spread;
+            return r;
+        }
+
+        pinhole film_lens() const {
+            pinhole lens;
+            lens.origin = origin;
+            lens.forward = unit_vector(lookat - lookfrom);
+            lens.focal = focal_length;
+            lens.lower_left = lower_left;
+            lens.horizontal = horizontal;
+            lens.vertical = vertical;
+            lens.width = screen_width;
+            lens.height = screen_height;
+            return lens;
+        }
+
+        // One bidirectional sample. The camera subpath draws from the pixel's stream, the light
+        // subpath from random_double() seeded past the bounces the wavefront tracer uses
+        color bdpt_color(const bdpt_integrator& bdpt, const ray& r, uint32_t pixel, int pass, tile_accumulator& acc, bdpt_paths& paths,
+                         const hittable& world, const hittable& lights, aov_sample* first){
+            color escaped = bdpt.camera_walk(r, world, lights, paths.camera);
+            if(first && paths.camera.size() > 1)record_aovs(r, paths.camera[1].rec, first);
+
+            sample_stream* stream = active_stream;
+            active_stream = nullptr;
+            seed_pixel(pixel, pass, max_depth + 1);
+            bdpt.light_walk(world, lights, paths.light);
+            active_stream = stream;
+
+            return escaped + bdpt.connect_all(paths.camera, paths.light, acc, world, lights);
+        }
+
+        // Domains of the numa layer, the film rows of each domain's tiles moved onto its node,
+        // and the world's BVH copied onto every node or interleaved over them. Worlds that are
+        // not a hittable_list with a BVH are left where they are
+        void place_numa(const hittable& world, const vector<tile>& tiles, const film& image, numa_topology& topology,
+                        vector<shared_ptr<hittable_list>>& replicas) const {
+            topology = numa_topology::detect();
+            if(numa_domains > 0)topology = topology.split(numa_domains);
+            int domains = topology.nodes.size();
+
+            for(int k = 0; k < domains; k++){
+                int begin = numa_share_begin(tiles.size(), k, domains), end = numa_share_begin(tiles.size(), k + 1, domains);
+                if(begin == end)continue;
+                size_t first = size_t(tiles[begin].y0) * screen_width, last = size_t(tiles[end - 1].y1) * screen_width;
+                numa_bind(&image.pixels[first], (last - first) * sizeof(color), topology.nodes[k].id);
+            }
+
+            auto list = dynamic_cast<const hittable_list*>(&world);
+            if(!list || !list->has_bvh())return;
+            if(!numa_replicate){
+                numa_interleave(list->bvh().node_memory(), list->bvh().node_bytes(), topology);
+                return;
+            }
+            replicas.resize(domains);
+            for(int k = 0; k < domains; k++)
+                on_node(topology.nodes[k], [&](){
+                    replicas[k] = make_shared<hittable_list>();
+                    replicas[k]->replicate(*list);
+                });
+        }
+
+        // The pass averaged image to output_path, false when it could not be written
+        bool write_output(const film& image) const {
+            bool written;
+            if(output_path.size() > 4 && output_path.compare(output_path.size() - 4, 4, ".pfm") == 0){
+                vector<color> linear (screen_width * screen_height);
+                for(int p = 0; p < screen_width * screen_height; p++)linear[p] = image.pixels[p] / iterations;
+                written = write_pfm(output_path, screen_width, screen_height, linear);
+            }
+            else {
+                std::ofstream out_file{output_path};
+                out_file << "P3\n" << screen_width << ' ' << screen_height << "\n255\n";
+                for(int j = screen_height - 1; j >= 0; j--){
+                    for(int i = 0; i < screen_width; i++) {
+                        write_color(out_file, image.at(i, j) / iterations);
+                    }
+                }
+                out_file.flush();
+                written = bool(out_file);
+            }
+            if(!written)cerr << "Could not write " << output_path << "\n";
+            return written;
+        }
+
+        // The first hit of the pixel's camera ray in a pass, seeded and jittered as the tile
+        // loop will trace it. False when it misses or a light is in front
+        bool primary_hit(int i, int j, int pass, ray& r, hit_record& rec, const hittable& world, const hittable& lights) const {
+            uint32_t pixel = j * screen_width + i;
+            seed_pixel(pixel, pass);
+            sample_stream stream(pixel_sampler.get(), pixel, pass);
+            r = get_ray(i, j, stream);
+            hit_record lrec;
+            return world.hit(r, interval(0.00000001, infinity), rec) && !lights.hit(r, interval(0.00000001, rec.t), lrec);
+        }
+
+        void seed_pixel(uint32_t pixel, int pass, int bounce = 0) const {
+            uint64_t key = ((uint64_t)pixel << 32 | (uint32_t)pass) ^ (seed * 0xd1342543de82ef95ull) ^ ((uint64_t)bounce * 0x9e3779b97f4a7c15ull);
+            seed_random(key);
+            reseed_direction_caches(uint32_t(random_u64()));
+        }
+
+        // first, when set, receives the AOVs of the first hit along r. bsdf_pdf is the density
+        // the previous bounce sampled r with, 0 after a delta bounce or for camera rays
+        color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights, aov_sample* first = nullptr, double bsdf_pdf = 0,
+                        caustic_path state = caustic_path::before_diffuse, direct_light lighting = direct_light::traced){
+            if(depth == 0){
+                STAT_INC(depth_exhausted);
+                STAT_PATH(max_depth);
+                return color(0,0,0);
+            }
 
             hit_record lrec;
             hit_record rec;
+            STAT_INC(rays_traced);
             
             if(!world.hit(r, interval(0.00000001, infinity), rec)){
+                STAT_PATH(max_depth - depth);
                 if(lights.hit(r, interval(0.00000001, infinity), lrec)){
-                    return color(10,10,10);
+                    STAT_INC(light_hits);
+                    if(first)record_aovs(r, lrec, first);
+                    bool elsewhere = state == caustic_path::delta_after_gather || lighting == direct_light::resampled_before;
+                    return elsewhere ? color(0,0,0) : color(10,10,10);
+                }
+                STAT_INC(escaped);
+                if(!environment)return color(0,0,0);
+
+                // The other half of the MIS pair in sample_environment
+                double weight = bsdf_pdf > 0 ? power_heuristic(bsdf_pdf, environment->pdf(r.dir)) : 1.0;
+                return weight * environment->eval(r.dir);
+            }
+
+            if(lights.hit(r, interval(0.00000001, rec.t), lrec)){
+                STAT_INC(light_hits);
+                STAT_PATH(max_depth - depth);
+                if(first)record_aovs(r, lrec, first);
+                bool elsewhere = state == caustic_path::delta_after_gather || lighting == direct_light::resampled_before;
+                return elsewhere ? color(0,0,0) : color(10,10,10);
+            }
+
+            if(first)record_aovs(r, rec, first);
+
+            ray scattered;
+            color attenuation;
+
+            // Materials without a delta lobe, the probe along the normal tells them apart
+            bool diffuse = (guiding || photons.ready()) && rec.mat->scattering_pdf(r, rec, rec.normal) > 0;
+
+            color caustic (0,0,0);
+            caustic_path next_state = state;
+            if(photons.ready()){
+                if(diffuse){
+                    if(state == caustic_path::before_diffuse)caustic = gather_caustics(r, rec);
+                    next_state = state == caustic_path::before_diffuse ? caustic_path::gathered : caustic_path::past;
+                }
+                else if(state == caustic_path::gathered){
+                    next_state = caustic_path::delta_after_gather;
                 }
+            }
+
+            // Guided at diffuse hits
+            int leaf = -1;
+            double guided_pdf = 0;
+            if(guiding && diffuse && !guide.empty())leaf = guide.leaf_at(rec.p);
+
+            uint64_t scatter_start = STAT_CYCLES();
+            bool scatter_kept = leaf >= 0 ? scatter_guided(r, rec, leaf, attenuation, scattered, guided_pdf)
+                                          : rec.mat->scatter(r, rec, attenuation, scattered);
+            STAT_SCATTER(rec.mat->material_id, scatter_start, !scatter_kept);
+            scattered.cone = r.width_at(rec.t);
+            scattered.spread = r.spread;
+
+            color direct (0,0,0);
+            double next_pdf = 0;
+            if(environment){
+                next_pdf = leaf >= 0 ? guided_pdf : rec.mat->scattering_pdf(r, rec, unit_vector(scattered.dir));
+                if(next_pdf > 0)direct = sample_environment(r, rec, world, lights, leaf);
+            }
+
+            // A guided direction the bsdf can not scatter into carries nothing
+            if(leaf >= 0 && !scatter_kept)return direct + caustic;
+
+            direct_light next_lighting = lighting == direct_light::resampled_here ? direct_light::resampled_before : direct_light::traced;
+            color incoming = ray_color(scattered, depth - 1, world, lights, nullptr, next_pdf, next_state, next_lighting);
+            if(leaf >= 0)guide.record(leaf, unit_vector(scattered.dir), incoming, guided_pdf);
+            return attenuation * incoming * dot(r.dir, scattered.dir) + direct + caustic;
+        }
+
+        // Density estimate of the photons around a diffuse hit: bsdf times flux over the disc
+        // area, with the dot(r.dir, wi) factor ray_color puts on a scattered ray
+        color gather_caustics(const ray& r, const hit_record& rec) const {
+            color sum (0,0,0);
+            photons.gather(rec.p, [&](size_t i){
+                vec3 wi (-photons.dx[i], -photons.dy[i], -photons.dz[i]);
+                double cos_theta = dot(rec.normal, wi);
+                if(cos_theta <= 0)return;
+                // eval is bsdf times cosine
+                color f = rec.mat->eval(r, rec, wi) / cos_theta;
+                sum += f * color(photons.r[i], photons.g[i], photons.b[i]) * dot(r.dir, wi);
+            });
+            return sum / (pi * photons.radius * photons.radius);
+        }
+
+        // Density of scatter_guided choosing the unit direction dir
+        double guided_pdf_of(const ray& r, const hit_record& rec, int leaf, const vec3& dir) const {
+            double bsdf = rec.mat->scattering_pdf(r, rec, dir);
+            if(!guide.usable(leaf))return bsdf;
+            return guide.fraction * guide.pdf(leaf, dir) + (1 - guide.fraction) * bsdf;
+        }
+
+        // Draws from the guide with probability guide.fraction, else from the bsdf, and weights
+        // the direction by the density of that mixture (one sample MIS, balance heuristic), so
+        // both choices estimate the same integral as plain bsdf sampling. pdf is the mixture's
+        bool scatter_guided(const ray& r, const hit_record& rec, int leaf, color& attenuation, ray& scattered, double& pdf){
+            if(!guide.usable(leaf)){
+                bool kept = rec.mat->scatter(r, rec, attenuation, scattered);
+                pdf = rec.mat->scattering_pdf(r, rec, unit_vector(scattered.dir));
+                return kept;
+            }
+
+            if(sample_1d() < guide.fraction){
+                double u1, u2;
+                sample_2d(u1, u2);
+                scattered = ray(rec.p, guide.sample(leaf, u1, u2));
+            }
+            else {
+                color unused;
+                if(!rec.mat->scatter(r, rec, unused, scattered))return false;
+            }
+
+            vec3 dir = unit_vector(scattered.dir);
+            pdf = guided_pdf_of(r, rec, leaf, dir);
+            color f = rec.mat->eval(r, rec, dir);
+            // Guided directions below the surface, false ends the path there
+            if(pdf <= 0 || (f.e[0] == 0 && f.e[1] == 0 && f.e[2] == 0))return false;
+            attenuation = f / pdf;
+            return true;
+        }
+
+        // One environment light sample at a non delta hit, weighted against the bsdf sample, or
+        // the guided mixture at a guide leaf. It carries the same dot(r.dir, wi) factor that
+        // ray_color applies to the scattered ray
+        color sample_environment(const ray& r, const hit_record& rec, const hittable& world, const hittable& lights, int leaf = -1){
+            double u1, u2;
+            if(active_stream)sample_2d(u1, u2);
+            else { u1 = random_double(); u2 = random_double(); }
+
+            double light_pdf;
+            vec3 wi = environment->sample(u1, u2, light_pdf);
+            if(light_pdf <= 0)return color(0,0,0);
+
+            color f = rec.mat->eval(r, rec, wi);
+            if(f.e[0] == 0 && f.e[1] == 0 && f.e[2] == 0)return color(0,0,0);
+
+            // Media along the shadow ray dim the sample instead of blocking it
+            hit_record shadow;
+            ray shadow_ray (rec.p, wi);
+            STAT_INC(rays_traced);
+            double visible = world.transmittance(shadow_ray, interval(0.00000001, infinity));
+            if(visible == 0 || lights.hit(shadow_ray, interval(0.00000001, infinity), shadow))
                 return color(0,0,0);
+
+            double scatter_pdf = leaf >= 0 ? guided_pdf_of(r, rec, leaf, wi) : rec.mat->scattering_pdf(r, rec, wi);
+            double weight = power_heuristic(light_pdf, scatter_pdf);
+            return f * environment->eval(wi) * (visible * weight / light_pdf * dot(r.dir, wi));
+        }
+
+
+        // ray_color unrolled over a whole tile. Every bounce reseeds from its pixel, pass and
+        // depth, so the image is the same as in pixel order. Path states come from a pool and
+        // the queue from the worker's arena, both released at once after the tile
+        void trace_wavefront(const tile& t, int pass, tile_accumulator& acc, wavefront_scratch& scratch,
+                             const hittable& world, const hittable& lights, int aov_capture){
+            size_t capacity = t.width() * t.height();
+            pool<path_state> states (scratch.memory);
+            path_state** paths = scratch.memory.allocate_array<path_state*>(capacity);
+            char* alive = scratch.memory.allocate_array<char>(capacity);
+            size_t count = 0;
+            for(int j = t.y1 - 1; j >= t.y0; j--){
+                for(int i = t.x0; i < t.x1; i++){
+                    uint32_t pixel = j * screen_width + i;
+                    sample_stream stream(pixel_sampler.get(), pixel, pass);
+                    ray r = get_ray(i, j, stream);
+                    STAT_INC(camera_rays);
+                    paths[count++] = states.create(r, pixel, max_depth, stream);
+                }
+            }
+
+            for(int bounce = 0; count > 0; bounce++){
+                fill(alive, alive + count, 0);
+                for(size_t p = 0; p < count; p++){
+                    path_state& path = *paths[p];
+                    int i = path.pixel % screen_width, j = path.pixel / screen_width;
+                    seed_pixel(path.pixel, pass, bounce);
+                    active_stream = &path.stream;
+                    color emitted (0,0,0);
+                    alive[p] = extend_path(path, world, lights, emitted, bounce == 0 && aov_capture, batch_scatter ? &scratch.batches : nullptr, p);
+                    active_stream = nullptr;
+
+                    acc.add(i, j, emitted);
+                    if(bounce == 0 && aov_capture)aovs.add(i, j, path.first);
+                }
+                scratch.batches.resolve(paths, alive);
+
+                size_t kept = 0;
+                for(size_t p = 0; p < count; p++){
+                    if(alive[p])paths[kept++] = paths[p];
+                    else states.destroy(paths[p]);
+                }
+                count = kept;
+            }
+
+            states.reset();
+            scratch.memory.reset();
+        }
+
+        // One bounce of ray_color on path. Adds what reaches the camera from this vertex to
+        // emitted and returns false when the path ends. Hits on batched materials go to
+        // batches as path index when it is given, and the path moves on when they are resolved
+        bool extend_path(path_state& path, const hittable& world, const hittable& lights, color& emitted, bool capture,
+                         scatter_batches* batches = nullptr, size_t index = 0){
+            const ray& r = path.r;
+            if(path.depth == 0){
+                STAT_INC(depth_exhausted);
+                STAT_PATH(max_depth);
+                return false;
+            }
+
+            hit_record lrec;
+            hit_record rec;
+            STAT_INC(rays_traced);
+
+            if(!world.hit(r, interval(0.00000001, infinity), rec)){
+                STAT_PATH(max_depth - path.depth);
+                if(lights.hit(r, interval(0.00000001, infinity), lrec)){
+                    STAT_INC(light_hits);
+                    if(capture)record_aovs(r, lrec, &path.first);
+                    emitted = path.throughput * color(10,10,10);
+                    return false;
+                }
+                STAT_INC(escaped);
+                if(!environment)return false;
+
+                double weight = path.bsdf_pdf > 0 ? power_heuristic(path.bsdf_pdf, environment->pdf(r.dir)) : 1.0;
+                emitted = path.throughput * weight * environment->eval(r.dir);
+                return false;
             }
 
             if(lights.hit(r, interval(0.00000001, rec.t), lrec)){
-                return color(10,10,10);
+                STAT_INC(light_hits);
+                STAT_PATH(max_depth - path.depth);
+                if(capture)record_aovs(r, lrec, &path.first);
+                emitted = path.throughput * color(10,10,10);
+                return false;
+            }
+
+            if(capture)record_aovs(r, rec, &path.first);
+
+            if(batches && rec.mat->batched()){
+                batches->add(index, r, rec, random_double());
+                return true;
             }
 
             ray scattered;
             color attenuation;
 
-            rec.mat->scatter(r, rec, attenuation, scattered);
+            uint64_t scatter_start = STAT_CYCLES();
+            bool scatter_kept = rec.mat->scatter(r, rec, attenuation, scattered);
+            STAT_SCATTER(rec.mat->material_id, scatter_start, !scatter_kept);
+            scattered.cone = r.width_at(rec.t);
+            scattered.spread = r.spread;
+
+            double next_pdf = 0;
+            if(environment){
+                next_pdf = rec.mat->scattering_pdf(r, rec, unit_vector(scattered.dir));
+                if(next_pdf > 0)emitted = path.throughput * sample_environment(r, rec, world, lights);
+            }
 
-            return attenuation * ray_color(scattered, depth - 1, world, lights) * dot(r.dir, scattered.dir);
+            path.throughput = path.throughput * attenuation * dot(r.dir, scattered.dir);
+            path.bsdf_pdf = next_pdf;
+            path.depth--;
+            path.r = scattered;
+            // Nothing more can reach the camera along this path
+            return path.throughput.e[0] != 0 || path.throughput.e[1] != 0 || path.throughput.e[2] != 0;
         }
 
+        void record_aovs(const ray& r, const hit_record& rec, aov_sample* s){
+            s->albedo = rec.mat->albedo_at(rec);
+            s->normal = rec.normal;
+            s->depth = rec.t * r.dir.length();
+            s->object_id = rec.object_id;
+            s->material_id = rec.mat->material_id;
+        }
 
         color fast_ray_color(const ray& r, int depth, const hittable& world, const hittable& lights){
             if(depth == 0)return color(0,0,0);
@@ -194,4 +882,4 @@ class camera {
 
 
 
-//#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -4,7 +4,9 @@
 #include "vec3.h"
 #include "ray.h"
 
+#include <fstream>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
@@ -21,5 +23,18 @@ void write_color(ostream &out, color pixel_color){
         << static_cast<int>(256 * intensity.clamp(linear_to_gamma(pixel_color.z()))) << '\n';
 }
 
+// Linear float RGB, pixels indexed j * width + i with row 0 at the bottom, the order PFM
+// stores rows in. The negative scale marks little endian
+bool write_pfm(const string& path, int width, int height, const vector<color>& pixels){
+    ofstream out (path, ios::binary);
+    out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+    vector<float> row (width * 3);
+    for(int j = 0; j < height; j++){
+        for(int i = 0; i < width; i++)
+            for(int k = 0; k < 3; k++)row[i * 3 + k] = float(pixels[j * width + i].e[k]);
+        out.write((const char*)row.data(), row.size() * sizeof(float));
+    }
+    return bool(out.flush());
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,420 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "camera.h"
+#include "parallel.h"
+#include "preview.h"
+#include "scene_file.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Long running renderer that takes jobs over a unix socket, so small renders do not pay for
+// process start, scene parsing and BVH builds every time. Commands are text lines, each
+// answered with one line:
+//   render scene=PATH out=PATH [priority=N] [width=N] [spp=N] [depth=N] [seed=N]
+//                  queued ID
+//   wait ID        done ID MS, or failed ID MESSAGE, once the job has ended
+//   status         queued Q running R done D cache HITS/MISSES
+//   quit           stops the daemon after the running jobs
+// Clients are served concurrently. Output is written like camera::render does, a .pfm
+// name gives linear floats.
+//
+// Parsed scenes and their BVHs are cached by path and kept until the file's modification
+// time changes or scene_cache_size newer scenes push them out. Jobs sharing a scene file
+// share the parsed scene, read only.
+//
+// Up to cores jobs run at once, the rest wait by priority, then in arrival order. Before
+// every pass a running job is given its priority's share of cores, cores * p / sum of p
+// over the running jobs and at least 1 (camera::pass_threads). A lone job gets every core,
+// and a job arriving during a long render takes its share from the long render's next pass.
+
+class render_job {
+    public:
+        int id = 0;
+        string scene_path;
+        string output_path;
+        int priority = 1;
+        // 0 keeps the scene file's
+        int width = 0;
+        int spp = 0;
+        int depth = 0;
+        uint64_t seed = 0;
+};
+
+class job_result {
+    public:
+        bool done = false;
+        bool ok = false;
+        double ms = 0;
+        string error;
+};
+
+class render_daemon {
+    public:
+        int cores;
+        size_t scene_cache_size = 16;
+
+        render_daemon(int cores = 0) : cores(cores > 0 ? cores : default_thread_count()) {
+            dispatcher = thread([this](){ dispatch(); });
+        }
+
+        ~render_daemon(){
+            stop();
+            unique_lock<mutex> lock (m);
+            changed.wait(lock, [&](){ return sessions == 0; });
+            lock.unlock();
+            dispatcher.join();
+        }
+
+        // Queues job and returns its id
+        int submit(render_job job){
+            lock_guard<mutex> lock (m);
+            job.id = next_id++;
+            job.priority = max(1, job.priority);
+            queue.push_back(job);
+            results[job.id] = job_result();
+            changed.notify_all();
+            return job.id;
+        }
+
+        // Blocks until job id has ended. Results are handed out once
+        job_result wait(int id){
+            unique_lock<mutex> lock (m);
+            changed.wait(lock, [&](){ return !results.count(id) || results[id].done; });
+            if(!results.count(id)){
+                job_result unknown;
+                unknown.done = true;
+                unknown.error = "unknown job";
+                return unknown;
+            }
+            job_result r = results[id];
+            results.erase(id);
+            return r;
+        }
+
+        // Threads job id gets for its next pass, 0 when it is not running
+        int share(int id){
+            lock_guard<mutex> lock (m);
+            if(!running.count(id))return 0;
+            int total = 0;
+            for(auto& r : running)total += r.second;
+            return max(1, cores * running[id] / total);
+        }
+
+        string status(){
+            // The cache counters belong to cache_mutex, taken on its own so the locks never nest
+            string cache_counts;
+            {
+                lock_guard<mutex> lock (cache_mutex);
+                cache_counts = to_string(cache_hits) + "/" + to_string(cache_misses);
+            }
+            lock_guard<mutex> lock (m);
+            return "queued " + to_string(queue.size()) + " running " + to_string(running.size()) + " done " + to_string(jobs_done)
+                   + " cache " + cache_counts;
+        }
+
+        // One command line, reply is the answer. False for quit and lines that are not understood
+        bool command(const string& line, string& reply){
+            istringstream in (line);
+            string name;
+            in >> name;
+            if(name == "quit"){
+                stop();
+                reply = "bye";
+                return false;
+            }
+            if(name == "status"){
+                reply = status();
+                return true;
+            }
+            int id;
+            if(name == "wait" && in >> id){
+                job_result r = wait(id);
+                reply = r.ok ? "done " + to_string(id) + " " + to_string(r.ms) : "failed " + to_string(id) + " " + r.error;
+                return true;
+            }
+            if(name == "render"){
+                render_job job;
+                string word;
+                bool ok = true;
+                while(ok && in >> word){
+                    size_t eq = word.find('=');
+                    if(eq == string::npos){
+                        ok = false;
+                        break;
+                    }
+                    string key = word.substr(0, eq), value = word.substr(eq + 1);
+                    try {
+                        if(key == "scene")job.scene_path = value;
+                        else if(key == "out")job.output_path = value;
+                        else if(key == "priority")job.priority = stoi(value);
+                        else if(key == "width")job.width = stoi(value);
+                        else if(key == "spp")job.spp = stoi(value);
+                        else if(key == "depth")job.depth = stoi(value);
+                        else if(key == "seed")job.seed = stoull(value);
+                        else ok = false;
+                    }
+                    catch(const exception&){
+                        ok = false;
+                    }
+                }
+                if(ok && !job.scene_path.empty() && !job.output_path.empty()){
+                    reply = "queued " + to_string(submit(job));
+                    return true;
+                }
+            }
+            reply = "error " + line;
+            return false;
+        }
+
+        // Ends after the running jobs, queued jobs fail
+        void stop(){
+            unique_lock<mutex> lock (m);
+            stopping = true;
+            for(auto& job : queue){
+                results[job.id].done = true;
+                results[job.id].error = "daemon stopped";
+            }
+            queue.clear();
+            changed.notify_all();
+            changed.wait(lock, [&](){ return running.empty(); });
+        }
+
+        bool stopped() const { return stopping; }
+
+        // Serves clients on the socket at path until quit or stop(), then waits for the
+        // sessions to end. Each client gets a detached thread that ends with its connection
+        bool serve(const string& path){
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd < 0)return false;
+            sockaddr_un addr {};
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            unlink(path.c_str());
+            if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0){
+                close(fd);
+                return false;
+            }
+
+            while(!stopping){
+                pollfd p {fd, POLLIN, 0};
+                if(poll(&p, 1, 100) <= 0)continue;
+                int client = accept(fd, nullptr, nullptr);
+                if(client < 0)continue;
+                {
+                    lock_guard<mutex> lock (m);
+                    sessions++;
+                }
+                thread([this, client](){
+                    session(client);
+                    close(client);
+                    lock_guard<mutex> lock (m);
+                    sessions--;
+                    changed.notify_all();
+                }).detach();
+            }
+
+            unique_lock<mutex> lock (m);
+            changed.wait(lock, [&](){ return sessions == 0; });
+            lock.unlock();
+            close(fd);
+            unlink(path.c_str());
+            return true;
+        }
+
+    private:
+        // A parsed scene, or why it could not be
+        class loaded_scene {
+            public:
+                shared_ptr<const scene_description> scene;
+                string error;
+        };
+
+        class cache_entry {
+            public:
+                int64_t modified;
+                shared_future<loaded_scene> scene;
+                uint64_t used;
+        };
+
+        mutex m;
+        condition_variable changed;
+        thread dispatcher;
+        vector<render_job> queue;
+        map<int, int> running;          // id, priority
+        map<int, job_result> results;
+        int next_id = 1;
+        int jobs_done = 0;
+        int sessions = 0;               // connected clients
+        atomic<bool> stopping {false};
+
+        mutex cache_mutex;
+        map<string, cache_entry> cache;
+        uint64_t cache_clock = 0;
+        int cache_hits = 0;
+        int cache_misses = 0;
+
+        // Starts queued jobs while fewer than cores run
+        void dispatch(){
+            unique_lock<mutex> lock (m);
+            for(;;){
+                changed.wait(lock, [&](){ return stopping || (!queue.empty() && (int)running.size() < cores); });
+                if(stopping)return;
+
+                auto next = queue.begin();
+                for(auto j = queue.begin(); j != queue.end(); j++)
+                    if(j->priority > next->priority)next = j;
+                render_job job = *next;
+                queue.erase(next);
+                running[job.id] = job.priority;
+                thread([this, job](){ run(job); }).detach();
+            }
+        }
+
+        void run(const render_job& job){
+            auto start = std::chrono::high_resolution_clock::now();
+            job_result result;
+            loaded_scene loaded = scene(job.scene_path);
+            if(!loaded.scene)result.error = loaded.error;
+            else {
+                const scene_description& s = *loaded.scene;
+                camera cam;
+                cam.screen_width = job.width > 0 ? job.width : s.width;
+                cam.aspect_ratio = s.aspect;
+                cam.max_depth = job.depth > 0 ? job.depth : s.depth;
+                cam.iterations = job.spp > 0 ? job.spp : s.spp;
+                cam.lookfrom = s.lookfrom;
+                cam.lookat = s.lookat;
+                cam.vup = s.vup;
+                cam.seed = job.seed;
+                cam.verbose = false;
+                cam.output_path = job.output_path;
+                cam.pass_threads = [this, id = job.id](){ return share(id); };
+                result.ok = cam.render(s.world, s.lights);
+                if(!result.ok)result.error = "cannot write " + job.output_path;
+            }
+            result.done = true;
+            result.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+            lock_guard<mutex> lock (m);
+            running.erase(job.id);
+            results[job.id] = result;
+            jobs_done++;
+            changed.notify_all();
+        }
+
+        // The cached scene at path, parsed by the first job that asks while later ones wait for it
+        loaded_scene scene(const string& path){
+            // Nanoseconds, so an edit within the same second is seen
+            struct stat info;
+            int64_t modified = stat(path.c_str(), &info) == 0 ? int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec : 0;
+
+            promise<loaded_scene> parsed;
+            shared_future<loaded_scene> pending;
+            {
+                lock_guard<mutex> lock (cache_mutex);
+                auto found = cache.find(path);
+                if(found != cache.end() && found->second.modified == modified){
+                    cache_hits++;
+                    found->second.used = ++cache_clock;
+                    pending = found->second.scene;
+                }
+                else {
+                    cache_misses++;
+                    cache[path] = cache_entry{modified, parsed.get_future().share(), ++cache_clock};
+                    // Least recently used out first, running jobs keep theirs alive
+                    while(cache.size() > scene_cache_size){
+                        auto oldest = cache.begin();
+                        for(auto e = cache.begin(); e != cache.end(); e++)
+                            if(e->second.used < oldest->second.used)oldest = e;
+                        cache.erase(oldest);
+                    }
+                }
+            }
+            if(pending.valid())return pending.get();
+
+            loaded_scene result;
+            auto s = make_shared<scene_description>();
+            if(load_scene(path, *s, result.error))result.scene = s;
+            parsed.set_value(result);
+
+            // Failed parses are not kept, the next job reads the file again
+            if(!result.scene){
+                lock_guard<mutex> lock (cache_mutex);
+                auto found = cache.find(path);
+                if(found != cache.end() && found->second.modified == modified)cache.erase(found);
+            }
+            return result;
+        }
+
+        void session(int client){
+            string line;
+            char c;
+            while(!stopping){
+                pollfd p {client, POLLIN, 0};
+                if(poll(&p, 1, 100) <= 0)continue;
+                if(recv(client, &c, 1, 0) != 1)break;
+                if(c != '\n'){
+                    line += c;
+                    continue;
+                }
+                string reply;
+                bool more = command(line, reply);
+                reply += "\n";
+                if(!send_all(client, reply.data(), reply.size()))break;
+                line.clear();
+                if(!more && stopping)break;
+            }
+        }
+};
+
+// Minimal client, for tools and tests
+class daemon_client {
+    public:
+        ~daemon_client(){ if(fd >= 0)close(fd); }
+
+        bool connect_to(const string& path){
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd < 0)return false;
+            sockaddr_un addr {};
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            return connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        }
+
+        // Sends one command and returns the reply line, empty when the connection is gone
+        string request(const string& line){
+            string l = line + "\n";
+            if(!send_all(fd, l.data(), l.size()))return "";
+            string reply;
+            char c;
+            while(recv(fd, &c, 1, 0) == 1){
+                if(c == '\n')return reply;
+                reply += c;
+            }
+            return "";
+        }
+
+    private:
+        int fd = -1;
+};
+
+#endif
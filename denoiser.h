@@ -0,0 +1,145 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "vec3.h"
+#include "aov.h"
+#include "parallel.h"
+#include "fastmath.h"
+
+#include <vector>
+#include <cmath>
+#include <immintrin.h>
+
+using namespace std;
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) with SVGF style albedo
+// demodulation. Each pass is a 5x5 B3 spline kernel with holes of 2^pass pixels, taps
+// are weighted down across normal, depth and color edges.
+class denoiser {
+    public:
+        int passes = 5;
+        float sigma_color = 8.0f;   // color distance scale of the first pass, halved every pass
+        float sigma_depth = 0.02f;  // depth difference relative to the center depth
+        int normal_power = 64;      // exponent on the normal dot product, a power of two
+        int threads = 0;
+
+        // beauty is linear color per pixel, indexed like the AOV buffer.
+        // f needs resolved albedo, normal and depth layers. No passes leaves beauty as it is
+        vector<color> run(const vector<color>& beauty, const aov_buffer& f) const {
+            if(passes < 1)return beauty;
+            const int pad = 2 << (passes - 1);
+            const int w = f.width + 2 * pad;
+            const int h = f.height + 2 * pad;
+
+            // Padded float planes, padding has valid = 0 so the inner loop needs no bounds checks
+            vector<float> r (w * h), g (w * h), b (w * h);
+            vector<float> nx (w * h), ny (w * h), nz (w * h), z (w * h), valid (w * h);
+
+            for(int j = 0; j < f.height; j++){
+                for(int i = 0; i < f.width; i++){
+                    int p = j * f.width + i;
+                    int q = (j + pad) * w + i + pad;
+                    color a = f.albedo[p];
+
+                    // Filter irradiance, texture and albedo detail is put back at the end
+                    r[q] = beauty[p].e[0] / fmax(a.e[0], 0.001);
+                    g[q] = beauty[p].e[1] / fmax(a.e[1], 0.001);
+                    b[q] = beauty[p].e[2] / fmax(a.e[2], 0.001);
+                    nx[q] = f.normal[p].e[0];
+                    ny[q] = f.normal[p].e[1];
+                    nz[q] = f.normal[p].e[2];
+                    z[q] = f.depth[p];
+                    valid[q] = 1.0f;
+                }
+            }
+
+            vector<float> r2 (r), g2 (g), b2 (b);
+            for(int pass = 0; pass < passes; pass++){
+                int step = 1 << pass;
+                float sigma = sigma_color / step;
+                float inv_color = 1.0f / (sigma * sigma);
+                float inv_depth = 1.0f / (sigma_depth * step);
+
+                parallel_for(f.height, [&](int j){
+                    filter_row(j + pad, pad, f.width, w, step, inv_color, inv_depth,
+                        r.data(), g.data(), b.data(), nx.data(), ny.data(), nz.data(), z.data(), valid.data(),
+                        r2.data(), g2.data(), b2.data());
+                }, threads);
+
+                swap(r, r2);
+                swap(g, g2);
+                swap(b, b2);
+            }
+
+            vector<color> out (f.width * f.height);
+            for(int j = 0; j < f.height; j++){
+                for(int i = 0; i < f.width; i++){
+                    int p = j * f.width + i;
+                    int q = (j + pad) * w + i + pad;
+                    color a = f.albedo[p];
+                    out[p] = color(r[q] * fmax(a.e[0], 0.001), g[q] * fmax(a.e[1], 0.001), b[q] * fmax(a.e[2], 0.001));
+                }
+            }
+            return out;
+        }
+
+    private:
+        // One row of one pass, 4 pixels at a time, columns [x0, x0 + count) of row y
+        void filter_row(int y, int x0, int count, int w, int step, float inv_color, float inv_depth,
+                        const float* r, const float* g, const float* b,
+                        const float* nx, const float* ny, const float* nz, const float* z, const float* valid,
+                        float* out_r, float* out_g, float* out_b) const {
+            static const float kernel[5] = {1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16};
+
+            for(int x = x0; x < x0 + count; x += 4){
+                // The last group may run into the right padding, those lanes are never read back
+                const int c = y * w + x;
+                const __m128 cr = _mm_loadu_ps(r + c), cg = _mm_loadu_ps(g + c), cb = _mm_loadu_ps(b + c);
+                const __m128 cnx = _mm_loadu_ps(nx + c), cny = _mm_loadu_ps(ny + c), cnz = _mm_loadu_ps(nz + c);
+                const __m128 cz = _mm_loadu_ps(z + c);
+                const __m128 depth_scale = _mm_div_ps(_mm_set1_ps(inv_depth), _mm_max_ps(cz, _mm_set1_ps(1e-4f)));
+
+                __m128 acc_r = _mm_setzero_ps(), acc_g = _mm_setzero_ps(), acc_b = _mm_setzero_ps();
+                __m128 wsum = _mm_setzero_ps();
+
+                for(int dy = -2; dy <= 2; dy++){
+                    for(int dx = -2; dx <= 2; dx++){
+                        const int q = c + dy * step * w + dx * step;
+                        const __m128 qr = _mm_loadu_ps(r + q), qg = _mm_loadu_ps(g + q), qb = _mm_loadu_ps(b + q);
+
+                        // Normal weight max(0, n.m)^normal_power by repeated squaring
+                        __m128 wn = _mm_add_ps(_mm_add_ps(
+                            _mm_mul_ps(cnx, _mm_loadu_ps(nx + q)),
+                            _mm_mul_ps(cny, _mm_loadu_ps(ny + q))),
+                            _mm_mul_ps(cnz, _mm_loadu_ps(nz + q)));
+                        wn = _mm_max_ps(wn, _mm_setzero_ps());
+                        for(int k = 1; k < normal_power; k *= 2)wn = _mm_mul_ps(wn, wn);
+
+                        // Depth and color weights share one exp
+                        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+                        const __m128 dz = _mm_and_ps(_mm_sub_ps(cz, _mm_loadu_ps(z + q)), abs_mask);
+                        const __m128 er = _mm_sub_ps(cr, qr), eg = _mm_sub_ps(cg, qg), eb = _mm_sub_ps(cb, qb);
+                        const __m128 dc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(er, er), _mm_mul_ps(eg, eg)), _mm_mul_ps(eb, eb));
+                        const __m128 e = _mm_add_ps(_mm_mul_ps(dz, depth_scale), _mm_mul_ps(dc, _mm_set1_ps(inv_color)));
+
+                        __m128 wgt = _mm_mul_ps(_mm_mul_ps(wn, math_exp4(_mm_xor_ps(e, _mm_set1_ps(-0.0f)))), _mm_loadu_ps(valid + q));
+                        wgt = _mm_mul_ps(wgt, _mm_set1_ps(kernel[dx + 2] * kernel[dy + 2]));
+
+                        acc_r = _mm_add_ps(acc_r, _mm_mul_ps(wgt, qr));
+                        acc_g = _mm_add_ps(acc_g, _mm_mul_ps(wgt, qg));
+                        acc_b = _mm_add_ps(acc_b, _mm_mul_ps(wgt, qb));
+                        wsum = _mm_add_ps(wsum, wgt);
+                    }
+                }
+
+                // Pixels without any usable neighbour (missed rays) keep their value
+                const __m128 has_weight = _mm_cmpgt_ps(wsum, _mm_set1_ps(1e-8f));
+                const __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(wsum, _mm_set1_ps(1e-8f)));
+                _mm_storeu_ps(out_r + c, _mm_blendv_ps(cr, _mm_mul_ps(acc_r, inv), has_weight));
+                _mm_storeu_ps(out_g + c, _mm_blendv_ps(cg, _mm_mul_ps(acc_g, inv), has_weight));
+                _mm_storeu_ps(out_b + c, _mm_blendv_ps(cb, _mm_mul_ps(acc_b, inv), has_weight));
+            }
+        }
+};
+
+#endif
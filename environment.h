@@ -0,0 +1,236 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "vec3.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Reads a PFM (PF, color) into rgb, top row first
+bool read_pfm(const string& path, int& width, int& height, vector<float>& rgb){
+    ifstream in (path, ios::binary);
+    if(!in)return false;
+
+    string magic;
+    double scale;
+    in >> magic >> width >> height >> scale;
+    if(!in || magic != "PF" || width <= 0 || height <= 0)return false;
+    in.get();
+
+    rgb.resize((size_t)width * height * 3);
+    // PFM stores the bottom row first, the sign of scale gives the byte order
+    for(int y = height - 1; y >= 0; y--)
+        in.read((char*)&rgb[(size_t)y * width * 3], (size_t)width * 3 * sizeof(float));
+    if(!in)return false;
+
+    if(scale > 0){
+        for(auto& f : rgb){
+            uint32_t bits;
+            memcpy(&bits, &f, 4);
+            bits = __builtin_bswap32(bits);
+            memcpy(&f, &bits, 4);
+        }
+    }
+    return true;
+}
+
+// Reads a Radiance RGBE file (.hdr) with -Y h +X w orientation, flat or run length encoded
+bool read_hdr(const string& path, int& width, int& height, vector<float>& rgb){
+    ifstream in (path, ios::binary);
+    if(!in)return false;
+
+    string line;
+    getline(in, line);
+    if(line.rfind("#?", 0) != 0)return false;
+    // Header lines end with an empty line
+    while(getline(in, line) && !line.empty()){
+        if(line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")return false;
+    }
+    getline(in, line);
+    char ya[3], xa[3];
+    if(sscanf(line.c_str(), "%2s %d %2s %d", ya, &height, xa, &width) != 4
+        || strcmp(ya, "-Y") != 0 || strcmp(xa, "+X") != 0)return false;
+
+    rgb.resize((size_t)width * height * 3);
+    vector<uint8_t> scan ((size_t)width * 4);
+    for(int y = 0; y < height; y++){
+        uint8_t head[4];
+        if(!in.read((char*)head, 4))return false;
+
+        if(width >= 8 && width < 32768 && head[0] == 2 && head[1] == 2 && ((head[2] << 8) | head[3]) == width){
+            // New RLE: the four components one after another, each as runs and literals
+            for(int c = 0; c < 4; c++){
+                int x = 0;
+                while(x < width){
+                    int count = in.get();
+                    if(count > 128){
+                        count -= 128;
+                        int value = in.get();
+                        if(x + count > width)return false;
+                        for(int k = 0; k < count; k++)scan[(x++) * 4 + c] = value;
+                    }
+                    else {
+                        if(count == 0 || x + count > width)return false;
+                        for(int k = 0; k < count; k++)scan[(x++) * 4 + c] = in.get();
+                    }
+                }
+            }
+        }
+        else {
+            memcpy(scan.data(), head, 4);
+            in.read((char*)scan.data() + 4, (size_t)(width - 1) * 4);
+        }
+        if(!in)return false;
+
+        for(int x = 0; x < width; x++){
+            const uint8_t* e = &scan[x * 4];
+            float f = e[3] ? ldexp(1.0f, e[3] - 136) : 0.0f;
+            for(int c = 0; c < 3; c++)
+                rgb[((size_t)y * width + x) * 3 + c] = (e[c] + 0.5f) * f;
+        }
+    }
+    return true;
+}
+
+// Multiple importance sampling weight of a strategy with density a against one with density b
+double power_heuristic(double a, double b){
+    double a2 = a * a;
+    double b2 = b * b;
+    return a2 + b2 > 0 ? a2 / (a2 + b2) : 0;
+}
+
+// Equirectangular HDR sky. Directions map like sphere uv: u goes around the y axis, row 0
+// is straight up. Importance sampling picks a row from the marginal CDF and then a column
+// from that row's CDF, both weighted by luminance times sin(theta) so the solid angle
+// density follows the radiance.
+class environment_map {
+    public:
+        double intensity = 1.0;
+
+        // Constant sky, mostly for testing
+        environment_map(const color& c) : width(1), height(1), texels{float(c.e[0]), float(c.e[1]), float(c.e[2])} {
+            build_distribution();
+        }
+
+        // .pfm or .hdr, on failure the sky is black and valid() is false
+        environment_map(const string& path){
+            bool ok = false;
+            if(path.size() > 4 && path.compare(path.size() - 4, 4, ".pfm") == 0)
+                ok = read_pfm(path, width, height, texels);
+            else
+                ok = read_hdr(path, width, height, texels);
+
+            if(!ok){
+                cerr << "Could not load environment " << path << "\n";
+                width = height = 1;
+                texels.assign(3, 0.0f);
+                loaded = false;
+            }
+            build_distribution();
+        }
+
+        bool valid() const { return loaded; }
+
+        color eval(const vec3& dir) const {
+            double u, v;
+            direction_to_uv(dir, u, v);
+            int x = min(int(u * width), width - 1);
+            int y = min(int(v * height), height - 1);
+            const float* t = &texels[((size_t)y * width + x) * 3];
+            return intensity * color(t[0], t[1], t[2]);
+        }
+
+        // Direction with density pdf per steradian, from two uniform numbers
+        vec3 sample(double u1, double u2, double& pdf) const {
+            int y = upper_bound(marginal.begin(), marginal.end(), u1 * total) - marginal.begin();
+            y = min(y, height - 1);
+            const double* row = &conditional[(size_t)y * width];
+            double row_sum = row[width - 1];
+            int x = upper_bound(row, row + width, u2 * row_sum) - row;
+            x = min(x, width - 1);
+
+            // Uniform inside the texel
+            double row_start = y > 0 ? marginal[y - 1] : 0;
+            double col_start = x > 0 ? row[x - 1] : 0;
+            double fy = (u1 * total - row_start) / (marginal[y] - row_start);
+            double fx = (u2 * row_sum - col_start) / (row[x] - col_start);
+            double u = (x + fmin(fmax(fx, 0.0), 0.999999)) / width;
+            double v = (y + fmin(fmax(fy, 0.0), 0.999999)) / height;
+
+            vec3 dir = uv_to_direction(u, v);
+            pdf = texel_pdf(x, y, v);
+            return dir;
+        }
+
+        double pdf(const vec3& dir) const {
+            double u, v;
+            direction_to_uv(dir, u, v);
+            int x = min(int(u * width), width - 1);
+            int y = min(int(v * height), height - 1);
+            return texel_pdf(x, y, v);
+        }
+
+    private:
+        int width = 0;
+        int height = 0;
+        bool loaded = true;
+        vector<float> texels;
+
+        // Running sums, conditional per row over columns and marginal over row totals
+        vector<double> conditional;
+        vector<double> marginal;
+        double total = 0;
+
+        static void direction_to_uv(const vec3& dir, double& u, double& v){
+            vec3 d = unit_vector(dir);
+            u = (atan2(-d.e[2], d.e[0]) + pi) / (2 * pi);
+            v = acos(fmin(fmax(d.e[1], -1.0), 1.0)) / pi;
+        }
+
+        static vec3 uv_to_direction(double u, double v){
+            double phi = 2 * pi * u - pi;
+            double theta = pi * v;
+            return vec3(sin(theta) * cos(phi), cos(theta), -sin(theta) * sin(phi));
+        }
+
+        double weight(int x, int y) const {
+            const float* t = &texels[((size_t)y * width + x) * 3];
+            double luminance = 0.2126 * t[0] + 0.7152 * t[1] + 0.0722 * t[2];
+            double sin_theta = sin(pi * (y + 0.5) / height);
+            // A small floor keeps every direction reachable
+            return (luminance + 1e-4) * sin_theta;
+        }
+
+        void build_distribution(){
+            conditional.resize((size_t)width * height);
+            marginal.resize(height);
+            total = 0;
+            for(int y = 0; y < height; y++){
+                double sum = 0;
+                for(int x = 0; x < width; x++){
+                    sum += weight(x, y);
+                    conditional[(size_t)y * width + x] = sum;
+                }
+                total += sum;
+                marginal[y] = total;
+            }
+        }
+
+        // Discrete probability of the texel spread over its solid angle
+        double texel_pdf(int x, int y, double v) const {
+            double p = weight(x, y) / total;
+            double sin_theta = sin(pi * v);
+            if(sin_theta <= 0)return 0;
+            return p * width * height / (2 * pi * pi * sin_theta);
+        }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <cmath>
+#include <immintrin.h>
+
+using namespace std;
+
+// Float math for the hot path in three accuracy tiers. The tier is fixed per build with
+// -DRT_MATH=<tier>, the fast tier when it is not given:
+//
+//   RT_MATH_EXACT  (0)  sqrt and division instructions, expf, logf and powf per lane
+//   RT_MATH_FAST   (1)  rsqrt and rcp estimates with one Newton step, degree 5 exp2 and
+//                       degree 7 log2 polynomials
+//   RT_MATH_APPROX (2)  raw 12 bit rsqrt and rcp estimates, degree 3 exp2 and degree 4 log2
+//
+// Worst relative error measured by test_fastmath, over x in 2^-60 to 2^60 for rsqrt, rcp
+// and log, x in [-80, 80] for exp, and |y log(x)| up to 80 for pow. The log error is
+// relative to max(1, |log(x)|):
+//
+//              rsqrt      rcp        log        exp        pow
+//   exact      9e-8       6e-8       6e-8       6e-8       6e-8
+//   fast       2.2e-7     1.7e-7     1.6e-7     2.4e-7     1.5e-5
+//   approx     3.3e-4     3.0e-4     1.7e-5     7.5e-5     1.3e-3
+//
+// pow outside the exact tier is exp(y log(x)) in float, rounding y log(x) alone costs
+// |y log(x)| * 6e-8, so its error is a few 1e-7 for the small exponents of shading and
+// grows to the above towards overflow. rsqrt(0) and rcp(0) are inf in every tier, exp
+// clamps to [-87, 88] instead of going denormal or inf, log and pow are only meant for
+// x > 0 (pow(0, y) is 0). The approx tier puts 3e-4 relative error on anything divided
+// by rcp, for a ray hit at t = 10 that is a few times the 0.001 self intersection bias,
+// so hit distances use math_rcp_t, which keeps the Newton step in every tier.
+//
+// The __m128 functions with a tier template argument exist so test_fastmath can compare
+// tiers in one binary, the renderer calls the math_ ones of the build tier.
+
+#define RT_MATH_EXACT 0
+#define RT_MATH_FAST 1
+#define RT_MATH_APPROX 2
+
+#ifndef RT_MATH
+#define RT_MATH RT_MATH_FAST
+#endif
+
+template <int tier>
+__m128 rsqrt4(__m128 x){
+    if constexpr (tier == RT_MATH_EXACT){
+        return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(x));
+    }
+    else {
+        const __m128 y = _mm_rsqrt_ps(x);
+        if constexpr (tier == RT_MATH_APPROX)return y;
+        // y (1.5 - 0.5 x y^2), kept at inf for x = 0 where the step would give nan
+        const __m128 step = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), x), _mm_mul_ps(y, y))));
+        return _mm_blendv_ps(step, y, _mm_cmpeq_ps(x, _mm_setzero_ps()));
+    }
+}
+
+template <int tier>
+__m128 rcp4(__m128 x){
+    if constexpr (tier == RT_MATH_EXACT){
+        return _mm_div_ps(_mm_set1_ps(1.0f), x);
+    }
+    else {
+        const __m128 y = _mm_rcp_ps(x);
+        if constexpr (tier == RT_MATH_APPROX)return y;
+        // y (2 - x y)
+        const __m128 step = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(2.0f), _mm_mul_ps(x, y)));
+        return _mm_blendv_ps(step, y, _mm_cmpeq_ps(x, _mm_setzero_ps()));
+    }
+}
+
+template <int tier>
+__m128 exp4(__m128 x){
+    if constexpr (tier == RT_MATH_EXACT){
+        alignas(16) float v[4];
+        _mm_store_ps(v, x);
+        for(int k = 0; k < 4; k++)v[k] = expf(v[k]);
+        return _mm_load_ps(v);
+    }
+    else {
+        // 2^(n + f) with n the nearest integer to x / ln 2 and f in [-0.5, 0.5]. The remainder
+        // is taken from x with ln 2 split in two (Cody and Waite), n ln2_hi is exact in float,
+        // so f keeps its precision for large x
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+        const __m128 n = _mm_round_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+        r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+        const __m128 f = _mm_mul_ps(r, _mm_set1_ps(1.44269504f));
+
+        __m128 p;
+        if constexpr (tier == RT_MATH_FAST){
+            p = _mm_set1_ps(1.3276470e-3f);
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6755419e-3f));
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5507135e-2f));
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022120e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314694e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0000001f));
+        }
+        else {
+            p = _mm_set1_ps(5.5171657e-2f);
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4261114e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9326097e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.9992806e-1f));
+        }
+
+        // 2^n built in the exponent bits, n = -127 would be a denormal so the clamp above
+        // stops at -87 (2^-125.5)
+        const __m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+        return _mm_mul_ps(p, _mm_castsi128_ps(e));
+    }
+}
+
+template <int tier>
+__m128 log4(__m128 x){
+    if constexpr (tier == RT_MATH_EXACT){
+        alignas(16) float v[4];
+        _mm_store_ps(v, x);
+        for(int k = 0; k < 4; k++)v[k] = logf(v[k]);
+        return _mm_load_ps(v);
+    }
+    else {
+        // x = 2^e m with m in [sqrt(0.5), sqrt(2)), log2(m) = (m - 1) p(m - 1)
+        const __m128i bits = _mm_castps_si128(x);
+        __m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+        __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+        const __m128 big = _mm_cmpge_ps(m, _mm_set1_ps(1.41421356f));
+        m = _mm_blendv_ps(m, _mm_mul_ps(m, _mm_set1_ps(0.5f)), big);
+        e = _mm_sub_epi32(e, _mm_castps_si128(big));    // the mask is -1 where m was halved
+        const __m128 t = _mm_sub_ps(m, _mm_set1_ps(1.0f));
+
+        __m128 p;
+        if constexpr (tier == RT_MATH_FAST){
+            p = _mm_set1_ps(-1.4581117e-1f);
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(2.3404227e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-2.4887699e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(2.8709871e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-3.6023962e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(4.8092324e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-7.2135282e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.4426949f));
+        }
+        else {
+            p = _mm_set1_ps(2.5475106e-1f);
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-3.9089245e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(4.8530665e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-7.2055495e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.4426463f));
+        }
+
+        const __m128 log2 = _mm_add_ps(_mm_cvtepi32_ps(e), _mm_mul_ps(t, p));
+        return _mm_mul_ps(log2, _mm_set1_ps(0.69314718f));
+    }
+}
+
+// x^y for x > 0, and 0 for x = 0 and y > 0
+template <int tier>
+__m128 pow4(__m128 x, __m128 y){
+    if constexpr (tier == RT_MATH_EXACT){
+        alignas(16) float a[4], b[4];
+        _mm_store_ps(a, x);
+        _mm_store_ps(b, y);
+        for(int k = 0; k < 4; k++)a[k] = powf(a[k], b[k]);
+        return _mm_load_ps(a);
+    }
+    const __m128 r = exp4<tier>(_mm_mul_ps(y, log4<tier>(x)));
+    return _mm_andnot_ps(_mm_cmpeq_ps(x, _mm_setzero_ps()), r);
+}
+
+#ifdef __AVX__
+template <int tier>
+__m256 rsqrt8(__m256 x){
+    if constexpr (tier == RT_MATH_EXACT){
+        return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(x));
+    }
+    else {
+        const __m256 y = _mm256_rsqrt_ps(x);
+        if constexpr (tier == RT_MATH_APPROX)return y;
+        const __m256 step = _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), x), _mm256_mul_ps(y, y))));
+        return _mm256_blendv_ps(step, y, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ));
+    }
+}
+
+__m256 math_rsqrt8(__m256 x){ return rsqrt8<RT_MATH>(x); }
+#endif
+
+__m128 math_rsqrt4(__m128 x){ return rsqrt4<RT_MATH>(x); }
+__m128 math_rcp4(__m128 x){ return rcp4<RT_MATH>(x); }
+__m128 math_exp4(__m128 x){ return exp4<RT_MATH>(x); }
+__m128 math_log4(__m128 x){ return log4<RT_MATH>(x); }
+__m128 math_pow4(__m128 x, __m128 y){ return pow4<RT_MATH>(x, y); }
+
+// Scalar versions, lane 0 of the above
+float math_rsqrt(float x){ return _mm_cvtss_f32(math_rsqrt4(_mm_set_ss(x))); }
+float math_rcp(float x){ return _mm_cvtss_f32(math_rcp4(_mm_set_ss(x))); }
+
+// Reciprocal for ray distances, with the Newton step in the approx tier too. The raw
+// estimate would move a hit at t = 10 by a few times the 0.001 self intersection bias
+float math_rcp_t(float x){
+    return _mm_cvtss_f32(rcp4<RT_MATH == RT_MATH_APPROX ? RT_MATH_FAST : RT_MATH>(_mm_set_ss(x)));
+}
+
+float math_exp(float x){
+    if constexpr (RT_MATH == RT_MATH_EXACT)return expf(x);
+    return _mm_cvtss_f32(math_exp4(_mm_set1_ps(x)));
+}
+
+float math_log(float x){
+    if constexpr (RT_MATH == RT_MATH_EXACT)return logf(x);
+    return _mm_cvtss_f32(math_log4(_mm_set1_ps(x)));
+}
+
+float math_pow(float x, float y){
+    if constexpr (RT_MATH == RT_MATH_EXACT)return powf(x, y);
+    return _mm_cvtss_f32(math_pow4(_mm_set1_ps(x), _mm_set1_ps(y)));
+}
+
+// x^5 by multiplication, exact in every tier
+template <typename T>
+T pow5(T x){
+    T x2 = x * x;
+    return x2 * x2 * x;
+}
+
+#endif
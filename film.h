@@ -0,0 +1,106 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include "vec3.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// Accumulation target of a parallel render. Each pixel belongs to exactly one tile and a
+// tile is rendered by one thread at a time, so tiles are summed in per thread scratch and
+// committed without locks or atomics. Splats to arbitrary pixels (light tracing) are
+// appended to a list owned by the tile that produced them and merged in tile order after
+// the pass, which makes the result independent of the thread count and schedule.
+
+class tile {
+    public:
+        int index;
+        int x0, y0;
+        int x1, y1;     // exclusive
+
+        int width() const { return x1 - x0; }
+        int height() const { return y1 - y0; }
+};
+
+// Row major tiles of size x size pixels, the last row and column may be smaller
+vector<tile> make_tiles(int width, int height, int size){
+    vector<tile> tiles;
+    for(int y = 0; y < height; y += size)
+        for(int x = 0; x < width; x += size)
+            tiles.push_back(tile{int(tiles.size()), x, y, min(x + size, width), min(y + size, height)});
+    return tiles;
+}
+
+class splat_record {
+    public:
+        int pixel;
+        color value;
+};
+
+// Per thread scratch for the tile being rendered. Aligned to a cache line so neighbouring
+// accumulators in an array never share one
+class alignas(64) tile_accumulator {
+    public:
+        tile area;
+        vector<color> sum;
+        vector<splat_record>* splats = nullptr;
+        int film_width = 0;
+
+        void add(int i, int j, const color& c){
+            sum[(j - area.y0) * area.width() + (i - area.x0)] += c;
+        }
+
+        // Contribution to any pixel of the film, p = j * width + i
+        void splat(int i, int j, const color& c){
+            splats->push_back(splat_record{j * film_width + i, c});
+        }
+};
+
+class film {
+    public:
+        int width = 0;
+        int height = 0;
+        vector<color> pixels;       // sums, indexed j * width + i with row 0 at the bottom
+
+        void resize(int w, int h, int tile_count){
+            width = w;
+            height = h;
+            pixels.assign(w * h, color(0,0,0));
+            tile_splats.assign(tile_count, vector<splat_record>());
+        }
+
+        color& at(int i, int j){ return pixels[j * width + i]; }
+        const color& at(int i, int j) const { return pixels[j * width + i]; }
+
+        void begin(tile_accumulator& acc, const tile& t){
+            acc.area = t;
+            acc.sum.assign(t.width() * t.height(), color(0,0,0));
+            acc.splats = &tile_splats[t.index];
+            acc.film_width = width;
+        }
+
+        // Adds the tile into the film, only this tile's pixels are written
+        void commit(const tile_accumulator& acc){
+            const tile& t = acc.area;
+            for(int j = t.y0; j < t.y1; j++){
+                const color* src = &acc.sum[(j - t.y0) * t.width()];
+                color* dst = &pixels[j * width + t.x0];
+                for(int i = 0; i < t.width(); i++)dst[i] += src[i];
+            }
+        }
+
+        // Single threaded, after every tile of a pass is committed
+        void merge_splats(){
+            for(auto& list : tile_splats){
+                for(auto& s : list)pixels[s.pixel] += s.value;
+                list.clear();
+            }
+        }
+
+    private:
+        vector<vector<splat_record>> tile_splats;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+#include "vec3.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Online path guiding after Mueller et al., "Practical Path Guiding" (2017). A binary tree
+// over space, each leaf holding a distribution over the directions light arrives from at
+// points inside it. The directional part is a fixed equal area histogram instead of the
+// paper's quadtree. The camera trains it during the first passes of a render and then
+// samples a mix of it and the bsdf.
+//
+// Training is deterministic: paths append records to a list owned by their tile, and the
+// lists are folded into the tree in tile order between passes. The tree is only read while
+// a pass is running, so lookups and sampling need no locks.
+
+const int guide_resolution = 16;
+const int guide_bins = guide_resolution * guide_resolution;
+
+// Incident light estimate from one path vertex: luminance over the pdf of its direction
+class guide_record {
+    public:
+        uint32_t leaf;
+        uint16_t bin;
+        float value;
+};
+
+// Records list of the tile being rendered on this thread, nullptr outside training passes
+thread_local vector<guide_record>* active_guide_records = nullptr;
+
+// Cylindrical equal area map of unit directions: rows are z = cos(theta), columns phi
+int guide_bin(const vec3& d){
+    int row = int((d.e[2] + 1) * 0.5 * guide_resolution);
+    int col = int((atan2(d.e[1], d.e[0]) + pi) / (2 * pi) * guide_resolution);
+    return min(max(row, 0), guide_resolution - 1) * guide_resolution + min(max(col, 0), guide_resolution - 1);
+}
+
+// Direction at fractions (fx, fy) inside a bin
+vec3 guide_direction(int bin, double fx, double fy){
+    double z = (bin / guide_resolution + fy) * 2.0 / guide_resolution - 1;
+    double phi = (bin % guide_resolution + fx) * 2 * pi / guide_resolution - pi;
+    double r = sqrt(fmax(0.0, 1 - z * z));
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+class guide_leaf {
+    public:
+        aabb box;
+        int node;
+        double sum[guide_bins] = {};
+        double seen = 0;                // records folded in, halved on every split
+        uint32_t recent = 0;            // records of the last training pass
+        float cdf[guide_bins] = {};     // running sums of sum[] normalized to 1
+        bool usable = false;
+};
+
+class guide_node {
+    public:
+        int child = -1;     // first of two children, -1 for a leaf
+        int axis = 0;
+        double split = 0;
+        int leaf = 0;
+};
+
+class path_guide {
+    public:
+        uint32_t split_records = 4000;  // a leaf that gets more in one pass is halved
+        double min_records = 256;       // before a leaf's distribution is sampled
+        double fraction = 0.5;          // of the samples at a usable leaf drawn from the guide
+        size_t max_leaves = 1 << 15;
+
+        void reset(const aabb& bounds){
+            nodes.assign(1, guide_node());
+            leaves.assign(1, guide_leaf());
+            leaves[0].box = bounds;
+            leaves[0].node = 0;
+        }
+
+        bool empty() const { return leaves.empty(); }
+        size_t leaf_count() const { return leaves.size(); }
+
+        int leaf_at(const point3& p) const {
+            int n = 0;
+            while(nodes[n].child >= 0)
+                n = nodes[n].child + (p.e[nodes[n].axis] >= nodes[n].split);
+            return nodes[n].leaf;
+        }
+
+        bool usable(int leaf) const { return leaves[leaf].usable; }
+
+        // Density per steradian of sample() at a usable leaf
+        double pdf(int leaf, const vec3& dir) const {
+            const guide_leaf& l = leaves[leaf];
+            int b = guide_bin(dir);
+            double p = l.cdf[b] - (b > 0 ? l.cdf[b - 1] : 0);
+            return p * guide_bins / (4 * pi);
+        }
+
+        vec3 sample(int leaf, double u1, double u2) const {
+            const guide_leaf& l = leaves[leaf];
+            int b = upper_bound(l.cdf, l.cdf + guide_bins, float(u1)) - l.cdf;
+            b = min(b, guide_bins - 1);
+            // u1 rounded up to 1 lands past the end, step back to a bin with weight
+            while(b > 0 && l.cdf[b] == l.cdf[b - 1])b--;
+            double start = b > 0 ? l.cdf[b - 1] : 0;
+            double fx = (u1 - start) / (l.cdf[b] - start);
+            return guide_direction(b, fmin(fmax(fx, 0.0), 0.999999), u2);
+        }
+
+        // Light arriving along the unit direction dir, sampled with density pdf
+        void record(int leaf, const vec3& dir, const color& incoming, double pdf) const {
+            if(!active_guide_records || pdf <= 0)return;
+            double luminance = fabs(0.2126 * incoming.e[0] + 0.7152 * incoming.e[1] + 0.0722 * incoming.e[2]);
+            double value = luminance / pdf;
+            if(!std::isfinite(value))return;
+            active_guide_records->push_back(guide_record{uint32_t(leaf), uint16_t(guide_bin(dir)), float(value)});
+        }
+
+        // Folds one pass of records in, in list order, then splits the leaves that got many
+        // and rebuilds the distributions
+        void update(const vector<vector<guide_record>>& lists){
+            for(auto& l : leaves)l.recent = 0;
+            for(const auto& list : lists)
+                for(const auto& r : list){
+                    guide_leaf& l = leaves[r.leaf];
+                    l.sum[r.bin] += r.value;
+                    l.seen++;
+                    l.recent++;
+                }
+
+            size_t count = leaves.size();
+            for(size_t i = 0; i < count; i++)split(leaves[i].node);
+
+            for(auto& l : leaves){
+                double total = 0;
+                for(int b = 0; b < guide_bins; b++)total += l.sum[b];
+                l.usable = total > 0 && l.seen >= min_records;
+                if(!l.usable)continue;
+                double running = 0;
+                for(int b = 0; b < guide_bins; b++){
+                    running += l.sum[b];
+                    l.cdf[b] = float(running / total);
+                }
+                l.cdf[guide_bins - 1] = 1.0f;
+            }
+        }
+
+    private:
+        vector<guide_node> nodes;
+        vector<guide_leaf> leaves;
+
+        // Halves the leaf of node along the longest axis of its box, both children start
+        // with half of its histogram, until the parts are under split_records
+        void split(int node){
+            int li = nodes[node].leaf;
+            if(leaves[li].recent <= split_records || leaves.size() >= max_leaves)return;
+
+            guide_leaf half = leaves[li];
+            for(int b = 0; b < guide_bins; b++)half.sum[b] *= 0.5;
+            half.seen *= 0.5;
+            half.recent /= 2;
+            int axis = half.box.longest_axis();
+            double mid = half.box.centroid().e[axis];
+
+            int first = nodes.size();
+            nodes[node].child = first;
+            nodes[node].axis = axis;
+            nodes[node].split = mid;
+
+            guide_node a, b;
+            a.leaf = li;
+            b.leaf = leaves.size();
+            nodes.push_back(a);
+            nodes.push_back(b);
+
+            leaves[li] = half;
+            leaves[li].box.hi.e[axis] = mid;
+            leaves[li].node = first;
+            leaves.push_back(half);
+            leaves.back().box.lo.e[axis] = mid;
+            leaves.back().node = first + 1;
+
+            split(first);
+            split(first + 1);
+        }
+};
+
+#endif
@@ -3,10 +3,13 @@
 
 #include "vec3.h"
 #include "vec4.h"
+#include "ray.h"
 #include "ray4.h"
 #include "interval.h"
+#include "aabb.h"
 
 class material;
+class hittable;
 
 class hit_record {
     public:
@@ -16,6 +19,16 @@ class hit_record {
 
         shared_ptr<material> mat;
         bool front_face;
+        int object_id = -1;
+
+        // Surface coordinates and the ray cone width there in uv units, for textures. Only
+        // filled in for the closest hit of a query (hittable::surface_coords)
+        double u = 0;
+        double v = 0;
+        double footprint = 0;
+
+        // Primitive that was hit, null where there is no surface (media)
+        const hittable* object = nullptr;
 
         void set_face_normal(const ray& r, const vec3& outward_normal){
             front_face = dot(r.direction(), outward_normal) < 0;
@@ -32,17 +45,56 @@ class hit_record4 {
         shared_ptr<material> mat;
         bool front_face;
 
+        double u = 0;
+        double v = 0;
+        double footprint = 0;
+        const hittable* object = nullptr;
+
         void set_face_normal(const ray4& r, const vec4& outward_normal){
             front_face = dot(r.direction(), outward_normal) < 0;
             normal = front_face ? outward_normal : -1 * outward_normal;
         }
 };
 
+int next_object_id = 0;
+
 class hittable {
     public:
+        // Unique per object, reported in hit_record for the object id AOV
+        int object_id;
+
+        hittable() : object_id(next_object_id++) {};
+        virtual ~hittable() = default;
+
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
         virtual bool fast_hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
         virtual bool simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const = 0;
+
+        virtual aabb bounding_box() const = 0;
+
+        // Fills in u, v and footprint of a hit on this primitive. hit only records the
+        // object, so candidates that a closer hit replaces never pay for the surface
+        // coordinates. Call finish_hit once the closest hit is known
+        virtual void surface_coords(const ray& r, hit_record& rec) const {}
+        virtual void surface_coords4(const ray4& r4, hit_record4& rec4) const {}
+
+        // Fraction of light that gets through along r, media override it with a smooth estimate
+        virtual double transmittance(const ray& r, interval ray_t) const {
+            hit_record rec;
+            return hit(r, ray_t, rec) ? 0 : 1;
+        }
+
+        // Whether transmittance is just hit or not, so a shadow ray may stop at any hit.
+        // False for whatever overrides transmittance
+        virtual bool opaque() const { return true; }
 };
 
+void finish_hit(const ray& r, hit_record& rec){
+    if(rec.object)rec.object->surface_coords(r, rec);
+}
+
+void finish_hit(const ray4& r4, hit_record4& rec4){
+    if(rec4.object)rec4.object->surface_coords4(r4, rec4);
+}
+
 #endif
\ No newline at end of file
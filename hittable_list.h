@@ -4,6 +4,8 @@
 #include "vec3.h"
 #include "sphere.h"
 #include "hittable.h"
+#include "stats.h"
+#include "bvh.h"
 
 #include <vector>
 #include <cmath>
@@ -16,19 +18,73 @@ class hittable_list : public hittable {
 
         hittable_list() {};
 
-        void clear(){ objects.clear(); }
+        void clear(){ objects.clear(); accel_valid = false; }
 
-        void add(shared_ptr<hittable> object) { objects.push_back(object); }
+        void add(shared_ptr<hittable> object) { objects.push_back(object); accel_valid = false; }
+
+        // Replaces the linear scan in the hit functions until objects change again. Worth it
+        // from a few dozen objects up. Nodes go into the arena when one is given
+        void build_bvh(arena* a = nullptr, const bvh_build_options& options = bvh_build_options()){
+            accel.build(objects, a, options);
+            accel_valid = true;
+            translucent.clear();
+            for(const auto& object : objects)
+                if(!object->opaque())translucent.push_back(object.get());
+        }
+
+        const bvh4& bvh() const { return accel; }
+
+        // Same objects as other, with a copy of its BVH made by the calling thread
+        void replicate(const hittable_list& other){
+            objects = other.objects;
+            if(other.accel_valid)accel.copy_from(other.accel);
+            accel_valid = other.accel_valid;
+            translucent = other.translucent;
+        }
+
+        // After moving objects in place. hit falls back to the linear scan until build_bvh
+        void clear_bvh(){ accel_valid = false; }
+        bool has_bvh() const { return accel_valid; }
 
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
 
         virtual bool fast_hit(const ray& r, interval ray_t, hit_record& rec) const override;
         
         virtual bool simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const override;
+
+        virtual double transmittance(const ray& r, interval ray_t) const override;
+
+        // Its transmittance is not 0 or 1 once it holds media
+        virtual bool opaque() const override { return false; }
+
+        virtual aabb bounding_box() const override {
+            aabb box;
+            for(const auto& object : objects)box.expand(object->bounding_box());
+            return box;
+        }
+
+    private:
+        bvh4 accel;
+        bool accel_valid = false;
+        vector<hittable*> translucent;  // objects that are not opaque, left to transmittance
 };
 
+// Surface coordinates are filled in for the closest hit only, see hittable::surface_coords
 bool hittable_list::hit(const ray& r, interval ray_t, hit_record& rec) const {
+    if(accel_valid){
+        double t_max = ray_t.max;
+        bool found = accel.traverse(r.orig, r.dir, ray_t.min, t_max, [&](hittable* object, double& t_max){
+            if(!object->hit(r, interval(ray_t.min, t_max), rec))return false;
+            t_max = rec.t;
+            return true;
+        });
+        if(found)finish_hit(r, rec);
+        return found;
+    }
+
     bool hit_anything = false;
+    STAT_INC(list_queries);
+    STAT_ADD(list_objects, objects.size());
 
     for(const auto& object : objects){
         if(object->hit(r, ray_t, rec)) {
@@ -37,11 +93,25 @@ bool hittable_list::hit(const ray& r, interval ray_t, hit_record& rec) const {
         }
     }
 
+    if(hit_anything)finish_hit(r, rec);
     return hit_anything;
 }
 
 bool hittable_list::fast_hit(const ray& r, interval ray_t, hit_record& rec) const {
+    if(accel_valid){
+        double t_max = ray_t.max;
+        bool found = accel.traverse(r.orig, r.dir, ray_t.min, t_max, [&](hittable* object, double& t_max){
+            if(!object->fast_hit(r, interval(ray_t.min, t_max), rec))return false;
+            t_max = rec.t;
+            return true;
+        });
+        if(found)finish_hit(r, rec);
+        return found;
+    }
+
     bool hit_anything = false;
+    STAT_INC(list_queries);
+    STAT_ADD(list_objects, objects.size());
 
     for(const auto& object : objects){
         if(object->fast_hit(r, ray_t, rec)) {
@@ -50,10 +120,22 @@ bool hittable_list::fast_hit(const ray& r, interval ray_t, hit_record& rec) cons
         }
     }
 
+    if(hit_anything)finish_hit(r, rec);
     return hit_anything;
 }
 
 bool hittable_list::simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const {
+    if(accel_valid){
+        double t_max = ray_t.max;
+        bool found = accel.traverse(vec3(r4.orig), vec3(r4.dir), ray_t.min, t_max, [&](hittable* object, double& t_max){
+            if(!object->simd_hit(r4, interval(ray_t.min, t_max), rec4))return false;
+            t_max = rec4.t;
+            return true;
+        });
+        if(found)finish_hit(r4, rec4);
+        return found;
+    }
+
     bool hit_anything = false;
 
     for(const auto& object : objects){
@@ -63,7 +145,30 @@ bool hittable_list::simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4)
         }
     }
 
+    if(hit_anything)finish_hit(r4, rec4);
     return hit_anything;
 }
 
+// With the BVH, any opaque hit ends a shadow ray. Media are multiplied in from the side list
+double hittable_list::transmittance(const ray& r, interval ray_t) const {
+    double t = 1;
+    if(accel_valid){
+        hit_record rec;
+        if(accel.any_hit(r.orig, r.dir, ray_t.min, ray_t.max, [&](hittable* object){
+            return object->opaque() && object->hit(r, ray_t, rec);
+        }))return 0;
+        for(hittable* object : translucent){
+            t *= object->transmittance(r, ray_t);
+            if(t == 0)break;
+        }
+        return t;
+    }
+
+    for(const auto& object : objects){
+        t *= object->transmittance(r, ray_t);
+        if(t == 0)break;
+    }
+    return t;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "vec3.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// The spheres of a lights list as one emitting surface, for tracers that start paths on the
+// lights (photon.h, bdpt.h). Points are picked uniformly over the total area, so every point
+// of every light has density 1 / area. Objects that are not spheres are left out
+class sphere_lights {
+    public:
+        vector<const sphere*> spheres;
+        double area = 0;
+
+        sphere_lights(const hittable& lights){
+            if(auto list = dynamic_cast<const hittable_list*>(&lights)){
+                for(auto& o : list->objects)
+                    if(auto s = dynamic_cast<const sphere*>(o.get())){
+                        spheres.push_back(s);
+                        area += 4 * pi * s->radius * s->radius;
+                        area_cdf.push_back(area);
+                    }
+            }
+        }
+
+        bool empty() const { return spheres.empty(); }
+
+        // Point p on the lights with its outward normal n, from three uniform numbers
+        void sample(double u, double u1, double u2, point3& p, vec3& n) const {
+            int s = upper_bound(area_cdf.begin(), area_cdf.end(), u * area) - area_cdf.begin();
+            const sphere* light = spheres[min(s, (int)spheres.size() - 1)];
+            n = sphere_direction(u1, u2);
+            p = light->center + light->radius * n;
+        }
+
+    private:
+        vector<double> area_cdf;
+};
+
+#endif
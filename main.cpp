@@ -7,6 +7,8 @@
 #include "camera.h"
 #include "material.h"
 #include "utils.h"
+#include "preview.h"
+#include "daemon.h"
 
 #include <iostream>
 #include <fstream>
@@ -14,7 +16,7 @@
 
 #define infinity std::numeric_limits<double>::infinity()
 
-int main(){
+int main(int argc, char** argv){
     // World
     // Materials
     auto material_left = make_shared<metal>(color(0.1, 0.7, 0.2), 0);
@@ -47,6 +49,18 @@ int main(){
     cam.aspect_ratio = 16.0 / 9.0;
     cam.max_depth = 6;
 
+    // main --preview [socket]: stream progressive frames to a client instead of writing out.ppm
+    if(argc > 1 && string(argv[1]) == "--preview"){
+        preview_server server (cam, world, lights);
+        return server.serve(argc > 2 ? argv[2] : "/tmp/raytracer.sock") ? 0 : 1;
+    }
+
+    // main --daemon [socket]: render jobs of scene files sent over the socket (daemon.h)
+    if(argc > 1 && string(argv[1]) == "--daemon"){
+        render_daemon renderer;
+        return renderer.serve(argc > 2 ? argv[2] : "/tmp/raytracer-daemon.sock") ? 0 : 1;
+    }
+
     cam.render(world, lights);
 
     return 0;
@@ -7,9 +7,37 @@
 #include "ray4.h"
 #include "hittable.h"
 #include "utils.h"
+#include "sampler.h"
+#include "stats.h"
+#include "texture.h"
+
+// Cosine weighted direction around the unit normal n, drawn from the active sampler
+// when the camera set one, otherwise from the batched direction kernels
+vec3 sample_cosine_hemisphere(const vec3& n){
+    if(!active_stream)return to_frame(n, random_cosine_direction());
+
+    double u1, u2;
+    sample_2d(u1, u2);
+    return to_frame(n, cosine_direction(u1, u2));
+}
+
+int next_material_id = 0;
+
+// One scatter() result with the densities bidirectional tracing (bdpt.h) weighs paths by
+class bsdf_sample {
+    public:
+        vec3 dir;               // as scatter() made it
+        color attenuation;
+        double pdf = 0;         // per steradian of dir, 0 for a delta lobe
+        double pdf_rev = 0;     // of the reverse move, arriving along -dir and leaving along -r_in.dir
+};
 
 class material {
     public:
+        // Unique per material, written to the material id AOV
+        int material_id;
+
+        material() : material_id(next_material_id++) {};
         virtual ~material() = default;
 
         virtual bool scatter(const ray& r_in, const hit_record& rec, color &attenuation, ray& scattered) const = 0;
@@ -20,30 +48,78 @@ class material {
 
         virtual bool simd_scatter(const ray4& r_in4, const hit_record4& rec4, color &attenuation, ray4& scattered4) const = 0;
 
+        // Surface color at the hit, used as the albedo feature for denoising
+        virtual color albedo_at(const hit_record& rec) const {
+            return color(1,1,1);
+        }
+
+        // Density per steradian of scatter() choosing the unit direction dir, 0 for
+        // materials with a delta lobe, which are then skipped by light sampling
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& dir) const {
+            return 0;
+        }
+
+        // BSDF times cosine for light arriving from the unit direction dir
+        virtual color eval(const ray& r_in, const hit_record& rec, const vec3& dir) const {
+            return color(0,0,0);
+        }
+
+        // Whether scatter_batch can shade many hits of this material at once. Only for a
+        // single delta lobe, the batched paths skip the environment sampling of a scatter
+        virtual bool batched() const {
+            return false;
+        }
+
+        // Directions and attenuations for n hits, normals point out of the surface, u are
+        // uniform numbers
+        virtual void scatter_batch(int n, const vec3* directions, const vec3* normals, const double* u, vec3* out, color* attenuation) const {}
+
+        // False for phase functions, whose hits are inside a medium and have no normal for
+        // eval and the density conversions of bdpt.h to take a cosine with
+        virtual bool on_surface() const {
+            return true;
+        }
+
+        // scattering_pdf the other way along the same two directions
+        double reverse_pdf(const ray& r_in, const hit_record& rec, const vec3& dir) const {
+            return scattering_pdf(ray(rec.p, -1 * dir), rec, unit_vector(-1 * r_in.direction()));
+        }
+
+        // scatter() and the densities of the direction it picked, both ways
+        bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const {
+            ray scattered;
+            if(!scatter(r_in, rec, s.attenuation, scattered))return false;
+            s.dir = scattered.direction();
+            vec3 d = unit_vector(s.dir);
+            s.pdf = scattering_pdf(r_in, rec, d);
+            s.pdf_rev = s.pdf > 0 ? reverse_pdf(r_in, rec, d) : 0;
+            return true;
+        }
 };
 
 class lambertian : public material {
     public:
-        lambertian(const color& a) : albedo(a) {};
+        lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {};
+        lambertian(shared_ptr<texture> tex) : albedo(tex) {};
 
         bool scatter(const ray& r_in, const hit_record& rec, color &attenuation, ray& scattered) const override {
-            vec3 scatter_direction = rec.normal + random_unit_vector();
+            vec3 scatter_direction = sample_cosine_hemisphere(rec.normal);
             scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo;
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
 
         bool fast_scatter(const ray& r_in, const hit_record& rec, color &attenuation, ray& scattered) const override {
-            vec3 scatter_direction = rec.normal + random_unit_vector();
+            vec3 scatter_direction = sample_cosine_hemisphere(rec.normal);
             scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo;
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
 
         bool scatter4(const ray4& r_in4, const hit_record4& rec4, color &attenuation, ray4& scattered4) const override {
             vec4 scatter_direction = rec4.normal + random_unit_vector_4();
             scattered4 = ray4(rec4.p, scatter_direction);
-            attenuation = albedo;
+            attenuation = albedo->value(rec4.u, rec4.v, vec3(rec4.p), rec4.footprint);
             
             return true;
         }
@@ -52,23 +128,36 @@ class lambertian : public material {
             //cout << "lambertian scatter\n";
             vec4 scatter_direction = simd_add(rec4.normal, random_unit_vector_4());
             scattered4 = ray4(rec4.p, scatter_direction);
-            attenuation = albedo;
+            attenuation = albedo->value(rec4.u, rec4.v, vec3(rec4.p), rec4.footprint);
             return true;
         }
 
+        color albedo_at(const hit_record& rec) const override {
+            return albedo->value(rec.u, rec.v, rec.p, rec.footprint);
+        }
+
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& dir) const override {
+            return fmax(0.0, dot(rec.normal, dir)) / pi;
+        }
+
+        color eval(const ray& r_in, const hit_record& rec, const vec3& dir) const override {
+            return albedo_at(rec) * scattering_pdf(r_in, rec, dir);
+        }
+
     private:
-        color albedo;
+        shared_ptr<texture> albedo;
 };
 
 class metal : public material {
     public:
-        metal(const color& a) : albedo(a), fuzz(0) {};
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {};
+        metal(const color& a) : albedo(make_shared<solid_color>(a)), fuzz(0) {};
+        metal(const color& a, double f) : albedo(make_shared<solid_color>(a)), fuzz(f < 1 ? f : 1) {};
+        metal(shared_ptr<texture> tex, double f) : albedo(tex), fuzz(f < 1 ? f : 1) {};
 
         bool scatter(const ray& r_in, const hit_record& rec, color &attenuation, ray& scattered) const override {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
             scattered = ray(rec.p, reflected + fuzz * random_unit_vector());
-            attenuation = albedo;
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
             // Returns if ray was absorbed
             return (dot(scattered.direction(), rec.normal) > 0);
         }
@@ -78,7 +167,7 @@ class metal : public material {
             vec3 reflected = simd_reflect(vec4(unit_vector(r_in.direction())), norm4);
             vec4 scatdir = simd_add_mul(vec4(reflected), vec4(random_unit_vector()), fuzz);
             scattered = ray(rec.p, scatdir);
-            attenuation = albedo;
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
             // Returns if ray was absorbed
             return (simd_dot(scatdir, norm4) > 0);
         }
@@ -86,7 +175,7 @@ class metal : public material {
         bool scatter4(const ray4& r_in4, const hit_record4& rec4, color &attenuation, ray4& scattered4) const override {
             vec4 reflected = reflect(unit_vector(r_in4.direction()), rec4.normal);
             scattered4 = ray4(rec4.p, reflected + fuzz * random_unit_vector_4());
-            attenuation = albedo;
+            attenuation = albedo->value(rec4.u, rec4.v, vec3(rec4.p), rec4.footprint);
             // Returns if ray was absorbed
             return (dot(scattered4.direction(), rec4.normal) > 0);
         }
@@ -95,17 +184,136 @@ class metal : public material {
             //cout << "metal scatter\n";
             vec4 reflected = simd_reflect(unit_vector(r_in4.direction()), rec4.normal);
             scattered4 = ray4(rec4.p, simd_add(reflected, simd_mul(random_unit_vector_4(), fuzz)));
-            attenuation = albedo;
+            attenuation = albedo->value(rec4.u, rec4.v, vec3(rec4.p), rec4.footprint);
             // Returns if ray was absorbed
             return (simd_dot(scattered4.direction(), rec4.normal) > 0.001);
         }
 
+        color albedo_at(const hit_record& rec) const override {
+            return albedo->value(rec.u, rec.v, rec.p, rec.footprint);
+        }
+
     private:
-        color albedo;
+        shared_ptr<texture> albedo;
         double fuzz;
 };
 
 
+// Batched glass shading, the same math as dielectic::scatter for 4 (SSE) or 8 (AVX2) hits
+// at once. Inputs are SoA: ray directions d (any length), outward surface normals n and one
+// uniform number u per hit. Reflect or refract is picked per lane with masks, no branches.
+void glass_scatter4(const float* dx, const float* dy, const float* dz,
+                    const float* nx, const float* ny, const float* nz,
+                    const float* u, float ir, float* ox, float* oy, float* oz){
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    // Unit direction
+    __m128 x = _mm_loadu_ps(dx), y = _mm_loadu_ps(dy), z = _mm_loadu_ps(dz);
+    const __m128 inv_len = math_rsqrt4(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+    x = _mm_mul_ps(x, inv_len);
+    y = _mm_mul_ps(y, inv_len);
+    z = _mm_mul_ps(z, inv_len);
+
+    // Flip the normal to face the ray, entering rays use 1/ir
+    __m128 mx = _mm_loadu_ps(nx), my = _mm_loadu_ps(ny), mz = _mm_loadu_ps(nz);
+    const __m128 d_dot_n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, mx), _mm_mul_ps(y, my)), _mm_mul_ps(z, mz));
+    const __m128 front = _mm_cmplt_ps(d_dot_n, _mm_setzero_ps());
+    const __m128 flip = _mm_andnot_ps(front, sign);
+    mx = _mm_xor_ps(mx, flip);
+    my = _mm_xor_ps(my, flip);
+    mz = _mm_xor_ps(mz, flip);
+    const __m128 eta = _mm_blendv_ps(_mm_set1_ps(ir), _mm_set1_ps(1.0f / ir), front);
+
+    // cos_theta = min(-d.n, 1), total internal reflection when eta * sin_theta > 1
+    const __m128 cos_theta = _mm_min_ps(_mm_xor_ps(_mm_xor_ps(d_dot_n, flip), sign), one);
+    const __m128 sin_theta = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(cos_theta, cos_theta)), _mm_setzero_ps()));
+    const __m128 tir = _mm_cmpgt_ps(_mm_mul_ps(eta, sin_theta), one);
+
+    // Schlick, (1 - cos)^5 by multiplication
+    __m128 r0 = _mm_div_ps(_mm_sub_ps(one, eta), _mm_add_ps(one, eta));
+    r0 = _mm_mul_ps(r0, r0);
+    const __m128 c = _mm_sub_ps(one, cos_theta);
+    const __m128 c2 = _mm_mul_ps(c, c);
+    const __m128 c5 = _mm_mul_ps(_mm_mul_ps(c2, c2), c);
+    const __m128 fresnel = _mm_add_ps(r0, _mm_mul_ps(_mm_sub_ps(one, r0), c5));
+    const __m128 reflect_mask = _mm_or_ps(tir, _mm_cmpgt_ps(fresnel, _mm_loadu_ps(u)));
+
+    // Reflection d + 2 cos n, since d.n = -cos
+    const __m128 two_cos = _mm_add_ps(cos_theta, cos_theta);
+    const __m128 rx = _mm_add_ps(x, _mm_mul_ps(two_cos, mx));
+    const __m128 ry = _mm_add_ps(y, _mm_mul_ps(two_cos, my));
+    const __m128 rz = _mm_add_ps(z, _mm_mul_ps(two_cos, mz));
+
+    // Refraction, perpendicular part eta (d + cos n) and parallel part -sqrt(|1 - |perp|^2|) n
+    const __m128 px = _mm_mul_ps(eta, _mm_add_ps(x, _mm_mul_ps(cos_theta, mx)));
+    const __m128 py = _mm_mul_ps(eta, _mm_add_ps(y, _mm_mul_ps(cos_theta, my)));
+    const __m128 pz = _mm_mul_ps(eta, _mm_add_ps(z, _mm_mul_ps(cos_theta, mz)));
+    const __m128 perp2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz));
+    const __m128 par = _mm_sqrt_ps(_mm_andnot_ps(sign, _mm_sub_ps(one, perp2)));
+    const __m128 tx = _mm_sub_ps(px, _mm_mul_ps(par, mx));
+    const __m128 ty = _mm_sub_ps(py, _mm_mul_ps(par, my));
+    const __m128 tz = _mm_sub_ps(pz, _mm_mul_ps(par, mz));
+
+    _mm_storeu_ps(ox, _mm_blendv_ps(tx, rx, reflect_mask));
+    _mm_storeu_ps(oy, _mm_blendv_ps(ty, ry, reflect_mask));
+    _mm_storeu_ps(oz, _mm_blendv_ps(tz, rz, reflect_mask));
+}
+
+#ifdef __AVX2__
+void glass_scatter8(const float* dx, const float* dy, const float* dz,
+                    const float* nx, const float* ny, const float* nz,
+                    const float* u, float ir, float* ox, float* oy, float* oz){
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    __m256 x = _mm256_loadu_ps(dx), y = _mm256_loadu_ps(dy), z = _mm256_loadu_ps(dz);
+    const __m256 inv_len = math_rsqrt8(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+    x = _mm256_mul_ps(x, inv_len);
+    y = _mm256_mul_ps(y, inv_len);
+    z = _mm256_mul_ps(z, inv_len);
+
+    __m256 mx = _mm256_loadu_ps(nx), my = _mm256_loadu_ps(ny), mz = _mm256_loadu_ps(nz);
+    const __m256 d_dot_n = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, mx), _mm256_mul_ps(y, my)), _mm256_mul_ps(z, mz));
+    const __m256 front = _mm256_cmp_ps(d_dot_n, _mm256_setzero_ps(), _CMP_LT_OQ);
+    const __m256 flip = _mm256_andnot_ps(front, sign);
+    mx = _mm256_xor_ps(mx, flip);
+    my = _mm256_xor_ps(my, flip);
+    mz = _mm256_xor_ps(mz, flip);
+    const __m256 eta = _mm256_blendv_ps(_mm256_set1_ps(ir), _mm256_set1_ps(1.0f / ir), front);
+
+    const __m256 cos_theta = _mm256_min_ps(_mm256_xor_ps(_mm256_xor_ps(d_dot_n, flip), sign), one);
+    const __m256 sin_theta = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(one, _mm256_mul_ps(cos_theta, cos_theta)), _mm256_setzero_ps()));
+    const __m256 tir = _mm256_cmp_ps(_mm256_mul_ps(eta, sin_theta), one, _CMP_GT_OQ);
+
+    __m256 r0 = _mm256_div_ps(_mm256_sub_ps(one, eta), _mm256_add_ps(one, eta));
+    r0 = _mm256_mul_ps(r0, r0);
+    const __m256 c = _mm256_sub_ps(one, cos_theta);
+    const __m256 c2 = _mm256_mul_ps(c, c);
+    const __m256 c5 = _mm256_mul_ps(_mm256_mul_ps(c2, c2), c);
+    const __m256 fresnel = _mm256_add_ps(r0, _mm256_mul_ps(_mm256_sub_ps(one, r0), c5));
+    const __m256 reflect_mask = _mm256_or_ps(tir, _mm256_cmp_ps(fresnel, _mm256_loadu_ps(u), _CMP_GT_OQ));
+
+    const __m256 two_cos = _mm256_add_ps(cos_theta, cos_theta);
+    const __m256 rx = _mm256_add_ps(x, _mm256_mul_ps(two_cos, mx));
+    const __m256 ry = _mm256_add_ps(y, _mm256_mul_ps(two_cos, my));
+    const __m256 rz = _mm256_add_ps(z, _mm256_mul_ps(two_cos, mz));
+
+    const __m256 px = _mm256_mul_ps(eta, _mm256_add_ps(x, _mm256_mul_ps(cos_theta, mx)));
+    const __m256 py = _mm256_mul_ps(eta, _mm256_add_ps(y, _mm256_mul_ps(cos_theta, my)));
+    const __m256 pz = _mm256_mul_ps(eta, _mm256_add_ps(z, _mm256_mul_ps(cos_theta, mz)));
+    const __m256 perp2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py)), _mm256_mul_ps(pz, pz));
+    const __m256 par = _mm256_sqrt_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(one, perp2)));
+    const __m256 tx = _mm256_sub_ps(px, _mm256_mul_ps(par, mx));
+    const __m256 ty = _mm256_sub_ps(py, _mm256_mul_ps(par, my));
+    const __m256 tz = _mm256_sub_ps(pz, _mm256_mul_ps(par, mz));
+
+    _mm256_storeu_ps(ox, _mm256_blendv_ps(tx, rx, reflect_mask));
+    _mm256_storeu_ps(oy, _mm256_blendv_ps(ty, ry, reflect_mask));
+    _mm256_storeu_ps(oz, _mm256_blendv_ps(tz, rz, reflect_mask));
+}
+#endif
+
 class dielectic : public material {
     public:
         dielectic(double index_of_refraction) : ir(index_of_refraction) {};
@@ -120,36 +328,88 @@ class dielectic : public material {
             bool internal_refraction = refraction_ratio * sin_theta > 1.0;
             vec3 direction;
 
-            if(internal_refraction || reflectance(cos_theta, refraction_ratio) > random_double())
+            if(internal_refraction || reflectance(cos_theta, refraction_ratio) > random_double()){
                 direction = reflect(unit_direction, rec.normal);
-            else 
+                STAT_INC(glass_reflected);
+            }
+            else {
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
+                STAT_INC(glass_refracted);
+            }
 
             scattered = ray(rec.p, direction);
             attenuation = color(1,1,1);
             return true;
         }
 
+        // The kernel orients the normal itself, so it is handed the outward one
         bool fast_scatter(const ray& r_in, const hit_record& rec, color &attenuation, ray& scattered) const override {
-            return false;
+            vec3 direction = kernel_scatter(r_in.direction(), rec.front_face ? rec.normal : -1 * rec.normal);
+            scattered = ray(rec.p, direction);
+            attenuation = color(1,1,1);
+            return true;
         }
         
         bool scatter4(const ray4& r_in4, const hit_record4& rec4, color &attenuation, ray4& scattered4) const override {
-            return false;
+            return simd_scatter(r_in4, rec4, attenuation, scattered4);
         }
 
         bool simd_scatter(const ray4& r_in4, const hit_record4& rec4, color &attenuation, ray4& scattered4) const override {
-            return false;
+            vec3 normal (rec4.normal);
+            vec3 direction = kernel_scatter(vec3(r_in4.dir), rec4.front_face ? normal : -1 * normal);
+            scattered4 = ray4(rec4.p, vec4(direction));
+            attenuation = color(1,1,1);
+            return true;
+        }
+
+        // camera::trace_wavefront collects the glass hits of a bounce and shades them here
+        bool batched() const override {
+            return true;
+        }
+
+        // 8 hits per kernel call, the last call padded
+        void scatter_batch(int n, const vec3* directions, const vec3* normals, const double* u, vec3* out, color* attenuation) const override {
+            alignas(32) float dx[8], dy[8], dz[8], nx[8], ny[8], nz[8], us[8], ox[8], oy[8], oz[8];
+            for(int base = 0; base < n; base += 8){
+                int count = min(8, n - base);
+                for(int k = 0; k < 8; k++){
+                    // Pad the last batch with copies of its first hit
+                    int i = base + (k < count ? k : 0);
+                    dx[k] = directions[i].e[0]; dy[k] = directions[i].e[1]; dz[k] = directions[i].e[2];
+                    nx[k] = normals[i].e[0]; ny[k] = normals[i].e[1]; nz[k] = normals[i].e[2];
+                    us[k] = u[i];
+                }
+#ifdef __AVX2__
+                glass_scatter8(dx, dy, dz, nx, ny, nz, us, ir, ox, oy, oz);
+#else
+                glass_scatter4(dx, dy, dz, nx, ny, nz, us, ir, ox, oy, oz);
+                glass_scatter4(dx + 4, dy + 4, dz + 4, nx + 4, ny + 4, nz + 4, us + 4, ir, ox + 4, oy + 4, oz + 4);
+#endif
+                for(int k = 0; k < count; k++){
+                    out[base + k] = vec3(ox[k], oy[k], oz[k]);
+                    attenuation[base + k] = color(1,1,1);
+                }
+            }
         }
 
     private:
         double ir;
 
+        // One hit through the 4 wide kernel, normal may face either way
+        vec3 kernel_scatter(const vec3& direction, const vec3& normal) const {
+            alignas(16) float dx[4] = {(float)direction.e[0]}, dy[4] = {(float)direction.e[1]}, dz[4] = {(float)direction.e[2]};
+            alignas(16) float nx[4] = {(float)normal.e[0]}, ny[4] = {(float)normal.e[1]}, nz[4] = {(float)normal.e[2]};
+            alignas(16) float u[4] = {(float)random_double()};
+            alignas(16) float ox[4], oy[4], oz[4];
+            glass_scatter4(dx, dy, dz, nx, ny, nz, u, ir, ox, oy, oz);
+            return vec3(ox[0], oy[0], oz[0]);
+        }
+
         static double reflectance(double cosine, double refraction_index){
             // Approximation for reflactance using Schlick
             auto r0 = (1 - refraction_index) / (1 + refraction_index);
             r0 = r0*r0;
-            return r0 + (1-r0) * pow((1-cosine), 5);
+            return r0 + (1-r0) * pow5(1-cosine);
         }
 };
 
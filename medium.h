@@ -0,0 +1,413 @@
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+#include "stats.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Scatters equally in all directions, the phase function of the media below
+class isotropic : public material {
+    public:
+        isotropic(const color& a) : albedo(make_shared<solid_color>(a)) {};
+        isotropic(shared_ptr<texture> tex) : albedo(tex) {};
+
+        bool scatter(const ray& r_in, const hit_record& rec, color &attenuation, ray& scattered) const override {
+            scattered = ray(rec.p, random_unit_vector());
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
+            return true;
+        }
+
+        bool fast_scatter(const ray& r_in, const hit_record& rec, color &attenuation, ray& scattered) const override {
+            return scatter(r_in, rec, attenuation, scattered);
+        }
+
+        bool scatter4(const ray4& r_in4, const hit_record4& rec4, color &attenuation, ray4& scattered4) const override {
+            scattered4 = ray4(rec4.p, random_unit_vector_4());
+            attenuation = albedo->value(rec4.u, rec4.v, vec3(rec4.p), rec4.footprint);
+            return true;
+        }
+
+        bool simd_scatter(const ray4& r_in4, const hit_record4& rec4, color &attenuation, ray4& scattered4) const override {
+            return scatter4(r_in4, rec4, attenuation, scattered4);
+        }
+
+        color albedo_at(const hit_record& rec) const override {
+            return albedo->value(rec.u, rec.v, rec.p, rec.footprint);
+        }
+
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& dir) const override {
+            return 1 / (4 * pi);
+        }
+
+        color eval(const ray& r_in, const hit_record& rec, const vec3& dir) const override {
+            return albedo_at(rec) / (4 * pi);
+        }
+
+        bool on_surface() const override {
+            return false;
+        }
+
+    private:
+        shared_ptr<texture> albedo;
+};
+
+// Extinction coefficient over space, per unit of distance
+class density_field {
+    public:
+        virtual ~density_field() = default;
+
+        virtual double density(const point3& p) const = 0;
+
+        // Upper bound of density inside the box lo - hi. The default probes a 5x5x5 lattice and
+        // adds a margin, fields that know their maximum should override it
+        virtual double max_density(const point3& lo, const point3& hi) const {
+            double m = 0;
+            for(int i = 0; i <= 4; i++)
+                for(int j = 0; j <= 4; j++)
+                    for(int k = 0; k <= 4; k++){
+                        point3 p (lo.e[0] + (hi.e[0] - lo.e[0]) * i / 4,
+                                  lo.e[1] + (hi.e[1] - lo.e[1]) * j / 4,
+                                  lo.e[2] + (hi.e[2] - lo.e[2]) * k / 4);
+                        m = fmax(m, density(p));
+                    }
+            return 1.25 * m;
+        }
+};
+
+// Voxel densities over a box, trilinearly interpolated, for simulated smoke
+class grid_density : public density_field {
+    public:
+        grid_density(const point3& lo, const point3& hi, int nx, int ny, int nz, vector<float> values)
+            : lo(lo), hi(hi), nx(nx), ny(ny), nz(nz), values(move(values)) {};
+
+        double density(const point3& p) const override {
+            double x = (p.e[0] - lo.e[0]) / (hi.e[0] - lo.e[0]) * nx - 0.5;
+            double y = (p.e[1] - lo.e[1]) / (hi.e[1] - lo.e[1]) * ny - 0.5;
+            double z = (p.e[2] - lo.e[2]) / (hi.e[2] - lo.e[2]) * nz - 0.5;
+            int x0 = int(floor(x)), y0 = int(floor(y)), z0 = int(floor(z));
+            double fx = x - x0, fy = y - y0, fz = z - z0;
+
+            double d = 0;
+            for(int k = 0; k < 2; k++)
+                for(int j = 0; j < 2; j++)
+                    for(int i = 0; i < 2; i++)
+                        d += (i ? fx : 1 - fx) * (j ? fy : 1 - fy) * (k ? fz : 1 - fz) * voxel(x0 + i, y0 + j, z0 + k);
+            return d;
+        }
+
+        // Exact, the largest voxel that can contribute to a point in the box
+        double max_density(const point3& a, const point3& b) const override {
+            int x0 = int(floor((a.e[0] - lo.e[0]) / (hi.e[0] - lo.e[0]) * nx - 0.5));
+            int y0 = int(floor((a.e[1] - lo.e[1]) / (hi.e[1] - lo.e[1]) * ny - 0.5));
+            int z0 = int(floor((a.e[2] - lo.e[2]) / (hi.e[2] - lo.e[2]) * nz - 0.5));
+            int x1 = int(floor((b.e[0] - lo.e[0]) / (hi.e[0] - lo.e[0]) * nx - 0.5)) + 1;
+            int y1 = int(floor((b.e[1] - lo.e[1]) / (hi.e[1] - lo.e[1]) * ny - 0.5)) + 1;
+            int z1 = int(floor((b.e[2] - lo.e[2]) / (hi.e[2] - lo.e[2]) * nz - 0.5)) + 1;
+
+            double m = 0;
+            for(int k = z0; k <= z1; k++)
+                for(int j = y0; j <= y1; j++)
+                    for(int i = x0; i <= x1; i++)
+                        m = fmax(m, voxel(i, j, k));
+            return m;
+        }
+
+    private:
+        point3 lo, hi;
+        int nx, ny, nz;
+        vector<float> values;
+
+        // Zero outside the grid
+        double voxel(int i, int j, int k) const {
+            if(i < 0 || j < 0 || k < 0 || i >= nx || j >= ny || k >= nz)return 0;
+            return values[((size_t)k * ny + j) * nx + i];
+        }
+};
+
+// Procedural smoke, scale * turbulence fading out towards the edge of a ball
+class noise_density : public density_field {
+    public:
+        noise_density(const point3& center, double radius, double scale, double frequency = 2.0)
+            : center(center), radius(radius), scale(scale), frequency(frequency) {};
+
+        double density(const point3& p) const override {
+            double falloff = 1 - (p - center).length() / radius;
+            if(falloff <= 0)return 0;
+            return scale * falloff * noise.turbulence(frequency * p, 4);
+        }
+
+    private:
+        perlin noise;
+        point3 center;
+        double radius;
+        double scale;
+        double frequency;
+};
+
+// Piecewise constant upper bound of a density_field on a coarse grid over a box. Tracking
+// uses the bound of each cell the ray crosses, so a thin dense wisp only costs extra
+// lookups in its own cells
+class majorant_grid {
+    public:
+        point3 lo, hi;
+        int res;
+
+        majorant_grid() : res(0) {};
+
+        majorant_grid(const density_field& field, const point3& lo, const point3& hi, int res = 16)
+            : lo(lo), hi(hi), res(res), cells(res * res * res) {
+            for(int k = 0; k < res; k++)
+                for(int j = 0; j < res; j++)
+                    for(int i = 0; i < res; i++)
+                        cells[(k * res + j) * res + i] = field.max_density(corner(i, j, k), corner(i + 1, j + 1, k + 1));
+        }
+
+        // Walks the cells along r between distances s0 and s1 along its unit direction and
+        // calls step(s_start, s_end, majorant) for each. step returns false to stop the walk
+        template <typename F>
+        void traverse(const ray& r, double s0, double s1, const F& step) const {
+            vec3 d = unit_vector(r.dir);
+            point3 p = r.orig + s0 * d;
+
+            int cell[3], dir_step[3];
+            double next[3], delta[3];
+            for(int a = 0; a < 3; a++){
+                double size = (hi.e[a] - lo.e[a]) / res;
+                double g = (p.e[a] - lo.e[a]) / size;
+                cell[a] = min(max(int(floor(g)), 0), res - 1);
+                if(d.e[a] > 0){
+                    dir_step[a] = 1;
+                    delta[a] = size / d.e[a];
+                    next[a] = s0 + ((cell[a] + 1) * size + lo.e[a] - p.e[a]) / d.e[a];
+                }
+                else if(d.e[a] < 0){
+                    dir_step[a] = -1;
+                    delta[a] = -size / d.e[a];
+                    next[a] = s0 + (cell[a] * size + lo.e[a] - p.e[a]) / d.e[a];
+                }
+                else {
+                    dir_step[a] = 0;
+                    delta[a] = infinity;
+                    next[a] = infinity;
+                }
+            }
+
+            double s = s0;
+            while(s < s1){
+                int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+                double end = fmin(next[a], s1);
+                if(!step(s, end, cells[(cell[2] * res + cell[1]) * res + cell[0]]))return;
+
+                s = end;
+                cell[a] += dir_step[a];
+                next[a] += delta[a];
+                if(cell[a] < 0 || cell[a] >= res)return;
+            }
+        }
+
+    private:
+        vector<double> cells;
+
+        point3 corner(int i, int j, int k) const {
+            return point3(lo.e[0] + (hi.e[0] - lo.e[0]) * i / res,
+                          lo.e[1] + (hi.e[1] - lo.e[1]) * j / res,
+                          lo.e[2] + (hi.e[2] - lo.e[2]) * k / res);
+        }
+};
+
+// Shared by the media: the part of r inside a convex boundary, as ray parameters t0 < t1
+bool medium_span(const hittable& boundary, const ray& r, interval ray_t, double& t0, double& t1){
+    hit_record rec1, rec2;
+    if(!boundary.hit(r, interval(-infinity, infinity), rec1))return false;
+    if(!boundary.hit(r, interval(rec1.t + 0.0001, infinity), rec2))return false;
+
+    t0 = fmax(rec1.t, ray_t.min);
+    t1 = fmin(rec2.t, ray_t.max);
+    if(t0 >= t1)return false;
+    t0 = fmax(t0, 0.0);
+    return true;
+}
+
+// Fills a scattering event at t, media have no surface normal
+void medium_record(const ray& r, double t, shared_ptr<material> phase, int object_id, hit_record& rec){
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.normal = vec3(1,0,0);
+    rec.front_face = true;
+    rec.mat = phase;
+    rec.object_id = object_id;
+    rec.object = nullptr;
+    rec.u = rec.v = 0;
+    rec.footprint = 0;
+}
+
+// The 4 wide paths go through the scalar hit, tracking is branchy anyway
+bool medium_hit4(const hittable& medium, const ray4& r4, interval ray_t, hit_record4& rec4){
+    hit_record rec;
+    if(!medium.hit(ray(vec3(r4.orig), r4.dir), ray_t, rec))return false;
+    rec4.t = rec.t;
+    rec4.p = vec4(rec.p);
+    rec4.normal = vec4(rec.normal);
+    rec4.front_face = true;
+    rec4.mat = rec.mat;
+    rec4.object = nullptr;
+    rec4.u = rec4.v = 0;
+    rec4.footprint = 0;
+    return true;
+}
+
+// Fog of constant density inside a convex boundary, the free flight distance is sampled
+// in closed form
+class constant_medium : public hittable {
+    public:
+        constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo)
+            : boundary(boundary), sigma_t(density), phase(make_shared<isotropic>(albedo)) {};
+
+        constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> albedo)
+            : boundary(boundary), sigma_t(density), phase(make_shared<isotropic>(albedo)) {};
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            double t0, t1;
+            if(!medium_span(*boundary, r, ray_t, t0, t1))return false;
+
+            double length = r.dir.length();
+            double distance = -log(1 - random_double()) / sigma_t;
+            STAT_INC(medium_lookups);
+            if(distance > (t1 - t0) * length)return false;
+
+            STAT_INC(medium_collisions);
+            medium_record(r, t0 + distance / length, phase, object_id, rec);
+            return true;
+        }
+
+        bool fast_hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return hit(r, ray_t, rec);
+        }
+
+        bool simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const override {
+            return medium_hit4(*this, r4, ray_t, rec4);
+        }
+
+        aabb bounding_box() const override { return boundary->bounding_box(); }
+
+        bool opaque() const override { return false; }
+
+        double transmittance(const ray& r, interval ray_t) const override {
+            double t0, t1;
+            if(!medium_span(*boundary, r, ray_t, t0, t1))return 1;
+            return exp(-sigma_t * (t1 - t0) * r.dir.length());
+        }
+
+    private:
+        shared_ptr<hittable> boundary;
+        double sigma_t;
+        shared_ptr<material> phase;
+};
+
+// Smoke with varying density inside a convex boundary. Free flights are sampled with delta
+// tracking against the majorant grid, shadow rays use ratio tracking
+class heterogeneous_medium : public hittable {
+    public:
+        // lo - hi must contain the boundary, it is the extent of the majorant grid
+        heterogeneous_medium(shared_ptr<hittable> boundary, shared_ptr<density_field> field, const color& albedo,
+                             const point3& lo, const point3& hi, int majorant_res = 16)
+            : boundary(boundary), field(field), phase(make_shared<isotropic>(albedo)),
+              majorants(*field, lo, hi, majorant_res) {};
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            double t0, t1;
+            if(!medium_span(*boundary, r, ray_t, t0, t1))return false;
+
+            double length = r.dir.length();
+            // Walk with a unit direction so the majorants apply per unit distance
+            ray u (r.orig, unit_vector(r.dir));
+            bool collided = false;
+            double collision = 0;
+
+            // Remaining optical depth to the next tentative collision, carried across cells
+            double tau = -log(1 - random_double());
+            majorants.traverse(u, t0 * length, t1 * length, [&](double s, double end, double majorant){
+                while(true){
+                    if(majorant * (end - s) <= tau){
+                        tau -= majorant * (end - s);
+                        return true;
+                    }
+                    s += tau / majorant;
+                    STAT_INC(medium_lookups);
+                    if(random_double() * majorant < field->density(u.at(s))){
+                        collided = true;
+                        collision = s;
+                        return false;
+                    }
+                    tau = -log(1 - random_double());
+                }
+            });
+
+            if(!collided)return false;
+            STAT_INC(medium_collisions);
+            medium_record(r, collision / length, phase, object_id, rec);
+            return true;
+        }
+
+        bool fast_hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return hit(r, ray_t, rec);
+        }
+
+        bool simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const override {
+            return medium_hit4(*this, r4, ray_t, rec4);
+        }
+
+        aabb bounding_box() const override { return boundary->bounding_box(); }
+
+        bool opaque() const override { return false; }
+
+        // Ratio tracking, each tentative collision scales the estimate by the null fraction
+        double transmittance(const ray& r, interval ray_t) const override {
+            double t0, t1;
+            if(!medium_span(*boundary, r, ray_t, t0, t1))return 1;
+
+            double length = r.dir.length();
+            // Walk with a unit direction so the majorants apply per unit distance
+            ray u (r.orig, unit_vector(r.dir));
+            double transmitted = 1;
+            double tau = -log(1 - random_double());
+            majorants.traverse(u, t0 * length, t1 * length, [&](double s, double end, double majorant){
+                while(true){
+                    if(majorant * (end - s) <= tau){
+                        tau -= majorant * (end - s);
+                        return true;
+                    }
+                    s += tau / majorant;
+                    STAT_INC(medium_lookups);
+                    transmitted *= 1 - fmin(field->density(u.at(s)) / majorant, 1.0);
+
+                    // Russian roulette once the estimate is small
+                    if(transmitted < 0.1){
+                        if(random_double() > transmitted){
+                            transmitted = 0;
+                            return false;
+                        }
+                        transmitted = 1;
+                    }
+                    tau = -log(1 - random_double());
+                }
+            });
+            return transmitted;
+        }
+
+    private:
+        shared_ptr<hittable> boundary;
+        shared_ptr<density_field> field;
+        shared_ptr<material> phase;
+        majorant_grid majorants;
+};
+
+#endif
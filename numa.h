@@ -0,0 +1,201 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// NUMA placement for render workers on Linux, without libnuma. The topology is read from
+// /sys/devices/system/node, workers are pinned with pthread_setaffinity_np and memory is
+// placed with the mbind system call. Elsewhere, or when /sys has no nodes, everything
+// falls back to a single node holding every hardware thread and pinning does nothing.
+
+class numa_node {
+    public:
+        int id;
+        vector<int> cpus;
+};
+
+// "0-3,8-11" as its numbers, the format of cpu and node lists in /sys
+vector<int> parse_cpu_list(const string& list){
+    vector<int> cpus;
+    stringstream in (list);
+    string range;
+    while(getline(in, range, ',')){
+        if(range.empty() || range == "\n")continue;
+        size_t dash = range.find('-');
+        int lo = stoi(range.substr(0, dash));
+        int hi = dash == string::npos ? lo : stoi(range.substr(dash + 1));
+        for(int c = lo; c <= hi; c++)cpus.push_back(c);
+    }
+    return cpus;
+}
+
+class numa_topology {
+    public:
+        vector<numa_node> nodes;
+
+        // The machine's nodes, those without cpus (memory only) left out
+        static numa_topology detect(){
+            numa_topology t;
+#ifdef __linux__
+            ifstream online ("/sys/devices/system/node/online");
+            string ids;
+            if(online && getline(online, ids))
+                for(int id : parse_cpu_list(ids)){
+                    ifstream in ("/sys/devices/system/node/node" + to_string(id) + "/cpulist");
+                    string list;
+                    if(!in || !getline(in, list))continue;
+                    vector<int> cpus = parse_cpu_list(list);
+                    if(!cpus.empty())t.nodes.push_back(numa_node{id, cpus});
+                }
+#endif
+            if(t.nodes.empty()){
+                numa_node all {0, {}};
+                unsigned n = thread::hardware_concurrency();
+                for(unsigned c = 0; c < max(1u, n); c++)all.cpus.push_back(c);
+                t.nodes.push_back(all);
+            }
+            return t;
+        }
+
+        int cpu_count() const {
+            int n = 0;
+            for(auto& node : nodes)n += node.cpus.size();
+            return n;
+        }
+
+        // The same cpus regrouped into domains nodes, for measuring how the layer scales on
+        // machines with fewer real nodes. Cpus go to domains in order. With fewer cpus than
+        // domains, domains share cpus. Memory stays on the real node of each cpu
+        numa_topology split(int domains) const {
+            vector<pair<int, int>> cpus;     // cpu, real node
+            for(auto& node : nodes)
+                for(int c : node.cpus)cpus.push_back({c, node.id});
+            numa_topology t;
+            int count = cpus.size();
+            for(int d = 0; d < domains; d++){
+                numa_node node {cpus[d * count / domains % count].second, {}};
+                int lo = d * count / domains, hi = max(lo + 1, (d + 1) * count / domains);
+                for(int c = lo; c < hi; c++)node.cpus.push_back(cpus[c % count].first);
+                t.nodes.push_back(node);
+            }
+            return t;
+        }
+};
+
+// Pins the calling thread to cpus. False where that is not supported
+bool pin_thread(const vector<int>& cpus){
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int c : cpus)
+        if(c >= 0 && c < CPU_SETSIZE)CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Memory policies of the mbind system call (linux/mempolicy.h)
+const int numa_policy_bind = 2;
+const int numa_policy_interleave = 3;
+const unsigned numa_move_pages = 1 << 1;
+
+// Applies policy over the whole pages of [p, p + bytes) for the nodes in mask, moving pages
+// already touched. False where mbind is missing or refused (single node kernels)
+bool numa_mbind(const void* p, size_t bytes, int policy, uint64_t mask){
+#if defined(__linux__) && defined(SYS_mbind)
+    if(bytes == 0 || mask == 0)return false;
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = uintptr_t(p) / page * page;
+    uintptr_t end = (uintptr_t(p) + bytes + page - 1) / page * page;
+    return syscall(SYS_mbind, begin, end - begin, policy, &mask, 64, numa_move_pages) == 0;
+#else
+    return false;
+#endif
+}
+
+// Pages of [p, p + bytes) onto node
+bool numa_bind(const void* p, size_t bytes, int node){
+    if(node < 0 || node >= 64)return false;
+    return numa_mbind(p, bytes, numa_policy_bind, uint64_t(1) << node);
+}
+
+// Pages of [p, p + bytes) spread round robin over the nodes of t
+bool numa_interleave(const void* p, size_t bytes, const numa_topology& t){
+    uint64_t mask = 0;
+    for(auto& node : t.nodes)
+        if(node.id < 64)mask |= uint64_t(1) << node.id;
+    return numa_mbind(p, bytes, numa_policy_interleave, mask);
+}
+
+// First index of node's share of n items, shares are contiguous and in node order
+int numa_share_begin(int n, int node, int nodes){
+    return int(int64_t(n) * node / nodes);
+}
+
+// fn(i, worker, node) for every i in [0, n) on one thread per cpu of t, each pinned to its
+// cpu. Node k's workers first take items from the k-th contiguous share of [0, n), so
+// neighbouring tiles stay on one node, then help the other nodes finish theirs. Workers are
+// numbered node by node in [0, t.cpu_count()), the calling thread is worker 0 and keeps
+// its own affinity afterwards
+template <typename F>
+void numa_parallel_for(const numa_topology& t, int n, const F& fn){
+    int nodes = t.nodes.size();
+    vector<atomic<int>> next (nodes);
+    for(int k = 0; k < nodes; k++)next[k] = numa_share_begin(n, k, nodes);
+
+    auto worker = [&](int w, int home){
+        for(int step = 0; step < nodes; step++){
+            int k = (home + step) % nodes;
+            int end = numa_share_begin(n, k + 1, nodes);
+            for(int i = next[k]++; i < end; i = next[k]++)fn(i, w, home);
+        }
+    };
+
+#ifdef __linux__
+    cpu_set_t saved;
+    bool restore = pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0;
+#endif
+    vector<thread> pool;
+    int w = 0;
+    for(int k = 0; k < nodes; k++)
+        for(int c : t.nodes[k].cpus){
+            if(w > 0)pool.emplace_back([&, w, k, c](){ pin_thread({c}); worker(w, k); });
+            w++;
+        }
+    pin_thread({t.nodes[0].cpus[0]});
+    worker(0, 0);
+    for(auto& th : pool)th.join();
+#ifdef __linux__
+    if(restore)pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+#endif
+}
+
+// Runs fn() on a thread pinned to node's cpus and waits for it, so the memory it first
+// touches is allocated on that node
+template <typename F>
+void on_node(const numa_node& node, const F& fn){
+    thread th ([&](){
+        pin_thread(node.cpus);
+        fn();
+    });
+    th.join();
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+int default_thread_count(){
+    unsigned n = thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Runs fn(i) for every i in [0, n), indices are handed out one at a time so uneven rows balance.
+// threads <= 0 uses every hardware thread
+template <typename F>
+void parallel_for(int n, const F& fn, int threads = 0){
+    if(threads <= 0)threads = default_thread_count();
+    if(threads > n)threads = n;
+
+    if(threads <= 1){
+        for(int i = 0; i < n; i++)fn(i);
+        return;
+    }
+
+    atomic<int> next (0);
+    auto worker = [&](){
+        for(int i = next++; i < n; i = next++)fn(i);
+    };
+
+    vector<thread> pool;
+    for(int t = 1; t < threads; t++)pool.emplace_back(worker);
+    worker();
+    for(auto& t : pool)t.join();
+}
+
+// Number of threads parallel_for_workers uses for n items
+int worker_count(int n, int threads = 0){
+    if(threads <= 0)threads = default_thread_count();
+    return max(1, min(threads, n));
+}
+
+// Like parallel_for, but fn(i, worker) also gets the index in [0, worker_count(n, threads))
+// of the thread running it, so per thread state can live in a plain array
+template <typename F>
+void parallel_for_workers(int n, const F& fn, int threads = 0){
+    threads = worker_count(n, threads);
+
+    atomic<int> next (0);
+    auto worker = [&](int w){
+        for(int i = next++; i < n; i = next++)fn(i, w);
+    };
+
+    vector<thread> pool;
+    for(int t = 1; t < threads; t++)pool.emplace_back(worker, t);
+    worker(0);
+    for(auto& t : pool)t.join();
+}
+
+// Threads that stay alive between jobs, for callers that start many short jobs (the preview
+// restarts a frame on every edit). run() is parallel_for_workers without creating threads
+class thread_pool {
+    public:
+        thread_pool(int threads = 0){
+            count = threads <= 0 ? default_thread_count() : threads;
+            for(int w = 1; w < count; w++)workers.emplace_back([this, w](){ work(w); });
+        }
+
+        ~thread_pool(){
+            {
+                lock_guard<mutex> lock (m);
+                stop = true;
+            }
+            wake.notify_all();
+            for(auto& t : workers)t.join();
+        }
+
+        int size() const { return count; }
+
+        // fn(i, worker) for every i in [0, n), worker in [0, size()). The calling thread is
+        // worker 0 and run() returns when every index is done. Not reentrant
+        template <typename F>
+        void run(int n, const F& fn){
+            {
+                lock_guard<mutex> lock (m);
+                job = [&fn](int i, int w){ fn(i, w); };
+                job_size = n;
+                next = 0;
+                busy = count - 1;
+                generation++;
+            }
+            wake.notify_all();
+            for(int i = next++; i < n; i = next++)fn(i, 0);
+
+            unique_lock<mutex> lock (m);
+            finished.wait(lock, [this](){ return busy == 0; });
+            job = nullptr;
+        }
+
+    private:
+        int count;
+        vector<thread> workers;
+        mutex m;
+        condition_variable wake, finished;
+        function<void(int, int)> job;
+        int job_size = 0;
+        atomic<int> next {0};
+        int busy = 0;
+        uint64_t generation = 0;
+        bool stop = false;
+
+        void work(int w){
+            uint64_t seen = 0;
+            for(;;){
+                {
+                    unique_lock<mutex> lock (m);
+                    wake.wait(lock, [&](){ return stop || generation != seen; });
+                    if(stop)return;
+                    seen = generation;
+                }
+                for(int i = next++; i < job_size; i = next++)job(i, w);
+
+                lock_guard<mutex> lock (m);
+                if(--busy == 0)finished.notify_one();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef PHOTON_H
+#define PHOTON_H
+
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "parallel.h"
+
+#include <cstdint>
+#include <vector>
+#include <immintrin.h>
+
+using namespace std;
+
+// Caustic photons in the probabilistic progressive form of Knaus and Zwicker (2011), which
+// gives the same limit as SPPM without per pixel statistics. Every pass traces a fresh set
+// of photons from the sphere lights through delta bounces (glass, mirrors) and keeps those
+// that land on a non delta surface after at least one of them, the light-specular-diffuse
+// paths a camera path only finds by luck. The camera gathers them at the first diffuse hit
+// of each path, and its own paths no longer count light reached from there through delta
+// bounces only, so every path is counted once. The radius shrinks between passes and the
+// film averages the pass estimates like any other samples, so the bias goes to 0.
+//
+// Photons carry the factors camera::ray_color applies in the other direction: attenuation
+// times dot(in, out) at every delta bounce, which is symmetric in the two directions.
+
+// Squared gather radius of pass k (from 0): r0^2 times the product of (i + alpha) / (i + 1)
+// for i = 1..k, each pass keeps the fraction alpha of the previous one's new photons
+double photon_radius2(double r0, double alpha, int k){
+    double r2 = r0 * r0;
+    for(int i = 1; i <= k; i++)r2 *= (i + alpha) / (i + 1);
+    return r2;
+}
+
+class photon_map {
+    public:
+        // Structure of arrays sorted by grid bucket: position, direction of travel and flux
+        // already divided by the number of photons emitted
+        vector<float> x, y, z;
+        vector<float> dx, dy, dz;
+        vector<float> r, g, b;
+        int64_t emitted = 0;
+        double radius = 0;
+
+        size_t size() const { return x.size(); }
+        bool ready() const { return emitted > 0; }
+
+        void clear(){
+            for(auto* v : {&x, &y, &z, &dx, &dy, &dz, &r, &g, &b})v->clear();
+            emitted = 0;
+        }
+
+        // Traces count photons from the spheres in lights, each glowing with radiance le in
+        // every direction like the lights camera::ray_color sees. Photon i of a pass always
+        // uses the same random numbers, whatever thread traces it
+        void trace(const hittable& world, const hittable& lights, const color& le, int count, uint64_t seed, int max_depth, int threads = 0){
+            clear();
+            emitted = count;
+
+            sphere_lights emitters (lights);
+            if(emitters.empty() || count <= 0)return;
+
+            // Power of a lambertian emitter, pi times radiance times area
+            const color flux = le * (pi * emitters.area / count);
+
+            const int chunk = 4096;
+            int chunks = (count + chunk - 1) / chunk;
+            vector<vector<float>> parts (chunks);
+            parallel_for(chunks, [&](int c){
+                vector<float>& out = parts[c];
+                for(int i = c * chunk; i < min(count, (c + 1) * chunk); i++){
+                    seed_random((uint64_t(i) << 20 ^ seed) * 0x9e3779b97f4a7c15ull + 0x632be59bd9b4e019ull);
+                    reseed_direction_caches(uint32_t(random_u64()));
+
+                    point3 origin;
+                    vec3 n;
+                    double u = random_double(), u1 = random_double(), u2 = random_double();
+                    emitters.sample(u, u1, u2, origin, n);
+                    ray ph (origin, to_frame(n, cosine_direction(random_double(), random_double())));
+                    color power = flux;
+
+                    bool through_delta = false;
+                    for(int depth = 0; depth < max_depth; depth++){
+                        hit_record rec;
+                        if(!world.hit(ph, interval(0.00000001, infinity), rec))break;
+
+                        if(rec.mat->scattering_pdf(ph, rec, rec.normal) > 0){
+                            if(through_delta){
+                                vec3 d = unit_vector(ph.dir);
+                                float v[9] = {float(rec.p.e[0]), float(rec.p.e[1]), float(rec.p.e[2]), float(d.e[0]), float(d.e[1]), float(d.e[2]),
+                                              float(power.e[0]), float(power.e[1]), float(power.e[2])};
+                                out.insert(out.end(), v, v + 9);
+                            }
+                            break;
+                        }
+
+                        ray scattered;
+                        color attenuation;
+                        if(!rec.mat->scatter(ph, rec, attenuation, scattered))break;
+                        power = power * attenuation * dot(ph.dir, scattered.dir);
+                        through_delta = true;
+                        ph = scattered;
+                    }
+                }
+            }, threads);
+
+            for(auto& part : parts)
+                for(size_t k = 0; k < part.size(); k += 9){
+                    x.push_back(part[k]);     y.push_back(part[k + 1]);  z.push_back(part[k + 2]);
+                    dx.push_back(part[k + 3]); dy.push_back(part[k + 4]); dz.push_back(part[k + 5]);
+                    r.push_back(part[k + 6]); g.push_back(part[k + 7]);  b.push_back(part[k + 8]);
+                }
+        }
+
+        // Hashes the photons into a grid of cells twice the gather radius wide, a gather then
+        // looks at the 2x2x2 cells around its point. Photons of one bucket are contiguous
+        void build(double gather_radius){
+            radius = gather_radius;
+            cell = 2 * gather_radius;
+            size_t n = size();
+            buckets = 1;
+            while(buckets < 2 * n)buckets <<= 1;
+
+            vector<uint32_t> key (n);
+            start.assign(buckets + 1, 0);
+            for(size_t i = 0; i < n; i++){
+                key[i] = bucket(cell_of(x[i]), cell_of(y[i]), cell_of(z[i]));
+                start[key[i] + 1]++;
+            }
+            for(size_t k = 0; k < buckets; k++)start[k + 1] += start[k];
+
+            vector<uint32_t> slot (start.begin(), start.end() - 1);
+            vector<uint32_t> order (n);
+            for(size_t i = 0; i < n; i++)order[slot[key[i]]++] = i;
+            for(auto* v : {&x, &y, &z, &dx, &dy, &dz, &r, &g, &b}){
+                vector<float> sorted (n);
+                for(size_t i = 0; i < n; i++)sorted[i] = (*v)[order[i]];
+                v->swap(sorted);
+            }
+        }
+
+        // Calls fn(i) for every photon i within radius of p, testing 4 at a time
+        template <typename F>
+        void gather(const point3& p, const F& fn) const {
+            if(size() == 0)return;
+            const float px = p.e[0], py = p.e[1], pz = p.e[2];
+            int c[3][2];
+            const double q[3] = {p.e[0], p.e[1], p.e[2]};
+            for(int a = 0; a < 3; a++){
+                double f = q[a] / cell;
+                int i = int(floor(f));
+                c[a][0] = i;
+                c[a][1] = f - i < 0.5f ? i - 1 : i + 1;
+            }
+
+            uint32_t seen[8];
+            int seen_count = 0;
+            const __m128 vx = _mm_set1_ps(px), vy = _mm_set1_ps(py), vz = _mm_set1_ps(pz);
+            const __m128 r2 = _mm_set1_ps(float(radius * radius));
+            for(int k = 0; k < 8; k++){
+                uint32_t h = bucket(c[0][k & 1], c[1][(k >> 1) & 1], c[2][k >> 2]);
+                // Two cells can share a bucket, it is only searched once
+                bool again = false;
+                for(int s = 0; s < seen_count; s++)again |= seen[s] == h;
+                if(again)continue;
+                seen[seen_count++] = h;
+
+                uint32_t begin = start[h], end = start[h + 1];
+                for(uint32_t i = begin; i < end; i += 4){
+                    int lanes = min(4u, end - i);
+                    __m128 ex, ey, ez;
+                    if(lanes == 4){
+                        ex = _mm_loadu_ps(&x[i]);
+                        ey = _mm_loadu_ps(&y[i]);
+                        ez = _mm_loadu_ps(&z[i]);
+                    }
+                    else {
+                        alignas(16) float tx[4] = {INFINITY, INFINITY, INFINITY, INFINITY}, ty[4] = {0}, tz[4] = {0};
+                        for(int l = 0; l < lanes; l++){ tx[l] = x[i + l]; ty[l] = y[i + l]; tz[l] = z[i + l]; }
+                        ex = _mm_load_ps(tx);
+                        ey = _mm_load_ps(ty);
+                        ez = _mm_load_ps(tz);
+                    }
+                    ex = _mm_sub_ps(ex, vx);
+                    ey = _mm_sub_ps(ey, vy);
+                    ez = _mm_sub_ps(ez, vz);
+                    const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), _mm_mul_ps(ez, ez));
+                    int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+                    while(mask){
+                        int l = __builtin_ctz(mask);
+                        fn(i + l);
+                        mask &= mask - 1;
+                    }
+                }
+            }
+        }
+
+    private:
+        double cell = 1;
+        size_t buckets = 1;
+        vector<uint32_t> start;
+
+        int cell_of(double v) const { return int(floor(v / cell)); }
+
+        uint32_t bucket(int i, int j, int k) const {
+            uint32_t h = uint32_t(i) * 73856093u ^ uint32_t(j) * 19349663u ^ uint32_t(k) * 83492791u;
+            return h & (buckets - 1);
+        }
+};
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "vec3.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "material.h"
+#include "camera.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Interactive preview over a unix socket. The server renders progressively: the first frame
+// takes one sample per coarse_block x coarse_block block, each following frame halves the
+// block until it is one pixel, then full resolution passes accumulate up to max_passes.
+// Every frame is sent to the client as soon as it is done.
+//
+// The client sends text commands, one per line:
+//   lookfrom x y z / lookat x y z / width n / depth n
+//   move i x y z        moves sphere i of the world
+//   add x y z r R G B   adds a lambertian sphere
+//   remove i
+//   quit
+// Each command, and each edit() from code, interrupts the frame in flight between rows and
+// restarts accumulation. The scene, BVH memory and worker threads are kept.
+
+// Sent before every frame, followed by width * height * 3 bytes of gamma corrected RGB with
+// the top row first (the order of out.ppm)
+class preview_frame_header {
+    public:
+        uint32_t magic = 0x46505452;    // "RTPF"
+        uint32_t generation = 0;        // counts restarts, older frames are stale
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t block = 0;             // side of the pixel block one sample covers
+        uint32_t passes = 0;            // samples per pixel at block 1
+        float ms = 0;                   // since the edit that started this generation
+};
+
+bool send_all(int fd, const void* data, size_t bytes){
+    const char* p = (const char*)data;
+    while(bytes > 0){
+        ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if(n <= 0)return false;
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+bool recv_all(int fd, void* data, size_t bytes){
+    char* p = (char*)data;
+    while(bytes > 0){
+        ssize_t n = recv(fd, p, bytes, 0);
+        if(n <= 0)return false;
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+class preview_server {
+    public:
+        int coarse_block = 16;
+        int max_passes = 256;
+
+        preview_server(camera& cam, hittable_list& world, const hittable& lights, int threads = 0)
+            : cam(cam), world(world), lights(lights), pool(threads) {};
+
+        // Queues fn to run between frames, then restarts. Safe from any thread
+        void edit(function<void(camera&, hittable_list&)> fn){
+            {
+                lock_guard<mutex> lock (m);
+                edits.push_back(fn);
+                if(pending_edits == 0)edit_time = std::chrono::high_resolution_clock::now();
+                pending_edits++;
+                // Set under the lock, so a cut short frame always has an edit waiting
+                interrupted = true;
+            }
+            changed.notify_one();
+        }
+
+        // Parses one command line, false for quit or a line that is not understood
+        bool command(const string& line){
+            istringstream in (line);
+            string name;
+            in >> name;
+            if(name == "quit"){
+                stop();
+                return false;
+            }
+
+            double x, y, z;
+            if(name == "lookfrom" && in >> x >> y >> z){
+                edit([=](camera& c, hittable_list&){ c.lookfrom = point3(x, y, z); });
+                return true;
+            }
+            if(name == "lookat" && in >> x >> y >> z){
+                edit([=](camera& c, hittable_list&){ c.lookat = point3(x, y, z); });
+                return true;
+            }
+            int n;
+            if(name == "width" && in >> n && n > 0){
+                edit([=](camera& c, hittable_list&){ c.screen_width = n; });
+                return true;
+            }
+            if(name == "depth" && in >> n && n > 0){
+                edit([=](camera& c, hittable_list&){ c.max_depth = n; });
+                return true;
+            }
+            if(name == "move" && in >> n >> x >> y >> z){
+                edit([=](camera&, hittable_list& w){
+                    if(n < 0 || n >= (int)w.objects.size())return;
+                    if(auto s = dynamic_cast<sphere*>(w.objects[n].get()))s->center = point3(x, y, z);
+                    w.clear_bvh();
+                });
+                return true;
+            }
+            double r, red, green, blue;
+            if(name == "add" && in >> x >> y >> z >> r >> red >> green >> blue){
+                edit([=](camera&, hittable_list& w){
+                    w.add(make_shared<sphere>(point3(x, y, z), r, make_shared<lambertian>(color(red, green, blue))));
+                });
+                return true;
+            }
+            if(name == "remove" && in >> n){
+                edit([=](camera&, hittable_list& w){
+                    if(n < 0 || n >= (int)w.objects.size())return;
+                    w.objects.erase(w.objects.begin() + n);
+                    w.clear_bvh();
+                });
+                return true;
+            }
+            return false;
+        }
+
+        void stop(){
+            stopping = true;
+            interrupted = true;
+            changed.notify_one();
+        }
+
+        // Serves clients on the socket at path one at a time until quit or stop()
+        bool serve(const string& path){
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd < 0)return false;
+            sockaddr_un addr {};
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            unlink(path.c_str());
+            if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0){
+                close(fd);
+                return false;
+            }
+
+            while(!stopping){
+                pollfd p {fd, POLLIN, 0};
+                if(poll(&p, 1, 100) <= 0)continue;
+                int client = accept(fd, nullptr, nullptr);
+                if(client < 0)continue;
+                session(client);
+                close(client);
+            }
+
+            close(fd);
+            unlink(path.c_str());
+            return true;
+        }
+
+    private:
+        camera& cam;
+        hittable_list& world;
+        const hittable& lights;
+        thread_pool pool;
+
+        mutex m;
+        condition_variable changed;
+        vector<function<void(camera&, hittable_list&)>> edits;
+        int pending_edits = 0;
+        std::chrono::high_resolution_clock::time_point edit_time;
+        atomic<bool> interrupted {false};
+        atomic<bool> stopping {false};
+
+        // Progress of the current generation
+        preview_frame_header state;
+        vector<color> sum;
+        vector<unsigned char> bytes;
+        std::chrono::high_resolution_clock::time_point restart_time;
+
+        void session(int client){
+            atomic<bool> connected {true};
+            thread reader ([&](){
+                string line;
+                char c;
+                while(recv(client, &c, 1, 0) == 1){
+                    if(c != '\n'){
+                        line += c;
+                        continue;
+                    }
+                    command(line);
+                    line.clear();
+                    if(stopping)break;
+                }
+                connected = false;
+                interrupted = true;
+                changed.notify_one();
+            });
+
+            restart(std::chrono::high_resolution_clock::now());
+            while(connected && !stopping){
+                if(apply_edits())continue;
+                if(state.passes >= (uint32_t)max_passes){
+                    unique_lock<mutex> lock (m);
+                    changed.wait_for(lock, std::chrono::milliseconds(100), [&](){ return pending_edits > 0 || stopping || !connected; });
+                    continue;
+                }
+                if(!render_frame())continue;
+                if(!send_frame(client))break;
+                if(state.block > 1)state.block /= 2;
+            }
+
+            shutdown(client, SHUT_RDWR);
+            reader.join();
+        }
+
+        // Runs queued edits while no frame is in flight, true if there were any
+        bool apply_edits(){
+            vector<function<void(camera&, hittable_list&)>> batch;
+            std::chrono::high_resolution_clock::time_point since;
+            {
+                lock_guard<mutex> lock (m);
+                if(pending_edits == 0){
+                    interrupted = stopping.load();
+                    return false;
+                }
+                batch.swap(edits);
+                pending_edits = 0;
+                since = edit_time;
+                interrupted = stopping.load();
+            }
+            bool had_bvh = world.has_bvh();
+            for(auto& fn : batch)fn(cam, world);
+            if(had_bvh && !world.has_bvh())world.build_bvh();
+            restart(since);
+            return true;
+        }
+
+        void restart(std::chrono::high_resolution_clock::time_point since){
+            cam.setup();
+            state.generation++;
+            state.width = cam.screen_width;
+            state.height = cam.height();
+            state.block = max(1, coarse_block);
+            state.passes = 0;
+            sum.assign(state.width * state.height, color(0,0,0));
+            bytes.assign(state.width * state.height * 3, 0);
+            restart_time = since;
+        }
+
+        // One coarse level or one full resolution pass, false when an edit cut it short
+        bool render_frame(){
+            int w = state.width, h = state.height, block = state.block;
+            int rows = (h + block - 1) / block;
+            pool.run(rows, [&](int row, int){
+                if(interrupted)return;
+                int j0 = row * block;
+                for(int i0 = 0; i0 < w; i0 += block){
+                    if(block > 1){
+                        // One sample for the whole block, at its corner pixel
+                        color c = cam.sample(i0, j0, 0, world, lights);
+                        for(int j = j0; j < min(j0 + block, h); j++)
+                            for(int i = i0; i < min(i0 + block, w); i++)
+                                store(i, j, c);
+                    }
+                    else {
+                        sum[j0 * w + i0] += cam.sample(i0, j0, state.passes, world, lights);
+                        store(i0, j0, sum[j0 * w + i0] / (state.passes + 1));
+                    }
+                }
+            });
+            if(interrupted)return false;
+
+            state.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - restart_time).count();
+            if(block == 1)state.passes++;
+            return true;
+        }
+
+        // Pixel (i, j) with row 0 at the bottom, stored top row first like write_color
+        void store(int i, int j, const color& c){
+            static const interval intensity(0.000001,0.9999999);
+            unsigned char* p = &bytes[((state.height - 1 - j) * state.width + i) * 3];
+            for(int k = 0; k < 3; k++)p[k] = static_cast<int>(256 * intensity.clamp(linear_to_gamma(c.e[k])));
+        }
+
+        bool send_frame(int client){
+            return send_all(client, &state, sizeof(state)) && send_all(client, bytes.data(), bytes.size());
+        }
+};
+
+// Minimal client, for tools and tests
+class preview_client {
+    public:
+        preview_frame_header header;
+        vector<unsigned char> pixels;
+
+        ~preview_client(){ if(fd >= 0)close(fd); }
+
+        bool connect_to(const string& path){
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd < 0)return false;
+            sockaddr_un addr {};
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            return connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        }
+
+        bool send_command(const string& line){
+            string l = line + "\n";
+            return send_all(fd, l.data(), l.size());
+        }
+
+        // Blocks for the next frame
+        bool read_frame(){
+            if(!recv_all(fd, &header, sizeof(header)) || header.magic != 0x46505452)return false;
+            pixels.resize(size_t(header.width) * header.height * 3);
+            return recv_all(fd, pixels.data(), pixels.size());
+        }
+
+    private:
+        int fd = -1;
+};
+
+#endif
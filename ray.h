@@ -9,6 +9,10 @@ class ray {
         point3 orig;
         vec3 dir;
 
+        // Ray cone for texture filtering: width at the origin and growth per unit distance
+        double cone = 0;
+        double spread = 0;
+
         ray() {};
         ray(const point3& o,const vec3& d) : orig(o), dir(d) {};
         ray(const point3& o,const vec4& d) : orig(o), dir(vec3(d.x, d.y, d.z)) {};
@@ -20,6 +24,11 @@ class ray {
             return orig + t*dir;
         }
 
+        // Cone width after travelling to t
+        double width_at(double t) const {
+            return cone + spread * t * dir.length();
+        }
+
         point3 fast_at(double t) const {
             return simd_add_mul(vec4(orig), vec4(dir), t);
         }
@@ -0,0 +1,225 @@
+#ifndef RESTIR_H
+#define RESTIR_H
+
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "material.h"
+#include "film.h"
+#include "sampling.h"
+#include "lights.h"
+#include "parallel.h"
+#include "stats.h"
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+// Direct light from the sphere lights at the first hit of every pixel by reservoir based
+// resampling (Bitterli et al., "Spatiotemporal reservoir resampling", 2020). Each pixel
+// streams a few candidate points on the lights through a reservoir that keeps one in
+// proportion to its unshadowed contribution, then merges the reservoir its pixel ended the
+// previous pass with (temporal reuse) and those of a few neighbours with a similar hit
+// (spatial reuse), and shades the survivor with one shadow ray. Candidates pick a light
+// uniformly and a point on its half facing the hit, so the work per pixel does not grow
+// with the number of lights, only the lights' own hit tests do (build a BVH over them).
+//
+// The reuse is the biased variant of the paper: merged counts are normalized by 1 / M and
+// neighbours are only rejected by normal and depth, which darkens a little at geometric
+// edges. Without reuse (temporal_cap and spatial_neighbors 0) it is plain RIS and unbiased.
+//
+// Each pass runs two phases over all pixels before the camera traces its paths, candidates
+// and temporal reuse, then spatial reuse and shading. Each reads only what the previous
+// phase or pass finished, so the image depends on the seed alone.
+
+// First hit of a pixel's camera ray, the reservoir's shading point
+class restir_hit {
+    public:
+        hit_record rec;
+        vec3 dir;               // camera ray direction, as traced
+        double depth = 0;
+        bool valid = false;     // a hit without a delta lobe
+};
+
+class light_reservoir {
+    public:
+        point3 y;               // the kept point on a light and the light's normal there
+        vec3 n;
+        double w_sum = 0;
+        double m = 0;           // candidates it stands for
+        double W = 0;           // contribution weight, an estimate of 1 / pdf(y)
+
+        bool update(const point3& p, const vec3& normal, double w, double u){
+            w_sum += w;
+            m++;
+            if(w <= 0 || u * w_sum >= w)return false;
+            y = p;
+            n = normal;
+            return true;
+        }
+};
+
+class restir_lights {
+    public:
+        int candidates = 32;
+        double temporal_cap = 20;       // history kept, in multiples of candidates
+        int spatial_neighbors = 4;
+        double spatial_radius = 16;     // pixels
+        color radiance = color(10,10,10);
+
+        void resize(int w, int h){
+            width = w;
+            height = h;
+            hits.assign(w * h, restir_hit());
+            initial.assign(w * h, light_reservoir());
+            final.assign(w * h, light_reservoir());
+            direct.assign(w * h, color(0,0,0));
+        }
+
+        bool sampled(int pixel) const { return hits[pixel].valid; }
+        const color& direct_light(int pixel) const { return direct[pixel]; }
+
+        // Fills the direct light of every pixel for a pass. primary(i, j, r, rec) traces the
+        // camera ray of the pixel the way the camera will in the pass and reports its hit
+        void prepare(const vector<tile>& tiles, int pass, uint64_t seed, const hittable& world, const hittable& lights,
+                     const function<bool(int, int, ray&, hit_record&)>& primary, int threads = 0){
+            sphere_lights emitters (lights);
+
+            parallel_for(tiles.size(), [&](int t){
+                for(int j = tiles[t].y0; j < tiles[t].y1; j++)
+                    for(int i = tiles[t].x0; i < tiles[t].x1; i++){
+                        int pixel = j * width + i;
+                        restir_hit& h = hits[pixel];
+                        ray r;
+                        h.valid = primary(i, j, r, h.rec) && h.rec.mat->scattering_pdf(r, h.rec, h.rec.normal) > 0;
+                        h.dir = r.direction();
+                        h.depth = h.valid ? h.rec.t * h.dir.length() : 0;
+                        if(!h.valid || emitters.empty())continue;
+
+                        seed_random(key(pixel, pass, seed, 1));
+                        reseed_direction_caches(uint32_t(random_u64()));
+                        light_reservoir& res = initial[pixel];
+                        res = light_reservoir();
+                        for(int c = 0; c < candidates; c++){
+                            point3 y;
+                            vec3 n;
+                            double pdf = sample_light(emitters, h.rec.p, y, n);
+                            res.update(y, n, pdf > 0 ? target(h, y, n) / pdf : 0, random_double());
+                        }
+                        finish(res, h);
+                        // Visibility reuse, an occluded pick stops counting right away
+                        if(res.W > 0 && visibility(h.rec.p, res.y, world, lights) == 0)res.W = 0;
+
+                        // The pixel's reservoir from the last pass, the camera has not moved
+                        if(pass > 0 && temporal_cap > 0){
+                            light_reservoir past = final[pixel];
+                            past.m = fmin(past.m, temporal_cap * candidates);
+                            light_reservoir merged;
+                            merge(merged, res, h, random_double());
+                            merge(merged, past, h, random_double());
+                            finish(merged, h);
+                            res = merged;
+                        }
+                    }
+            }, threads);
+
+            parallel_for(tiles.size(), [&](int t){
+                for(int j = tiles[t].y0; j < tiles[t].y1; j++)
+                    for(int i = tiles[t].x0; i < tiles[t].x1; i++){
+                        int pixel = j * width + i;
+                        const restir_hit& h = hits[pixel];
+                        direct[pixel] = color(0,0,0);
+                        if(!h.valid || emitters.empty())continue;
+
+                        seed_random(key(pixel, pass, seed, 2));
+                        light_reservoir merged;
+                        merge(merged, initial[pixel], h, random_double());
+                        for(int k = 0; k < spatial_neighbors; k++){
+                            double radius = spatial_radius * sqrt(random_double());
+                            double phi = 2 * pi * random_double();
+                            int ni = i + int(lround(radius * cos(phi))), nj = j + int(lround(radius * sin(phi)));
+                            if(ni < 0 || nj < 0 || ni >= width || nj >= height || (ni == i && nj == j))continue;
+                            int other = nj * width + ni;
+                            const restir_hit& o = hits[other];
+                            if(!o.valid || dot(o.rec.normal, h.rec.normal) < 0.9 || fabs(o.depth - h.depth) > 0.1 * h.depth)continue;
+                            merge(merged, initial[other], h, random_double());
+                        }
+                        finish(merged, h);
+                        final[pixel] = merged;
+
+                        if(merged.W > 0)
+                            direct[pixel] = contribution(h, merged.y, merged.n) * (merged.W * visibility(h.rec.p, merged.y, world, lights));
+                    }
+            }, threads);
+        }
+
+    private:
+        int width = 0;
+        int height = 0;
+        vector<restir_hit> hits;
+        vector<light_reservoir> initial;    // candidates and temporal reuse of this pass
+        vector<light_reservoir> final;      // after spatial reuse, kept for the next pass
+        vector<color> direct;
+
+        static uint64_t key(int pixel, int pass, uint64_t seed, int phase){
+            return ((uint64_t)pixel << 32 | (uint32_t)pass) ^ (seed * 0xd1342543de82ef95ull) ^ ((uint64_t)phase * 0xbf58476d1ce4e5b9ull) ^ 0x94d049bb133111ebull;
+        }
+
+        // A light picked uniformly and a uniform point on its half facing x, from the
+        // precomputed directions. Returns the density per unit area of the point
+        double sample_light(const sphere_lights& emitters, const point3& x, point3& y, vec3& n) const {
+            int count = emitters.spheres.size();
+            const sphere* light = emitters.spheres[min(int(random_double() * count), count - 1)];
+            float dx, dy, dz;
+            next_unit_direction(dx, dy, dz);
+            n = vec3(dx, dy, dz);
+            if(dot(n, x - light->center) < 0)n = -1 * n;
+            y = light->center + light->radius * n;
+            return 1 / (2 * pi * light->radius * light->radius * count);
+        }
+
+        // Unshadowed light from y as ray_color would get it from a bounce towards y
+        color contribution(const restir_hit& h, const point3& y, const vec3& n) const {
+            vec3 d = y - h.rec.p;
+            double dist2 = d.length_squared();
+            vec3 wi = d / sqrt(dist2);
+            double cos_light = dot(n, -1 * wi);
+            if(cos_light <= 0)return color(0,0,0);
+            color f = h.rec.mat->eval(ray(h.rec.p - h.dir, h.dir), h.rec, wi);
+            return f * radiance * (dot(h.dir, wi) * cos_light / dist2);
+        }
+
+        // Resampling target, the luminance of the contribution. ray_color's estimate is negative
+        // on reflection, so it is the magnitude
+        double target(const restir_hit& h, const point3& y, const vec3& n) const {
+            color c = contribution(h, y, n);
+            return fabs(0.2126 * c.e[0] + 0.7152 * c.e[1] + 0.0722 * c.e[2]);
+        }
+
+        void merge(light_reservoir& into, const light_reservoir& from, const restir_hit& h, double u) const {
+            double m = into.m;
+            into.update(from.y, from.n, from.W > 0 ? target(h, from.y, from.n) * from.W * from.m : 0, u);
+            into.m = m + from.m;
+        }
+
+        void finish(light_reservoir& r, const restir_hit& h) const {
+            double p = r.w_sum > 0 ? target(h, r.y, r.n) : 0;
+            r.W = p > 0 ? r.w_sum / (r.m * p) : 0;
+        }
+
+        double visibility(const point3& x, const point3& y, const hittable& world, const hittable& lights) const {
+            vec3 d = y - x;
+            double dist = d.length();
+            ray shadow (x, d / dist);
+            interval between (0.00000001, dist * (1 - 1e-6));
+            hit_record unused;
+            STAT_INC(rays_traced);
+            if(lights.hit(shadow, between, unused))return 0;
+            return world.transmittance(shadow, between);
+        }
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "utils.h"
+
+#include <cstdint>
+
+// Samplers return a value in [0,1) for a (pixel, sample index, dimension) triple.
+// The same triple always gives the same value, except for independent_sampler
+class sampler {
+    public:
+        virtual ~sampler() = default;
+
+        virtual double get(uint32_t pixel, uint32_t index, uint32_t dim) const = 0;
+};
+
+uint32_t hash_u32(uint32_t x){
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t hash_combine(uint32_t seed, uint32_t v){
+    return hash_u32(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+double u32_to_unit(uint32_t x){
+    return x * (1.0 / 4294967296.0);
+}
+
+uint32_t reverse_bits(uint32_t x){
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Hash based Owen scrambling (Laine-Karras permutation, constants from Burley 2020)
+uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed){
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// First two dimensions of the Sobol sequence as 32 bit fixed point
+uint32_t sobol_2d(uint32_t index, uint32_t dim){
+    if(dim == 0)return reverse_bits(index);
+
+    // Dimension 1, primitive polynomial x + 1, m_i = 2*m_(i-1) ^ m_(i-1)
+    uint32_t result = 0;
+    uint32_t v = 1u << 31;
+    for(; index; index >>= 1, v ^= v >> 1){
+        if(index & 1)result ^= v;
+    }
+    return result;
+}
+
+// Plain random_double() draws, ignores the indices. This is what the renderer used before samplers
+class independent_sampler : public sampler {
+    public:
+        double get(uint32_t pixel, uint32_t index, uint32_t dim) const override {
+            return random_double();
+        }
+};
+
+// Jittered strata of 1/samples per dimension, strata are shuffled per pixel and dimension
+// so that every pair of dimensions forms a latin hypercube. Needs the spp up front
+class stratified_sampler : public sampler {
+    public:
+        stratified_sampler(uint32_t samples) : samples(samples > 0 ? samples : 1) {};
+
+        double get(uint32_t pixel, uint32_t index, uint32_t dim) const override {
+            // Every batch of samples past the first gets a fresh set of strata
+            uint32_t seed = hash_combine(hash_combine(hash_u32(pixel), dim), index / samples);
+            uint32_t stratum = permute(index % samples, samples, seed);
+            double jitter = u32_to_unit(hash_combine(seed, index));
+            return (stratum + jitter) / samples;
+        }
+
+    private:
+        uint32_t samples;
+
+        // Random permutation of [0,n) without tables (Kensler 2013, cycle walking)
+        static uint32_t permute(uint32_t i, uint32_t n, uint32_t seed){
+            uint32_t w = n - 1;
+            w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+            do {
+                i ^= seed; i *= 0xe170893du;
+                i ^= seed >> 16; i ^= (i & w) >> 4;
+                i ^= seed >> 8; i *= 0x0929eb3f;
+                i ^= seed >> 23; i ^= (i & w) >> 1;
+                i *= 1 | seed >> 27; i *= 0x6935fa69;
+                i ^= (i & w) >> 11; i *= 0x74dcb303;
+                i ^= (i & w) >> 2; i *= 0x9e501cc3;
+                i ^= (i & w) >> 2; i *= 0xc860a3df;
+                i &= w;
+                i ^= i >> 5;
+            } while(i >= n);
+            return (i + seed) % n;
+        }
+};
+
+// Owen scrambled Sobol, padded in pairs of dimensions: every pair (2k, 2k+1) uses the
+// 2D Sobol sequence with its own index shuffle and scramble seed
+class sobol_sampler : public sampler {
+    public:
+        sobol_sampler(uint32_t seed = 0) : seed(seed) {};
+
+        double get(uint32_t pixel, uint32_t index, uint32_t dim) const override {
+            uint32_t pixel_seed = hash_combine(hash_u32(pixel), seed);
+            uint32_t pair_seed = hash_combine(pixel_seed, dim >> 1);
+            uint32_t shuffled = nested_uniform_scramble(index, pair_seed);
+            uint32_t x = sobol_2d(shuffled, dim & 1);
+            return u32_to_unit(nested_uniform_scramble(x, hash_combine(pair_seed, dim)));
+        }
+
+    private:
+        uint32_t seed;
+};
+
+// Sobol with a per pixel Cranley-Patterson rotation taken from a blue noise dither mask,
+// this spreads the error of neighbouring pixels as blue noise at low spp.
+// The mask is the R2 sequence dither (Roberts 2018), offset per dimension
+class blue_noise_sampler : public sampler {
+    public:
+        blue_noise_sampler(uint32_t width) : width(width > 0 ? width : 1) {};
+
+        double get(uint32_t pixel, uint32_t index, uint32_t dim) const override {
+            uint32_t x = pixel % width;
+            uint32_t y = pixel / width;
+
+            // Offset the mask per dimension so dimensions are not correlated
+            uint32_t offset = hash_u32(dim);
+            double mask = dither(x + (offset & 0xff), y + ((offset >> 8) & 0xff));
+
+            // Same shuffle in every pixel so the rotation alone decides the error pattern
+            uint32_t shuffled = (dim >> 1) ? nested_uniform_scramble(index, hash_u32(dim >> 1)) : index;
+            double s = u32_to_unit(sobol_2d(shuffled, dim & 1)) + mask;
+            return s - floor(s);
+        }
+
+    private:
+        uint32_t width;
+
+        static double dither(uint32_t x, uint32_t y){
+            // 1/g and 1/g^2 where g is the plastic number
+            const double a1 = 0.7548776662466927;
+            const double a2 = 0.5698402909980532;
+            double v = a1 * x + a2 * y;
+            return v - floor(v);
+        }
+};
+
+// Sample stream of a single camera path, hands out consecutive dimensions
+class sample_stream {
+    public:
+        const sampler* s;
+        uint32_t pixel;
+        uint32_t index;
+        uint32_t dim;
+
+        sample_stream(const sampler* s, uint32_t pixel, uint32_t index) : s(s), pixel(pixel), index(index), dim(0) {};
+
+        double next() {
+            return s->get(pixel, index, dim++);
+        }
+};
+
+// Path currently being traced on this thread, set by the camera
+thread_local sample_stream* active_stream = nullptr;
+
+double sample_1d(){
+    if(active_stream)return active_stream->next();
+    return random_double();
+}
+
+void sample_2d(double& u1, double& u2){
+    if(active_stream){
+        u1 = active_stream->next();
+        u2 = active_stream->next();
+        return;
+    }
+    u1 = random_double();
+    u2 = random_double();
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include "utils.h"
+
+#include <cstdint>
+#include <immintrin.h>
+
+// Closed form direction sampling, no rejection loops.
+// The simd kernels map uniform numbers in [0,1) to 4 (SSE) or 8 (AVX2) directions at once,
+// the direction caches below hand them out one at a time to scalar callers.
+
+// sin and cos of 2*pi*u for u in [0,1), max error about 1e-7
+void sincos_2pi4(__m128 u, __m128& s, __m128& c){
+    // Quadrant q and remainder a in [-pi/4, pi/4]
+    const __m128 q = _mm_round_ps(_mm_mul_ps(u, _mm_set1_ps(4.0f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    const __m128 a = _mm_mul_ps(_mm_sub_ps(u, _mm_mul_ps(q, _mm_set1_ps(0.25f))), _mm_set1_ps(6.28318530718f));
+    const __m128 a2 = _mm_mul_ps(a, a);
+
+    // Taylor series, sin to a^9 and cos to a^8
+    __m128 ps = _mm_set1_ps(1.0f / 362880.0f);
+    ps = _mm_add_ps(_mm_mul_ps(ps, a2), _mm_set1_ps(-1.0f / 5040.0f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, a2), _mm_set1_ps(1.0f / 120.0f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, a2), _mm_set1_ps(-1.0f / 6.0f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, a2), _mm_set1_ps(1.0f));
+    ps = _mm_mul_ps(ps, a);
+
+    __m128 pc = _mm_set1_ps(1.0f / 40320.0f);
+    pc = _mm_add_ps(_mm_mul_ps(pc, a2), _mm_set1_ps(-1.0f / 720.0f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, a2), _mm_set1_ps(1.0f / 24.0f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, a2), _mm_set1_ps(-1.0f / 2.0f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, a2), _mm_set1_ps(1.0f));
+
+    // Rotate by q quarter turns: odd quadrants swap sin and cos, then fix the signs
+    const __m128i qi = _mm_cvtps_epi32(q);
+    const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(qi, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    const __m128 sign_s = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(qi, _mm_set1_epi32(2)), 30));
+    const __m128 sign_c = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(qi, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+    s = _mm_xor_ps(_mm_blendv_ps(ps, pc, swap), sign_s);
+    c = _mm_xor_ps(_mm_blendv_ps(pc, ps, swap), sign_c);
+}
+
+// Uniform directions on the unit sphere
+void unit_directions4(__m128 u1, __m128 u2, __m128& x, __m128& y, __m128& z){
+    z = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(u1, _mm_set1_ps(2.0f)));
+    const __m128 r = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(z, z))));
+    __m128 s, c;
+    sincos_2pi4(u2, s, c);
+    x = _mm_mul_ps(r, c);
+    y = _mm_mul_ps(r, s);
+}
+
+// Cosine weighted directions around +z, pdf cos(theta)/pi
+void cosine_directions4(__m128 u1, __m128 u2, __m128& x, __m128& y, __m128& z){
+    const __m128 r = _mm_sqrt_ps(u2);
+    __m128 s, c;
+    sincos_2pi4(u1, s, c);
+    x = _mm_mul_ps(r, c);
+    y = _mm_mul_ps(r, s);
+    z = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1.0f), u2)));
+}
+
+#ifdef __AVX2__
+void sincos_2pi8(__m256 u, __m256& s, __m256& c){
+    const __m256 q = _mm256_round_ps(_mm256_mul_ps(u, _mm256_set1_ps(4.0f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    const __m256 a = _mm256_mul_ps(_mm256_sub_ps(u, _mm256_mul_ps(q, _mm256_set1_ps(0.25f))), _mm256_set1_ps(6.28318530718f));
+    const __m256 a2 = _mm256_mul_ps(a, a);
+
+    __m256 ps = _mm256_set1_ps(1.0f / 362880.0f);
+    ps = _mm256_fmadd_ps(ps, a2, _mm256_set1_ps(-1.0f / 5040.0f));
+    ps = _mm256_fmadd_ps(ps, a2, _mm256_set1_ps(1.0f / 120.0f));
+    ps = _mm256_fmadd_ps(ps, a2, _mm256_set1_ps(-1.0f / 6.0f));
+    ps = _mm256_fmadd_ps(ps, a2, _mm256_set1_ps(1.0f));
+    ps = _mm256_mul_ps(ps, a);
+
+    __m256 pc = _mm256_set1_ps(1.0f / 40320.0f);
+    pc = _mm256_fmadd_ps(pc, a2, _mm256_set1_ps(-1.0f / 720.0f));
+    pc = _mm256_fmadd_ps(pc, a2, _mm256_set1_ps(1.0f / 24.0f));
+    pc = _mm256_fmadd_ps(pc, a2, _mm256_set1_ps(-1.0f / 2.0f));
+    pc = _mm256_fmadd_ps(pc, a2, _mm256_set1_ps(1.0f));
+
+    const __m256i qi = _mm256_cvtps_epi32(q);
+    const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(qi, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    const __m256 sign_s = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(qi, _mm256_set1_epi32(2)), 30));
+    const __m256 sign_c = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(qi, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+
+    s = _mm256_xor_ps(_mm256_blendv_ps(ps, pc, swap), sign_s);
+    c = _mm256_xor_ps(_mm256_blendv_ps(pc, ps, swap), sign_c);
+}
+
+void unit_directions8(__m256 u1, __m256 u2, __m256& x, __m256& y, __m256& z){
+    z = _mm256_fnmadd_ps(u1, _mm256_set1_ps(2.0f), _mm256_set1_ps(1.0f));
+    const __m256 r = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_fnmadd_ps(z, z, _mm256_set1_ps(1.0f))));
+    __m256 s, c;
+    sincos_2pi8(u2, s, c);
+    x = _mm256_mul_ps(r, c);
+    y = _mm256_mul_ps(r, s);
+}
+
+void cosine_directions8(__m256 u1, __m256 u2, __m256& x, __m256& y, __m256& z){
+    const __m256 r = _mm256_sqrt_ps(u2);
+    __m256 s, c;
+    sincos_2pi8(u1, s, c);
+    x = _mm256_mul_ps(r, c);
+    y = _mm256_mul_ps(r, s);
+    z = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(_mm256_set1_ps(1.0f), u2)));
+}
+#endif
+
+// 8 lanes of xorshift32, uniform floats with 24 bits of precision
+class simd_rng {
+    public:
+        simd_rng(uint32_t seed = 1) { reseed(seed); }
+
+        void reseed(uint32_t seed){
+            for(int i = 0; i < 8; i++){
+                // splitmix style scramble, the state must never be 0
+                uint32_t x = seed + 0x9e3779b9u * (i + 1);
+                x = (x ^ (x >> 16)) * 0x85ebca6bu;
+                x = (x ^ (x >> 13)) * 0xc2b2ae35u;
+                x ^= x >> 16;
+                state[i] = x ? x : 0x6d2b79f5u;
+            }
+        }
+
+        __m128 next4(int half = 0){
+            __m128i x = _mm_loadu_si128((__m128i*)&state[half * 4]);
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+            x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+            _mm_storeu_si128((__m128i*)&state[half * 4], x);
+            return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+        }
+
+#ifdef __AVX2__
+        __m256 next8(){
+            __m256i x = _mm256_loadu_si256((__m256i*)state);
+            x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+            x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+            x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+            _mm256_storeu_si256((__m256i*)state, x);
+            return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+        }
+#endif
+
+    private:
+        uint32_t state[8];
+};
+
+// Batch of 8 precomputed directions, refilled with one 8 wide (or two 4 wide) kernel call
+class direction_cache {
+    public:
+        direction_cache(bool cosine) : cosine(cosine) {};
+
+        void next(float& dx, float& dy, float& dz){
+            if(used == 8)refill();
+            dx = x[used];
+            dy = y[used];
+            dz = z[used];
+            used++;
+        }
+
+        void reseed(uint32_t seed){
+            rng.reseed(seed);
+            used = 8;
+        }
+
+    private:
+        alignas(32) float x[8];
+        alignas(32) float y[8];
+        alignas(32) float z[8];
+        int used = 8;
+        bool cosine;
+        simd_rng rng;
+
+        void refill(){
+#ifdef __AVX2__
+            __m256 u1 = rng.next8();
+            __m256 u2 = rng.next8();
+            __m256 vx, vy, vz;
+            if(cosine)cosine_directions8(u1, u2, vx, vy, vz);
+            else unit_directions8(u1, u2, vx, vy, vz);
+            _mm256_store_ps(x, vx);
+            _mm256_store_ps(y, vy);
+            _mm256_store_ps(z, vz);
+#else
+            for(int half = 0; half < 2; half++){
+                __m128 u1 = rng.next4(half);
+                __m128 u2 = rng.next4(half);
+                __m128 vx, vy, vz;
+                if(cosine)cosine_directions4(u1, u2, vx, vy, vz);
+                else unit_directions4(u1, u2, vx, vy, vz);
+                _mm_store_ps(x + half * 4, vx);
+                _mm_store_ps(y + half * 4, vy);
+                _mm_store_ps(z + half * 4, vz);
+            }
+#endif
+            used = 0;
+        }
+};
+
+thread_local direction_cache unit_direction_cache (false);
+thread_local direction_cache cosine_direction_cache (true);
+
+// Next uniform direction on the unit sphere
+void next_unit_direction(float& x, float& y, float& z){
+    unit_direction_cache.next(x, y, z);
+}
+
+// Restarts both caches from seed, the camera does this per pixel sample
+void reseed_direction_caches(uint32_t seed){
+    unit_direction_cache.reseed(seed);
+    cosine_direction_cache.reseed(seed ^ 0x5bd1e995u);
+}
+
+// Next cosine weighted direction around +z
+void next_cosine_direction(float& x, float& y, float& z){
+    cosine_direction_cache.next(x, y, z);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "vec3.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "material.h"
+#include "arena.h"
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+// Text scene files, one statement per line, # starts a comment:
+//   material name lambertian R G B
+//   material name metal R G B fuzz
+//   material name dielectric ir
+//   sphere x y z r material
+//   light x y z r
+//   camera [width n] [aspect a] [depth n] [spp n] [lookfrom x y z] [lookat x y z] [vup x y z]
+// Materials are declared before the spheres that use them. A BVH is built over the world
+// once it has bvh_threshold spheres or more. Materials, spheres and BVH nodes are placed in
+// the scene's arena in file order.
+
+const int bvh_threshold = 32;
+
+class scene_description {
+    public:
+        // Holds what load_scene creates, declared first so it goes after the lists. Objects
+        // must not be kept past the scene
+        arena memory;
+
+        hittable_list world;
+        hittable_list lights;
+
+        // Camera settings, overridable per job
+        int width = 400;
+        double aspect = 16.0 / 9.0;
+        int depth = 6;
+        int spp = 16;
+        point3 lookfrom = point3(0,0,0);
+        point3 lookat = point3(0,0,-1);
+        vec3 vup = vec3(0,1,0);
+};
+
+// Materials number themselves from a global counter, so scenes are parsed one at a time
+mutex scene_parse_mutex;
+
+// Parses the file at path into s, false with a message naming the line on errors
+bool load_scene(const string& path, scene_description& s, string& error){
+    ifstream in (path);
+    if(!in){
+        error = "cannot open " + path;
+        return false;
+    }
+
+    unique_lock<mutex> lock (scene_parse_mutex);
+    map<string, shared_ptr<material>> materials;
+    string line;
+    for(int number = 1; getline(in, line); number++){
+        size_t hash = line.find('#');
+        if(hash != string::npos)line.erase(hash);
+        istringstream words (line);
+        string kind;
+        if(!(words >> kind))continue;
+
+        bool ok = false;
+        if(kind == "material"){
+            string name, type;
+            double r, g, b, x;
+            if(words >> name >> type){
+                if(type == "lambertian" && words >> r >> g >> b)materials[name] = make_arena_shared<lambertian>(s.memory, color(r, g, b));
+                else if(type == "metal" && words >> r >> g >> b >> x)materials[name] = make_arena_shared<metal>(s.memory, color(r, g, b), x);
+                else if(type == "dielectric" && words >> x)materials[name] = make_arena_shared<dielectic>(s.memory, x);
+                ok = materials.count(name) > 0;
+            }
+        }
+        else if(kind == "sphere"){
+            double x, y, z, r;
+            string name;
+            if(words >> x >> y >> z >> r >> name && materials.count(name)){
+                s.world.add(make_arena_shared<sphere>(s.memory, point3(x, y, z), r, materials[name]));
+                ok = true;
+            }
+        }
+        else if(kind == "light"){
+            double x, y, z, r;
+            if(words >> x >> y >> z >> r){
+                s.lights.add(make_arena_shared<sphere>(s.memory, point3(x, y, z), r, make_arena_shared<lambertian>(s.memory, color(1,1,1))));
+                ok = true;
+            }
+        }
+        else if(kind == "camera"){
+            ok = true;
+            string key;
+            while(ok && words >> key){
+                if(key == "width")ok = bool(words >> s.width) && s.width > 0;
+                else if(key == "aspect")ok = bool(words >> s.aspect) && s.aspect > 0;
+                else if(key == "depth")ok = bool(words >> s.depth) && s.depth > 0;
+                else if(key == "spp")ok = bool(words >> s.spp) && s.spp > 0;
+                else if(key == "lookfrom")ok = bool(words >> s.lookfrom.e[0] >> s.lookfrom.e[1] >> s.lookfrom.e[2]);
+                else if(key == "lookat")ok = bool(words >> s.lookat.e[0] >> s.lookat.e[1] >> s.lookat.e[2]);
+                else if(key == "vup")ok = bool(words >> s.vup.e[0] >> s.vup.e[1] >> s.vup.e[2]);
+                else ok = false;
+            }
+        }
+
+        if(!ok){
+            error = path + ":" + to_string(number) + ": cannot read '" + line + "'";
+            return false;
+        }
+    }
+
+    lock.unlock();
+    if(s.world.objects.size() >= bvh_threshold)s.world.build_bvh(&s.memory);
+    return true;
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include "ray.h"
 #include "hittable.h"
 #include "material.h"
+#include "stats.h"
 
 #include <cmath>
 
@@ -27,6 +28,34 @@ class sphere : public hittable {
         virtual bool fast_hit(const ray& r, interval ray_t, hit_record& rec) const override;
 
         virtual bool simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const override;
+
+        virtual void surface_coords(const ray& r, hit_record& rec) const override {
+            get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
+            rec.footprint = footprint(r, rec.t);
+        }
+
+        virtual void surface_coords4(const ray4& r4, hit_record4& rec4) const override {
+            get_sphere_uv(vec3(simd_mul(simd_minus(rec4.p, vec4(center)), 1/radius)), rec4.u, rec4.v);
+        }
+
+        virtual aabb bounding_box() const override {
+            vec3 r (radius, radius, radius);
+            return aabb(center - r, center + r);
+        }
+
+    private:
+        // u around the y axis from x = -1, v from the bottom pole, p on the unit sphere
+        static void get_sphere_uv(const point3& p, double& u, double& v){
+            auto theta = acos(fmin(fmax(-p.e[1], -1.0), 1.0));
+            auto phi = atan2(-p.e[2], p.e[0]) + pi;
+            u = phi / (2 * pi);
+            v = theta / pi;
+        }
+
+        // The ray cone width at the hit, relative to the half circumference that v spans
+        double footprint(const ray& r, double t) const {
+            return r.width_at(t) / (pi * radius);
+        }
 };
 
 double sphere::intersect(const ray& r) const {
@@ -42,6 +71,7 @@ double sphere::intersect(const ray& r) const {
 }
 
 bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
+    STAT_INC(sphere_tests);
     vec3 oc = r.origin() - center;
 
     auto a = r.direction().length_squared();
@@ -69,12 +99,16 @@ bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
     rec.set_face_normal(r, outward_normal);
    
     rec.mat = mat;
+    rec.object = this;
+    rec.object_id = object_id;
+    STAT_INC(sphere_hits);
     
     return true;
 }
 
 
 bool sphere::fast_hit(const ray& r, interval ray_t, hit_record& rec) const {
+    STAT_INC(sphere_tests);
     vec3 oc = r.origin() - center;
     vec4 oc4 = oc;
     vec4 rdir4 = r.direction();
@@ -91,12 +125,13 @@ bool sphere::fast_hit(const ray& r, interval ray_t, hit_record& rec) const {
     
     if (discriminant < 0) return false;
     float sqrtd = sqrt(discriminant);
+    float inv_a = math_rcp_t(a);
 
     // Returns the nearest root that lies in the acceptable range
-    float root = (-half_b - sqrtd) / a;
+    float root = (-half_b - sqrtd) * inv_a;
     if(!ray_t.surrounds(root)){
         // Reading second hit
-        root = (-half_b + sqrtd) / a;
+        root = (-half_b + sqrtd) * inv_a;
         if(!ray_t.surrounds(root)){
             return false;
         }
@@ -104,18 +139,21 @@ bool sphere::fast_hit(const ray& r, interval ray_t, hit_record& rec) const {
 
     rec.t = root;
     rec.p = r.fast_at(rec.t);
-    //vec3 outward_normal = (rec.p - center) / radius;
-    rec.normal = (rec.p - center) / radius;
+    vec3 outward_normal = (rec.p - center) / radius;
     //rec.normal = simd_mul(simd_minus(vec4(rec.p), vec4(center)), 1/radius);
 
-    //rec.set_face_normal(r, outward_normal);
+    rec.set_face_normal(r, outward_normal);
    
     rec.mat = mat;
+    rec.object = this;
+    rec.object_id = object_id;
+    STAT_INC(sphere_hits);
     
     return true;
 }
 
 bool sphere::simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const {
+    STAT_INC(sphere_tests);
     if(ray_t.max - ray_t.min < 0.001)return false;
     vec4 center4 (center);
     vec4 oc = simd_minus(r4.origin(), center4);
@@ -129,12 +167,13 @@ bool sphere::simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const {
 
     if (discriminant != 0 && discriminant < 0.001) return false;
     float sqrtd = sqrt(discriminant);
+    float inv_a = math_rcp_t(a);
 
     // Returns the nearest root that lies in the acceptable range
-    float root = (-half_b - sqrtd) / a;
+    float root = (-half_b - sqrtd) * inv_a;
     if(!ray_t.surrounds(root)){
         // Reading second hit
-        root = (-half_b + sqrtd) / a;
+        root = (-half_b + sqrtd) * inv_a;
         if(!ray_t.surrounds(root)){
             return false;
         }
@@ -142,11 +181,12 @@ bool sphere::simd_hit(const ray4& r4, interval ray_t, hit_record4& rec4) const {
 
     rec4.t = root;
     rec4.p = r4.simd_at(rec4.t);
-    //vec4 outward_normal = simd_mul(simd_minus(rec4.p, center4), 1/radius);
+    vec4 outward_normal = simd_mul(simd_minus(rec4.p, center4), 1/radius);
 
-    //rec4.set_face_normal(r4, outward_normal);
-    rec4.normal = simd_mul(simd_minus(rec4.p, center4), 1/radius);
+    rec4.set_face_normal(r4, outward_normal);
     rec4.mat = mat;
+    rec4.object = this;
+    STAT_INC(sphere_hits);
     
     return true;
 }
@@ -0,0 +1,223 @@
+#ifndef STATIC_SCENE_H
+#define STATIC_SCENE_H
+
+#include "vec3.h"
+#include "ray.h"
+#include "material.h"
+#include "fastmath.h"
+#include "stats.h"
+
+#include <cmath>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Scenes of spheres whose material types are known at compile time, for the specialised
+// integrator static_trace. The spheres of each material type live in their own SoA
+// container and the containers in a std::tuple, so a ray is tested with one tight loop
+// per type, and the hit is shaded by a direct call on the concrete material. No virtual
+// call, shared_ptr or texture lookup is left on the path and the compiler can inline the
+// whole bounce. The scene is a flat list, it has no BVH, so it is meant for scenes of up
+// to a few hundred spheres. Everything else (BVHs, textures, media, lights sampling) stays
+// on the hittable / material path.
+//
+// The materials scatter like lambertian, metal and dielectic and draw the same numbers,
+// so a static render converges to the same image as the dynamic one.
+
+// Features of static_trace, or'ed into its Features template argument
+enum static_feature {
+    static_lights = 1,      // light spheres end paths with their radiance, as in ray_color
+    static_absorb = 2,      // end paths that a material absorbs (ray_color keeps tracing them)
+};
+
+// Hit of a static scene, the material type and the sphere in its container
+class static_hit {
+    public:
+        double t;
+        point3 p;
+        vec3 normal;            // against the ray
+        bool front_face;
+        int type = -1;
+        int index = 0;
+};
+
+class static_lambertian {
+    public:
+        color albedo;
+
+        bool scatter(const ray& r_in, const static_hit& h, color& attenuation, ray& scattered) const {
+            scattered = ray(h.p, sample_cosine_hemisphere(h.normal));
+            attenuation = albedo;
+            return true;
+        }
+};
+
+class static_metal {
+    public:
+        color albedo;
+        double fuzz = 0;
+
+        bool scatter(const ray& r_in, const static_hit& h, color& attenuation, ray& scattered) const {
+            vec3 reflected = reflect(unit_vector(r_in.direction()), h.normal);
+            scattered = ray(h.p, reflected + fuzz * random_unit_vector());
+            attenuation = albedo;
+            return dot(scattered.direction(), h.normal) > 0;
+        }
+};
+
+class static_dielectric {
+    public:
+        double ir = 1.5;
+
+        bool scatter(const ray& r_in, const static_hit& h, color& attenuation, ray& scattered) const {
+            vec3 unit_direction = unit_vector(r_in.direction());
+            double refraction_ratio = h.front_face ? (1.0 / ir) : ir;
+            double cos_theta = fmin(dot(-1 * unit_direction, h.normal), 1.0);
+            double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+
+            // Schlick
+            double r0 = (1 - refraction_ratio) / (1 + refraction_ratio);
+            r0 = r0 * r0;
+            if(refraction_ratio * sin_theta > 1.0 || r0 + (1 - r0) * pow5(1 - cos_theta) > random_double())
+                scattered = ray(h.p, reflect(unit_direction, h.normal));
+            else
+                scattered = ray(h.p, refract(unit_direction, h.normal, refraction_ratio));
+            attenuation = color(1,1,1);
+            return true;
+        }
+};
+
+class static_emitter {
+    public:
+        color radiance = color(10,10,10);
+};
+
+// Spheres of one material type, one array per field
+template <typename Material>
+class sphere_soa {
+    public:
+        vector<double> cx, cy, cz, radius;
+        vector<Material> materials;
+
+        void add(const point3& center, double r, const Material& m){
+            cx.push_back(center.e[0]);
+            cy.push_back(center.e[1]);
+            cz.push_back(center.e[2]);
+            radius.push_back(r);
+            materials.push_back(m);
+        }
+
+        int size() const { return cx.size(); }
+
+        // Nearest hit in (t_min, h.t), same roots as sphere::hit. Only t and the sphere are
+        // kept, finish() fills in the rest for the winner
+        bool hit(const ray& r, double t_min, static_hit& h, int type) const {
+            const vec3& d = r.direction();
+            const point3& o = r.origin();
+            double a = d.length_squared();
+            double inv_a = 1 / a;
+            bool found = false;
+            for(int s = 0; s < size(); s++){
+                double ox = o.e[0] - cx[s], oy = o.e[1] - cy[s], oz = o.e[2] - cz[s];
+                double half_b = ox * d.e[0] + oy * d.e[1] + oz * d.e[2];
+                double c = ox * ox + oy * oy + oz * oz - radius[s] * radius[s];
+                double discriminant = half_b * half_b - a * c;
+                if(discriminant < 0)continue;
+                double sqrtd = sqrt(discriminant);
+                double root = (-half_b - sqrtd) * inv_a;
+                if(root <= t_min)root = (-half_b + sqrtd) * inv_a;
+                if(root <= t_min || root >= h.t)continue;
+                h.t = root;
+                h.index = s;
+                found = true;
+            }
+            if(found)h.type = type;
+            return found;
+        }
+
+        void finish(const ray& r, static_hit& h) const {
+            h.p = r.at(h.t);
+            vec3 outward = (h.p - point3(cx[h.index], cy[h.index], cz[h.index])) / radius[h.index];
+            h.front_face = dot(r.direction(), outward) < 0;
+            h.normal = h.front_face ? outward : -1 * outward;
+        }
+};
+
+template <typename... Materials>
+class static_scene {
+    public:
+        tuple<sphere_soa<Materials>...> spheres;
+        sphere_soa<static_emitter> lights;
+
+        template <typename Material>
+        void add(const point3& center, double r, const Material& m){
+            get<sphere_soa<Material>>(spheres).add(center, r, m);
+        }
+
+        void add_light(const point3& center, double r, const color& radiance = color(10,10,10)){
+            lights.add(center, r, static_emitter{radiance});
+        }
+
+        bool hit(const ray& r, double t_min, double t_max, static_hit& h) const {
+            h.t = t_max;
+            h.type = -1;
+            hit_each(r, t_min, h, index_sequence_for<Materials...>());
+            if(h.type < 0)return false;
+            finish_each(r, h, index_sequence_for<Materials...>());
+            return true;
+        }
+
+        bool scatter(const ray& r_in, const static_hit& h, color& attenuation, ray& scattered) const {
+            return scatter_each(r_in, h, attenuation, scattered, index_sequence_for<Materials...>());
+        }
+
+    private:
+        template <size_t... I>
+        void hit_each(const ray& r, double t_min, static_hit& h, index_sequence<I...>) const {
+            (get<I>(spheres).hit(r, t_min, h, I), ...);
+        }
+
+        template <size_t... I>
+        void finish_each(const ray& r, static_hit& h, index_sequence<I...>) const {
+            ((h.type == int(I) ? get<I>(spheres).finish(r, h) : void()), ...);
+        }
+
+        template <size_t... I>
+        bool scatter_each(const ray& r_in, const static_hit& h, color& attenuation, ray& scattered, index_sequence<I...>) const {
+            bool kept = false;
+            ((h.type == int(I) ? (void)(kept = get<I>(spheres).materials[h.index].scatter(r_in, h, attenuation, scattered)) : void()), ...);
+            return kept;
+        }
+};
+
+// ray_color for a static_scene, unrolled over Depth bounces at compile time
+template <int Depth, int Features, typename Scene>
+color static_trace(const Scene& scene, const ray& r){
+    if constexpr (Depth == 0){
+        return color(0,0,0);
+    }
+    else {
+        STAT_INC(rays_traced);
+        static_hit h;
+        bool found = scene.hit(r, 0.00000001, infinity, h);
+
+        if constexpr ((Features & static_lights) != 0){
+            static_hit light;
+            light.t = found ? h.t : infinity;
+            if(scene.lights.hit(r, 0.00000001, light, 0))return scene.lights.materials[light.index].radiance;
+        }
+        if(!found)return color(0,0,0);
+
+        ray scattered;
+        color attenuation;
+        bool kept = scene.scatter(r, h, attenuation, scattered);
+        if constexpr ((Features & static_absorb) != 0){
+            if(!kept)return color(0,0,0);
+        }
+        return attenuation * static_trace<Depth - 1, Features>(scene, scattered) * dot(r.dir, scattered.dir);
+    }
+}
+
+#endif
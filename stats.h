@@ -0,0 +1,198 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <x86intrin.h>
+
+using namespace std;
+
+// Hot path counters, compiled in with -DRT_STATS. Without it every STAT_ macro expands to
+// a no-op that still uses its operands, so the render loop is unchanged and values kept
+// only for the counters do not warn. Counters are thread local and only merged
+// when a report is made.
+
+const int stats_max_depth = 64;
+const int stats_max_materials = 64;
+
+class render_stats {
+    public:
+        uint64_t camera_rays = 0;       // primary rays
+        uint64_t rays_traced = 0;       // world intersection queries from the integrator
+        uint64_t list_queries = 0;      // hittable_list::hit calls
+        uint64_t list_objects = 0;      // objects looped over by those calls
+        uint64_t sphere_tests = 0;
+        uint64_t sphere_hits = 0;
+        uint64_t bvh_nodes = 0;         // acceleration structure nodes visited
+        uint64_t light_hits = 0;
+        uint64_t escaped = 0;
+        uint64_t depth_exhausted = 0;   // paths cut off by max_depth
+        uint64_t glass_reflected = 0;   // dielectric scatters that reflected
+        uint64_t glass_refracted = 0;
+        uint64_t medium_lookups = 0;    // density evaluations and free flight samples in media
+        uint64_t medium_collisions = 0; // real scattering events in media
+        uint64_t path_length[stats_max_depth + 1] = {};
+        uint64_t scatter_calls[stats_max_materials] = {};
+        uint64_t scatter_cycles[stats_max_materials] = {};
+        uint64_t scatter_absorbed[stats_max_materials] = {};
+
+        void record_path(int length){
+            path_length[min(length, stats_max_depth)]++;
+        }
+
+        void record_scatter(int material_id, uint64_t cycles, bool absorbed){
+            int m = min(max(material_id, 0), stats_max_materials - 1);
+            scatter_calls[m]++;
+            scatter_cycles[m] += cycles;
+            if(absorbed)scatter_absorbed[m]++;
+        }
+
+        void merge(const render_stats& o){
+            camera_rays += o.camera_rays;
+            rays_traced += o.rays_traced;
+            list_queries += o.list_queries;
+            list_objects += o.list_objects;
+            sphere_tests += o.sphere_tests;
+            sphere_hits += o.sphere_hits;
+            bvh_nodes += o.bvh_nodes;
+            light_hits += o.light_hits;
+            escaped += o.escaped;
+            depth_exhausted += o.depth_exhausted;
+            glass_reflected += o.glass_reflected;
+            glass_refracted += o.glass_refracted;
+            medium_lookups += o.medium_lookups;
+            medium_collisions += o.medium_collisions;
+            for(int i = 0; i <= stats_max_depth; i++)path_length[i] += o.path_length[i];
+            for(int i = 0; i < stats_max_materials; i++){
+                scatter_calls[i] += o.scatter_calls[i];
+                scatter_cycles[i] += o.scatter_cycles[i];
+                scatter_absorbed[i] += o.scatter_absorbed[i];
+            }
+        }
+
+        void report(ostream& out) const;
+};
+
+// Every thread's counters are registered once, a thread that exits folds its counters
+// into retired so nothing is lost
+class stats_registry {
+    public:
+        mutex lock;
+        vector<render_stats*> live;
+        render_stats retired;
+};
+
+stats_registry& global_stats(){
+    static stats_registry registry;
+    return registry;
+}
+
+class stats_slot {
+    public:
+        render_stats s;
+
+        stats_slot(){
+            lock_guard<mutex> guard (global_stats().lock);
+            global_stats().live.push_back(&s);
+        }
+
+        ~stats_slot(){
+            stats_registry& g = global_stats();
+            lock_guard<mutex> guard (g.lock);
+            g.retired.merge(s);
+            g.live.erase(find(g.live.begin(), g.live.end(), &s));
+        }
+};
+
+thread_local stats_slot thread_stats;
+
+// Sum over all threads, only valid when no thread is rendering
+render_stats collect_stats(){
+    stats_registry& g = global_stats();
+    lock_guard<mutex> guard (g.lock);
+    render_stats total = g.retired;
+    for(auto* s : g.live)total.merge(*s);
+    return total;
+}
+
+void reset_stats(){
+    stats_registry& g = global_stats();
+    lock_guard<mutex> guard (g.lock);
+    g.retired = render_stats();
+    for(auto* s : g.live)*s = render_stats();
+}
+
+void render_stats::report(ostream& out) const {
+    auto per = [](uint64_t a, uint64_t b){ return b ? double(a) / b : 0.0; };
+
+    out << "---------------- Render statistics ----------------\n";
+    out << "camera rays:        " << camera_rays << "\n";
+    out << "rays traced:        " << rays_traced << " (" << setprecision(3) << per(rays_traced, camera_rays) << " per camera ray)\n";
+    out << "list queries:       " << list_queries << " (" << per(list_objects, list_queries) << " objects each)\n";
+    out << "sphere tests:       " << sphere_tests << " (" << per(sphere_tests, rays_traced) << " per ray, "
+        << 100 * per(sphere_hits, sphere_tests) << "% hit)\n";
+    out << "bvh nodes visited:  " << bvh_nodes << " (" << per(bvh_nodes, rays_traced) << " per ray)\n";
+    out << "light hits:         " << light_hits << "\n";
+    out << "escaped:            " << escaped << "\n";
+    out << "cut by max_depth:   " << depth_exhausted << " (" << 100 * per(depth_exhausted, camera_rays) << "% of paths)\n";
+
+    out << "glass reflect/refract: " << glass_reflected << " / " << glass_refracted << "\n";
+    out << "medium lookups:     " << medium_lookups << " (" << per(medium_lookups, rays_traced) << " per ray, "
+        << medium_collisions << " scattering events)\n";
+
+    out << "path length histogram (bounces: paths):\n";
+    for(int i = 0; i <= stats_max_depth; i++)
+        if(path_length[i])out << "  " << setw(3) << i << ": " << path_length[i] << "\n";
+
+    out << "scatter per material id (calls, cycles per call, absorbed):\n";
+    for(int i = 0; i < stats_max_materials; i++)
+        if(scatter_calls[i])
+            out << "  " << setw(3) << i << ": " << scatter_calls[i] << ", "
+                << setprecision(4) << per(scatter_cycles[i], scatter_calls[i]) << ", " << scatter_absorbed[i] << "\n";
+}
+
+// False color PPM of a per pixel cost, indexed like grid (j * width + i, bottom row first).
+// Log scaled between the cheapest pixel and the 99th percentile, black - red - yellow - white
+void write_heatmap(const string& path, const vector<uint64_t>& cost, int width, int height){
+    vector<uint64_t> sorted (cost);
+    sort(sorted.begin(), sorted.end());
+    double lo = log(1.0 + sorted.front());
+    double hi = log(1.0 + sorted[min(sorted.size() - 1, sorted.size() * 99 / 100)]);
+    double range = hi > lo ? hi - lo : 1.0;
+
+    ofstream out (path);
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for(int j = height - 1; j >= 0; j--){
+        for(int i = 0; i < width; i++){
+            double t = (log(1.0 + cost[j * width + i]) - lo) / range;
+            t = min(max(t, 0.0), 1.0);
+            int r = 255 * min(1.0, 3 * t);
+            int g = 255 * min(1.0, max(0.0, 3 * t - 1));
+            int b = 255 * min(1.0, max(0.0, 3 * t - 2));
+            out << r << ' ' << g << ' ' << b << '\n';
+        }
+    }
+}
+
+#ifdef RT_STATS
+#define STAT_INC(counter) (thread_stats.s.counter++)
+#define STAT_ADD(counter, n) (thread_stats.s.counter += (n))
+#define STAT_PATH(length) (thread_stats.s.record_path(length))
+#define STAT_CYCLES() __rdtsc()
+#define STAT_SCATTER(material_id, start, absorbed) (thread_stats.s.record_scatter((material_id), __rdtsc() - (start), (absorbed)))
+#else
+#define STAT_INC(counter) ((void)0)
+#define STAT_ADD(counter, n) ((void)(n))
+#define STAT_PATH(length) ((void)(length))
+#define STAT_CYCLES() (uint64_t(0))
+#define STAT_SCATTER(material_id, start, absorbed) ((void)(material_id), (void)(start), (void)(absorbed))
+#endif
+
+#endif
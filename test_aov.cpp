@@ -0,0 +1,153 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+
+#include <iostream>
+#include <fstream>
+#include <map>
+
+// Renders a sphere in the middle of the view with every AOV layer, reads the EXR back and
+// checks the channel list, the data window and the layers at the centre pixel (the sphere,
+// about 2 away and facing the camera, half a pixel off axis) and at a top corner (sky)
+
+const int width = 64;
+const int spp = 4;
+const string exr_path = "/tmp/test_aov.exr";
+
+// Channels and pixels of an uncompressed scanline EXR, as aov_buffer::write_exr writes them
+class exr_image {
+    public:
+        int width = 0, height = 0;
+        vector<string> names;
+        vector<int32_t> types;
+        vector<int32_t> window;
+        map<string, vector<uint32_t>> channels;     // raw 4 byte values, rows top down
+
+        bool read(const string& path){
+            ifstream in (path, ios::binary);
+            vector<char> d ((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            size_t at = 0;
+            auto i32 = [&](){ int32_t v; memcpy(&v, &d[at], 4); at += 4; return v; };
+            auto str = [&](){ string s (&d[at]); at += s.size() + 1; return s; };
+
+            if(d.size() < 8 || i32() != 20000630 || i32() != 2)return false;
+            while(true){
+                string name = str();
+                if(name.empty())break;
+                string type = str();
+                int32_t size = i32();
+                size_t end = at + size;
+                if(name == "channels"){
+                    while(true){
+                        string channel = str();
+                        if(channel.empty())break;
+                        names.push_back(channel);
+                        types.push_back(i32());
+                        at += 12;
+                    }
+                }
+                if(name == "dataWindow")
+                    for(int k = 0; k < 4; k++)window.push_back(i32());
+                at = end;
+            }
+            if(window.size() != 4)return false;
+            width = window[2] - window[0] + 1;
+            height = window[3] - window[1] + 1;
+
+            // Offset table, then one block per scanline with the channels in header order
+            vector<uint64_t> offsets (height);
+            memcpy(offsets.data(), &d[at], 8 * height);
+            for(auto& n : names)channels[n].resize(width * height);
+            for(int y = 0; y < height; y++){
+                at = offsets[y];
+                if(i32() != y || i32() != int32_t(width * 4 * names.size()))return false;
+                for(auto& n : names){
+                    memcpy(&channels[n][y * width], &d[at], 4 * width);
+                    at += 4 * width;
+                }
+            }
+            return true;
+        }
+
+        uint32_t id(const string& channel, int x, int y) const { return channels.at(channel)[y * width + x]; }
+
+        float value(const string& channel, int x, int y) const {
+            float f;
+            uint32_t bits = id(channel, x, y);
+            memcpy(&f, &bits, 4);
+            return f;
+        }
+};
+
+int main(){
+    auto blue = make_shared<lambertian>(color(0.2, 0.4, 0.6));
+    auto centre = make_shared<sphere>(vec3(0, 0, -3), 1, blue);
+    hittable_list world, lights;
+    world.add(centre);
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    // Behind the camera, lights the sphere without being seen
+    lights.add(make_shared<sphere>(vec3(0, 3, 2), 1, make_shared<lambertian>(color(1,1,1))));
+
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = 4;
+    cam.iterations = spp;
+    cam.verbose = false;
+    cam.output_path = "/tmp/test_aov.ppm";
+    cam.aov_layers = aov_all;
+    cam.aov_path = exr_path;
+    cam.render(world, lights);
+    remove(cam.output_path.c_str());
+
+    bool passed = true;
+    exr_image exr;
+    bool read = exr.read(exr_path);
+    remove(exr_path.c_str());
+    cout << "EXR " << (read ? "read" : "NOT READ") << ", " << exr.width << "x" << exr.height << ", channels:";
+    for(auto& n : exr.names)cout << " " << n;
+    cout << "\n";
+    if(!read){
+        cout << "FAILED\n";
+        return 1;
+    }
+
+    // Sorted by name, ids and counts as uint (0), the rest as float (2)
+    vector<string> expected = {"B", "G", "R", "albedo.B", "albedo.G", "albedo.R", "depth.Z", "material_id.id", "normal.X",
+                               "normal.Y", "normal.Z", "object_id.id", "sample_count.count", "time.ms"};
+    bool types_ok = true;
+    for(size_t c = 0; c < exr.names.size(); c++)
+        types_ok &= exr.types[c] == (exr.names[c].find(".id") != string::npos || exr.names[c] == "sample_count.count" ? 0 : 2);
+    passed &= exr.names == expected && types_ok;
+    passed &= exr.width == width && exr.height == int(width / cam.aspect_ratio);
+
+    int x = exr.width / 2, y = exr.height / 2;
+    uint32_t object = exr.id("object_id.id", x, y), material = exr.id("material_id.id", x, y);
+    float depth = exr.value("depth.Z", x, y), normal_z = exr.value("normal.Z", x, y);
+    color albedo (exr.value("albedo.R", x, y), exr.value("albedo.G", x, y), exr.value("albedo.B", x, y));
+    uint32_t samples = exr.id("sample_count.count", x, y);
+    cout << "centre: object " << object << " (sphere " << centre->object_id << "), material " << material << " (" << blue->material_id
+         << "), depth " << depth << ", normal z " << normal_z << ", albedo " << albedo << ", samples " << samples << "\n";
+    passed &= object == uint32_t(centre->object_id) && material == uint32_t(blue->material_id);
+    passed &= fabs(depth - 2) < 0.02 && normal_z > 0.99 && (albedo - color(0.2, 0.4, 0.6)).length() < 1e-6 && samples == spp;
+
+    uint32_t sky = exr.id("object_id.id", 0, 0);
+    cout << "top corner: object " << hex << sky << dec << ", depth " << exr.value("depth.Z", 0, 0) << "\n";
+    passed &= sky == 0xffffffffu && exr.id("material_id.id", 0, 0) == 0xffffffffu && exr.value("depth.Z", 0, 0) == 0;
+
+    double time = 0;
+    int lit = 0;
+    for(int j = 0; j < exr.height; j++)
+        for(int i = 0; i < exr.width; i++){
+            time += exr.value("time.ms", i, j);
+            lit += exr.value("R", i, j) != 0;
+        }
+    cout << "time layer total " << time << " ms, " << lit << " pixels with red in the beauty\n";
+    passed &= time > 0 && lit > 0;
+
+    cout << (passed ? "all passed" : "FAILED") << "\n";
+    return passed ? 0 : 1;
+}
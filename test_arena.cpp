@@ -0,0 +1,162 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "arena.h"
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Builds the same sphere scene with make_shared and with make_arena_shared and compares
+// build time, traversal time and cache misses of a brute force hittable_list walk.
+// The heap build interleaves short lived allocations the way a scene loader does, which is
+// what scatters the nodes in practice
+
+const int sphere_count = 200000;
+const int material_count = 64;
+const int ray_count = 200;
+
+// Hardware cache miss counter for this thread, -1 when perf events are not available
+class miss_counter {
+    public:
+        miss_counter(){
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+        ~miss_counter(){ if(fd >= 0)close(fd); }
+
+        void start(){
+            if(fd < 0)return;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        long long stop(){
+            if(fd < 0)return -1;
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            long long n = 0;
+            if(read(fd, &n, sizeof(n)) != sizeof(n))return -1;
+            return n;
+        }
+
+    private:
+        int fd;
+};
+
+point3 sphere_center(int i){
+    return point3((i % 1000) * 0.01 - 5, ((i / 1000) % 200) * 0.01 - 1, -3 - (i % 7) * 0.1);
+}
+
+double traverse(const hittable_list& world){
+    double sink = 0;
+    for(int k = 0; k < ray_count; k++){
+        ray r (point3(0,0,0), vec3(random_double(-1, 1), random_double(-1, 1), -1));
+        hit_record rec;
+        if(world.hit(r, interval(0.001, infinity), rec))sink += rec.t;
+    }
+    return sink;
+}
+
+int main(){
+    vector<shared_ptr<material>> materials;
+    for(int m = 0; m < material_count; m++)
+        materials.push_back(make_shared<lambertian>(color(random_double(), random_double(), random_double())));
+
+    miss_counter misses;
+    using clock = std::chrono::high_resolution_clock;
+
+    // Heap, with loader garbage between the nodes
+    double heap_build, heap_traverse, heap_sum;
+    long long heap_misses;
+    {
+        vector<unique_ptr<char[]>> garbage;
+        auto start = clock::now();
+        hittable_list world;
+        for(int i = 0; i < sphere_count; i++){
+            garbage.emplace_back(new char[16 + random_u64() % 200]);
+            if(random_u64() % 2)garbage[random_u64() % garbage.size()].reset();
+            world.add(make_shared<sphere>(sphere_center(i), 0.004, materials[i % material_count]));
+        }
+        heap_build = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+        seed_random(1);
+        traverse(world);
+        seed_random(1);
+        start = clock::now();
+        misses.start();
+        heap_sum = traverse(world);
+        heap_misses = misses.stop();
+        heap_traverse = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    // Arena, objects and control blocks back to back
+    double arena_build, arena_traverse, arena_reset, arena_sum;
+    long long arena_misses;
+    size_t arena_bytes;
+    {
+        arena a (4 << 20);
+        auto start = clock::now();
+        {
+            hittable_list world;
+            world.objects.reserve(sphere_count);
+            for(int i = 0; i < sphere_count; i++)
+                world.add(make_arena_shared<sphere>(a, sphere_center(i), 0.004, materials[i % material_count]));
+            arena_build = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            arena_bytes = a.bytes_used();
+
+            seed_random(1);
+            traverse(world);
+            seed_random(1);
+            start = clock::now();
+            misses.start();
+            arena_sum = traverse(world);
+            arena_misses = misses.stop();
+            arena_traverse = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        }
+        // The spheres are destroyed with the list, the memory goes back in one step
+        start = clock::now();
+        a.reset();
+        arena_reset = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+    }
+
+    // Per frame scratch through a pool
+    {
+        arena a;
+        pool<hit_record> records (a);
+        auto start = clock::now();
+        for(int frame = 0; frame < 100; frame++){
+            vector<hit_record*> live;
+            for(int i = 0; i < 10000; i++)live.push_back(records.create());
+            for(int i = 0; i < 10000; i += 2)records.destroy(live[i]);
+            for(int i = 0; i < 5000; i++)records.create();
+            records.reset();
+            a.reset();
+        }
+        double pool_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        cout << "pool scratch: 100 frames of 15000 records in " << pool_ms << " ms, arena holds " << a.bytes_reserved() << " bytes\n";
+    }
+
+    auto show = [](long long m){ return m < 0 ? string("n/a") : to_string(m); };
+    cout << sphere_count << " spheres, " << ray_count << " rays through a flat list\n";
+    cout << "make_shared: build " << heap_build << " ms, traverse " << heap_traverse << " ms, cache misses " << show(heap_misses) << "\n";
+    cout << "arena:       build " << arena_build << " ms, traverse " << arena_traverse << " ms, cache misses " << show(arena_misses)
+         << ", " << arena_bytes / sphere_count << " bytes per sphere, reset " << arena_reset << " us\n";
+    // Same spheres and rays, so the hits have to be the same
+    cout << "sum of hit distances: make_shared " << heap_sum << ", arena " << arena_sum << ", "
+         << (heap_sum == arena_sum ? "same" : "DIFFERENT") << "\n";
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "environment.h"
+
+#include <iostream>
+#include <chrono>
+
+// Error against time of bidirectional and plain path tracing, compared with a long path
+// traced reference as mean squared error of the linear (PFM) pixels, light pixels left out.
+// The two scenes are main.cpp with its light shrunk to 0.08, and a glass sphere focusing
+// a small light onto the floor, where all light on the floor under it is a caustic.
+// Bidirectional renders get fewer samples per pixel, as many as fit in the path traced time.
+// Single renders are too noisy to rank the two on the small light, so every row is the mean
+// error and time over several seeds. Bidirectional has to be more efficient at the highest
+// spp in both scenes. On the small light it loses at low spp, its few bright light tracing
+// paths dominate the error until there are enough of them.
+
+const int width = 160;
+const int depth = 6;
+const int reference_spp = 4096;
+const int seeds = 8;
+
+void small_light(hittable_list& world, hittable_list& lights){
+    world.add(make_shared<sphere>(vec3(-2, 0.5, -2), 1, make_shared<metal>(color(0.1, 0.7, 0.2), 0)));
+    world.add(make_shared<sphere>(vec3(0, 0.5, -3), 1, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    world.add(make_shared<sphere>(vec3(-0.55, 0, -1), 0.25, make_shared<lambertian>(color(0.2, 0.1, 0.7))));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    lights.add(make_shared<sphere>(vec3(1.55, 0, -1), 0.08, make_shared<lambertian>(color(1,1,1))));
+}
+
+void caustic(hittable_list& world, hittable_list& lights){
+    world.add(make_shared<sphere>(vec3(0, 0.3, -2), 0.5, make_shared<dielectic>(1.5)));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -2), 100, make_shared<lambertian>(color(0.6, 0.6, 0.6))));
+    lights.add(make_shared<sphere>(vec3(0.3, 2.5, -2.3), 0.05, make_shared<lambertian>(color(1,1,1))));
+}
+
+double render(hittable_list& world, hittable_list& lights, int spp, bool bidirectional, uint64_t seed, vector<float>& image){
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = depth;
+    cam.iterations = spp;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.bidirectional = bidirectional;
+    cam.output_path = "/tmp/bdpt_test.pfm";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cam.render(world, lights);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    int w, h;
+    read_pfm(cam.output_path, w, h, image);
+    remove(cam.output_path.c_str());
+    return ms;
+}
+
+// Over pixels the reference does not show a light in
+double mse(const vector<float>& a, const vector<float>& reference){
+    double s = 0;
+    int n = 0;
+    for(size_t p = 0; p < reference.size(); p += 3){
+        if(fmax(fabs(reference[p]), fmax(fabs(reference[p + 1]), fabs(reference[p + 2]))) > 5)continue;
+        for(int k = 0; k < 3; k++)s += (a[p + k] - reference[p + k]) * (a[p + k] - reference[p + k]);
+        n += 3;
+    }
+    return s / n;
+}
+
+// Mean time and mse over seeds 1 to seeds
+void render_seeds(hittable_list& world, hittable_list& lights, int spp, bool bidirectional, const vector<float>& reference,
+                  double& ms, double& error){
+    ms = error = 0;
+    for(int seed = 1; seed <= seeds; seed++){
+        vector<float> image;
+        ms += render(world, lights, spp, bidirectional, seed, image) / seeds;
+        error += mse(image, reference) / seeds;
+    }
+}
+
+// Returns the efficiency of the last row
+double compare(const char* name, void (*scene)(hittable_list&, hittable_list&)){
+    hittable_list world, lights;
+    scene(world, lights);
+
+    vector<float> reference;
+    double ref_ms = render(world, lights, reference_spp, false, 7, reference);
+    cout << name << ", reference " << reference_spp << " spp path traced, " << ref_ms << " ms\n";
+
+    // Efficiency is the inverse of mse times time, its ratio is how much longer path tracing
+    // takes to reach the bidirectional error
+    // takes to reach the bidirectional error. Times and errors are means over the seeds
+    cout << "  spp    pt ms       pt mse   bd spp    bd ms       bd mse   efficiency   (" << seeds << " seeds)\n";
+    double efficiency = 0;
+    for(int spp = 16; spp <= 128; spp *= 2){
+        double plain_ms, plain_mse, bd_ms, bd_mse;
+        render_seeds(world, lights, spp, false, reference, plain_ms, plain_mse);
+        int bd_spp = max(1, spp / 4);
+        render_seeds(world, lights, bd_spp, true, reference, bd_ms, bd_mse);
+        int fit = max(1, int(bd_spp * plain_ms / bd_ms));
+        if(fit != bd_spp){
+            bd_spp = fit;
+            render_seeds(world, lights, bd_spp, true, reference, bd_ms, bd_mse);
+        }
+        efficiency = plain_mse * plain_ms / (bd_mse * bd_ms);
+        printf("%5d  %7.1f  %11.3e  %7d  %7.1f  %11.3e  %11.2f\n", spp, plain_ms, plain_mse, bd_spp, bd_ms, bd_mse, efficiency);
+    }
+    cout << "\n";
+    return efficiency;
+}
+
+int main(){
+    bool passed = true;
+    passed &= compare("small light", small_light) > 1;
+    passed &= compare("caustic", caustic) > 1;
+    cout << (passed ? "all passed" : "FAILED") << "\n";
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "arena.h"
+#include "medium.h"
+
+#include <iostream>
+#include <chrono>
+
+// Checks hittable_list::hit and transmittance with the quantised 4 wide BVH against the
+// linear scan and reports node memory next to a binary BVH with float boxes over the same splits
+
+void fill(hittable_list& world, int n, shared_ptr<material> mat){
+    for(int i = 0; i < n; i++){
+        point3 c (random_double(-50, 50), random_double(-50, 50), random_double(-150, -50));
+        world.add(make_shared<sphere>(c, random_double(0.05, 0.5), mat));
+    }
+}
+
+ray random_ray(){
+    return ray(point3(random_double(-5, 5), random_double(-5, 5), 0), vec3(random_double(-0.5, 0.5), random_double(-0.5, 0.5), -1));
+}
+
+int main(){
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    using clock = std::chrono::high_resolution_clock;
+
+    // Same hits as the linear scan
+    {
+        seed_random(7);
+        hittable_list world;
+        fill(world, 20000, mat);
+        const int rays = 5000;
+        vector<ray> probe;
+        for(int i = 0; i < rays; i++)probe.push_back(random_ray());
+
+        vector<double> linear_t (rays, -1);
+        vector<int> linear_id (rays, -1);
+        auto start = clock::now();
+        for(int i = 0; i < rays; i++){
+            hit_record rec;
+            if(world.hit(probe[i], interval(0.001, infinity), rec)){
+                linear_t[i] = rec.t;
+                linear_id[i] = rec.object_id;
+            }
+        }
+        double linear_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+        world.build_bvh();
+        int mismatched = 0, hits = 0;
+        start = clock::now();
+        for(int i = 0; i < rays; i++){
+            hit_record rec;
+            bool hit = world.hit(probe[i], interval(0.001, infinity), rec);
+            if(hit)hits++;
+            if(hit != (linear_id[i] >= 0) || (hit && (rec.object_id != linear_id[i] || rec.t != linear_t[i])))mismatched++;
+        }
+        double bvh_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        cout << "20000 spheres: " << mismatched << " / " << rays << " rays differ from the linear scan (" << hits << " hits), "
+             << linear_ms / rays * 1000 << " us vs " << bvh_ms / rays * 1000 << " us per ray\n";
+    }
+
+    // Shadow rays: any hit through the BVH, a medium multiplied in from the side list
+    {
+        seed_random(9);
+        hittable_list world;
+        fill(world, 20000, mat);
+        world.add(make_shared<constant_medium>(make_shared<sphere>(point3(0, 0, -60), 8, mat), 0.05, color(1, 1, 1)));
+        const int rays = 5000;
+        vector<ray> probe;
+        for(int i = 0; i < rays; i++)probe.push_back(random_ray());
+
+        vector<double> linear (rays);
+        auto start = clock::now();
+        for(int i = 0; i < rays; i++)linear[i] = world.transmittance(probe[i], interval(0.001, 200));
+        double linear_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+        world.build_bvh();
+        int mismatched = 0, blocked = 0;
+        start = clock::now();
+        for(int i = 0; i < rays; i++){
+            double t = world.transmittance(probe[i], interval(0.001, 200));
+            if(t == 0)blocked++;
+            if(fabs(t - linear[i]) > 1e-12)mismatched++;
+        }
+        double bvh_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        cout << "transmittance: " << mismatched << " / " << rays << " rays differ from the linear scan (" << blocked << " blocked), "
+             << linear_ms / rays * 1000 << " us vs " << bvh_ms / rays * 1000 << " us per ray\n";
+    }
+
+    // Memory and speed at 1M
+    {
+        seed_random(11);
+        hittable_list world;
+        fill(world, 1000000, mat);
+        arena a (16 << 20);
+        auto start = clock::now();
+        world.build_bvh(&a);
+        double build_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+        const bvh4& b = world.bvh();
+        double n = world.objects.size();
+        double quantised = b.node_bytes() + b.prims.size() * sizeof(hittable*);
+        double binary = b.binary_nodes * 32.0 + b.prims.size() * sizeof(hittable*);
+        cout << "1M spheres: " << b.node_count() << " nodes, built in " << build_ms << " ms\n";
+        cout << "  quantised 4 wide: " << quantised / n << " bytes per primitive (" << b.node_bytes() / n << " in nodes)\n";
+        cout << "  binary, float boxes: " << binary / n << " bytes per primitive (" << b.binary_nodes * 32.0 / n << " in nodes)\n";
+
+        const int rays = 200000;
+        int hits = 0;
+        start = clock::now();
+        for(int i = 0; i < rays; i++){
+            hit_record rec;
+            if(world.hit(random_ray(), interval(0.001, infinity), rec))hits++;
+        }
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        cout << "  " << rays / ms / 1000 << " M rays/s, " << hits << " hits\n";
+    }
+
+    return 0;
+}
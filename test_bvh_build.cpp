@@ -0,0 +1,104 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "arena.h"
+
+#include <iostream>
+#include <chrono>
+
+// Build time of the SAH and Morton builders on 1M spheres, per phase at several thread
+// counts, against the trace speed of the tree they produce, with hits checked against the
+// linear scan on a smaller scene and the tree checked to be the same for every thread count
+
+void fill(hittable_list& world, int n, shared_ptr<material> mat){
+    for(int i = 0; i < n; i++){
+        point3 c (random_double(-50, 50), random_double(-50, 50), random_double(-150, -50));
+        world.add(make_shared<sphere>(c, random_double(0.05, 0.5), mat));
+    }
+}
+
+ray random_ray(){
+    return ray(point3(random_double(-5, 5), random_double(-5, 5), 0), vec3(random_double(-0.5, 0.5), random_double(-0.5, 0.5), -1));
+}
+
+const char* name(bvh_builder b){ return b == bvh_builder::sah ? "sah" : "morton"; }
+
+int main(){
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    using clock = std::chrono::high_resolution_clock;
+    const bvh_builder builders[] = {bvh_builder::sah, bvh_builder::morton};
+
+    // Same hits as the linear scan, and the same prims order with 1 and 4 threads
+    {
+        seed_random(3);
+        hittable_list world;
+        fill(world, 50000, mat);
+        const int rays = 2000;
+        vector<ray> probe;
+        vector<int> linear_id;
+        for(int i = 0; i < rays; i++){
+            probe.push_back(random_ray());
+            hit_record rec;
+            linear_id.push_back(world.hit(probe[i], interval(0.001, infinity), rec) ? rec.object_id : -1);
+        }
+
+        for(auto builder : builders){
+            bvh_build_options options;
+            options.builder = builder;
+            options.threads = 1;
+            world.build_bvh(nullptr, options);
+            vector<hittable*> serial = world.bvh().prims;
+            int serial_nodes = world.bvh().node_count();
+
+            options.threads = 4;
+            world.build_bvh(nullptr, options);
+            bool same = serial == world.bvh().prims && serial_nodes == world.bvh().node_count();
+
+            int mismatched = 0;
+            for(int i = 0; i < rays; i++){
+                hit_record rec;
+                int id = world.hit(probe[i], interval(0.001, infinity), rec) ? rec.object_id : -1;
+                if(id != linear_id[i])mismatched++;
+            }
+            cout << name(builder) << ": " << mismatched << " / " << rays << " rays differ from the linear scan, "
+                 << (same ? "same" : "DIFFERENT") << " tree with 1 and 4 threads\n";
+        }
+    }
+
+    // Build speed against trace speed at 1M
+    seed_random(11);
+    hittable_list world;
+    fill(world, 1000000, mat);
+    cout << "1M spheres, " << default_thread_count() << " hardware threads\n";
+    vector<int> thread_counts = {1, 2, 4};
+    if(default_thread_count() > 4)thread_counts.push_back(default_thread_count());
+    for(auto builder : builders){
+        bvh_build_options options;
+        options.builder = builder;
+        world.build_bvh(nullptr, options);     // warm up the allocator
+        cout << "  " << name(builder) << ":\n";
+        for(int threads : thread_counts){
+            options.threads = threads;
+            world.build_bvh(nullptr, options);
+            cout << "    " << threads << " threads, ";
+            world.bvh().timing.print(cout);
+        }
+        const bvh4& b = world.bvh();
+
+        seed_random(5);
+        const int rays = 200000;
+        int hits = 0;
+        auto start = clock::now();
+        for(int i = 0; i < rays; i++){
+            hit_record rec;
+            if(world.hit(random_ray(), interval(0.001, infinity), rec))hits++;
+        }
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        cout << "    " << b.node_count() << " nodes, " << rays / ms / 1000 << " M rays/s, " << hits << " hits\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "environment.h"
+
+#include <iostream>
+#include <chrono>
+
+// Caustic error against time with path tracing alone and with photons, a glass sphere above
+// a diffuse floor, lit by a small sphere light and focusing it close to the floor. The
+// focused spot under the glass is light-specular-diffuse-eye and rarely reached from the
+// camera. Every render takes the floor's direct light by resampling (unbiased RIS, no
+// reuse), so the comparison is about the caustic and not about the fireflies of a small
+// light found by bsdf sampling, which both renders would share and which dominated the
+// error before. Renders write linear PFM, odd bounce terms of the estimator are negative
+// and a P3 would clamp them, and are compared with a long path traced reference as mean
+// squared error, over the whole image and over the caustic below the sphere. Photons must
+// give the lower caustic error at every sample count.
+
+const int width = 160;
+const int depth = 6;
+const int reference_spp = 4096;
+
+void scene(hittable_list& world, hittable_list& lights){
+    world.add(make_shared<sphere>(vec3(0, 0.3, -2), 0.5, make_shared<dielectic>(1.5)));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -2), 100, make_shared<lambertian>(color(0.6, 0.6, 0.6))));
+    lights.add(make_shared<sphere>(vec3(0.3, 2.5, -2.3), 0.05, make_shared<lambertian>(color(1,1,1))));
+}
+
+double render(hittable_list& world, hittable_list& lights, int spp, bool caustics, uint64_t seed, vector<float>& image, int photons = 0){
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = depth;
+    cam.iterations = spp;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.caustics = caustics;
+    cam.resample_lights = true;
+    cam.light_resampler.candidates = 4;
+    cam.light_resampler.temporal_cap = 0;
+    cam.light_resampler.spatial_neighbors = 0;
+    if(photons)cam.caustic_photons = photons;
+    cam.output_path = "caustics_test.pfm";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cam.render(world, lights);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    int w, h;
+    read_pfm(cam.output_path, w, h, image);
+    remove(cam.output_path.c_str());
+    return ms;
+}
+
+// Over rows y0..y1 and columns x0..x1 of the image, all of it by default
+double mse(const vector<float>& a, const vector<float>& b, int x0 = 0, int y0 = 0, int x1 = -1, int y1 = -1){
+    int height = a.size() / 3 / width;
+    if(x1 < 0)x1 = width;
+    if(y1 < 0)y1 = height;
+    double s = 0;
+    for(int y = y0; y < y1; y++)
+        for(int x = x0; x < x1; x++)
+            for(int k = 0; k < 3; k++){
+                double d = a[(y * width + x) * 3 + k] - b[(y * width + x) * 3 + k];
+                s += d * d;
+            }
+    return s / ((x1 - x0) * (y1 - y0) * 3);
+}
+
+int main(){
+    hittable_list world, lights;
+    scene(world, lights);
+
+    vector<float> reference;
+    double ref_ms = render(world, lights, reference_spp, false, 7, reference);
+    cout << "reference " << reference_spp << " spp path traced, " << ref_ms << " ms\n\n";
+
+    // The focused spot is on the floor below the sphere, in the middle of the image a little
+    // below its center (rows counted from the top)
+    int height = reference.size() / 3 / width;
+    int cx0 = width * 7 / 16, cx1 = width * 9 / 16, cy0 = height * 9 / 16, cy1 = height * 11 / 16;
+
+    // Photons get the time of the path traced render, with fewer samples per pixel
+    cout << "  spp    pt ms       pt mse   caustic mse   pm spp   pm ms       pm mse   caustic mse\n";
+    bool passed = true;
+    for(int spp = 16; spp <= 256; spp *= 2){
+        vector<float> plain, photons;
+        double plain_ms = render(world, lights, spp, false, 1, plain);
+        int pm_spp = spp;
+        double pm_ms = render(world, lights, pm_spp, true, 1, photons, 20000);
+        while(pm_ms > plain_ms * 1.05 && pm_spp > 1){
+            pm_spp = max(1, int(pm_spp * plain_ms / pm_ms));
+            pm_ms = render(world, lights, pm_spp, true, 1, photons, 20000);
+        }
+        double plain_caustic = mse(plain, reference, cx0, cy0, cx1, cy1), photon_caustic = mse(photons, reference, cx0, cy0, cx1, cy1);
+        printf("%5d  %7.1f  %11.3e  %12.3e  %7d  %6.1f  %11.3e  %12.3e  %.1fx\n", spp, plain_ms, mse(plain, reference),
+               plain_caustic, pm_spp, pm_ms, mse(photons, reference), photon_caustic, plain_caustic / photon_caustic);
+        passed &= photon_caustic < plain_caustic;
+    }
+    cout << (passed ? "all passed" : "FAILED") << "\n";
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+#include "camera.h"
+#include "environment.h"
+#include "scene_file.h"
+#include "daemon.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <dirent.h>
+
+// Render daemon (daemon.h): a job sent over the socket must give the same image as a direct
+// render of the scene file, a batch of small jobs is timed against doing each one from
+// scratch (parse, BVH build, render) as separate runs of the program would, and the core
+// shares of running jobs of different priorities are shown.
+
+const string scene_path = "/tmp/daemon_test_scene.txt";
+const string socket_path = "/tmp/daemon_test.sock";
+const int batch = 24;
+
+void write_scene(){
+    ofstream out (scene_path);
+    out << "# ground, a field of small spheres under a BVH and one light\n";
+    out << "camera width 160 depth 6 spp 4 lookfrom 0 0.5 1 lookat 0 0 -1\n";
+    out << "material ground lambertian 0.5 0.5 0.5\n";
+    out << "material red lambertian 0.7 0.2 0.2\n";
+    out << "material steel metal 0.8 0.8 0.8 0.1\n";
+    out << "material glass dielectric 1.5\n";
+    out << "sphere 0 -1000.5 -1 1000 ground\n";
+    const char* names[] = {"red", "steel", "glass"};
+    for(int a = 0; a < 40; a++)
+        for(int b = 0; b < 40; b++)
+            out << "sphere " << -4 + 0.2 * a << " -0.45 " << -1 - 0.2 * b << " 0.05 " << names[(a * 7 + b) % 3] << "\n";
+    out << "light 0 4 -6 2\n";
+}
+
+// A job done without the daemon: parse, build and render
+double standalone(int width, int spp, uint64_t seed, const string& output){
+    auto start = std::chrono::high_resolution_clock::now();
+    scene_description s;
+    string error;
+    if(!load_scene(scene_path, s, error))cout << error << "\n";
+    camera cam;
+    cam.screen_width = width;
+    cam.aspect_ratio = s.aspect;
+    cam.max_depth = s.depth;
+    cam.iterations = spp;
+    cam.lookfrom = s.lookfrom;
+    cam.lookat = s.lookat;
+    cam.vup = s.vup;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.output_path = output;
+    cam.render(s.world, s.lights);
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Misses of a status reply, "... cache HITS/MISSES"
+int cache_misses(const string& status){
+    return stoi(status.substr(status.rfind('/') + 1));
+}
+
+// Threads of this process
+int thread_count(){
+    int n = 0;
+    DIR* tasks = opendir("/proc/self/task");
+    if(!tasks)return 0;
+    while(dirent* e = readdir(tasks))n += e->d_name[0] != '.';
+    closedir(tasks);
+    return n;
+}
+
+vector<float> image(const string& path){
+    int w, h;
+    vector<float> pixels;
+    read_pfm(path, w, h, pixels);
+    remove(path.c_str());
+    return pixels;
+}
+
+int main(){
+    write_scene();
+    bool passed = true;
+
+    render_daemon renderer;
+    thread server ([&](){ renderer.serve(socket_path); });
+    daemon_client client;
+    for(int attempt = 0; attempt < 100 && !client.connect_to(socket_path); attempt++)
+        this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // Same image over the socket as rendered directly
+    standalone(160, 4, 7, "/tmp/daemon_direct.pfm");
+    string queued = client.request("render scene=" + scene_path + " out=/tmp/daemon_job.pfm seed=7");
+    string done = client.request("wait " + queued.substr(7));
+    bool same = image("/tmp/daemon_direct.pfm") == image("/tmp/daemon_job.pfm");
+    cout << queued << ", " << done << ", same image: " << (same ? "yes" : "NO") << "\n";
+    passed &= same && done.rfind("done", 0) == 0;
+
+    // Errors come back as replies
+    string missing = client.request("wait " + client.request("render scene=/tmp/no_such_scene.txt out=/tmp/x.pfm").substr(7));
+    string bad = client.request("render scene=" + scene_path);
+    string unwritable = client.request("wait " + client.request("render scene=" + scene_path + " out=/tmp/no_such_dir/x.pfm width=8 spp=1").substr(7));
+    cout << missing << "\n" << bad << "\n" << unwritable << "\n";
+    passed &= missing.rfind("failed", 0) == 0 && bad.rfind("error", 0) == 0 && unwritable.rfind("failed", 0) == 0;
+
+    // Thumbnails, each from scratch and then all through the daemon
+    double scratch_ms = 0;
+    for(int j = 0; j < batch; j++)scratch_ms += standalone(64, 2, j, "/tmp/daemon_thumb.pfm");
+    remove("/tmp/daemon_thumb.pfm");
+
+    auto start = std::chrono::high_resolution_clock::now();
+    vector<string> ids;
+    for(int j = 0; j < batch; j++)
+        ids.push_back(client.request("render scene=" + scene_path + " out=/tmp/daemon_thumb" + to_string(j) + ".pfm width=64 spp=2 seed=" + to_string(j)).substr(7));
+    int ok = 0;
+    for(auto& id : ids)ok += client.request("wait " + id).rfind("done", 0) == 0;
+    double daemon_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    for(int j = 0; j < batch; j++)remove(("/tmp/daemon_thumb" + to_string(j) + ".pfm").c_str());
+
+    printf("\n%d thumbnails    from scratch %7.1f ms   daemon %7.1f ms   %.2fx\n", batch, scratch_ms, daemon_ms, scratch_ms / daemon_ms);
+    string before = client.request("status");
+    cout << before << "\n";
+    passed &= ok == batch;
+
+    // An edited scene file is read again, even within the same second
+    this_thread::sleep_for(std::chrono::milliseconds(20));
+    write_scene();
+    string again = client.request("wait " + client.request("render scene=" + scene_path + " out=/tmp/daemon_job.pfm width=32 spp=1").substr(7));
+    remove("/tmp/daemon_job.pfm");
+    string status = client.request("status");
+    cout << "after editing the scene: " << status << "\n";
+    passed &= again.rfind("done", 0) == 0 && cache_misses(status) == cache_misses(before) + 1;
+
+    // Sessions end with their connections, many short clients leave no threads behind
+    int threads_before = thread_count();
+    for(int c = 0; c < 200; c++){
+        daemon_client once;
+        passed &= once.connect_to(socket_path) && once.request("status").rfind("queued", 0) == 0;
+    }
+    int threads_after = thread_count();
+    for(int attempt = 0; attempt < 100 && threads_after > threads_before; attempt++){
+        this_thread::sleep_for(std::chrono::milliseconds(10));
+        threads_after = thread_count();
+    }
+    cout << "threads before and after 200 clients: " << threads_before << ", " << threads_after << "\n";
+    passed &= threads_after <= threads_before;
+
+    cout << client.request("quit") << "\n";
+    server.join();
+
+    // Shares of long jobs on 4 cores, each running job asks before every pass
+    render_daemon shared (4);
+    render_job job;
+    job.scene_path = scene_path;
+    job.width = 160;
+    job.spp = 64;
+    job.output_path = "/tmp/daemon_low.pfm";
+    int low = shared.submit(job);
+    job.priority = 3;
+    job.output_path = "/tmp/daemon_high.pfm";
+    int high = shared.submit(job);
+    while(shared.share(low) == 0 || shared.share(high) == 0)this_thread::sleep_for(std::chrono::milliseconds(1));
+    cout << "\nshares on 4 cores: priority 1 gets " << shared.share(low) << ", priority 3 gets " << shared.share(high) << "\n";
+    passed &= shared.share(low) == 1 && shared.share(high) == 3;
+    job_result high_result = shared.wait(high);
+    cout << "priority 3 done after " << high_result.ms << " ms, priority 1 now gets " << shared.share(low) << "\n";
+    passed &= shared.wait(low).ok && high_result.ok;
+    remove("/tmp/daemon_low.pfm");
+    remove("/tmp/daemon_high.pfm");
+    remove(scene_path.c_str());
+
+    cout << (passed ? "all passed" : "FAILED") << "\n";
+    return passed ? 0 : 1;
+}
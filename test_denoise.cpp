@@ -0,0 +1,92 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+
+// 4 spp with the a-trous denoiser (denoiser.h) against 15 spp without, on the main.cpp scene.
+// Both are compared with a long render as RMSE of the 8 bit output values, and the denoised
+// one has to win on time and on error. A denoiser with no passes must leave the image alone.
+
+const int width = 200;
+const int depth = 6;
+const int reference_spp = 1024;
+
+void scene(hittable_list& world, hittable_list& lights){
+    world.add(make_shared<sphere>(vec3(-2, 0.5, -2), 1, make_shared<metal>(color(0.1, 0.7, 0.2), 0)));
+    world.add(make_shared<sphere>(vec3(0, 0.5, -3), 1, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    world.add(make_shared<sphere>(vec3(-0.55, 0, -1), 0.25, make_shared<lambertian>(color(0.2, 0.1, 0.7))));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    lights.add(make_shared<sphere>(vec3(1.55, 0, -1), 0.25, make_shared<lambertian>(color(1,1,1))));
+}
+
+vector<int> read_ppm8(const string& path){
+    ifstream in (path);
+    string magic;
+    int w, h, max_value;
+    in >> magic >> w >> h >> max_value;
+    vector<int> v (w * h * 3);
+    for(auto& c : v)in >> c;
+    return v;
+}
+
+double rmse(const vector<int>& a, const vector<int>& b){
+    double s = 0;
+    for(size_t i = 0; i < a.size(); i++)s += double(a[i] - b[i]) * (a[i] - b[i]);
+    return sqrt(s / a.size());
+}
+
+// Best of three wall times, the image of the last run
+double render(hittable_list& world, hittable_list& lights, int spp, bool denoise, int passes, uint64_t seed, vector<int>& image, int runs = 3){
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = depth;
+    cam.iterations = spp;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.denoise = denoise;
+    cam.denoise_filter.passes = passes;
+    cam.output_path = "/tmp/denoise_test.ppm";
+
+    double best = infinity;
+    for(int run = 0; run < runs; run++){
+        auto start = std::chrono::high_resolution_clock::now();
+        cam.render(world, lights);
+        best = fmin(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+    image = read_ppm8(cam.output_path);
+    remove(cam.output_path.c_str());
+    return best;
+}
+
+int main(){
+    hittable_list world, lights;
+    scene(world, lights);
+    bool passed = true;
+
+    vector<int> reference;
+    double ref_ms = render(world, lights, reference_spp, false, 5, 7, reference, 1);
+    cout << "reference " << reference_spp << " spp, " << ref_ms << " ms\n\n";
+
+    vector<int> plain, denoised, untouched, four;
+    double plain_ms = render(world, lights, 15, false, 5, 1, plain);
+    double denoised_ms = render(world, lights, 4, true, 5, 1, denoised);
+    printf("15 spp             %7.1f ms   rmse %6.2f\n", plain_ms, rmse(plain, reference));
+    printf("4 spp + denoise    %7.1f ms   rmse %6.2f\n", denoised_ms, rmse(denoised, reference));
+    passed &= denoised_ms < plain_ms && rmse(denoised, reference) < rmse(plain, reference);
+
+    render(world, lights, 4, true, 0, 1, untouched, 1);
+    render(world, lights, 4, false, 5, 1, four, 1);
+    bool same = untouched == four;
+    cout << "no passes " << (same ? "keeps" : "CHANGES") << " the image\n";
+    passed &= same;
+
+    cout << (passed ? "all passed" : "FAILED") << "\n";
+    return passed ? 0 : 1;
+}
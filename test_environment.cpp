@@ -0,0 +1,69 @@
+#include "vec3.h"
+#include "environment.h"
+
+#include <iostream>
+#include <fstream>
+
+// Writes a small sky with a sun to a PFM, then checks that the importance sampling is
+// consistent (sample pdf == pdf(dir), E[L/pdf] == integral of L) and compares its noise
+// with uniform sphere sampling
+
+int main(){
+    const int w = 256, h = 128;
+    const string path = "/tmp/test_environment.pfm";
+    {
+        ofstream out (path, ios::binary);
+        out << "PF\n" << w << ' ' << h << "\n-1.0\n";
+        // Bottom row first
+        for(int y = h - 1; y >= 0; y--){
+            for(int x = 0; x < w; x++){
+                float sky = y < h / 2 ? 0.2f + 0.6f * (1.0f - float(y) / (h / 2)) : 0.05f;
+                bool sun = abs(x - 40) <= 2 && abs(y - 30) <= 2;
+                float rgb[3] = {sun ? 5000.0f : sky, sun ? 4500.0f : sky, sun ? 4000.0f : sky * 1.3f};
+                out.write((const char*)rgb, sizeof(rgb));
+            }
+        }
+    }
+
+    environment_map env (path);
+    if(!env.valid()){
+        cout << "could not read " << path << "\n";
+        return 1;
+    }
+
+    // Reference integral by quadrature over the texels
+    double reference = 0;
+    const int q = 2048;
+    for(int j = 0; j < q; j++){
+        double theta = pi * (j + 0.5) / q;
+        for(int i = 0; i < 2 * q; i++){
+            double phi = 2 * pi * (i + 0.5) / (2 * q);
+            vec3 d (sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            reference += env.eval(d).e[1] * sin(theta) * (pi / q) * (2 * pi / (2 * q));
+        }
+    }
+
+    const int n = 1000000;
+    double sum = 0, sum2 = 0, max_pdf_error = 0;
+    double uniform_sum = 0, uniform_sum2 = 0;
+    for(int i = 0; i < n; i++){
+        double pdf;
+        vec3 d = env.sample(random_double(), random_double(), pdf);
+        max_pdf_error = fmax(max_pdf_error, fabs(env.pdf(d) - pdf) / pdf);
+        double e = env.eval(d).e[1] / pdf;
+        sum += e;
+        sum2 += e * e;
+
+        double u = env.eval(sphere_direction(random_double(), random_double())).e[1] * 4 * pi;
+        uniform_sum += u;
+        uniform_sum2 += u * u;
+    }
+
+    double mean = sum / n, uniform_mean = uniform_sum / n;
+    cout << "reference integral:   " << reference << "\n";
+    cout << "importance estimate:  " << mean << " (stddev per sample " << sqrt(sum2 / n - mean * mean) << ")\n";
+    cout << "uniform estimate:     " << uniform_mean << " (stddev per sample " << sqrt(uniform_sum2 / n - uniform_mean * uniform_mean) << ")\n";
+    cout << "max relative pdf mismatch: " << max_pdf_error << "\n";
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "fastmath.h"
+#include "utils.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <x86intrin.h>
+
+// Error and speed of every fastmath.h function in every tier. The errors are the worst
+// over the inputs against long double math, the numbers in the table at the top of
+// fastmath.h. Cycles are TSC ticks per 4 lane call, the best of several runs
+
+const int samples = 1 << 20;
+const int runs = 5;
+
+vector<float> xs, ys;
+
+// x with a random exponent in [lo, hi) and random mantissa, so every binade is covered
+float random_binade(int lo, int hi){
+    return ldexpf(1.0f + random_float(), lo + int(random_u64() % (hi - lo)));
+}
+
+// Relative error, or for log the error relative to max(1, |reference|)
+template <typename F, typename R>
+double max_relative(const F& fn, const R& ref, bool absolute = false){
+    double worst = 0;
+    alignas(16) float got[4];
+    for(int i = 0; i < samples; i += 4){
+        _mm_store_ps(got, fn(_mm_loadu_ps(&xs[i]), _mm_loadu_ps(&ys[i])));
+        for(int k = 0; k < 4; k++){
+            long double r = ref(xs[i + k], ys[i + k]);
+            long double e = fabsl(got[k] - r);
+            e /= absolute ? fmaxl(1, fabsl(r)) : fabsl(r);
+            worst = fmax(worst, double(e));
+        }
+    }
+    return worst;
+}
+
+template <typename F>
+double cycles(const F& fn){
+    double best = INFINITY;
+    __m128 sink = _mm_setzero_ps();
+    for(int r = 0; r < runs; r++){
+        uint64_t start = __rdtsc();
+        for(int i = 0; i < samples; i += 4)sink = _mm_add_ps(sink, fn(_mm_loadu_ps(&xs[i]), _mm_loadu_ps(&ys[i])));
+        best = fmin(best, double(__rdtsc() - start) / (samples / 4));
+    }
+    volatile float keep = _mm_cvtss_f32(sink);
+    (void)keep;
+    return best;
+}
+
+template <typename F, typename R>
+void row(const char* name, const F& fn, const R& ref, bool absolute = false){
+    cout << "  " << left << setw(8) << name << right << setw(12) << max_relative(fn, ref, absolute)
+         << setw(10) << cycles(fn) << "\n";
+}
+
+template <int tier>
+void run_tier(const char* name){
+    cout << name << "          error    cycles\n";
+
+    for(int i = 0; i < samples; i++)xs[i] = random_binade(-60, 60);
+    row("rsqrt", [](__m128 x, __m128){ return rsqrt4<tier>(x); }, [](float x, float){ return 1.0L / sqrtl(x); });
+    row("rcp", [](__m128 x, __m128){ return rcp4<tier>(x); }, [](float x, float){ return 1.0L / x; });
+    row("log", [](__m128 x, __m128){ return log4<tier>(x); }, [](float x, float){ return logl(x); }, true);
+
+    for(int i = 0; i < samples; i++)xs[i] = random_float(-80, 80);
+    row("exp", [](__m128 x, __m128){ return exp4<tier>(x); }, [](float x, float){ return expl(x); });
+
+    // x in every binade, y so that |y log(x)| stays below 80
+    for(int i = 0; i < samples; i++){
+        xs[i] = random_binade(-40, 40);
+        ys[i] = random_float(-1, 1) * 80 / fmax(fabs(log(xs[i])), 1.0);
+    }
+    row("pow", [](__m128 x, __m128 y){ return pow4<tier>(x, y); }, [](float x, float y){ return powl(x, y); });
+}
+
+int main(){
+    xs.resize(samples);
+    ys.assign(samples, 0);
+    cout << scientific << setprecision(2);
+
+    run_tier<RT_MATH_EXACT>("exact");
+    run_tier<RT_MATH_FAST>("fast");
+    run_tier<RT_MATH_APPROX>("approx");
+
+    cout << fixed << setprecision(3);
+    cout << "pow5 against pow, x in [0, 1]\n";
+    double worst = 0;
+    for(int i = 0; i < samples; i++){
+        float x = random_float();
+        worst = fmax(worst, fabs(double(pow5(x)) - pow(double(x), 5)));
+    }
+    cout << scientific << "  absolute error " << worst << "\n";
+    return 0;
+}
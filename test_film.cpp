@@ -0,0 +1,68 @@
+#include "vec3.h"
+#include "film.h"
+#include "parallel.h"
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+
+// Accumulates samples and random splats into a film with 1, 2, 4 and 8 threads. Every
+// pixel sample reseeds random_double from its pixel and pass, so the films must match
+// bit for bit, and samples per second should not drop as threads are added
+
+const int width = 512;
+const int height = 512;
+const int passes = 8;
+
+// A few hundred cycles of fake shading per sample
+color shade(){
+    color c (0,0,0);
+    for(int i = 0; i < 32; i++)c += color(random_double(), random_double(), random_double());
+    return c / 32;
+}
+
+film run(int threads, double& seconds){
+    vector<tile> tiles = make_tiles(width, height, 32);
+    film image;
+    image.resize(width, height, tiles.size());
+    vector<tile_accumulator> accumulators (worker_count(tiles.size(), threads));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int k = 0; k < passes; k++){
+        parallel_for_workers(tiles.size(), [&](int t, int worker){
+            tile_accumulator& acc = accumulators[worker];
+            image.begin(acc, tiles[t]);
+            for(int j = tiles[t].y0; j < tiles[t].y1; j++){
+                for(int i = tiles[t].x0; i < tiles[t].x1; i++){
+                    seed_random(((uint64_t)(j * width + i) << 32) | k);
+                    acc.add(i, j, shade());
+                    // One light tracing style splat to a random pixel per sample
+                    int si = random_u64() % width, sj = random_u64() % height;
+                    acc.splat(si, sj, color(0.01, 0.02, 0.03) * random_double());
+                }
+            }
+            image.commit(acc);
+        }, threads);
+        image.merge_splats();
+    }
+    seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    return image;
+}
+
+int main(){
+    double base_seconds;
+    film reference = run(1, base_seconds);
+    double samples = double(width) * height * passes;
+    cout << "1 thread: " << samples / base_seconds / 1e6 << " M samples/s\n";
+
+    for(int threads : {2, 4, 8}){
+        double seconds;
+        film image = run(threads, seconds);
+        bool same = memcmp(image.pixels.data(), reference.pixels.data(), sizeof(color) * image.pixels.size()) == 0;
+        cout << threads << " threads: " << samples / seconds / 1e6 << " M samples/s, "
+             << (same ? "identical to 1 thread" : "DIFFERENT from 1 thread") << "\n";
+    }
+    cout << "hardware threads: " << default_thread_count() << "\n";
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "material.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "environment.h"
+
+#include <iostream>
+#include <chrono>
+
+// Compares the scalar dielectic::scatter with the simd glass kernel on random hits.
+// Both draw their one random number from random_double(), reseeded to the same value per hit.
+// Then times a wavefront render of a glass scene with the glass hits of each bounce batched
+// through the kernel against one scalar scatter per hit
+
+int main(){
+    const int n = 200000;
+    dielectic glass (1.5);
+
+    vector<vec3> directions (n), outward (n), scalar_out (n), kernel_out (n), batch_out (n);
+    vector<double> u (n);
+    for(int i = 0; i < n; i++){
+        directions[i] = random_unit_vector() * random_double(0.5, 2.0);
+        outward[i] = random_unit_vector();
+    }
+
+    int mismatched = 0;
+    double max_error = 0;
+    for(int i = 0; i < n; i++){
+        ray r (point3(0,0,0), directions[i]);
+        hit_record rec;
+        rec.set_face_normal(r, outward[i]);
+        color attenuation;
+        ray scattered;
+
+        seed_random(i);
+        glass.scatter(r, rec, attenuation, scattered);
+        scalar_out[i] = scattered.dir;
+
+        // fast_scatter gets the face normal like sphere::fast_hit gives it
+        hit_record fast_rec;
+        fast_rec.set_face_normal(r, outward[i]);
+        seed_random(i);
+        u[i] = random_double();
+        seed_random(i);
+        glass.fast_scatter(r, fast_rec, attenuation, scattered);
+        kernel_out[i] = scattered.dir;
+
+        // A different choice of reflect or refract shows up as a large difference
+        double e = (scalar_out[i] - kernel_out[i]).length();
+        if(e > 1e-3)mismatched++;
+        else max_error = fmax(max_error, e);
+    }
+
+    vector<color> batch_attenuation (n);
+    glass.scatter_batch(n, directions.data(), outward.data(), u.data(), batch_out.data(), batch_attenuation.data());
+    int batch_mismatched = 0;
+    for(int i = 0; i < n; i++)
+        if((batch_out[i] - kernel_out[i]).length() > 1e-6 || (batch_attenuation[i] - color(1,1,1)).length() != 0)batch_mismatched++;
+
+    cout << "different reflect/refract choice: " << mismatched << " / " << n << "\n";
+    cout << "max direction error otherwise: " << max_error << "\n";
+    cout << "batch vs single lane mismatches (direction or attenuation): " << batch_mismatched << "\n";
+
+    // Throughput of the scalar path vs the batch kernel, random numbers drawn up front
+    auto start = std::chrono::high_resolution_clock::now();
+    double sink = 0;
+    for(int i = 0; i < n; i++){
+        ray r (point3(0,0,0), directions[i]);
+        hit_record rec;
+        rec.set_face_normal(r, outward[i]);
+        color attenuation;
+        ray scattered;
+        glass.scatter(r, rec, attenuation, scattered);
+        sink += scattered.dir.e[0];
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    glass.scatter_batch(n, directions.data(), outward.data(), u.data(), batch_out.data(), batch_attenuation.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    sink += batch_out[0].e[0];
+
+    cout << "scalar: " << std::chrono::duration<double, std::nano>(mid - start).count() / n << " ns/hit\n";
+    cout << "batch:  " << std::chrono::duration<double, std::nano>(end - mid).count() / n << " ns/hit (" << sink << ")\n";
+
+    // A field of glass balls on a diffuse floor, mostly glass hits after the first bounce
+    hittable_list world, lights;
+    seed_random(3);
+    auto clear = make_shared<dielectic>(1.5);
+    for(int a = -12; a < 12; a++)
+        for(int b = 0; b < 24; b++)
+            world.add(make_shared<sphere>(point3(a * 0.5 + random_double(0, 0.2), 0, -1 - b * 0.5), 0.2, clear));
+    world.add(make_shared<sphere>(point3(0, -1000.2, -1), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    world.build_bvh();
+    lights.add(make_shared<sphere>(point3(0, 8, -6), 3, make_shared<lambertian>(color(1,1,1))));
+
+    const char* names[] = {"one scatter per hit", "batched per bounce"};
+    double times[2] = {infinity, infinity}, mean[2] = {0, 0};
+    // Interleaved best of five
+    for(int run = 0; run < 5; run++){
+        for(int m = 0; m < 2; m++){
+            camera cam;
+            cam.screen_width = 240;
+            cam.max_depth = 12;
+            cam.iterations = 16;
+            cam.tile_size = 64;
+            cam.lookfrom = point3(0, 1, 1);
+            cam.lookat = point3(0, 0, -4);
+            cam.verbose = false;
+            cam.wavefront = true;
+            cam.batch_scatter = m == 1;
+            cam.output_path = "/tmp/glass_wavefront.pfm";
+            auto render_start = std::chrono::high_resolution_clock::now();
+            cam.render(world, lights);
+            times[m] = fmin(times[m], std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - render_start).count());
+
+            int w, h;
+            vector<float> rgb;
+            read_pfm(cam.output_path, w, h, rgb);
+            mean[m] = 0;
+            for(float c : rgb)mean[m] += c / rgb.size();
+        }
+    }
+    remove("/tmp/glass_wavefront.pfm");
+    for(int m = 0; m < 2; m++)printf("wavefront, %-20s %7.1f ms, mean %.4f\n", names[m], times[m], mean[m]);
+    printf("batched %.2fx\n", times[0] / times[1]);
+
+    return 0;
+}
@@ -0,0 +1,238 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "environment.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <map>
+#include <cstring>
+
+// Golden image regression test. Each case renders a canonical scene at a fixed seed and low
+// spp and compares it with a high spp reference in golden/. Per pixel noise at low spp is far
+// above any real regression, so the images are compared as means over 4x4 blocks:
+//   block rmse   root mean square difference of the block means in linear 0-255
+//   bias         difference of the total brightness relative to the reference's, catches
+//                small shifts the noise hides in the blocks
+// A case also fails when it renders slower than time_slack times its stored baseline.
+//
+//   test_golden            checks every case, exit status 1 on any failure
+//   test_golden --update   renders the references and baselines again (slow), after a
+//                          change that is meant to alter the images
+
+const string golden_dir = "golden/";
+const int width = 160;
+const int block = 4;
+const int reference_spp = 256;
+const int test_spp = 16;
+// Different seeds, so the test samples are not a subset of the reference's
+const uint64_t reference_seed = 2;
+const uint64_t test_seed = 1;
+const double time_slack = 2.0;      // times the baseline, plus 100 ms for timer noise
+
+class image8 {
+    public:
+        int width = 0, height = 0;
+        vector<unsigned char> rgb;
+
+        bool read(const string& path){
+            ifstream in (path, ios::binary);
+            string magic;
+            int max_value;
+            if(!(in >> magic >> width >> height >> max_value) || (magic != "P3" && magic != "P6"))return false;
+            rgb.resize(width * height * 3);
+            if(magic == "P6"){
+                in.get();
+                in.read((char*)rgb.data(), rgb.size());
+                return bool(in);
+            }
+            for(auto& c : rgb){
+                int v;
+                if(!(in >> v))return false;
+                c = v;
+            }
+            return true;
+        }
+
+        bool write(const string& path) const {
+            ofstream out (path, ios::binary);
+            out << "P6\n" << width << ' ' << height << "\n255\n";
+            out.write((const char*)rgb.data(), rgb.size());
+            return bool(out);
+        }
+};
+
+class scene {
+    public:
+        hittable_list world;
+        hittable_list lights;
+        shared_ptr<environment_map> environment;
+};
+
+// The main.cpp scene: metal, diffuse and a small spherical light
+void spheres(scene& s){
+    s.world.add(make_shared<sphere>(vec3(-2, 0.5, -2), 1, make_shared<metal>(color(0.1, 0.7, 0.2), 0)));
+    s.world.add(make_shared<sphere>(vec3(0, 0.5, -3), 1, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    s.world.add(make_shared<sphere>(vec3(-0.55, 0, -1), 0.25, make_shared<lambertian>(color(0.2, 0.1, 0.7))));
+    s.world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    s.lights.add(make_shared<sphere>(vec3(1.55, 0, -1), 0.25, make_shared<lambertian>(color(1,1,1))));
+}
+
+// Glass in front of diffuse spheres, rays cross the surface from both sides
+void glass(scene& s){
+    s.world.add(make_shared<sphere>(vec3(0, 0, -1.5), 0.5, make_shared<dielectic>(1.5)));
+    s.world.add(make_shared<sphere>(vec3(-0.8, 0.1, -3), 0.6, make_shared<lambertian>(color(0.8, 0.3, 0.2))));
+    s.world.add(make_shared<sphere>(vec3(0.9, 0.2, -3.5), 0.7, make_shared<lambertian>(color(0.2, 0.4, 0.8))));
+    s.world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    s.lights.add(make_shared<sphere>(vec3(0, 3, -2), 1, make_shared<lambertian>(color(1,1,1))));
+}
+
+// Constant sky, lit only through environment sampling and MIS
+void sky(scene& s){
+    s.world.add(make_shared<sphere>(vec3(-0.6, 0, -1.5), 0.5, make_shared<lambertian>(color(0.7, 0.7, 0.7))));
+    s.world.add(make_shared<sphere>(vec3(0.6, 0, -1.5), 0.5, make_shared<metal>(color(0.8, 0.6, 0.2), 0.2)));
+    s.world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.4, 0.5, 0.4))));
+    s.environment = make_shared<environment_map>(color(0.8, 0.9, 1.0));
+}
+
+enum class path { standard, fast, wavefront };
+
+class test_case {
+    public:
+        string name;
+        string reference;       // golden image compared against, several cases may share one
+        void (*make)(scene&);
+        path trace;
+        double max_block_rmse;
+        double max_bias;
+};
+
+// Thresholds are about twice what the code at the time of writing measures. A shift of a
+// few percent in one material stays inside them, 16 spp is too noisy to see it
+const test_case cases[] = {
+    {"spheres", "spheres", spheres, path::standard, 5.5, 0.04},
+    {"spheres_fast", "spheres", spheres, path::fast, 5.5, 0.04},
+    {"spheres_wavefront", "spheres", spheres, path::wavefront, 5.5, 0.04},
+    {"glass", "glass", glass, path::standard, 3.6, 0.05},
+    {"glass_fast", "glass", glass, path::fast, 4.0, 0.05},
+    {"glass_wavefront", "glass", glass, path::wavefront, 4.0, 0.05},
+    {"sky", "sky", sky, path::standard, 0.8, 0.01},
+};
+
+// Renders with the camera writing to a scratch file, returns the wall time in ms
+double render(const test_case& c, int spp, uint64_t seed, image8& out){
+    scene s;
+    c.make(s);
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = 6;
+    cam.iterations = spp;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.output_path = golden_dir + "last_" + c.name + ".ppm";
+    cam.environment = s.environment;
+    cam.fast_kernels = c.trace == path::fast;
+    cam.wavefront = c.trace == path::wavefront;
+    // The wavefront cases also cover the batched glass scatter, which is off by default
+    cam.batch_scatter = cam.wavefront;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cam.render(s.world, s.lights);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    out.read(cam.output_path);
+    remove(cam.output_path.c_str());
+    return ms;
+}
+
+void compare(const image8& a, const image8& b, double& block_rmse, double& bias){
+    // Back to linear before averaging, a mean of gamma values is darker than the gamma of the
+    // mean and the more so the noisier the pixels are. Scaled so 255 is white
+    double linear[256];
+    for(int v = 0; v < 256; v++)linear[v] = (v + 0.5) * (v + 0.5) / 256.0;
+    double sum_squares = 0, sum = 0, reference = 0;
+    int blocks = 0;
+    for(int by = 0; by + block <= a.height; by += block){
+        for(int bx = 0; bx + block <= a.width; bx += block){
+            for(int k = 0; k < 3; k++){
+                double d = 0;
+                for(int y = by; y < by + block; y++)
+                    for(int x = bx; x < bx + block; x++){
+                        int p = (y * a.width + x) * 3 + k;
+                        d += linear[a.rgb[p]] - linear[b.rgb[p]];
+                        reference += linear[b.rgb[p]];
+                    }
+                d /= block * block;
+                sum_squares += d * d;
+                sum += d;
+                blocks++;
+            }
+        }
+    }
+    block_rmse = sqrt(sum_squares / blocks);
+    bias = sum * block * block / reference;
+}
+
+map<string, double> read_baselines(){
+    map<string, double> times;
+    ifstream in (golden_dir + "baseline.txt");
+    string name;
+    double ms;
+    while(in >> name >> ms)times[name] = ms;
+    return times;
+}
+
+int main(int argc, char** argv){
+    bool update = argc > 1 && strcmp(argv[1], "--update") == 0;
+
+    if(update){
+        ofstream baseline (golden_dir + "baseline.txt");
+        for(const auto& c : cases){
+            image8 img;
+            if(c.name == c.reference){
+                double ms = render(c, reference_spp, reference_seed, img);
+                img.write(golden_dir + c.reference + ".ppm");
+                cout << c.reference << ": reference at " << reference_spp << " spp in " << ms << " ms\n";
+            }
+            // Best of three, the first render also pays for page faults
+            double best = INFINITY;
+            for(int r = 0; r < 3; r++)best = fmin(best, render(c, test_spp, test_seed, img));
+            baseline << c.name << ' ' << best << "\n";
+            cout << c.name << ": baseline " << best << " ms\n";
+        }
+        return 0;
+    }
+
+    map<string, double> baselines = read_baselines();
+    int failed = 0;
+    for(const auto& c : cases){
+        image8 golden, img;
+        if(!golden.read(golden_dir + c.reference + ".ppm")){
+            cout << "FAIL " << c.name << ": no reference " << golden_dir << c.reference << ".ppm, run with --update\n";
+            failed++;
+            continue;
+        }
+        double ms = render(c, test_spp, test_seed, img);
+        if(img.width != golden.width || img.height != golden.height){
+            cout << "FAIL " << c.name << ": " << img.width << "x" << img.height << " against a "
+                 << golden.width << "x" << golden.height << " reference\n";
+            failed++;
+            continue;
+        }
+
+        double block_rmse, bias;
+        compare(img, golden, block_rmse, bias);
+        double max_ms = baselines.count(c.name) ? baselines[c.name] * time_slack + 100 : INFINITY;
+        bool ok = block_rmse <= c.max_block_rmse && fabs(bias) <= c.max_bias && ms <= max_ms;
+        if(!ok)failed++;
+        cout << (ok ? "ok   " : "FAIL ") << c.name << ": block rmse " << block_rmse << " (max " << c.max_block_rmse
+             << "), bias " << bias << " (max " << c.max_bias << "), " << ms << " ms (max " << max_ms << ")\n";
+    }
+
+    cout << (failed ? to_string(failed) + " failed" : "all passed") << "\n";
+    return failed ? 1 : 0;
+}
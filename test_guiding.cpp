@@ -0,0 +1,91 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+
+// Error against time with and without path guiding, on the main.cpp scene with the light
+// shrunk to a third of its radius. Sphere lights are only found by bsdf sampling, so most
+// paths miss it. Both renders are compared with a long unguided reference, as mean squared
+// error of the linear pixel values, at growing sample counts.
+
+const int width = 160;
+const int depth = 6;
+const int reference_spp = 4096;
+
+void scene(hittable_list& world, hittable_list& lights){
+    world.add(make_shared<sphere>(vec3(-2, 0.5, -2), 1, make_shared<metal>(color(0.1, 0.7, 0.2), 0)));
+    world.add(make_shared<sphere>(vec3(0, 0.5, -3), 1, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    world.add(make_shared<sphere>(vec3(-0.55, 0, -1), 0.25, make_shared<lambertian>(color(0.2, 0.1, 0.7))));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    lights.add(make_shared<sphere>(vec3(1.55, 0, -1), 0.08, make_shared<lambertian>(color(1,1,1))));
+}
+
+vector<double> read_linear(const string& path){
+    ifstream in (path);
+    string magic;
+    int w, h, max_value;
+    in >> magic >> w >> h >> max_value;
+    vector<double> v (w * h * 3);
+    for(auto& x : v){
+        int c;
+        in >> c;
+        x = (c + 0.5) * (c + 0.5) / 65536.0;
+    }
+    return v;
+}
+
+double mse(const vector<double>& a, const vector<double>& b){
+    double s = 0;
+    for(size_t i = 0; i < a.size(); i++)s += (a[i] - b[i]) * (a[i] - b[i]);
+    return s / a.size();
+}
+
+double render(hittable_list& world, hittable_list& lights, int spp, bool guiding, uint64_t seed, vector<double>& image, size_t* leaves = nullptr){
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = depth;
+    cam.iterations = spp;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.guiding = guiding;
+    cam.guide_training = max(1, spp / 4);
+    cam.output_path = "guiding_test.ppm";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cam.render(world, lights);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    image = read_linear(cam.output_path);
+    remove(cam.output_path.c_str());
+    if(leaves)*leaves = cam.guide.empty() ? 0 : cam.guide.leaf_count();
+    return ms;
+}
+
+int main(){
+    hittable_list world, lights;
+    scene(world, lights);
+
+    vector<double> reference;
+    double ref_ms = render(world, lights, reference_spp, false, 7, reference);
+    cout << "reference " << reference_spp << " spp unguided, " << ref_ms << " ms\n\n";
+
+    // Efficiency is the inverse of mse times time, its ratio is how much longer bsdf sampling
+    // alone takes to reach the guided error
+    cout << "  spp   bsdf ms      bsdf mse   guided ms    guided mse   leaves   mse ratio   efficiency\n";
+    for(int spp = 8; spp <= 128; spp *= 2){
+        vector<double> plain, guided;
+        size_t leaves;
+        double plain_ms = render(world, lights, spp, false, 1, plain);
+        double guided_ms = render(world, lights, spp, true, 1, guided, &leaves);
+        double plain_mse = mse(plain, reference), guided_mse = mse(guided, reference);
+        printf("%5d  %8.1f  %12.3e  %10.1f  %12.3e  %7zu  %10.2f  %11.2f\n", spp, plain_ms, plain_mse, guided_ms, guided_mse, leaves,
+               plain_mse / guided_mse, plain_mse * plain_ms / (guided_mse * guided_ms));
+    }
+    return 0;
+}
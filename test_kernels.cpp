@@ -0,0 +1,274 @@
+#include "vec3.h"
+#include "vec4.h"
+#include "ray.h"
+#include "ray4.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "material.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <x86intrin.h>
+
+// Accuracy and speed of every simd_ kernel in vec4.h next to its scalar vec4 version, and of
+// sphere::hit, fast_hit and simd_hit. Inputs are random, errors are measured against the
+// same math in long double: ULPs against the reference rounded to float, and the error
+// relative to the size of the reference (its length for vectors). Cycles are TSC ticks per
+// call in a loop over the inputs, the best of several runs. The scalar loops are free to be
+// auto vectorized, which is the bar a hand written kernel has to beat
+
+const int samples = 1 << 16;
+const int runs = 7;
+
+// Distance in representable floats between a and b
+int64_t ulp_distance(float a, float b){
+    if(a == b)return 0;
+    if(std::isnan(a) || std::isnan(b))return INT32_MAX;
+    int32_t ia, ib;
+    memcpy(&ia, &a, 4);
+    memcpy(&ib, &b, 4);
+    // Map the sign magnitude bits onto a monotonic integer line
+    if(ia < 0)ia = INT32_MIN - ia;
+    if(ib < 0)ib = INT32_MIN - ib;
+    return llabs((int64_t)ia - ib);
+}
+
+class error_stats {
+    public:
+        int64_t max_ulp = 0;
+        double sum_ulp = 0;
+        double max_relative = 0;
+        long count = 0;
+
+        // scale is what the error is relative to, |ref| for scalars and |ref| as a vector
+        void add(float got, long double ref, long double scale){
+            int64_t u = ulp_distance(got, float(ref));
+            max_ulp = max(max_ulp, u);
+            sum_ulp += u;
+            if(scale > 0)max_relative = fmax(max_relative, double(fabsl(got - ref) / scale));
+            count++;
+        }
+
+        void add(const vec4& got, const long double ref[4], int lanes = 4){
+            long double scale = 0;
+            for(int k = 0; k < lanes; k++)scale += ref[k] * ref[k];
+            scale = sqrtl(scale);
+            const float* g = &got.x;
+            for(int k = 0; k < lanes; k++)add(g[k], ref[k], scale);
+        }
+
+        double mean_ulp() const { return count ? sum_ulp / count : 0; }
+};
+
+// Best TSC ticks per call of fn(i) over every sample
+template <typename F>
+double cycles_per_call(const F& fn){
+    double best = INFINITY;
+    for(int r = 0; r < runs; r++){
+        uint64_t start = __rdtsc();
+        for(int i = 0; i < samples; i++)fn(i);
+        best = fmin(best, double(__rdtsc() - start) / samples);
+    }
+    return best;
+}
+
+vector<vec4> a, b, normals, results;
+vector<float> t, scalar_results;
+
+vec4 random_vec4(){
+    return vec4(random_float(-10, 10), random_float(-10, 10), random_float(-10, 10), 0);
+}
+
+void print_row(const string& name, const error_stats& simd, const error_stats& scalar, double simd_cycles, double scalar_cycles){
+    cout << left << setw(30) << name << right
+         << setw(10) << simd.max_ulp << setw(10) << fixed << setprecision(2) << simd.mean_ulp()
+         << setw(12) << scientific << setprecision(1) << simd.max_relative
+         << setw(10) << scalar.max_ulp
+         << setw(9) << fixed << setprecision(2) << simd_cycles << setw(9) << scalar_cycles
+         << setw(8) << scalar_cycles / simd_cycles << "x\n";
+}
+
+// Lane wise kernels: simd(i) and scalar(i) return vec4, ref(i, out) fills 4 long doubles
+template <typename S, typename C, typename R>
+void vector_kernel(const string& name, const S& simd, const C& scalar, const R& ref, int lanes = 4){
+    error_stats simd_error, scalar_error;
+    for(int i = 0; i < samples; i++){
+        long double r[4];
+        ref(i, r);
+        simd_error.add(simd(i), r, lanes);
+        scalar_error.add(scalar(i), r, lanes);
+    }
+    double simd_cycles = cycles_per_call([&](int i){ results[i] = simd(i); });
+    double scalar_cycles = cycles_per_call([&](int i){ results[i] = scalar(i); });
+    print_row(name, simd_error, scalar_error, simd_cycles, scalar_cycles);
+}
+
+template <typename S, typename C, typename R>
+void scalar_kernel(const string& name, const S& simd, const C& scalar, const R& ref){
+    error_stats simd_error, scalar_error;
+    for(int i = 0; i < samples; i++){
+        long double r = ref(i);
+        simd_error.add(simd(i), r, fabsl(r));
+        scalar_error.add(scalar(i), r, fabsl(r));
+    }
+    double simd_cycles = cycles_per_call([&](int i){ scalar_results[i] = simd(i); });
+    double scalar_cycles = cycles_per_call([&](int i){ scalar_results[i] = scalar(i); });
+    print_row(name, simd_error, scalar_error, simd_cycles, scalar_cycles);
+}
+
+long double ld(float x){ return x; }
+
+void vec4_kernels(){
+    cout << left << setw(30) << "kernel" << right << setw(10) << "max ulp" << setw(10) << "mean ulp" << setw(12) << "max rel"
+         << setw(10) << "scalar" << setw(9) << "simd" << setw(9) << "scalar" << setw(9) << "speedup\n";
+    cout << left << setw(30) << "" << right << setw(10) << "" << setw(10) << "" << setw(12) << ""
+         << setw(10) << "max ulp" << setw(9) << "cycles" << setw(9) << "cycles" << "\n";
+
+    auto lanes = [](const vec4& v, int k){ return (&v.x)[k]; };
+
+    vector_kernel("simd_add(a, b)", [](int i){ return simd_add(a[i], b[i]); }, [](int i){ return a[i] + b[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) + lanes(b[i], k); });
+    vector_kernel("simd_minus(a, b)", [](int i){ return simd_minus(a[i], b[i]); }, [](int i){ return a[i] - b[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) - lanes(b[i], k); });
+    vector_kernel("simd_add_mul(a, t, b)", [](int i){ return simd_add_mul(a[i], t[i], b[i]); }, [](int i){ return a[i] * t[i] + b[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) * t[i] + lanes(b[i], k); });
+    vector_kernel("simd_add_mul(a, b, t)", [](int i){ return simd_add_mul(a[i], b[i], t[i]); }, [](int i){ return a[i] + b[i] * t[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) + ld(lanes(b[i], k)) * t[i]; });
+    vector_kernel("simd_minus_mul(a, t, b)", [](int i){ return simd_minus_mul(a[i], t[i], b[i]); }, [](int i){ return a[i] * t[i] - b[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) * t[i] - lanes(b[i], k); });
+    vector_kernel("simd_minus_mul(a, b, t)", [](int i){ return simd_minus_mul(a[i], b[i], t[i]); }, [](int i){ return a[i] - b[i] * t[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) - ld(lanes(b[i], k)) * t[i]; });
+    vector_kernel("simd_mul(a, t)", [](int i){ return simd_mul(a[i], t[i]); }, [](int i){ return a[i] * t[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) * t[i]; });
+    vector_kernel("simd_mul(a, b)", [](int i){ return simd_mul(a[i], b[i]); }, [](int i){ return a[i] * b[i]; },
+        [&](int i, long double* r){ for(int k = 0; k < 4; k++)r[k] = ld(lanes(a[i], k)) * lanes(b[i], k); });
+    vector_kernel("simd_normalize(a)", [](int i){ return simd_normalize(a[i]); }, [](int i){ return unit_vector(a[i]); },
+        [&](int i, long double* r){
+            long double l = 0;
+            for(int k = 0; k < 4; k++)l += ld(lanes(a[i], k)) * lanes(a[i], k);
+            for(int k = 0; k < 4; k++)r[k] = lanes(a[i], k) / sqrtl(l);
+        }, 3);
+    vector_kernel("simd_reflect(a, n)", [](int i){ return simd_reflect(a[i], normals[i]); }, [](int i){ return reflect(a[i], normals[i]); },
+        [&](int i, long double* r){
+            const vec4& n = normals[i];
+            long double d = 0;
+            for(int k = 0; k < 4; k++)d += ld(lanes(a[i], k)) * lanes(n, k);
+            for(int k = 0; k < 4; k++)r[k] = lanes(a[i], k) - 2 * d * lanes(n, k);
+        }, 3);
+
+    scalar_kernel("simd_dot(a, b)", [](int i){ return simd_dot(a[i], b[i]); }, [](int i){ return dot(a[i], b[i]); },
+        [&](int i){ long double d = 0; for(int k = 0; k < 4; k++)d += ld(lanes(a[i], k)) * lanes(b[i], k); return d; });
+    scalar_kernel("simd_length_squared(a)", [](int i){ return simd_length_squared(a[i]); }, [](int i){ return a[i].length_squared(); },
+        [&](int i){ long double d = 0; for(int k = 0; k < 4; k++)d += ld(lanes(a[i], k)) * lanes(a[i], k); return d; });
+}
+
+// Nearest root in (t_min, inf) of a ray against a sphere in long double, -1 for a miss
+long double reference_root(const ray& r, const sphere& s, double t_min){
+    long double oc[3], a = 0, half_b = 0, c = 0;
+    for(int k = 0; k < 3; k++){
+        oc[k] = (long double)r.orig.e[k] - s.center.e[k];
+        a += (long double)r.dir.e[k] * r.dir.e[k];
+        half_b += oc[k] * r.dir.e[k];
+        c += oc[k] * oc[k];
+    }
+    c -= (long double)s.radius * s.radius;
+    long double d = half_b * half_b - a * c;
+    if(d < 0)return -1;
+    long double root = (-half_b - sqrtl(d)) / a;
+    if(root <= t_min)root = (-half_b + sqrtl(d)) / a;
+    return root > t_min ? root : -1;
+}
+
+class hit_stats {
+    public:
+        int disagree = 0;           // hit where the reference misses or the other way round
+        double max_t_error = 0;     // relative to t
+        double max_normal_error = 0;
+        int flipped = 0;            // normal facing along the ray instead of against it
+        double cycles = 0;
+
+        void add(bool hit, const point3& p, const vec3& normal, double t, long double ref_t, const ray& r, const sphere& s){
+            if(hit != (ref_t > 0)){
+                disagree++;
+                return;
+            }
+            if(!hit)return;
+            max_t_error = fmax(max_t_error, double(fabsl(t - ref_t) / ref_t));
+            // Outward normal of the reference hit, turned against the ray like set_face_normal
+            vec3 ref_p = r.orig + double(ref_t) * r.dir;
+            vec3 outward = (ref_p - s.center) / s.radius;
+            if(dot(r.dir, outward) > 0)outward = -outward;
+            max_normal_error = fmax(max_normal_error, (normal - outward).length());
+            if(dot(normal, r.dir) > 0)flipped++;
+        }
+};
+
+void sphere_kernels(){
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    vector<sphere> spheres;
+    vector<ray> rays;
+    vector<ray4> rays4;
+    for(int i = 0; i < samples; i++){
+        point3 c (random_double(-5, 5), random_double(-5, 5), random_double(-5, 5));
+        double radius = random_double(0.1, 2);
+        spheres.emplace_back(c, radius, mat);
+        // Aimed near the sphere so about half hit, and some start inside it
+        point3 o = c + vec3(random_double(-10, 10), random_double(-10, 10), random_double(-10, 10)) * (i % 8 == 0 ? 0.05 : 1);
+        point3 target = c + random_unit_vector() * radius * random_double(0, 2);
+        ray r (o, target - o);
+        rays.push_back(r);
+        rays4.push_back(ray4(vec4(r.orig, 0), vec4(r.dir, 0)));
+    }
+    const double t_min = 0.001;
+
+    hit_stats exact, fast, simd;
+    vector<long double> ref (samples);
+    for(int i = 0; i < samples; i++){
+        ref[i] = reference_root(rays[i], spheres[i], t_min);
+        hit_record rec;
+        bool h = spheres[i].hit(rays[i], interval(t_min, infinity), rec);
+        exact.add(h, rec.p, rec.normal, rec.t, ref[i], rays[i], spheres[i]);
+        h = spheres[i].fast_hit(rays[i], interval(t_min, infinity), rec);
+        fast.add(h, rec.p, rec.normal, rec.t, ref[i], rays[i], spheres[i]);
+        hit_record4 rec4;
+        h = spheres[i].simd_hit(rays4[i], interval(t_min, infinity), rec4);
+        simd.add(h, vec3(rec4.p), vec3(rec4.normal), rec4.t, ref[i], rays[i], spheres[i]);
+    }
+
+    vector<double> sink (samples);
+    exact.cycles = cycles_per_call([&](int i){ hit_record rec; sink[i] = spheres[i].hit(rays[i], interval(t_min, infinity), rec) ? rec.t : 0; });
+    fast.cycles = cycles_per_call([&](int i){ hit_record rec; sink[i] = spheres[i].fast_hit(rays[i], interval(t_min, infinity), rec) ? rec.t : 0; });
+    simd.cycles = cycles_per_call([&](int i){ hit_record4 rec; sink[i] = spheres[i].simd_hit(rays4[i], interval(t_min, infinity), rec) ? rec.t : 0; });
+
+    int hits = 0;
+    for(auto r : ref)if(r > 0)hits++;
+    cout << "\n" << samples << " ray / sphere pairs, " << hits << " hit in the long double reference\n";
+    cout << left << setw(30) << "variant" << right << setw(10) << "wrong" << setw(12) << "max t err"
+         << setw(12) << "max n err" << setw(10) << "flipped" << setw(9) << "cycles\n";
+    auto row = [](const string& name, const hit_stats& s){
+        cout << left << setw(30) << name << right << setw(10) << s.disagree
+             << setw(12) << scientific << setprecision(1) << s.max_t_error << setw(12) << s.max_normal_error
+             << setw(10) << s.flipped << setw(9) << fixed << setprecision(2) << s.cycles << "\n";
+    };
+    row("sphere::hit", exact);
+    row("sphere::fast_hit", fast);
+    row("sphere::simd_hit", simd);
+}
+
+int main(){
+    seed_random(5);
+    for(int i = 0; i < samples; i++){
+        a.push_back(random_vec4());
+        b.push_back(random_vec4());
+        t.push_back(random_float(-4, 4));
+    }
+    results.resize(samples);
+    scalar_results.resize(samples);
+    for(int i = 0; i < samples; i++)normals.push_back(unit_vector(random_vec4()));
+
+    vec4_kernels();
+    sphere_kernels();
+
+    return 0;
+}
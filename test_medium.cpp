@@ -0,0 +1,109 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "medium.h"
+
+#include <iostream>
+#include <chrono>
+
+// Checks the tracking estimators against ray marched references and counts density
+// lookups per ray with a fine majorant grid and with one global bound
+
+// Forwards to a field and counts the calls
+class counting_density : public density_field {
+    public:
+        shared_ptr<density_field> inner;
+        mutable uint64_t calls = 0;
+
+        counting_density(shared_ptr<density_field> f) : inner(f) {};
+
+        double density(const point3& p) const override {
+            calls++;
+            return inner->density(p);
+        }
+
+        double max_density(const point3& lo, const point3& hi) const override {
+            return inner->max_density(lo, hi);
+        }
+};
+
+// Optical depth by fine midpoint marching
+double marched_transmittance(const density_field& f, const ray& r, double t0, double t1){
+    const int steps = 20000;
+    double length = r.dir.length();
+    double tau = 0;
+    for(int i = 0; i < steps; i++)
+        tau += f.density(r.at(t0 + (t1 - t0) * (i + 0.5) / steps)) * (t1 - t0) * length / steps;
+    return exp(-tau);
+}
+
+int main(){
+    auto boundary = make_shared<sphere>(point3(0,0,0), 1.0, nullptr);
+    const int n = 200000;
+
+    // Constant density, closed form transmittance vs hit frequency
+    constant_medium fog (boundary, 0.7, color(1,1,1));
+    ray through (point3(0,0,-3), vec3(0,0,2));
+    int passed = 0;
+    for(int i = 0; i < n; i++){
+        hit_record rec;
+        if(!fog.hit(through, interval(0.001, infinity), rec))passed++;
+    }
+    cout << "constant: exact T " << fog.transmittance(through, interval(0.001, infinity))
+         << ", delta tracking " << double(passed) / n << "\n";
+
+    // A dense wisp along z in thin smoke, voxel grid 32^3 over the unit ball's box
+    const int res = 32;
+    vector<float> voxels (res * res * res);
+    for(int k = 0; k < res; k++)
+        for(int j = 0; j < res; j++)
+            for(int i = 0; i < res; i++){
+                double x = (i + 0.5) / res * 2 - 1, y = (j + 0.5) / res * 2 - 1;
+                double wisp = exp(-((x - 0.3) * (x - 0.3) + y * y) / 0.005);
+                voxels[(k * res + j) * res + i] = 0.2 + 20 * wisp;
+            }
+    auto grid = make_shared<grid_density>(point3(-1,-1,-1), point3(1,1,1), res, res, res, voxels);
+
+    for(int majorant_res : {1, 16}){
+        auto counted = make_shared<counting_density>(grid);
+        heterogeneous_medium smoke (boundary, counted, color(1,1,1), point3(-1,-1,-1), point3(1,1,1), majorant_res);
+
+        ray r (point3(-0.5, 0.05, -3), vec3(0.2, 0, 1));
+        double t0, t1;
+        medium_span(*boundary, r, interval(0.001, infinity), t0, t1);
+        double reference = marched_transmittance(*grid, r, t0, t1);
+
+        counted->calls = 0;
+        int escaped = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(int i = 0; i < n; i++){
+            hit_record rec;
+            if(!smoke.hit(r, interval(0.001, infinity), rec))escaped++;
+        }
+        auto mid = std::chrono::high_resolution_clock::now();
+        double delta_lookups = double(counted->calls) / n;
+
+        counted->calls = 0;
+        double ratio = 0;
+        for(int i = 0; i < n; i++)ratio += smoke.transmittance(r, interval(0.001, infinity));
+        double ratio_lookups = double(counted->calls) / n;
+
+        // Lookups for rays spread over the whole volume
+        counted->calls = 0;
+        for(int i = 0; i < n; i++){
+            ray random_ray (point3(random_double(-0.9, 0.9), random_double(-0.9, 0.9), -3), vec3(0, 0, 1));
+            hit_record rec;
+            smoke.hit(random_ray, interval(0.001, infinity), rec);
+        }
+        double spread_lookups = double(counted->calls) / n;
+
+        cout << "majorant grid " << majorant_res << "^3: reference T " << reference
+             << ", delta tracking " << double(escaped) / n << ", ratio tracking " << ratio / n << "\n";
+        cout << "  lookups per ray: delta " << delta_lookups << ", ratio " << ratio_lookups
+             << ", over the volume " << spread_lookups
+             << " (" << std::chrono::duration<double, std::nano>(mid - start).count() / n << " ns per delta tracked ray)\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "environment.h"
+#include "numa.h"
+
+#include <iostream>
+#include <chrono>
+
+// Scaling report of the numa layer (numa.h): the machine's nodes, then render time of a
+// scene of many spheres under a BVH with the plain thread pool and with pinned workers in
+// 1, 2 and 4 domains, the BVH replicated per domain or interleaved. On machines with fewer
+// nodes than domains the cpus are regrouped (numa_topology::split), which shows the cost
+// of the layer itself but not the gain from local memory. Every render must give the same
+// image, it only depends on the seed.
+
+const int width = 320;
+const int depth = 6;
+const int spp = 8;
+
+void scene(hittable_list& world, hittable_list& lights){
+    world.add(make_shared<sphere>(vec3(0, -1000.5, -1), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    seed_random(42);
+    for(int a = 0; a < 60; a++)
+        for(int b = 0; b < 60; b++){
+            point3 c (-6 + 0.2 * a + 0.1 * random_double(), -0.45, -1 - 0.2 * b + 0.1 * random_double());
+            color albedo (random_double(), random_double(), random_double());
+            if(random_double() < 0.8)world.add(make_shared<sphere>(c, 0.05, make_shared<lambertian>(albedo)));
+            else world.add(make_shared<sphere>(c, 0.05, make_shared<metal>(albedo, 0.2)));
+        }
+    world.build_bvh();
+    lights.add(make_shared<sphere>(vec3(0, 4, -6), 2, make_shared<lambertian>(color(1,1,1))));
+}
+
+double render(hittable_list& world, hittable_list& lights, bool numa, int domains, bool replicate, vector<float>& image){
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = depth;
+    cam.iterations = spp;
+    cam.verbose = false;
+    cam.numa = numa;
+    cam.numa_domains = domains;
+    cam.numa_replicate = replicate;
+    cam.output_path = "numa_test.pfm";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cam.render(world, lights);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    int w, h;
+    read_pfm(cam.output_path, w, h, image);
+    remove(cam.output_path.c_str());
+    return ms;
+}
+
+int main(){
+    numa_topology machine = numa_topology::detect();
+    cout << machine.nodes.size() << " node(s), " << machine.cpu_count() << " cpu(s)\n";
+    for(auto& node : machine.nodes){
+        cout << "  node " << node.id << ":";
+        for(int c : node.cpus)cout << " " << c;
+        cout << "\n";
+    }
+
+    hittable_list world, lights;
+    scene(world, lights);
+    cout << world.objects.size() << " spheres, " << width << " px, " << spp << " spp\n\n";
+
+    // The first render pays for cold caches and page faults, it is not timed
+    vector<float> reference;
+    render(world, lights, false, 0, true, reference);
+    double base_ms = render(world, lights, false, 0, true, reference);
+    cout << "  layout                      ms   speedup   same image\n";
+    printf("  %-22s %7.1f     %5.2f   %s\n", "thread pool", base_ms, 1.0, "-");
+    for(int domains : {1, 2, 4})
+        for(bool replicate : {true, false}){
+            if(domains == 1 && !replicate)continue;
+            vector<float> image;
+            double ms = render(world, lights, true, domains, replicate, image);
+            string layout = to_string(domains) + (domains > 1 ? " domains " : " domain ") + (replicate ? "replicated" : "interleaved");
+            printf("  %-22s %7.1f     %5.2f   %s\n", layout.c_str(), ms, base_ms / ms, image == reference ? "yes" : "NO");
+        }
+    return 0;
+}
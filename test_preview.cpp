@@ -0,0 +1,89 @@
+#include "vec3.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "preview.h"
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+// Starts a preview server on the main.cpp scene, connects as a client and follows the frames
+// from the coarsest block down to full resolution passes, then moves the camera and adds a
+// sphere and reports the time from each command to the first frame of the new view
+
+const string socket_path = "/tmp/raytracer_test.sock";
+
+double since(std::chrono::high_resolution_clock::time_point t){
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t).count();
+}
+
+// Reads frames until one of a newer generation than old arrives
+bool wait_generation(preview_client& client, uint32_t old){
+    while(client.read_frame())
+        if(client.header.generation > old)return true;
+    return false;
+}
+
+int main(){
+    hittable_list world;
+    world.add(make_shared<sphere>(vec3(-2, 0.5, -2), 1, make_shared<metal>(color(0.1, 0.7, 0.2), 0)));
+    world.add(make_shared<sphere>(vec3(0, 0.5, -3), 1, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    world.add(make_shared<sphere>(vec3(-0.55, 0, -1), 0.25, make_shared<lambertian>(color(0.2, 0.1, 0.7))));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    world.build_bvh();
+    hittable_list lights;
+    lights.add(make_shared<sphere>(vec3(1.55, 0, -1), 0.25, make_shared<lambertian>(color(1,1,1))));
+
+    camera cam;
+    cam.screen_width = 640;
+    cam.max_depth = 6;
+
+    preview_server server (cam, world, lights);
+    server.max_passes = 8;
+    thread serving ([&](){ server.serve(socket_path); });
+
+    preview_client client;
+    auto start = std::chrono::high_resolution_clock::now();
+    while(!client.connect_to(socket_path))this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // Coarse to fine
+    bool ok = client.read_frame();
+    double first = since(start);
+    cout << "first frame after " << first << " ms: " << client.header.width << "x" << client.header.height
+         << ", block " << client.header.block << "\n";
+    uint32_t last_block = client.header.block;
+    bool refining = ok;
+    while(ok && client.header.passes < 4){
+        ok = client.read_frame();
+        if(client.header.block > last_block)refining = false;
+        last_block = client.header.block;
+        cout << "  block " << client.header.block << ", " << client.header.passes << " passes, "
+             << client.header.ms << " ms\n";
+    }
+    cout << (refining && last_block == 1 ? "refines" : "DOES NOT REFINE") << " down to full resolution\n";
+
+    // Camera edit, then a scene edit that rebuilds the BVH
+    uint32_t generation = client.header.generation;
+    start = std::chrono::high_resolution_clock::now();
+    client.send_command("lookfrom 0 1.5 1");
+    ok = ok && wait_generation(client, generation);
+    cout << "camera moved: first frame after " << since(start) << " ms (" << client.header.ms << " ms on the server), block "
+         << client.header.block << "\n";
+
+    generation = client.header.generation;
+    start = std::chrono::high_resolution_clock::now();
+    client.send_command("add 1 0.2 -2 0.6 0.9 0.9 0.2");
+    ok = ok && wait_generation(client, generation);
+    cout << "sphere added: first frame after " << since(start) << " ms (" << client.header.ms << " ms on the server), "
+         << world.objects.size() << " objects, bvh " << (world.has_bvh() ? "rebuilt" : "MISSING") << "\n";
+
+    // Idle at max_passes until told to quit
+    while(ok && client.header.passes < (uint32_t)server.max_passes)ok = client.read_frame();
+    client.send_command("quit");
+    serving.join();
+    cout << (ok ? "session ok" : "SESSION FAILED") << "\n";
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "environment.h"
+
+#include <iostream>
+#include <chrono>
+
+// Direct light from many small lights: a floor and three spheres lit by a wall of count
+// sphere lights behind the camera, out of view. Together they keep the same area, so the
+// scenes differ only in how the light is split up. Paths stop after one bounce, so the image
+// is the direct light the resampling replaces. First the time of a pass as the count grows,
+// then error against time of path tracing, resampling without reuse (RIS, unbiased) and with
+// spatial and temporal reuse, compared with a long RIS reference as mean squared error of
+// the linear pixels.
+
+const int width = 160;
+const int depth = 2;
+const int reference_spp = 512;
+
+void scene(int count, hittable_list& world, hittable_list& lights){
+    world.add(make_shared<sphere>(vec3(-1.2, 0, -3), 0.5, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    world.add(make_shared<sphere>(vec3(0, 0, -3.5), 0.5, make_shared<lambertian>(color(0.2, 0.7, 0.2))));
+    world.add(make_shared<sphere>(vec3(1.2, 0, -3), 0.5, make_shared<lambertian>(color(0.1, 0.2, 0.7))));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -3), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+    int side = max(1, int(lround(sqrt(count))));
+    double radius = 0.25 / sqrt(double(side * side));
+    for(int a = 0; a < side; a++)
+        for(int b = 0; b < side; b++){
+            double x = -3 + 6 * (a + 0.5) / side, y = 3 * (b + 0.5) / side;
+            lights.add(make_shared<sphere>(vec3(x, y, 1), radius, make_shared<lambertian>(color(1,1,1))));
+        }
+    lights.build_bvh();
+}
+
+enum class method { traced, ris, restir };
+
+double render(hittable_list& world, hittable_list& lights, int spp, method m, uint64_t seed, vector<float>& image){
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = depth;
+    cam.iterations = spp;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.resample_lights = m != method::traced;
+    if(m == method::ris){
+        cam.light_resampler.temporal_cap = 0;
+        cam.light_resampler.spatial_neighbors = 0;
+    }
+    cam.output_path = "restir_test.pfm";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cam.render(world, lights);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    int w, h;
+    read_pfm(cam.output_path, w, h, image);
+    remove(cam.output_path.c_str());
+    return ms;
+}
+
+double mse(const vector<float>& a, const vector<float>& reference){
+    double s = 0;
+    for(size_t p = 0; p < reference.size(); p++)s += (a[p] - reference[p]) * (a[p] - reference[p]);
+    return s / reference.size();
+}
+
+// Samples per pixel of method m that fit in ms, from a short timing render
+int fit(hittable_list& world, hittable_list& lights, method m, double ms){
+    vector<float> unused;
+    double per_pass = render(world, lights, 4, m, 3, unused) / 4;
+    return max(1, int(ms / per_pass));
+}
+
+int main(){
+    cout << "  lights   pt ms/pass   restir ms/pass\n";
+    for(int count = 10; count <= 10000; count *= 10){
+        hittable_list world, lights;
+        scene(count, world, lights);
+        vector<float> unused;
+        printf("%8d  %11.2f  %15.2f\n", count, render(world, lights, 8, method::traced, 1, unused) / 8,
+               render(world, lights, 8, method::restir, 1, unused) / 8);
+    }
+
+    hittable_list world, lights;
+    scene(1000, world, lights);
+    vector<float> reference;
+    double ref_ms = render(world, lights, reference_spp, method::ris, 7, reference);
+    cout << "\n1000 lights, reference " << reference_spp << " spp RIS, " << ref_ms << " ms\n";
+
+    cout << "     ms   pt spp       pt mse  ris spp      ris mse  restir spp   restir mse\n";
+    for(double ms = 250; ms <= 2000; ms *= 2){
+        vector<float> plain, ris, restir;
+        int pt_spp = fit(world, lights, method::traced, ms), ris_spp = fit(world, lights, method::ris, ms),
+            restir_spp = fit(world, lights, method::restir, ms);
+        render(world, lights, pt_spp, method::traced, 1, plain);
+        render(world, lights, ris_spp, method::ris, 1, ris);
+        render(world, lights, restir_spp, method::restir, 1, restir);
+        printf("%7.0f  %7d  %11.3e  %7d  %11.3e  %10d  %11.3e\n", ms, pt_spp, mse(plain, reference), ris_spp, mse(ris, reference),
+               restir_spp, mse(restir, reference));
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "sampler.h"
+#include "vec3.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+
+// Error vs spp of every sampler on integrands with known value.
+// Each pixel gets its own random integrand, the RMSE is taken over all pixels
+
+const int pixels = 2048;
+
+struct integrand {
+    double cx, cy, r;
+    double phase_x, phase_y;
+};
+
+// Disk inside the unit square, a hard edge like a silhouette in a pixel
+double disk(const integrand& f, double x, double y){
+    double dx = x - f.cx, dy = y - f.cy;
+    return dx*dx + dy*dy < f.r*f.r ? 1.0 : 0.0;
+}
+
+double disk_reference(const integrand& f){
+    return pi * f.r * f.r;
+}
+
+// Smooth integrand, integrates to 1 over the unit square
+double smooth(const integrand& f, double x, double y){
+    return (1 + sin(2*pi*(x + f.phase_x))) * (1 + cos(2*pi*(y + f.phase_y)));
+}
+
+double smooth_reference(const integrand& f){
+    return 1.0;
+}
+
+template <typename F, typename R>
+double rmse(const sampler& s, const vector<integrand>& fs, int spp, uint32_t dim, F f, R reference){
+    double err = 0;
+    for(int p = 0; p < pixels; p++){
+        double sum = 0;
+        for(int k = 0; k < spp; k++){
+            double x = s.get(p, k, dim);
+            double y = s.get(p, k, dim + 1);
+            sum += f(fs[p], x, y);
+        }
+        double e = sum / spp - reference(fs[p]);
+        err += e*e;
+    }
+    return sqrt(err / pixels);
+}
+
+int main(){
+    vector<integrand> fs (pixels);
+    for(auto& f : fs){
+        f.r = random_double(0.1, 0.4);
+        f.cx = random_double(f.r, 1 - f.r);
+        f.cy = random_double(f.r, 1 - f.r);
+        f.phase_x = random_double();
+        f.phase_y = random_double();
+    }
+
+    const int max_spp = 256;
+    independent_sampler independent;
+    stratified_sampler stratified_small (16);
+    sobol_sampler sobol;
+    blue_noise_sampler blue_noise (64);
+
+    vector<pair<string, const sampler*>> samplers = {
+        {"independent", &independent},
+        {"stratified16", &stratified_small},
+        {"sobol", &sobol},
+        {"blue_noise", &blue_noise},
+    };
+
+    // Dimension 6 checks that padded dimensions keep their quality
+    for(uint32_t dim : {0u, 6u}){
+        for(int integrand_kind = 0; integrand_kind < 2; integrand_kind++){
+            cout << (integrand_kind == 0 ? "disk" : "smooth") << " integrand, dimensions " << dim << "," << dim + 1 << "\n";
+            cout << setw(6) << "spp";
+            for(auto& s : samplers)cout << setw(14) << s.first;
+            cout << "\n";
+
+            for(int spp = 1; spp <= max_spp; spp *= 2){
+                cout << setw(6) << spp;
+                for(auto& s : samplers){
+                    double e = integrand_kind == 0
+                        ? rmse(*s.second, fs, spp, dim, disk, disk_reference)
+                        : rmse(*s.second, fs, spp, dim, smooth, smooth_reference);
+                    cout << setw(14) << setprecision(5) << e;
+                }
+                cout << "\n";
+            }
+            cout << "\n";
+        }
+    }
+
+    // Cost of a single draw
+    for(auto& s : samplers){
+        auto start = std::chrono::high_resolution_clock::now();
+        double sink = 0;
+        for(int p = 0; p < pixels; p++)
+            for(int k = 0; k < 64; k++)
+                sink += s.second->get(p, k, 2);
+        auto end = std::chrono::high_resolution_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / (pixels * 64);
+        cout << s.first << ": " << setprecision(3) << ns << " ns/sample (" << sink / (pixels * 64) << ")\n";
+    }
+
+    return 0;
+}
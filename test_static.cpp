@@ -0,0 +1,120 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "environment.h"
+#include "static_scene.h"
+
+#include <iostream>
+#include <chrono>
+
+// Time of the compile time specialised path (static_scene.h) against the dynamic one on
+// the same scenes: the hittable_list scanned linearly, with fast_kernels, and with its BVH.
+// The static image is checked against the dynamic one as mean squared error of the linear
+// pixels, next to the error between two dynamic renders of different seeds, which is what
+// noise alone gives. The scenes are main.cpp and a field of small spheres on its floor.
+
+const int width = 320;
+const int depth = 6;
+const int spp = 16;
+
+using scene_t = static_scene<static_lambertian, static_metal, static_dielectric>;
+
+void main_scene(hittable_list& world, hittable_list& lights, scene_t& s){
+    world.add(make_shared<sphere>(vec3(-2, 0.5, -2), 1, make_shared<metal>(color(0.1, 0.7, 0.2), 0)));
+    world.add(make_shared<sphere>(vec3(0, 0.5, -3), 1, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    world.add(make_shared<sphere>(vec3(-0.55, 0, -1), 0.25, make_shared<lambertian>(color(0.2, 0.1, 0.7))));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    lights.add(make_shared<sphere>(vec3(1.55, 0, -1), 0.25, make_shared<lambertian>(color(1,1,1))));
+
+    s.add(vec3(-2, 0.5, -2), 1, static_metal{color(0.1, 0.7, 0.2), 0});
+    s.add(vec3(0, 0.5, -3), 1, static_lambertian{color(0.7, 0.2, 0.1)});
+    s.add(vec3(-0.55, 0, -1), 0.25, static_lambertian{color(0.2, 0.1, 0.7)});
+    s.add(vec3(0, -100.5, -1), 100, static_lambertian{color(0.5, 0.5, 0.5)});
+    s.add_light(vec3(1.55, 0, -1), 0.25);
+}
+
+void field(hittable_list& world, hittable_list& lights, scene_t& s){
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    s.add(vec3(0, -100.5, -1), 100, static_lambertian{color(0.5, 0.5, 0.5)});
+    for(int a = 0; a < 12; a++)
+        for(int b = 0; b < 12; b++){
+            point3 c (-3 + 0.5 * a, -0.35, -1.5 - 0.5 * b);
+            color albedo (0.2 + 0.05 * a, 0.3, 0.2 + 0.05 * b);
+            switch((a + b) % 3){
+                case 0:
+                    world.add(make_shared<sphere>(c, 0.15, make_shared<lambertian>(albedo)));
+                    s.add(c, 0.15, static_lambertian{albedo});
+                    break;
+                case 1:
+                    world.add(make_shared<sphere>(c, 0.15, make_shared<metal>(albedo, 0.3)));
+                    s.add(c, 0.15, static_metal{albedo, 0.3});
+                    break;
+                default:
+                    world.add(make_shared<sphere>(c, 0.15, make_shared<dielectic>(1.5)));
+                    s.add(c, 0.15, static_dielectric{1.5});
+            }
+        }
+    lights.add(make_shared<sphere>(vec3(0, 3, -3), 1, make_shared<lambertian>(color(1,1,1))));
+    s.add_light(vec3(0, 3, -3), 1);
+}
+
+camera make_camera(uint64_t seed){
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = depth;
+    cam.iterations = spp;
+    cam.seed = seed;
+    cam.verbose = false;
+    cam.output_path = "static_test.pfm";
+    return cam;
+}
+
+template <typename F>
+double timed(camera& cam, const F& render, vector<float>& image){
+    auto start = std::chrono::high_resolution_clock::now();
+    render();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    int w, h;
+    read_pfm(cam.output_path, w, h, image);
+    remove(cam.output_path.c_str());
+    return ms;
+}
+
+double mse(const vector<float>& a, const vector<float>& b){
+    double s = 0;
+    for(size_t p = 0; p < a.size(); p++)s += (a[p] - b[p]) * (a[p] - b[p]);
+    return s / a.size();
+}
+
+void compare(const char* name, void (*build)(hittable_list&, hittable_list&, scene_t&)){
+    hittable_list world, lights;
+    scene_t scene;
+    build(world, lights, scene);
+    cout << name << ", " << world.objects.size() << " spheres, " << spp << " spp\n";
+
+    vector<float> dynamic, other, fast, bvh, specialised;
+    camera a = make_camera(1), b = make_camera(2), c = make_camera(1), d = make_camera(1), e = make_camera(1);
+    double list_ms = timed(a, [&]{ a.render(world, lights); }, dynamic);
+    timed(b, [&]{ b.render(world, lights); }, other);
+    c.fast_kernels = true;
+    double fast_ms = timed(c, [&]{ c.render(world, lights); }, fast);
+    world.build_bvh();
+    double bvh_ms = timed(d, [&]{ d.render(world, lights); }, bvh);
+    double static_ms = timed(e, [&]{ e.render_static<depth>(scene); }, specialised);
+
+    printf("  dynamic list   %8.1f ms\n", list_ms);
+    printf("  fast_kernels   %8.1f ms  %5.2fx\n", fast_ms, list_ms / fast_ms);
+    printf("  dynamic bvh    %8.1f ms  %5.2fx\n", bvh_ms, list_ms / bvh_ms);
+    printf("  static         %8.1f ms  %5.2fx\n", static_ms, list_ms / static_ms);
+    printf("  mse static vs dynamic %.3e, dynamic vs dynamic (other seed) %.3e\n\n", mse(specialised, dynamic), mse(other, dynamic));
+}
+
+int main(){
+    compare("main.cpp", main_scene);
+    compare("field", field);
+    return 0;
+}
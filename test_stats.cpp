@@ -0,0 +1,90 @@
+// The counters only exist with RT_STATS, so the test turns it on itself
+#ifndef RT_STATS
+#define RT_STATS
+#endif
+
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+// Renders a tiny scene with the stats build and checks that the counters add up: one
+// camera ray per pixel and sample, every path ends exactly once (escaped, on a light or
+// cut by max_depth), every traced ray either ends or scatters, and the glass scatters
+// are split into reflected and refracted. The heatmap has to be written at the image size.
+
+const int width = 48;
+const int spp = 3;
+
+int main(){
+    auto glass = make_shared<dielectic>(1.5);
+    hittable_list world, lights;
+    world.add(make_shared<sphere>(vec3(-0.6, 0, -2), 0.5, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    world.add(make_shared<sphere>(vec3(0.6, 0, -2), 0.5, glass));
+    world.add(make_shared<sphere>(vec3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    lights.add(make_shared<sphere>(vec3(0, 2, -2), 0.5, make_shared<lambertian>(color(1,1,1))));
+
+    camera cam;
+    cam.screen_width = width;
+    cam.max_depth = 5;
+    cam.iterations = spp;
+    cam.verbose = false;
+    cam.output_path = "/tmp/test_stats.ppm";
+    cam.heatmap_path = "/tmp/test_stats_cost.ppm";
+    remove(cam.heatmap_path.c_str());
+
+    // The report goes to cout, keep it out of the way of the results
+    stringstream report;
+    streambuf* saved = cout.rdbuf(report.rdbuf());
+    cam.render(world, lights);
+    cout.rdbuf(saved);
+    remove(cam.output_path.c_str());
+
+    bool passed = true;
+    render_stats s = collect_stats();
+    uint64_t pixels = uint64_t(width) * int(width / cam.aspect_ratio);
+    uint64_t paths = 0, scatters = 0;
+    for(int i = 0; i <= stats_max_depth; i++)paths += s.path_length[i];
+    for(int i = 0; i < stats_max_materials; i++)scatters += s.scatter_calls[i];
+
+    cout << "camera rays " << s.camera_rays << " (" << pixels << " pixels x " << spp << " spp)\n";
+    passed &= s.camera_rays == pixels * spp;
+
+    uint64_t ended = s.escaped + s.light_hits + s.depth_exhausted;
+    cout << "paths ended " << ended << ", in the length histogram " << paths << "\n";
+    passed &= ended == s.camera_rays && paths == s.camera_rays;
+
+    cout << "rays traced " << s.rays_traced << ", ended or scattered " << s.escaped + s.light_hits + scatters << "\n";
+    passed &= s.rays_traced == s.escaped + s.light_hits + scatters;
+
+    uint64_t glass_calls = s.scatter_calls[glass->material_id];
+    cout << "glass scatters " << glass_calls << ", reflected " << s.glass_reflected << " + refracted " << s.glass_refracted << "\n";
+    passed &= glass_calls > 0 && s.glass_reflected + s.glass_refracted == glass_calls;
+
+    cout << "list queries " << s.list_queries << ", sphere tests " << s.sphere_tests << ", hits " << s.sphere_hits << "\n";
+    passed &= s.list_queries >= s.rays_traced && s.sphere_tests >= s.rays_traced && s.sphere_hits > 0 && s.sphere_hits <= s.sphere_tests;
+    passed &= s.escaped > 0 && s.light_hits > 0 && s.depth_exhausted > 0;
+
+    bool reported = report.str().find("camera rays:        " + to_string(s.camera_rays)) != string::npos;
+    cout << "report " << (reported ? "printed" : "MISSING") << "\n";
+    passed &= reported;
+
+    ifstream heatmap (cam.heatmap_path);
+    string magic;
+    int w = 0, h = 0, max_value = 0, values = 0, v;
+    heatmap >> magic >> w >> h >> max_value;
+    while(heatmap >> v)values++;
+    remove(cam.heatmap_path.c_str());
+    cout << "heatmap " << magic << " " << w << "x" << h << ", " << values << " values\n";
+    passed &= magic == "P3" && uint64_t(w) * h == pixels && w == width && max_value == 255 && uint64_t(values) == 3 * pixels;
+
+    cout << (passed ? "all passed" : "FAILED") << "\n";
+    return passed ? 0 : 1;
+}
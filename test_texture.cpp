@@ -0,0 +1,112 @@
+#include "vec3.h"
+#include "texture.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <unistd.h>
+
+// Writes a 2048x2048 checker PPM, reads it through a cache far smaller than the image and
+// checks the mip chain and that the cache stays inside its budget. A .tex cut short must be
+// converted again, and tiles that can not be read must be reported
+
+int main(){
+    const int size = 2048;
+    const int cell = 16;
+    const string path = "/tmp/test_texture.ppm";
+    {
+        ofstream out (path, ios::binary);
+        out << "P6\n" << size << ' ' << size << "\n255\n";
+        vector<uint8_t> row (size * 3);
+        for(int y = 0; y < size; y++){
+            for(int x = 0; x < size; x++){
+                uint8_t c = ((x / cell + y / cell) % 2) ? 255 : 0;
+                row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = c;
+            }
+            out.write((const char*)row.data(), row.size());
+        }
+    }
+    remove((path + ".tex").c_str());
+    const string cache_dir = "/tmp/test_texture_cache";
+    bool passed = true;
+
+    // 12 MB of texels, 1 MB budget
+    texture_cache cache (1 << 20, cache_dir);
+    remove(cache.tex_path(path).c_str());
+    image_texture tex (path, &cache);
+    struct stat info;
+    bool beside = stat((path + ".tex").c_str(), &info) == 0;
+    cout << ".tex written to " << cache.tex_path(path) << (beside ? ", ALSO next to the source" : "") << "\n";
+    passed &= !beside && stat(cache.tex_path(path).c_str(), &info) == 0;
+    off_t full_size = info.st_size;
+
+    // Finest level reproduces the cells, the level where a texel covers a cell is grey
+    color a = tex.value((0.5 + 0.5) / size, 1 - 0.5 / size, point3(), 0);
+    color b = tex.value((cell + 0.5) / size, 1 - 0.5 / size, point3(), 0);
+    color grey = tex.value(0.3, 0.7, point3(), 2.0 * cell / size);
+    cout << "texel (0,0): " << a << "  texel (16,0): " << b << "\n";
+    cout << "coarse level: " << grey << " (expected 0.5 0.5 0.5)\n";
+    passed &= a.e[0] == 0 && b.e[0] == 1 && fabs(grey.e[0] - 0.5) < 0.01;
+
+    // Random lookups at full resolution, then with a wide footprint
+    auto start = std::chrono::high_resolution_clock::now();
+    double sink = 0;
+    const int n = 1000000;
+    size_t peak = 0;
+    for(int i = 0; i < n; i++){
+        sink += tex.value(random_double(), random_double(), point3(), 0).e[0];
+        peak = max(peak, cache.resident_bytes());
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    uint64_t fine_misses = cache.miss_count();
+    for(int i = 0; i < n; i++)
+        sink += tex.value(random_double(), random_double(), point3(), 0.01).e[0];
+    auto end = std::chrono::high_resolution_clock::now();
+
+    cout << "fine lookups:   " << std::chrono::duration<double, std::nano>(mid - start).count() / n << " ns, "
+         << fine_misses << " tile loads\n";
+    cout << "coarse lookups: " << std::chrono::duration<double, std::nano>(end - mid).count() / n << " ns, "
+         << cache.miss_count() - fine_misses << " tile loads\n";
+
+    // Shading order, neighbouring points read neighbouring texels and mostly pinned tiles
+    auto coherent_start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < n; i++){
+        double u = (i % 1000) / 1000.0, v = (i / 1000) / 1000.0;
+        sink += tex.value(u * 0.25, v * 0.25, point3(), 0.5 / size).e[0];
+    }
+    auto coherent_end = std::chrono::high_resolution_clock::now();
+    cout << "coherent lookups: " << std::chrono::duration<double, std::nano>(coherent_end - coherent_start).count() / n << " ns\n";
+
+    cout << "hits " << cache.hit_count() << ", misses " << cache.miss_count() << ", evictions " << cache.eviction_count() << "\n";
+    cout << "peak resident " << peak << " bytes, budget " << (1 << 20) << (peak <= (1 << 20) ? " (ok)" : " (OVER)") << "\n";
+    // Half the checker cells are white
+    cout << "mean red of all lookups: " << sink / (3 * n) << " (expected about 0.5)\n";
+    passed &= peak <= (1 << 20) && fabs(sink / (3 * n) - 0.5) < 0.05;
+
+    // A conversion that was cut short is newer than the source but incomplete
+    string tex_path = cache.tex_path(path);
+    passed &= truncate(tex_path.c_str(), full_size / 2) == 0;
+    {
+        texture_cache again (1 << 20, cache_dir);
+        image_texture rebuilt (path, &again);
+        stat(tex_path.c_str(), &info);
+        color c = rebuilt.value((cell + 0.5) / size, 1 - 0.5 / size, point3(), 0);
+        cout << "truncated .tex " << (info.st_size == full_size ? "converted again" : "KEPT") << ", texel (16,0): " << c << "\n";
+        passed &= info.st_size == full_size && c.e[0] == 1;
+    }
+
+    // Cut short under an open cache, tiles it has not read yet fail
+    {
+        texture_cache open (1 << 20, cache_dir);
+        image_texture tex (path, &open);
+        passed &= truncate(tex_path.c_str(), sizeof(tex_header)) == 0;
+        color c = tex.value((cell + 0.5) / size, 1 - 0.5 / size, point3(), 0);
+        cout << "unreadable tile: " << c << ", " << open.read_error_count() << " read errors\n";
+        passed &= open.read_error_count() > 0 && c.e[0] == 0;
+    }
+    remove(tex_path.c_str());
+    remove(path.c_str());
+
+    cout << (passed ? "all passed" : "FAILED") << "\n";
+    return passed ? 0 : 1;
+}
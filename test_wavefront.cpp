@@ -0,0 +1,74 @@
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+
+// Renders a cloud of spheres, larger than the cache even once it is in a BVH, in pixel
+// order and breadth first. The order must not change the image, only the time
+
+string read_file(const string& path){
+    ifstream in (path);
+    stringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+int main(){
+    int count = 3000000;
+    auto ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    vector<shared_ptr<material>> materials;
+    for(int m = 0; m < 16; m++)
+        materials.push_back(make_shared<lambertian>(color(random_double(), random_double(), random_double())));
+
+    seed_random(17);
+    hittable_list world;
+    for(int i = 0; i < count; i++){
+        point3 c (random_double(-100, 100), random_double(-100, 100), random_double(-200, 0));
+        world.add(make_shared<sphere>(c, random_double(0.2, 0.5), materials[i % 16]));
+    }
+    world.add(make_shared<sphere>(vec3(0, -1000.5, -1), 1000, ground));
+    world.build_bvh();
+    cout << count << " spheres, " << world.bvh().node_bytes() / (1 << 20) << " MB of BVH nodes\n";
+
+    hittable_list lights;
+    lights.add(make_shared<sphere>(vec3(0, 40, -30), 15, make_shared<lambertian>(color(1,1,1))));
+
+    const char* modes[] = {"pixel order", "wavefront"};
+    double times[2];
+    string images[2];
+    for(int m = 0; m < 2; m++){
+        camera cam;
+        cam.screen_width = 400;
+        cam.max_depth = 6;
+        cam.iterations = 2;
+        cam.tile_size = 256;
+        cam.wavefront = m == 1;
+        cam.verbose = false;
+        cam.output_path = "/tmp/test_wavefront.ppm";
+
+        // Best of two, the first run also warms the caches
+        times[m] = infinity;
+        for(int run = 0; run < 2; run++){
+            auto start = std::chrono::high_resolution_clock::now();
+            cam.render(world, lights);
+            times[m] = fmin(times[m], std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+        images[m] = read_file(cam.output_path);
+        remove(cam.output_path.c_str());
+    }
+
+    for(int m = 0; m < 2; m++)cout << modes[m] << ": " << times[m] << " ms\n";
+    cout << "breadth first " << times[0] / times[1] << "x over pixel order\n";
+    // Same samples as ray_color, only the float summation order differs
+    cout << "breadth first " << (images[0] == images[1] ? "matches" : "differs from") << " pixel order in the 8 bit output\n";
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "vec3.h"
+#include "utils.h"
+#include "texture_cache.h"
+
+#include <cmath>
+#include <string>
+
+using namespace std;
+
+// Surface color lookup. u, v are the surface coordinates of the hit, p its position and
+// footprint the approximate width of the pixel on the surface in uv units, so image
+// textures can choose a mip level
+class texture {
+    public:
+        virtual ~texture() = default;
+
+        virtual color value(double u, double v, const point3& p, double footprint) const = 0;
+};
+
+class solid_color : public texture {
+    public:
+        solid_color(const color& c) : color_value(c) {};
+        solid_color(double r, double g, double b) : solid_color(color(r, g, b)) {};
+
+        color value(double u, double v, const point3& p, double footprint) const override {
+            return color_value;
+        }
+
+    private:
+        color color_value;
+};
+
+// 3D checker pattern in world space, scale is the size of one cell
+class checker_texture : public texture {
+    public:
+        checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd)
+            : inv_scale(1.0 / scale), even(even), odd(odd) {};
+
+        checker_texture(double scale, const color& c1, const color& c2)
+            : checker_texture(scale, shared_ptr<texture>(make_shared<solid_color>(c1)), shared_ptr<texture>(make_shared<solid_color>(c2))) {};
+
+        color value(double u, double v, const point3& p, double footprint) const override {
+            int x = int(floor(inv_scale * p.e[0]));
+            int y = int(floor(inv_scale * p.e[1]));
+            int z = int(floor(inv_scale * p.e[2]));
+
+            return (x + y + z) % 2 == 0 ? even->value(u, v, p, footprint) : odd->value(u, v, p, footprint);
+        }
+
+    private:
+        double inv_scale;
+        shared_ptr<texture> even;
+        shared_ptr<texture> odd;
+};
+
+// Gradient noise with random unit vectors on the lattice and permuted axes
+class perlin {
+    public:
+        perlin(){
+            for(int i = 0; i < point_count; i++)
+                gradients[i] = unit_vector(vec3::random(-1, 1));
+
+            generate_perm(perm_x);
+            generate_perm(perm_y);
+            generate_perm(perm_z);
+        }
+
+        // In [-1, 1]
+        double noise(const point3& p) const {
+            double u = p.e[0] - floor(p.e[0]);
+            double v = p.e[1] - floor(p.e[1]);
+            double w = p.e[2] - floor(p.e[2]);
+            int i = int(floor(p.e[0]));
+            int j = int(floor(p.e[1]));
+            int k = int(floor(p.e[2]));
+
+            vec3 c[2][2][2];
+            for(int di = 0; di < 2; di++)
+                for(int dj = 0; dj < 2; dj++)
+                    for(int dk = 0; dk < 2; dk++)
+                        c[di][dj][dk] = gradients[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^ perm_z[(k + dk) & 255]];
+
+            // Hermite smoothing of the weights
+            double uu = u * u * (3 - 2 * u);
+            double vv = v * v * (3 - 2 * v);
+            double ww = w * w * (3 - 2 * w);
+
+            double sum = 0;
+            for(int di = 0; di < 2; di++)
+                for(int dj = 0; dj < 2; dj++)
+                    for(int dk = 0; dk < 2; dk++){
+                        vec3 weight (u - di, v - dj, w - dk);
+                        sum += (di * uu + (1 - di) * (1 - uu))
+                             * (dj * vv + (1 - dj) * (1 - vv))
+                             * (dk * ww + (1 - dk) * (1 - ww))
+                             * dot(c[di][dj][dk], weight);
+                    }
+            return sum;
+        }
+
+        // Sum of octaves of |noise|
+        double turbulence(const point3& p, int depth) const {
+            double sum = 0;
+            double weight = 1.0;
+            point3 q = p;
+            for(int i = 0; i < depth; i++){
+                sum += weight * fabs(noise(q));
+                weight *= 0.5;
+                q = q * 2;
+            }
+            return sum;
+        }
+
+    private:
+        static const int point_count = 256;
+        vec3 gradients[point_count];
+        int perm_x[point_count];
+        int perm_y[point_count];
+        int perm_z[point_count];
+
+        static void generate_perm(int* p){
+            for(int i = 0; i < point_count; i++)p[i] = i;
+            for(int i = point_count - 1; i > 0; i--)
+                swap(p[i], p[random_u64() % (i + 1)]);
+        }
+};
+
+// Marble like procedural texture, scale is the frequency of the stripes
+class noise_texture : public texture {
+    public:
+        noise_texture(double scale, const color& c = color(1,1,1), int octaves = 7)
+            : scale(scale), base(c), octaves(octaves) {};
+
+        color value(double u, double v, const point3& p, double footprint) const override {
+            return base * 0.5 * (1 + sin(scale * p.e[2] + 10 * noise.turbulence(p, octaves)));
+        }
+
+    private:
+        perlin noise;
+        double scale;
+        color base;
+        int octaves;
+};
+
+// Shared by every image_texture unless one is given
+texture_cache& global_texture_cache(){
+    static texture_cache cache;
+    return cache;
+}
+
+// PPM image read through the tile cache, filtered trilinearly between the two mip levels
+// closest to the footprint. Texels are stored with gamma 2 and returned linear
+class image_texture : public texture {
+    public:
+        image_texture(const string& path, texture_cache* c = nullptr)
+            : cache(c ? c : &global_texture_cache()) {
+            handle = cache->open_texture(path);
+            if(handle < 0)
+                cerr << "Could not load texture " << path << "\n";
+        }
+
+        color value(double u, double v, const point3& p, double footprint) const override {
+            // Missing textures show up as magenta
+            if(handle < 0)return color(1, 0, 1);
+
+            u = u - floor(u);
+            v = v - floor(v);
+
+            int levels = cache->levels(handle);
+            int size = max(cache->width(handle), cache->height(handle));
+            double lod = footprint > 0 ? log2(footprint * size) : 0;
+            lod = fmin(fmax(lod, 0.0), levels - 1);
+
+            int level = int(lod);
+            double f = lod - level;
+            color c = bilinear(level, u, v);
+            if(f > 0 && level + 1 < levels)
+                c = (1 - f) * c + f * bilinear(level + 1, u, v);
+            return c;
+        }
+
+    private:
+        texture_cache* cache;
+        int handle;
+
+        // Image rows are stored top first, v = 0 is the bottom
+        color bilinear(int level, double u, double v) const {
+            int w = max(1, cache->width(handle) >> level);
+            int h = max(1, cache->height(handle) >> level);
+            double x = u * w - 0.5;
+            double y = (1 - v) * h - 0.5;
+            int x0 = int(floor(x));
+            int y0 = int(floor(y));
+            double fx = x - x0;
+            double fy = y - y0;
+
+            color top = (1 - fx) * cache->texel(handle, level, x0, y0) + fx * cache->texel(handle, level, x0 + 1, y0);
+            color bottom = (1 - fx) * cache->texel(handle, level, x0, y0 + 1) + fx * cache->texel(handle, level, x0 + 1, y0 + 1);
+            return (1 - fy) * top + fy * bottom;
+        }
+};
+
+#endif
@@ -0,0 +1,441 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "vec3.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Image textures are converted once to a tiled, mip mapped file (.tex) in a cache directory.
+// Rendering only reads the tiles it touches, through a cache with a fixed memory budget,
+// so the sum of all textures in a scene can be far larger than RAM.
+//
+// .tex layout: header, then for every level from full resolution down to 1x1 its tiles in
+// row major order. Every tile is tile_size^2 RGB bytes, edge tiles are padded.
+
+const int texture_tile_size = 64;
+const int texture_tile_bytes = texture_tile_size * texture_tile_size * 3;
+
+class tex_header {
+    public:
+        char magic[4] = {'R', 'T', 'T', 'X'};
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t levels = 0;
+        int32_t tile_size = texture_tile_size;
+};
+
+// Size and first tile of one mip level
+class tex_level {
+    public:
+        int width;
+        int height;
+        int tiles_x;
+        int tiles_y;
+        int64_t first_tile;
+};
+
+vector<tex_level> tex_levels(int width, int height){
+    vector<tex_level> levels;
+    int64_t tiles = 0;
+    while(true){
+        tex_level l;
+        l.width = width;
+        l.height = height;
+        l.tiles_x = (width + texture_tile_size - 1) / texture_tile_size;
+        l.tiles_y = (height + texture_tile_size - 1) / texture_tile_size;
+        l.first_tile = tiles;
+        tiles += (int64_t)l.tiles_x * l.tiles_y;
+        levels.push_back(l);
+        if(width == 1 && height == 1)break;
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+    }
+    return levels;
+}
+
+// Reads a binary (P6) or ascii (P3) PPM with maxval 255 one row at a time
+class ppm_reader {
+    public:
+        int width = 0;
+        int height = 0;
+
+        bool open(const string& path){
+            in.open(path, ios::binary);
+            if(!in)return false;
+
+            int maxval;
+            in >> magic;
+            auto skip_comments = [&](){
+                in >> ws;
+                while(in.peek() == '#'){
+                    string line;
+                    getline(in, line);
+                    in >> ws;
+                }
+            };
+            skip_comments(); in >> width;
+            skip_comments(); in >> height;
+            skip_comments(); in >> maxval;
+            if(!in || maxval != 255 || width <= 0 || height <= 0 || (magic != "P6" && magic != "P3"))return false;
+            if(magic == "P6")in.get();
+            return true;
+        }
+
+        // Next row of width RGB triples, top row first
+        bool row(uint8_t* rgb){
+            if(magic == "P6")in.read((char*)rgb, (size_t)width * 3);
+            else {
+                for(size_t i = 0; i < (size_t)width * 3; i++){
+                    int v;
+                    in >> v;
+                    rgb[i] = v;
+                }
+            }
+            return bool(in);
+        }
+
+    private:
+        ifstream in;
+        string magic;
+};
+
+// Builds the .tex file for a PPM. The source is streamed: every mip level keeps one band of
+// tile_size rows, written out as a row of tiles once it is full, so memory grows with the
+// image width and not its area
+bool convert_to_tex(const string& source, const string& target){
+    ppm_reader in;
+    if(!in.open(source))return false;
+
+    tex_header header;
+    header.width = in.width;
+    header.height = in.height;
+    vector<tex_level> levels = tex_levels(in.width, in.height);
+    header.levels = levels.size();
+
+    ofstream out (target, ios::binary);
+    out.write((const char*)&header, sizeof(header));
+
+    size_t n = levels.size();
+    vector<vector<uint8_t>> bands (n);      // rows of the band being filled, per level
+    vector<vector<uint8_t>> held (n);       // even row waiting for the odd one below it
+    vector<vector<uint8_t>> filtered (n);   // row passed down to the next level
+    vector<int> rows (n, 0);
+    vector<uint8_t> tile (texture_tile_bytes);
+
+    // Writes the tiles of band ty of level l, padding repeats the edge texels
+    auto write_band = [&](size_t l, int ty){
+        const tex_level& lv = levels[l];
+        int band_rows = min(texture_tile_size, lv.height - ty * texture_tile_size);
+        out.seekp(sizeof(tex_header) + (lv.first_tile + (int64_t)ty * lv.tiles_x) * texture_tile_bytes);
+        for(int tx = 0; tx < lv.tiles_x; tx++){
+            for(int y = 0; y < texture_tile_size; y++){
+                const uint8_t* src = &bands[l][(size_t)min(y, band_rows - 1) * lv.width * 3];
+                for(int x = 0; x < texture_tile_size; x++)
+                    memcpy(&tile[(y * texture_tile_size + x) * 3], &src[min(tx * texture_tile_size + x, lv.width - 1) * 3], 3);
+            }
+            out.write((const char*)tile.data(), tile.size());
+        }
+        bands[l].clear();
+    };
+
+    vector<uint8_t> source_row ((size_t)in.width * 3);
+    for(int y = 0; y < in.height; y++){
+        if(!in.row(source_row.data()))return false;
+        const uint8_t* row = source_row.data();
+        for(size_t l = 0; l < n; l++){
+            const tex_level& lv = levels[l];
+            int ry = rows[l]++;
+            bands[l].insert(bands[l].end(), row, row + (size_t)lv.width * 3);
+            if(ry % texture_tile_size == texture_tile_size - 1 || ry == lv.height - 1)write_band(l, ry / texture_tile_size);
+            if(l + 1 == n)break;
+
+            // Row ry / 2 of the next level once both its rows are in. A level one row high
+            // pairs its row with itself, the last row of a taller odd level is left out
+            const tex_level& next = levels[l + 1];
+            bool last = ry == lv.height - 1;
+            if(ry % 2 == 0 && !last){
+                held[l].assign(row, row + (size_t)lv.width * 3);
+                break;
+            }
+            if(ry / 2 >= next.height)break;
+            const uint8_t* above = ry % 2 == 1 ? held[l].data() : row;
+
+            // 2x2 box filter in linear space (the renderer uses gamma 2)
+            filtered[l].resize((size_t)next.width * 3);
+            for(int x = 0; x < next.width; x++){
+                for(int c = 0; c < 3; c++){
+                    double sum = 0;
+                    for(int dy = 0; dy < 2; dy++){
+                        const uint8_t* src = dy == 0 ? above : row;
+                        for(int dx = 0; dx < 2; dx++){
+                            double v = src[min(2 * x + dx, lv.width - 1) * 3 + c] / 255.0;
+                            sum += v * v;
+                        }
+                    }
+                    filtered[l][x * 3 + c] = (uint8_t)lround(255 * sqrt(sum / 4));
+                }
+            }
+            row = filtered[l].data();
+        }
+    }
+    out.flush();
+    return bool(out);
+}
+
+// Bytes of a complete .tex file for header
+int64_t tex_file_bytes(const tex_header& header){
+    vector<tex_level> levels = tex_levels(header.width, header.height);
+    const tex_level& last = levels.back();
+    return sizeof(tex_header) + (last.first_tile + (int64_t)last.tiles_x * last.tiles_y) * texture_tile_bytes;
+}
+
+// The tiles a thread read last, over all caches. A shading point reads up to 8 texels, mostly
+// from one tile per mip level, so with a few tiles pinned most reads skip the shard lock.
+// A pinned tile stays alive after the cache evicts it, up to count tiles per thread above
+// the budget
+class texture_pins {
+    public:
+        static const int count = 4;
+        uint64_t cache_id[count] = {};
+        uint64_t key[count] = {};
+        shared_ptr<const vector<uint8_t>> data[count];
+        int next = 0;
+};
+
+thread_local texture_pins texture_tile_pins;
+atomic<uint64_t> next_texture_cache_id {1};
+
+// Shared cache of texture tiles with a memory budget, least recently used tiles are
+// evicted. Lookups are split over independently locked shards so threads rarely wait, and
+// each thread pins the last tiles it read (texture_pins).
+// Textures can be opened while other threads render: open files sit in a fixed table
+// that never moves, and a slot is written before its handle is handed out.
+class texture_cache {
+    public:
+        // .tex files go to cache_dir, which is made when missing, so asset directories may be read only
+        texture_cache(size_t budget_bytes = 64 << 20, const string& cache_dir = "/tmp/rt_textures")
+            : budget(budget_bytes), cache_dir(cache_dir) {};
+
+        ~texture_cache(){
+            for(int i = 0; i < file_count; i++)close(files[i]->fd);
+        }
+
+        // Returns a handle for the texture, converting the source to a .tex file when there
+        // is none newer than it. -1 when it can not be read or max_textures are open
+        int open_texture(const string& path){
+            lock_guard<mutex> guard (files_lock);
+            int count = file_count;
+            for(int i = 0; i < count; i++)
+                if(files[i]->path == path)return i;
+            if(count == max_textures)return -1;
+
+            string target = tex_path(path);
+            auto modified = [](const struct stat& info){ return int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec; };
+            struct stat src, tex;
+            bool fresh = stat(target.c_str(), &tex) == 0 && (stat(path.c_str(), &src) != 0 || modified(tex) >= modified(src));
+
+            tex_file f;
+            f.path = path;
+            if(fresh)f.fd = open_tex(target, f.header);
+            if(f.fd < 0){
+                // Written under a temporary name and renamed, so a conversion that did not
+                // finish never looks like a finished one
+                mkdir(cache_dir.c_str(), 0755);
+                string temp = target + ".tmp" + to_string(getpid());
+                if(!convert_to_tex(path, temp) || rename(temp.c_str(), target.c_str()) != 0){
+                    unlink(temp.c_str());
+                    return -1;
+                }
+                f.fd = open_tex(target, f.header);
+                if(f.fd < 0)return -1;
+            }
+            f.levels = tex_levels(f.header.width, f.header.height);
+            files[count] = make_unique<tex_file>(move(f));
+            file_count = count + 1;
+            return count;
+        }
+
+        // The .tex of path, named after the file and a hash of its full path
+        string tex_path(const string& path) const {
+            char full[PATH_MAX];
+            string key = realpath(path.c_str(), full) ? string(full) : path;
+            string name = key.substr(key.rfind('/') + 1);
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash<string>()(key));
+            return cache_dir + "/" + name + "." + hex + ".tex";
+        }
+
+        int width(int handle) const { return files[handle]->header.width; }
+        int height(int handle) const { return files[handle]->header.height; }
+        int levels(int handle) const { return files[handle]->header.levels; }
+
+        // Linear color of texel (x, y) on a mip level, coordinates wrap around
+        color texel(int handle, int level, int x, int y){
+            const tex_file& f = *files[handle];
+            const tex_level& lv = f.levels[level];
+            x %= lv.width; if(x < 0)x += lv.width;
+            y %= lv.height; if(y < 0)y += lv.height;
+
+            int64_t tile = lv.first_tile + (int64_t)(y / texture_tile_size) * lv.tiles_x + x / texture_tile_size;
+            uint64_t key = ((uint64_t)handle << 40) | (uint64_t)tile;
+            int offset = ((y % texture_tile_size) * texture_tile_size + x % texture_tile_size) * 3;
+
+            const uint8_t* data = tile_data(f, key, tile);
+            if(!data)return color(0,0,0);
+            const uint8_t* rgb = data + offset;
+
+            auto linear = [](uint8_t v){ double d = v / 255.0; return d * d; };
+            return color(linear(rgb[0]), linear(rgb[1]), linear(rgb[2]));
+        }
+
+        // Hits and misses count lookups that went to a shard, reads of pinned tiles do not
+        size_t resident_bytes() const { return resident; }
+        uint64_t hit_count() const { return shard_sum(&shard::hits); }
+        uint64_t miss_count() const { return shard_sum(&shard::misses); }
+        uint64_t eviction_count() const { return evictions; }
+        uint64_t read_error_count() const { return read_errors; }
+
+    private:
+        static const int shard_count = 16;
+        static const int max_textures = 4096;
+
+        class tex_file {
+            public:
+                string path;
+                int fd = -1;
+                tex_header header;
+                vector<tex_level> levels;
+        };
+
+        class tile_entry {
+            public:
+                uint64_t key;
+                shared_ptr<const vector<uint8_t>> data;    // shared with the threads that pinned it
+        };
+
+        class shard {
+            public:
+                mutex lock;
+                list<tile_entry> lru;
+                unordered_map<uint64_t, list<tile_entry>::iterator> index;
+                size_t bytes = 0;
+                uint64_t hits = 0;      // under lock, so threads do not share a counter
+                uint64_t misses = 0;
+        };
+
+        size_t budget;
+        string cache_dir;
+        mutex files_lock;
+        unique_ptr<tex_file> files[max_textures];
+        atomic<int> file_count {0};
+        mutable shard shards[shard_count];
+        const uint64_t id = next_texture_cache_id++;
+        // Only changed when a tile is loaded
+        atomic<size_t> resident {0};
+        atomic<uint64_t> evictions {0}, read_errors {0};
+
+        uint64_t shard_sum(uint64_t shard::* counter) const {
+            uint64_t n = 0;
+            for(auto& s : shards){
+                lock_guard<mutex> guard (s.lock);
+                n += s.*counter;
+            }
+            return n;
+        }
+
+        // Texels of a tile, pinned by this thread or looked up in its shard and pinned.
+        // nullptr when the tile can not be read
+        const uint8_t* tile_data(const tex_file& f, uint64_t key, int64_t tile){
+            texture_pins& pins = texture_tile_pins;
+            for(int i = 0; i < texture_pins::count; i++)
+                if(pins.key[i] == key && pins.cache_id[i] == id)return pins.data[i]->data();
+
+            shared_ptr<const vector<uint8_t>> data;
+            {
+                shard& s = shards[hash<uint64_t>()(key) % shard_count];
+                lock_guard<mutex> guard (s.lock);
+                auto it = s.index.find(key);
+                if(it == s.index.end()){
+                    s.misses++;
+                    it = load(s, f, key, tile);
+                    if(it == s.index.end())return nullptr;
+                }
+                else {
+                    s.hits++;
+                    // Move to the front of the LRU list
+                    s.lru.splice(s.lru.begin(), s.lru, it->second);
+                }
+                data = it->second->data;
+            }
+
+            int slot = pins.next++ % texture_pins::count;
+            pins.cache_id[slot] = id;
+            pins.key[slot] = key;
+            pins.data[slot] = move(data);
+            return pins.data[slot]->data();
+        }
+
+        // fd of a complete .tex file, -1 when it is missing, not one, or shorter or longer
+        // than its header says
+        static int open_tex(const string& path, tex_header& header){
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0)return -1;
+            struct stat info;
+            if(pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, "RTTX", 4) != 0
+               || header.tile_size != texture_tile_size || header.width <= 0 || header.height <= 0
+               || header.levels != (int)tex_levels(header.width, header.height).size()
+               || fstat(fd, &info) != 0 || info.st_size != tex_file_bytes(header)){
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        // Called with the shard locked, every shard gets an equal part of the budget. A tile
+        // that can not be read is reported and not cached, index.end() is returned and its
+        // texels are black
+        unordered_map<uint64_t, list<tile_entry>::iterator>::iterator load(shard& s, const tex_file& f, uint64_t key, int64_t tile){
+            vector<uint8_t> data (texture_tile_bytes);
+            off_t offset = sizeof(tex_header) + (off_t)tile * texture_tile_bytes;
+            if(pread(f.fd, data.data(), texture_tile_bytes, offset) != texture_tile_bytes){
+                if(read_errors++ == 0)cerr << "Could not read tile " << tile << " of " << f.path << "\n";
+                return s.index.end();
+            }
+
+            size_t shard_budget = max<size_t>(budget / shard_count, texture_tile_bytes);
+            while(!s.lru.empty() && s.bytes + texture_tile_bytes > shard_budget){
+                s.index.erase(s.lru.back().key);
+                s.lru.pop_back();
+                s.bytes -= texture_tile_bytes;
+                resident -= texture_tile_bytes;
+                evictions++;
+            }
+
+            s.lru.push_front(tile_entry{key, make_shared<const vector<uint8_t>>(move(data))});
+
+            s.bytes += texture_tile_bytes;
+            resident += texture_tile_bytes;
+            return s.index.emplace(key, s.lru.begin()).first;
+        }
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <vector>
 #include <cmath>
 #include <memory>
+#include <cstdint>
 
 using namespace std;
 using std::make_shared;
@@ -11,14 +12,31 @@ using std::shared_ptr;
 
 double infinity = std::numeric_limits<double>::infinity();
 double infinity_float = std::numeric_limits<float>::infinity();
+const double pi = 3.1415926535897932385;
 
 
+// Per thread splitmix64 behind every random_double. rand() serialises threads on a global
+// lock and its lag correlations show up in long runs. The camera reseeds it for every pixel
+// sample, so an image does not depend on which thread rendered which pixel
+thread_local uint64_t random_state = 0x853c49e6748fea9bull;
+
+void seed_random(uint64_t seed){
+    random_state = seed;
+}
+
+uint64_t random_u64(){
+    uint64_t z = (random_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
 double random_double() {
-    return rand() / (RAND_MAX + 1.0);
+    return (random_u64() >> 11) * 0x1.0p-53;
 }
 
 float random_float() {
-    return rand() / (RAND_MAX + 1.0);
+    return (random_u64() >> 40) * 0x1.0p-24f;
 }
 
 double random_double(double min, double max){
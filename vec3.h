@@ -2,6 +2,7 @@
 #define VEC3_H
 
 #include "utils.h"
+#include "sampling.h"
 #include "vec4.h"
 
 #include <cmath>
@@ -110,16 +111,23 @@ vec3 unit_vector(const vec3 &v){
     return v / v.length();
 }
 
-vec3 random_in_unit_sphere(){
-    while(true){
-        auto p = vec3::random(-1,1);
-        if(p.length_squared() < 1)
-            return p;
-    }
+// Uniform direction on the unit sphere, from two uniform numbers in [0,1)
+vec3 sphere_direction(double u1, double u2){
+    auto z = 1 - 2 * u1;
+    auto r = sqrt(fmax(0.0, 1 - z*z));
+    auto phi = 2 * pi * u2;
+    return vec3(r * cos(phi), r * sin(phi), z);
 }
 
 vec3 random_unit_vector(){
-    return unit_vector(random_in_unit_sphere());
+    float x, y, z;
+    next_unit_direction(x, y, z);
+    return vec3(x, y, z);
+}
+
+// Uniform point in the unit ball, radius is the cube root of a uniform number
+vec3 random_in_unit_sphere(){
+    return cbrt(random_double()) * random_unit_vector();
 }
 
 vec3 random_on_hemisphere(const vec3& normal){
@@ -131,6 +139,30 @@ vec3 random_on_hemisphere(const vec3& normal){
     return -on_unit_sphere;
 }
 
+// Direction around +z with pdf cos(theta)/pi, from two uniform numbers in [0,1)
+vec3 cosine_direction(double u1, double u2){
+    auto phi = 2 * pi * u1;
+    auto r = sqrt(u2);
+    return vec3(r * cos(phi), r * sin(phi), sqrt(1 - u2));
+}
+
+vec3 random_cosine_direction(){
+    float x, y, z;
+    next_cosine_direction(x, y, z);
+    return vec3(x, y, z);
+}
+
+// Rotates a direction given around +z into the frame around the unit vector n
+// Branchless orthonormal basis from Duff et al. 2017
+vec3 to_frame(const vec3& n, const vec3& local){
+    double sign = copysign(1.0, n.e[2]);
+    double a = -1.0 / (sign + n.e[2]);
+    double b = n.e[0] * n.e[1] * a;
+    vec3 t (1.0 + sign * n.e[0] * n.e[0] * a, sign * b, -sign * n.e[0]);
+    vec3 s (b, sign + n.e[1] * n.e[1] * a, -n.e[1]);
+    return local.e[0] * t + local.e[1] * s + local.e[2] * n;
+}
+
 // Vector that is specularly reflected when v hits the point with normal n
 vec3 reflect(const vec3& v, const vec3& n){
     return v - 2*dot(v,n)*n;
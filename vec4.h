@@ -2,7 +2,9 @@
 #define VEC4_H
 
 #include "utils.h"
+#include "sampling.h"
 #include "vec3.h"
+#include "fastmath.h"
 
 #include <cmath>
 #include <iostream>
@@ -12,12 +14,13 @@
 
 using namespace std;
 
-class vec4 {
+// 16 byte aligned so the simd_ functions can use aligned loads
+class alignas(16) vec4 {
     public:
         float x, y, z, w;
 
         vec4() : vec4(0,0,0,0) {};
-        vec4(float x, float y, float z, float a) : x(x),y(y),z(z),w(w) {};
+        vec4(float x, float y, float z, float w) : x(x),y(y),z(z),w(w) {};
 
         template <typename VecType>
         vec4(const VecType& v, float w = 0.0f) : x(v.e[0]), y(v.e[1]), z(v.e[2]), w(w) {}
@@ -119,16 +122,15 @@ vec4 unit_vector(const vec4 &v){
     return v / v.length();
 }
 
-vec4 random_in_unit_sphere_4(){
-    while(true){
-        auto p = vec4::random(-1,1);
-        if(p.length_squared() < 1)
-            return p;
-    }
+// Directions keep w = 0 so the 4 lane dot products only see x, y and z
+vec4 random_unit_vector_4(){
+    vec4 v;
+    next_unit_direction(v.x, v.y, v.z);
+    return v;
 }
 
-vec4 random_unit_vector_4(){
-    return unit_vector(random_in_unit_sphere_4());
+vec4 random_in_unit_sphere_4(){
+    return cbrtf(random_float()) * random_unit_vector_4();
 }
 
 vec4 random_on_hemisphere(const vec4& normal){
@@ -248,7 +250,7 @@ vec4 simd_mul(vec4 a, vec4 b) {
 vec4 simd_normalize(vec4 a) {
     const __m128 xmm_a = _mm_load_ps(&a.x);
     const __m128 square_magnitude = _mm_dp_ps(xmm_a, xmm_a, 0xff);
-    const __m128 inv_magnitude = _mm_rsqrt_ps(square_magnitude);
+    const __m128 inv_magnitude = math_rsqrt4(square_magnitude);
     const __m128 normalized_a = _mm_mul_ps(xmm_a, inv_magnitude);
     vec4 res;
     _mm_store_ps(&res.x, normalized_a);
@@ -0,0 +1,117 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "vec3.h"
+#include "ray.h"
+#include "aov.h"
+#include "sampler.h"
+#include "hittable.h"
+#include "material.h"
+#include "arena.h"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Breadth first tracing. Every path of a tile advances one bounce at a time, so each bounce
+// runs the same intersection and shading code over the whole tile before the next one.
+
+class path_state {
+    public:
+        ray r;
+        color throughput;
+        uint32_t pixel;
+        int depth;              // bounces left, as in camera::ray_color
+        double bsdf_pdf;
+        sample_stream stream;
+        aov_sample first;
+
+        path_state(const ray& r, uint32_t pixel, int depth, const sample_stream& stream)
+            : r(r), throughput(1,1,1), pixel(pixel), depth(depth), bsdf_pdf(0), stream(stream) {};
+};
+
+// Hits of one bounce on materials that shade in batches (material::scatter_batch), kept
+// per material until every path of the bounce has been traced and then scattered together
+class scatter_batches {
+    public:
+        // Path index of the queue went through r and hit rec, u is its uniform number for the scatter
+        void add(size_t index, const ray& r, const hit_record& rec, double u){
+            const material* mat = rec.mat.get();
+            // Its own batch, else an empty one, else a new one. Scenes have few such materials
+            batch* b = nullptr;
+            for(auto& candidate : batches)
+                if(candidate.mat == mat){
+                    b = &candidate;
+                    break;
+                }
+            for(auto& candidate : batches)
+                if(!b && candidate.paths.empty())b = &candidate;
+            if(!b){
+                batches.emplace_back();
+                b = &batches.back();
+            }
+            b->mat = mat;
+            b->paths.push_back(index);
+            b->points.push_back(rec.p);
+            b->widths.push_back(r.width_at(rec.t));
+            b->directions.push_back(r.dir);
+            b->normals.push_back(rec.front_face ? rec.normal : -1 * rec.normal);
+            b->u.push_back(u);
+        }
+
+        // Scatters the collected hits and moves their paths on by one bounce, as
+        // camera::extend_path does. alive[index] is false for paths that carry nothing more
+        void resolve(path_state* const* paths, char* alive){
+            for(auto& b : batches){
+                size_t n = b.paths.size();
+                if(n == 0)continue;
+                b.out.resize(n);
+                b.attenuation.resize(n);
+                b.mat->scatter_batch(n, b.directions.data(), b.normals.data(), b.u.data(), b.out.data(), b.attenuation.data());
+                for(size_t k = 0; k < n; k++){
+                    path_state& path = *paths[b.paths[k]];
+                    ray scattered (b.points[k], b.out[k]);
+                    scattered.cone = b.widths[k];
+                    scattered.spread = path.r.spread;
+                    path.throughput = path.throughput * b.attenuation[k] * dot(path.r.dir, scattered.dir);
+                    path.bsdf_pdf = 0;
+                    path.depth--;
+                    path.r = scattered;
+                    alive[b.paths[k]] = path.throughput.e[0] != 0 || path.throughput.e[1] != 0 || path.throughput.e[2] != 0;
+                }
+                b.paths.clear();
+                b.points.clear();
+                b.widths.clear();
+                b.directions.clear();
+                b.normals.clear();
+                b.u.clear();
+            }
+        }
+
+    private:
+        class batch {
+            public:
+                const material* mat = nullptr;
+                vector<size_t> paths;
+                vector<point3> points;
+                vector<double> widths;
+                vector<vec3> directions;
+                vector<vec3> normals;       // out of the surface
+                vector<double> u;
+                vector<vec3> out;
+                vector<color> attenuation;
+        };
+
+        vector<batch> batches;      // kept with their capacity between bounces
+};
+
+// Per worker scratch of trace_wavefront, reused for every tile the worker renders. The
+// path states and queues of a tile are carved from memory and dropped together after it
+class wavefront_scratch {
+    public:
+        arena memory;
+        scatter_batches batches;
+};
+
+#endif